@@ -0,0 +1,33 @@
+# Automatically generated by configure - DO NOT EDIT!
+ROOTDIR  ?= .
+BUILDDIR ?= ./build.linux
+OSENV    ?= posix
+ARCH     ?= x86_64
+ifeq ($(origin CC),default)
+CC        = cc
+endif
+PYTHON   ?= python
+CFLAGS   += 
+LDFLAGS  += 
+prefix    = /usr/local
+bindir    = ${prefix}/bin
+mandir    = ${datadir}/man
+datadir   = ${prefix}/share
+libdir    = ${prefix}/lib
+LDFLAGS += -lssl -lcrypto 
+CFLAGS  += 
+LDFLAGS += -lz 
+CFLAGS  += 
+CONFIG_CWC = yes
+CONFIG_V4L = yes
+CONFIG_LINUXDVB = yes
+CONFIG_DVBSCAN = yes
+CONFIG_AVAHI = no
+CONFIG_ZLIB = yes
+CONFIG_BUNDLE = no
+CONFIG_STATS = yes
+CONFIG_EXECINFO = yes
+CONFIG_MMX = yes
+CONFIG_SSE2 = yes
+CONFIG_PYGZIP = yes
+CONFIG_SSL = yes
@@ -0,0 +1,26 @@
+// Automatically generated by configure - DO NOT EDIT!
+#define ENABLE_CWC 1
+#define CONFIG_CWC 1
+#define ENABLE_V4L 1
+#define CONFIG_V4L 1
+#define ENABLE_LINUXDVB 1
+#define CONFIG_LINUXDVB 1
+#define ENABLE_DVBSCAN 1
+#define CONFIG_DVBSCAN 1
+#define ENABLE_AVAHI 0
+#define ENABLE_ZLIB 1
+#define CONFIG_ZLIB 1
+#define ENABLE_BUNDLE 0
+#define ENABLE_STATS 1
+#define CONFIG_STATS 1
+#define ENABLE_EXECINFO 1
+#define CONFIG_EXECINFO 1
+#define ENABLE_MMX 1
+#define CONFIG_MMX 1
+#define ENABLE_SSE2 1
+#define CONFIG_SSE2 1
+#define ENABLE_PYGZIP 1
+#define CONFIG_PYGZIP 1
+#define ENABLE_SSL 1
+#define CONFIG_SSL 1
+#define TVHEADEND_DATADIR "/usr/local/share/tvheadend"
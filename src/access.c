@@ -272,6 +272,44 @@ access_get_by_addr(struct sockaddr *src)
 }
 
 
+/**
+ * Streaming socket options of the matching entries
+ *
+ * Like the rest of the access control this only knows IPv4 networks
+ * (the HTTP server only listens on IPv4), other peers get the defaults
+ */
+void
+access_get_stream_tuning(const char *username, struct sockaddr *src,
+			 int *sndbuf, int *notsent_lowat, int *zerocopy)
+{
+  struct sockaddr_in *si = (struct sockaddr_in *)src;
+  uint32_t b = ntohl(si->sin_addr.s_addr);
+  access_entry_t *ae;
+
+  *sndbuf = *notsent_lowat = *zerocopy = 0;
+
+  if(src->sa_family != AF_INET)
+    return;
+
+  TAILQ_FOREACH(ae, &access_entries, ae_link) {
+
+    if(!ae->ae_enabled)
+      continue;
+
+    if(ae->ae_username[0] != '*' &&
+       (username == NULL || strcmp(ae->ae_username, username)))
+      continue;
+
+    if((b & ae->ae_netmask) != ae->ae_network)
+      continue; /* IP based access mismatches */
+
+    *sndbuf        = MAX(*sndbuf, ae->ae_sndbuf);
+    *notsent_lowat = MAX(*notsent_lowat, ae->ae_notsent_lowat);
+    *zerocopy     |= ae->ae_zerocopy;
+  }
+}
+
+
 
 
 /**
@@ -395,6 +433,10 @@ access_record_build(access_entry_t *ae)
   htsmsg_add_u32(e, "webui"    , ae->ae_rights & ACCESS_WEB_INTERFACE ? 1 : 0);
   htsmsg_add_u32(e, "admin"    , ae->ae_rights & ACCESS_ADMIN         ? 1 : 0);
 
+  htsmsg_add_u32(e, "sndbuf",        ae->ae_sndbuf);
+  htsmsg_add_u32(e, "notsent_lowat", ae->ae_notsent_lowat);
+  htsmsg_add_u32(e, "zerocopy",      !!ae->ae_zerocopy);
+
 
   htsmsg_add_str(e, "id", ae->ae_id);
   
@@ -495,6 +537,15 @@ access_record_update(void *opaque, const char *id, htsmsg_t *values,
   if(!htsmsg_get_u32(values, "webui", &u32))
     access_update_flag(ae, ACCESS_WEB_INTERFACE, u32);
 
+  if(!htsmsg_get_u32(values, "sndbuf", &u32))
+    ae->ae_sndbuf = u32;
+
+  if(!htsmsg_get_u32(values, "notsent_lowat", &u32))
+    ae->ae_notsent_lowat = u32;
+
+  if(!htsmsg_get_u32(values, "zerocopy", &u32))
+    ae->ae_zerocopy = u32;
+
   return access_record_build(ae);
 }
 
@@ -38,6 +38,10 @@ typedef struct access_entry {
 
   uint32_t ae_rights;
 
+  int ae_sndbuf;        /* SO_SNDBUF for streaming, 0 = system default */
+  int ae_notsent_lowat; /* TCP_NOTSENT_LOWAT for streaming, 0 = unset */
+  int ae_zerocopy;      /* Use MSG_ZEROCOPY for streaming if available */
+
   uint32_t ae_network; /* derived from ae_ip */
   uint32_t ae_netmask; /* derived from ae_prefixlen */
 } access_entry_t;
@@ -94,6 +98,13 @@ uint32_t access_get_hashed(const char *username, const uint8_t digest[20],
  */
 uint32_t access_get_by_addr(struct sockaddr *src);
 
+/**
+ * Get the socket tuning for streaming to the given user and address.
+ * Settings of all matching entries are merged, the largest value wins.
+ */
+void access_get_stream_tuning(const char *username, struct sockaddr *src,
+			      int *sndbuf, int *notsent_lowat, int *zerocopy);
+
 
 /**
  *
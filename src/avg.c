@@ -16,97 +16,161 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "avg.h"
-#include <stdlib.h>
+#include "htsmsg.h"
+
+#define AVGSTAT_SLOT(as, t) (&(as)->as_slot[(t) & (AVGSTAT_SLOTS - 1)])
+
+/**
+ * Windows exported by avgstat_input_msg()
+ */
+static const int avgstat_windows[] = { 1, 10, 60 };
+
 
 void
 avgstat_init(avgstat_t *as, int depth)
 {
-  TAILQ_INIT(&as->as_queue);
-  pthread_mutex_init(&as->as_mutex, NULL);
-  as->as_depth = depth;
+  memset((void *)as->as_slot, 0, sizeof(as->as_slot));
+  as->as_depth = depth < AVGSTAT_SLOTS - 1 ? depth : AVGSTAT_SLOTS - 2;
 }
 
 
 void
 avgstat_flush(avgstat_t *as)
 {
-  avgstat_entry_t *ase;
+  memset((void *)as->as_slot, 0, sizeof(as->as_slot));
+}
 
-  while((ase = TAILQ_FIRST(&as->as_queue)) != NULL) {
-    TAILQ_REMOVE(&as->as_queue, ase, ase_link);
-    free(ase);
-  }
+
+/**
+ * Read a slot in one go, 64 bit loads aren't atomic on 32 bit CPUs
+ */
+static inline uint64_t
+avgstat_slot_read(volatile uint64_t *s)
+{
+#if defined(__LP64__)
+  return *s;
+#else
+  return __sync_val_compare_and_swap(s, 0, 0);
+#endif
 }
 
 
-static void
-avgstat_expire(avgstat_t *as, int now)
+/**
+ * Count of the given second, zero if the slot has moved on since
+ */
+static inline unsigned int
+avgstat_get(avgstat_t *as, uint32_t t)
 {
-  avgstat_entry_t *ase;
-
-  while(1) {
-    ase = TAILQ_LAST(&as->as_queue, avgstat_entry_queue);
-    if(ase == NULL || ase->ase_clock > now - as->as_depth) 
-      break;
-    TAILQ_REMOVE(&as->as_queue, ase, ase_link);
-    free(ase);
-  }
+  uint64_t v = avgstat_slot_read(AVGSTAT_SLOT(as, t));
+  return (uint32_t)(v >> 32) == t ? (uint32_t)v : 0;
 }
 
 
+/**
+ * Called from the input threads for every packet, no locks and no
+ * allocation. The compare-and-swap only loops if another thread adds to
+ * the same stat at the same time.
+ */
 void
 avgstat_add(avgstat_t *as, int count, time_t now)
 {
-  avgstat_entry_t *ase;
-
-  pthread_mutex_lock(&as->as_mutex);
-  ase = TAILQ_FIRST(&as->as_queue);
-  if(ase != NULL && ase->ase_clock == now) {
-    ase->ase_count += count;
-  } else {
-    ase = malloc(sizeof(avgstat_entry_t));
-    TAILQ_INSERT_HEAD(&as->as_queue, ase, ase_link);
-    ase->ase_clock = now;
-    ase->ase_count = count;
-  }
-
-  avgstat_expire(as, now);
-  pthread_mutex_unlock(&as->as_mutex);
+  volatile uint64_t *s = AVGSTAT_SLOT(as, now);
+  uint64_t o, n;
+
+  do {
+    o = *s; // May be torn on 32 bit, but then the CAS fails
+    if((uint32_t)(o >> 32) == (uint32_t)now)
+      n = o + (uint32_t)count;
+    else
+      n = ((uint64_t)(uint32_t)now << 32) | (uint32_t)count;
+  } while(!__sync_bool_compare_and_swap(s, o, n));
 }
 
 
 unsigned int
 avgstat_read_and_expire(avgstat_t *as, time_t now)
 {
-  avgstat_entry_t *ase;
-  int r = 0;
+  return avgstat_read(as, as->as_depth, now);
+}
 
-  pthread_mutex_lock(&as->as_mutex);
 
-  avgstat_expire(as, now);
+unsigned int
+avgstat_read(avgstat_t *as, int depth, time_t now)
+{
+  unsigned int r = 0;
+  int i;
 
-  TAILQ_FOREACH(ase, &as->as_queue, ase_link)
-    r += ase->ase_count;
+  if(depth > AVGSTAT_SLOTS - 2)
+    depth = AVGSTAT_SLOTS - 2;
 
-  pthread_mutex_unlock(&as->as_mutex);
+  for(i = 0; i <= depth; i++)
+    r += avgstat_get(as, now - i);
   return r;
 }
 
-unsigned int
-avgstat_read(avgstat_t *as, int depth, time_t now)
+
+/**
+ * Sum, min, max and 95th percentile of the per second counts over the
+ * last 'depth' complete seconds (the current one is still filling up)
+ */
+void
+avgstat_window(avgstat_t *as, int depth, time_t now, avgstat_window_t *aw)
 {
-  avgstat_entry_t *ase;
-  int r = 0;
+  unsigned int v[AVGSTAT_SLOTS], x;
+  int i, j;
+
+  if(depth > AVGSTAT_SLOTS - 2)
+    depth = AVGSTAT_SLOTS - 2;
+  if(depth < 1)
+    depth = 1;
+
+  aw->aw_sum = 0;
+
+  /* Insertion sort, at most 62 entries */
+  for(i = 0; i < depth; i++) {
+    x = avgstat_get(as, now - 1 - i);
+    aw->aw_sum += x;
+    for(j = i; j > 0 && v[j - 1] > x; j--)
+      v[j] = v[j - 1];
+    v[j] = x;
+  }
+
+  aw->aw_min = v[0];
+  aw->aw_max = v[depth - 1];
+  aw->aw_p95 = v[(depth * 95 + 99) / 100 - 1];
+}
 
-  pthread_mutex_lock(&as->as_mutex);
 
-  TAILQ_FOREACH(ase, &as->as_queue, ase_link) {
-    if(ase->ase_clock < now - depth)
-      break;
-    r += ase->ase_count;
+/**
+ * Input statistics (bytes, continuity and transport errors) over each
+ * of the exported windows, bitrates are in bit/s
+ */
+htsmsg_t *
+avgstat_input_msg(avgstat_t *bytes, avgstat_t *cc, avgstat_t *tei,
+		  time_t now)
+{
+  htsmsg_t *l = htsmsg_create_list(), *m;
+  avgstat_window_t aw;
+  int i, d;
+
+  for(i = 0; i < (int)(sizeof(avgstat_windows) / sizeof(int)); i++) {
+    d = avgstat_windows[i];
+    m = htsmsg_create_map();
+    htsmsg_add_u32(m, "period", d);
+
+    avgstat_window(bytes, d, now, &aw);
+    htsmsg_add_u32(m, "packets", aw.aw_sum / 188);
+    htsmsg_add_s64(m, "bitrate", (int64_t)aw.aw_sum * 8 / d);
+    htsmsg_add_s64(m, "bitrateMin", (int64_t)aw.aw_min * 8);
+    htsmsg_add_s64(m, "bitrateMax", (int64_t)aw.aw_max * 8);
+    htsmsg_add_s64(m, "bitrateP95", (int64_t)aw.aw_p95 * 8);
+
+    htsmsg_add_u32(m, "ccErrors", cc ? avgstat_read(cc, d - 1, now - 1) : 0);
+    htsmsg_add_u32(m, "teiErrors", tei ? avgstat_read(tei, d - 1, now - 1) : 0);
+    htsmsg_add_msg(l, NULL, m);
   }
-  pthread_mutex_unlock(&as->as_mutex);
-  return r;
+  return l;
 }
-
@@ -19,31 +19,45 @@
 #ifndef AVG_H
 #define AVG_H
 
-#include <pthread.h>
-#include "queue.h"
+#include <stdint.h>
+#include <time.h>
+
+struct htsmsg;
 
 /*
- * avg stat queue
+ * avg stat ring
+ *
+ * One slot per second, each holding the second it belongs to (upper 32
+ * bits) and the count (lower 32 bits), so a slot can be claimed for a
+ * new second and added to with a single compare-and-swap. Slots that
+ * belong to an older second read as zero.
  */
 
-TAILQ_HEAD(avgstat_entry_queue, avgstat_entry);
+#define AVGSTAT_SLOTS 64 /* Power of two, longer than any depth */
 
 typedef struct avgstat {
-  pthread_mutex_t as_mutex;
-  struct avgstat_entry_queue as_queue;
+  volatile uint64_t as_slot[AVGSTAT_SLOTS];
   int as_depth;  /* in seconds */
 } avgstat_t;
 
-typedef struct avgstat_entry {
-  TAILQ_ENTRY(avgstat_entry) ase_link;
-  int ase_clock;
-  int ase_count;
-} avgstat_entry_t;
+/**
+ * Per second counts over a window of complete seconds
+ */
+typedef struct avgstat_window {
+  unsigned int aw_sum;
+  unsigned int aw_min;
+  unsigned int aw_max;
+  unsigned int aw_p95;
+} avgstat_window_t;
 
 void avgstat_init(avgstat_t *as, int maxdepth);
 void avgstat_add(avgstat_t *as, int count, time_t now);
 void avgstat_flush(avgstat_t *as);
 unsigned int avgstat_read_and_expire(avgstat_t *as, time_t now);
 unsigned int avgstat_read(avgstat_t *as, int depth, time_t now);
+void avgstat_window(avgstat_t *as, int depth, time_t now,
+		    avgstat_window_t *aw);
+struct htsmsg *avgstat_input_msg(avgstat_t *bytes, avgstat_t *cc,
+				 avgstat_t *tei, time_t now);
 
 #endif /* AVG_H */
@@ -0,0 +1,1134 @@
+/*
+ *  tvheadend, streaming pipeline benchmark
+ *  Copyright (C) 2012
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * End-to-end benchmark of the streaming path. A number of subscriptions
+ * are made on every service of the replayed transport streams (see
+ * rawtsinput.c) and the output is muxed like the web or HTSP server
+ * would do it, written to /dev/null or a loopback TCP socket.
+ *
+ * With epg=<channels> the EPG is benchmarked instead, on a synthetic
+ * guide. That creates channels, so use a scratch configuration directory.
+ * With charset=<MB> the DVB text conversion is benchmarked on EIT samples.
+ *
+ * When done a JSON report is written and tvheadend exits.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "tvheadend.h"
+#include "streaming.h"
+#include "channels.h"
+#include "subscriptions.h"
+#include "service.h"
+#include "rawtsinput.h"
+#include "muxer.h"
+#include "htsp.h"
+#include "htsmsg_binary.h"
+#include "plumbing/tsfix.h"
+#include "plumbing/globalheaders.h"
+#include "epg.h"
+#include "bench.h"
+#include "stats.h"
+#if ENABLE_LINUXDVB
+#include "dvb/dvb_support.h"
+#endif
+
+#define BENCH_MAX_SERVICES 64
+#define BENCH_HIST_SIZE    512
+
+typedef enum {
+  BENCH_PASS,
+  BENCH_MATROSKA,
+  BENCH_HTSP,
+} bench_mode_t;
+
+static const char *bench_mode_txt[] = {
+  [BENCH_PASS]     = "pass",
+  [BENCH_MATROSKA] = "matroska",
+  [BENCH_HTSP]     = "htsp",
+};
+
+
+/**
+ * Latency histogram, log2 with 8 buckets per octave (microseconds)
+ */
+typedef struct bench_hist {
+  uint64_t bh_count[BENCH_HIST_SIZE];
+  int64_t bh_max;
+} bench_hist_t;
+
+
+/**
+ * One benchmark subscription
+ */
+typedef struct bench_sub {
+  LIST_ENTRY(bench_sub) bs_link;
+  int bs_index;
+
+  streaming_target_t bs_input;
+  streaming_queue_t bs_sq;
+  streaming_target_t *bs_tsfix;
+  streaming_target_t *bs_gh;
+  th_subscription_t *bs_s;
+
+  /**
+   * Arrival time of queued raw TS packets. They carry no timestamp
+   * of their own, so we keep a FIFO in step with the queue
+   * (protected by sq_mutex)
+   */
+  int64_t *bs_ts;
+  int bs_ts_size;
+  int bs_ts_head;
+  int bs_ts_len;
+
+  int bs_fd;
+  int bs_peer;
+  pthread_t bs_tid;
+  pthread_t bs_drain_tid;
+
+  uint64_t bs_pkts;
+  uint64_t bs_bytes;
+  int64_t bs_cpu;
+  bench_hist_t bs_lat;
+
+} bench_sub_t;
+
+
+static LIST_HEAD(, bench_sub) bench_subs;
+static volatile int bench_running;
+
+static int bench_nsubs = 1;
+static bench_mode_t bench_mode = BENCH_MATROSKA;
+static int bench_time = 30;
+static int bench_tcp;
+static char *bench_output;
+static int bench_epg_channels;
+static int bench_epg_days = 14;
+static int bench_charset_mb;
+
+
+/**
+ *
+ */
+static int
+bench_hist_bucket(int64_t v)
+{
+  int o, b;
+
+  if(v < 8)
+    return v < 0 ? 0 : v;
+
+  o = 63 - __builtin_clzll(v);
+  b = (o - 2) * 8 + ((v >> (o - 3)) & 7);
+  return MIN(b, BENCH_HIST_SIZE - 1);
+}
+
+
+/**
+ * Lower bound of a bucket
+ */
+static int64_t
+bench_hist_value(int b)
+{
+  if(b < 8)
+    return b;
+  return (int64_t)(8 + (b & 7)) << (b / 8 - 1);
+}
+
+
+/**
+ *
+ */
+static void
+bench_hist_add(bench_hist_t *bh, int64_t v)
+{
+  bh->bh_count[bench_hist_bucket(v)]++;
+  if(v > bh->bh_max)
+    bh->bh_max = v;
+}
+
+
+/**
+ *
+ */
+static int64_t
+bench_hist_percentile(const bench_hist_t *bh, uint64_t total, double p)
+{
+  uint64_t n = 0, target = total * p;
+  int i;
+
+  for(i = 0; i < BENCH_HIST_SIZE; i++) {
+    n += bh->bh_count[i];
+    if(n > target)
+      return bench_hist_value(i);
+  }
+  return bh->bh_max;
+}
+
+
+/**
+ * Queue a message and remember when it arrived
+ */
+static void
+bench_input(void *opaque, streaming_message_t *sm)
+{
+  bench_sub_t *bs = opaque;
+  streaming_queue_t *sq = &bs->bs_sq;
+  int64_t *ts;
+  int i;
+
+  pthread_mutex_lock(&sq->sq_mutex);
+
+  if(sm->sm_type == SMT_MPEGTS) {
+    if(bs->bs_ts_len == bs->bs_ts_size) {
+      ts = malloc(sizeof(int64_t) * bs->bs_ts_size * 2);
+      for(i = 0; i < bs->bs_ts_len; i++)
+	ts[i] = bs->bs_ts[(bs->bs_ts_head + i) % bs->bs_ts_size];
+      free(bs->bs_ts);
+      bs->bs_ts = ts;
+      bs->bs_ts_head = 0;
+      bs->bs_ts_size *= 2;
+    }
+    bs->bs_ts[(bs->bs_ts_head + bs->bs_ts_len++) % bs->bs_ts_size] =
+      getmonoclock();
+  }
+
+  TAILQ_INSERT_TAIL(&sq->sq_queue, sm, sm_link);
+  pthread_cond_signal(&sq->sq_cond);
+  pthread_mutex_unlock(&sq->sq_mutex);
+}
+
+
+/**
+ * Write a packet as a HTSP 'muxpkt' message, reference is transfered
+ */
+static void
+bench_write_htsp(bench_sub_t *bs, th_pkt_t *pkt)
+{
+  htsmsg_t *m;
+  void *data;
+  size_t len, off = 0;
+  ssize_t r;
+
+  pkt = pkt_merge_header(pkt);
+  m = htsp_build_muxpkt(bs->bs_index, pkt);
+
+  if(!htsmsg_binary_serialize(m, &data, &len, INT32_MAX)) {
+    while(off < len) {
+      r = write(bs->bs_fd, data + off, len - off);
+      if(r < 0 && errno == EINTR)
+	continue;
+      if(r <= 0)
+	break;
+      off += r;
+    }
+    bs->bs_bytes += off;
+    free(data);
+  }
+  htsmsg_destroy(m);
+  pkt_ref_dec(pkt);
+}
+
+
+/**
+ * Consume one subscription, like http_stream_run() or the HTSP
+ * writer would
+ */
+static void *
+bench_thread(void *aux)
+{
+  bench_sub_t *bs = aux;
+  streaming_queue_t *sq = &bs->bs_sq;
+  streaming_message_t *sm;
+  muxer_t *mux = NULL;
+  struct timespec ts;
+  struct rusage ru;
+  int64_t t;
+
+  while(bench_running) {
+    pthread_mutex_lock(&sq->sq_mutex);
+    sm = TAILQ_FIRST(&sq->sq_queue);
+    if(sm == NULL) {
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += 100000000;
+      if(ts.tv_nsec >= 1000000000) {
+	ts.tv_sec++;
+	ts.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait(&sq->sq_cond, &sq->sq_mutex, &ts);
+      pthread_mutex_unlock(&sq->sq_mutex);
+      continue;
+    }
+
+    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+
+    t = 0;
+    if(sm->sm_type == SMT_MPEGTS && bs->bs_ts_len > 0) {
+      t = bs->bs_ts[bs->bs_ts_head];
+      bs->bs_ts_head = (bs->bs_ts_head + 1) % bs->bs_ts_size;
+      bs->bs_ts_len--;
+    }
+    pthread_mutex_unlock(&sq->sq_mutex);
+
+    switch(sm->sm_type) {
+    case SMT_START:
+      if(bench_mode == BENCH_HTSP)
+	break;
+
+      if(mux != NULL) {
+	muxer_close(mux);
+	muxer_destroy(mux);
+      }
+      mux = muxer_create(bs->bs_s->ths_service,
+			 bench_mode == BENCH_PASS ? MC_PASS : MC_MATROSKA);
+      muxer_open_stream(mux, bs->bs_fd);
+      muxer_init(mux, sm->sm_data, "Benchmark");
+      break;
+
+    case SMT_PACKET:
+      t = ((th_pkt_t *)sm->sm_data)->pkt_rcvtime;
+      if(bench_mode == BENCH_HTSP) {
+	bench_write_htsp(bs, sm->sm_data);
+	sm->sm_data = NULL;
+	break;
+      }
+      /* FALLTHRU */
+
+    case SMT_MPEGTS:
+      if(mux == NULL)
+	break;
+      if(!muxer_write_pkt(mux, sm->sm_data))
+	sm->sm_data = NULL;
+      bs->bs_bytes = mux->m_bytes;
+      break;
+
+    default:
+      break;
+    }
+
+    if(t != 0 && (sm->sm_type == SMT_PACKET || sm->sm_type == SMT_MPEGTS)) {
+      bs->bs_pkts++;
+      bench_hist_add(&bs->bs_lat, getmonoclock() - t);
+    }
+
+    streaming_msg_free(sm);
+  }
+
+  if(mux != NULL) {
+    muxer_close(mux);
+    muxer_destroy(mux);
+  }
+
+  getrusage(RUSAGE_THREAD, &ru);
+  bs->bs_cpu = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL +
+    ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+  return NULL;
+}
+
+
+/**
+ * Discard whatever arrives on the far end of the loopback socket
+ */
+static void *
+bench_drain_thread(void *aux)
+{
+  bench_sub_t *bs = aux;
+  char buf[65536];
+
+  while(read(bs->bs_peer, buf, sizeof(buf)) > 0)
+    ;
+  return NULL;
+}
+
+
+/**
+ * Open the output, either /dev/null or a connected loopback socket
+ */
+static int
+bench_open_output(bench_sub_t *bs)
+{
+  struct sockaddr_in sin;
+  socklen_t slen = sizeof(sin);
+  int fd;
+
+  if(!bench_tcp) {
+    bs->bs_fd = tvh_open("/dev/null", O_WRONLY, 0);
+    return bs->bs_fd == -1 ? -1 : 0;
+  }
+
+  if((fd = tvh_socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    return -1;
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if(bind(fd, (struct sockaddr *)&sin, sizeof(sin)) ||
+     getsockname(fd, (struct sockaddr *)&sin, &slen) ||
+     listen(fd, 1) ||
+     (bs->bs_fd = tvh_socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+    close(fd);
+    return -1;
+  }
+
+  if(connect(bs->bs_fd, (struct sockaddr *)&sin, sizeof(sin)) ||
+     (bs->bs_peer = accept(fd, NULL, NULL)) == -1) {
+    close(bs->bs_fd);
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  pthread_create(&bs->bs_drain_tid, NULL, bench_drain_thread, bs);
+  return 0;
+}
+
+
+/**
+ * Replayed services mapped to a channel, caller must hold global_lock
+ */
+static int
+bench_get_services(service_t **vec)
+{
+  service_t *svcs[BENCH_MAX_SERVICES];
+  int i, n, r = 0;
+
+  n = rawts_get_services(svcs, BENCH_MAX_SERVICES);
+
+  for(i = 0; i < n; i++)
+    if(svcs[i]->s_ch != NULL)
+      vec[r++] = svcs[i];
+  return r;
+}
+
+
+/**
+ *
+ */
+static int64_t
+bench_rusage_self(void)
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL +
+    ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+
+/**
+ * Snapshot of the global counters
+ */
+typedef struct bench_counters {
+  int64_t bc_clock;
+  int64_t bc_cpu;
+  uint64_t bc_input;
+  uint64_t bc_allocs[STATS_ALLOCS]; // Only counted with stats enabled
+} bench_counters_t;
+
+static void
+bench_counters_get(bench_counters_t *bc)
+{
+  bc->bc_clock  = getmonoclock();
+  bc->bc_cpu    = bench_rusage_self();
+  bc->bc_input  = rawts_get_packets();
+#if ENABLE_STATS
+  stats_allocs(bc->bc_allocs);
+#else
+  memset(bc->bc_allocs, 0, sizeof(bc->bc_allocs));
+#endif
+}
+
+
+/**
+ *
+ */
+static FILE *
+bench_report_open(void)
+{
+  FILE *fp;
+
+  if(bench_output == NULL)
+    return stdout;
+  if((fp = fopen(bench_output, "w")) == NULL) {
+    tvhlog(LOG_ERR, "bench", "Unable to write %s -- %s",
+	   bench_output, strerror(errno));
+    return stdout;
+  }
+  return fp;
+}
+
+
+/**
+ *
+ */
+static void
+bench_report_close(FILE *fp)
+{
+  if(fp != stdout)
+    fclose(fp);
+  else
+    fflush(fp);
+}
+
+
+/**
+ *
+ */
+static void
+bench_report(const bench_counters_t *a, const bench_counters_t *b,
+	     int nservices)
+{
+  bench_sub_t *bs;
+  bench_hist_t *lat = calloc(1, sizeof(bench_hist_t));
+  uint64_t pkts = 0, bytes = 0;
+  int64_t consumer_cpu = 0;
+  double secs = (b->bc_clock - a->bc_clock) / 1000000.0;
+  double cpu = (b->bc_cpu - a->bc_cpu) / 1000000.0;
+  uint64_t allocs;
+  int i, n = 0;
+  FILE *fp = stdout;
+
+  LIST_FOREACH(bs, &bench_subs, bs_link) {
+    n++;
+    pkts += bs->bs_pkts;
+    bytes += bs->bs_bytes;
+    consumer_cpu += bs->bs_cpu;
+    for(i = 0; i < BENCH_HIST_SIZE; i++)
+      lat->bh_count[i] += bs->bs_lat.bh_count[i];
+    lat->bh_max = MAX(lat->bh_max, bs->bs_lat.bh_max);
+  }
+
+  fp = bench_report_open();
+
+  allocs = 0;
+  for(i = 0; i < STATS_ALLOCS; i++)
+    allocs += b->bc_allocs[i] - a->bc_allocs[i];
+
+  fprintf(fp,
+	  "{\n"
+	  "  \"mode\": \"%s\",\n"
+	  "  \"sink\": \"%s\",\n"
+	  "  \"services\": %d,\n"
+	  "  \"subscriptions\": %d,\n"
+	  "  \"duration\": %.3f,\n"
+	  "  \"input\": {\n"
+	  "    \"packets\": %"PRIu64",\n"
+	  "    \"pkts_per_sec\": %.1f\n"
+	  "  },\n"
+	  "  \"output\": {\n"
+	  "    \"packets\": %"PRIu64",\n"
+	  "    \"bytes\": %"PRIu64",\n"
+	  "    \"pkts_per_sec\": %.1f,\n"
+	  "    \"mbit_per_sec\": %.3f\n"
+	  "  },\n"
+	  "  \"cpu\": {\n"
+	  "    \"total_pct\": %.2f,\n"
+	  "    \"per_stream_pct\": %.3f,\n"
+	  "    \"consumer_per_stream_pct\": %.3f\n"
+	  "  },\n"
+	  "  \"allocations\": {\n"
+	  "    \"pkt\": %"PRIu64",\n"
+	  "    \"pktref\": %"PRIu64",\n"
+	  "    \"pktbuf\": %"PRIu64",\n"
+	  "    \"streaming_msg\": %"PRIu64",\n"
+	  "    \"per_output_packet\": %.3f\n"
+	  "  },\n"
+	  "  \"latency_us\": {\n"
+	  "    \"p50\": %"PRId64",\n"
+	  "    \"p99\": %"PRId64",\n"
+	  "    \"max\": %"PRId64"\n"
+	  "  }\n"
+	  "}\n",
+	  bench_mode_txt[bench_mode], bench_tcp ? "tcp" : "null",
+	  nservices, n, secs,
+	  b->bc_input - a->bc_input, (b->bc_input - a->bc_input) / secs,
+	  pkts, bytes, pkts / secs, bytes * 8 / secs / 1000000.0,
+	  100.0 * cpu / secs,
+	  n ? 100.0 * cpu / secs / n : 0,
+	  n ? 100.0 * consumer_cpu / 1000000.0 / secs / n : 0,
+	  b->bc_allocs[STATS_ALLOC_PKT] - a->bc_allocs[STATS_ALLOC_PKT],
+	  b->bc_allocs[STATS_ALLOC_PKTREF] - a->bc_allocs[STATS_ALLOC_PKTREF],
+	  b->bc_allocs[STATS_ALLOC_PKTBUF] - a->bc_allocs[STATS_ALLOC_PKTBUF],
+	  b->bc_allocs[STATS_ALLOC_MSG] - a->bc_allocs[STATS_ALLOC_MSG],
+	  pkts ? (double)allocs / pkts : 0,
+	  bench_hist_percentile(lat, pkts, 0.50),
+	  bench_hist_percentile(lat, pkts, 0.99),
+	  lat->bh_max);
+
+  bench_report_close(fp);
+  free(lat);
+}
+
+
+/**
+ * Resident set size in MB
+ */
+static double
+bench_rss(void)
+{
+  long pages = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+
+  if(fp != NULL) {
+    if(fscanf(fp, "%*d %ld", &pages) != 1)
+      pages = 0;
+    fclose(fp);
+  }
+  return pages * (double)sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+
+/**
+ * Synthetic guide of 30 minute programmes on bench_epg_channels channels
+ * for bench_epg_days days, then lookups the way the HTSP and web server
+ * do them. Runs with global_lock held.
+ *
+ * The channels are never saved and are deleted again at the end, which
+ * takes their broadcasts (and so the episodes) with them. We refuse to
+ * run if one of the names is taken, so no real channel is touched.
+ */
+#define BENCH_EPG_EPISODES 2000
+#define BENCH_EPG_LOOKUPS  200000
+#define BENCH_EPG_QUERIES  200
+
+static void
+bench_epg(void)
+{
+  int nch = bench_epg_channels, slots = bench_epg_days * 48;
+  channel_t **chs = calloc(nch, sizeof(channel_t *));
+  epg_episode_t **eps = calloc(BENCH_EPG_EPISODES, sizeof(epg_episode_t *));
+  epg_broadcast_t *e, *e2;
+  epg_sched_rec_t *r;
+  epg_query_result_t eqr;
+  time_t t0 = dispatch_clock - dispatch_clock % 1800, t;
+  int64_t ts, t_load, t_updated, t_walk, t_index, t_grid, t_query;
+  int64_t t_eidwalk, t_eid, t_id;
+  uint64_t id0, id1;
+  unsigned int seed = 1;
+  int i, j, k, save = 0, mismatch = 0, grid = 0, results = 0;
+  double rss0, rss1;
+  char buf[64];
+  FILE *fp;
+
+  tvhlog(LOG_INFO, "bench", "EPG with %d channels for %d days",
+	 nch, bench_epg_days);
+
+  rss0 = bench_rss();
+  pthread_mutex_lock(&global_lock);
+
+  for(i = 0; i < nch; i++) {
+    snprintf(buf, sizeof(buf), "bench%05d", i);
+    if(channel_find_by_name(buf, 0, 0) != NULL) {
+      tvhlog(LOG_ERR, "bench", "Channel \"%s\" already exists", buf);
+      pthread_mutex_unlock(&global_lock);
+      free(chs);
+      free(eps);
+      return;
+    }
+  }
+  for(i = 0; i < nch; i++) {
+    snprintf(buf, sizeof(buf), "bench%05d", i);
+    chs[i] = channel_find_by_name(buf, 1, 0);
+  }
+  for(i = 0; i < BENCH_EPG_EPISODES; i++) {
+    snprintf(buf, sizeof(buf), "bench-episode-%d", i);
+    eps[i] = epg_episode_find_by_uri(buf, 1, &save);
+    snprintf(buf, sizeof(buf), "Programme %d", i);
+    save |= epg_episode_set_title(eps[i], buf, "eng", NULL);
+  }
+
+  /* Load */
+  id1 = id0 = 0;
+  ts = getmonoclock();
+  epg_begin();
+  for(i = 0; i < nch; i++) {
+    for(j = 0; j < slots; j++) {
+      t = t0 + j * 1800;
+      e = epg_broadcast_find_by_time(chs[i], t, t + 1800, j & 0xffff, 1, &save);
+      save |= epg_broadcast_set_episode(e, eps[(i * 7 + j) % BENCH_EPG_EPISODES],
+					NULL);
+      if(!id0)
+	id0 = e->id;
+      id1 = e->id;
+    }
+  }
+  t_load = getmonoclock() - ts;
+
+  ts = getmonoclock();
+  epg_commit();
+  t_updated = getmonoclock() - ts;
+  rss1 = bench_rss();
+
+  /* What is on at a given time, walking the schedule */
+  ts = getmonoclock();
+  for(k = 0; k < BENCH_EPG_LOOKUPS; k++) {
+    i = rand_r(&seed) % nch;
+    t = t0 + rand_r(&seed) % (slots * 1800);
+    RB_FOREACH(e, &chs[i]->ch_epg_schedule, sched_link)
+      if(e->stop > t)
+	break;
+    if(e == NULL)
+      mismatch++;
+  }
+  t_walk = getmonoclock() - ts;
+
+  /* Same with the index */
+  seed = 1;
+  ts = getmonoclock();
+  for(k = 0; k < BENCH_EPG_LOOKUPS; k++) {
+    i = rand_r(&seed) % nch;
+    t = t0 + rand_r(&seed) % (slots * 1800);
+    e2 = epg_channel_find_at(chs[i], t);
+    if(e2 == NULL || e2->start > t || e2->stop <= t)
+      mismatch++;
+  }
+  t_index = getmonoclock() - ts;
+
+  /* EIT and OpenTV updates find the broadcast by event id */
+  ts = getmonoclock();
+  for(k = 0; k < BENCH_EPG_LOOKUPS / 10; k++) {
+    i = rand_r(&seed) % nch;
+    j = rand_r(&seed) % slots;
+    RB_FOREACH(e, &chs[i]->ch_epg_schedule, sched_link)
+      if(e->dvb_eid == j)
+	break;
+    if(e == NULL)
+      mismatch++;
+  }
+  t_eidwalk = (getmonoclock() - ts) * 10;
+
+  ts = getmonoclock();
+  for(k = 0; k < BENCH_EPG_LOOKUPS; k++) {
+    i = rand_r(&seed) % nch;
+    j = rand_r(&seed) % slots;
+    e = epg_broadcast_find_by_eid(chs[i], j);
+    if(e == NULL || e->dvb_eid != j)
+      mismatch++;
+  }
+  t_eid = getmonoclock() - ts;
+
+  /* HTSP and the DVR find events by object id */
+  ts = getmonoclock();
+  for(k = 0; k < BENCH_EPG_LOOKUPS; k++)
+    if(epg_broadcast_find_by_id(id0 + rand_r(&seed) % (id1 - id0 + 1),
+				NULL) == NULL)
+      mismatch++;
+  t_id = getmonoclock() - ts;
+
+  /* A three hour grid over all channels */
+  ts = getmonoclock();
+  for(k = 0; k < BENCH_EPG_QUERIES; k++) {
+    t = t0 + rand_r(&seed) % (slots * 1800);
+    for(i = 0; i < nch; i++)
+      grid += epg_channel_get_window(chs[i], t, t + 3 * 3600, &r);
+  }
+  t_grid = getmonoclock() - ts;
+
+  /* Full schedule of one channel (web UI and HTSP query) */
+  ts = getmonoclock();
+  for(k = 0; k < BENCH_EPG_QUERIES; k++) {
+    epg_query0(&eqr, chs[rand_r(&seed) % nch], NULL, NULL, NULL, NULL, 0);
+    results += eqr.eqr_entries;
+    epg_query_free(&eqr);
+  }
+  t_query = getmonoclock() - ts;
+
+  for(i = 0; i < nch; i++)
+    channel_delete(chs[i]);
+  epg_updated();
+
+  pthread_mutex_unlock(&global_lock);
+
+  fp = bench_report_open();
+  fprintf(fp,
+	  "{\n"
+	  "  \"mode\": \"epg\",\n"
+	  "  \"channels\": %d,\n"
+	  "  \"days\": %d,\n"
+	  "  \"broadcasts\": %d,\n"
+	  "  \"load\": {\n"
+	  "    \"secs\": %.3f,\n"
+	  "    \"per_sec\": %.0f,\n"
+	  "    \"updated_secs\": %.3f,\n"
+	  "    \"rss_mb\": %.1f\n"
+	  "  },\n"
+	  "  \"find_at_us\": {\n"
+	  "    \"walk\": %.3f,\n"
+	  "    \"index\": %.3f\n"
+	  "  },\n"
+	  "  \"find_by_eid_us\": {\n"
+	  "    \"walk\": %.3f,\n"
+	  "    \"hash\": %.3f\n"
+	  "  },\n"
+	  "  \"find_by_id_us\": %.3f,\n"
+	  "  \"lookup_errors\": %d,\n"
+	  "  \"grid_3h_ms\": %.3f,\n"
+	  "  \"grid_3h_events\": %d,\n"
+	  "  \"channel_query_us\": %.1f,\n"
+	  "  \"channel_query_events\": %d\n"
+	  "}\n",
+	  nch, bench_epg_days, nch * slots,
+	  t_load / 1e6, nch * slots / (t_load / 1e6), t_updated / 1e6,
+	  rss1 - rss0,
+	  (double)t_walk / BENCH_EPG_LOOKUPS,
+	  (double)t_index / BENCH_EPG_LOOKUPS,
+	  (double)t_eidwalk / BENCH_EPG_LOOKUPS,
+	  (double)t_eid / BENCH_EPG_LOOKUPS,
+	  (double)t_id / BENCH_EPG_LOOKUPS, mismatch,
+	  t_grid / 1000.0 / BENCH_EPG_QUERIES, grid / BENCH_EPG_QUERIES,
+	  (double)t_query / BENCH_EPG_QUERIES, results / BENCH_EPG_QUERIES);
+  bench_report_close(fp);
+
+  free(chs);
+  free(eps);
+}
+
+
+#if ENABLE_LINUXDVB
+/**
+ * Title and description of EIT events in the charsets seen in the wild,
+ * as carried in the short and extended event descriptors (including the
+ * charset selector)
+ */
+#define BENCH_STR(s) (const uint8_t *)s, sizeof(s) - 1
+
+static const struct {
+  const char *name;
+  const uint8_t *title;
+  size_t title_len;
+  const uint8_t *desc;
+  size_t desc_len;
+} bench_charset_samples[] = {
+  { "en_default",
+    BENCH_STR("Strictly Come Dancing"),
+    BENCH_STR("The remaining couples take to the floor for another week of dances, h"
+              "oping to impress the judges and the viewers at home. Tess Daly and Cl"
+              "audia Winkleman present. [AD,S]") },
+  { "fr_6937",
+    BENCH_STR("Le journal de 20 heures"),
+    BENCH_STR("Pr\xc2""esentation : Anne-Claire Coudray. L\xb9""actualit\xc2""e nati"
+              "onale et internationale, avec des reportages, des invit\xc2""es et la"
+              " m\xc2""et\xc2""eo. Une \xc2""edition sp\xc2""eciale consacr\xc2""ee "
+              "\xc1""a la rentr\xc2""ee scolaire et \xc1""a l\xb9\xc2""economie fran"
+              "\xcb""caise.") },
+  { "de_8859_15",
+    BENCH_STR("\x10\x00\x0fTatort: Sch\xf6ne Gr\xfc\xdf""e aus M\xfcnster"),
+    BENCH_STR("\x10\x00\x0fThiel und Boerne ermitteln im Fall einer \xc4rztin, die t"
+              "ot in ihrer Praxis aufgefunden wird. Die Spuren f\xfchren zu einem al"
+              "ten Bekannten aus Boernes Studienzeit, der pl\xf6tzlich gro\xdf""e Sc"
+              "hulden hat.") },
+  { "tr_8859_9",
+    BENCH_STR("\x05""Ak\xfe""am Haberleri"),
+    BENCH_STR("\x05G\xfcn\xfcn \xf6ne \xe7\xfdkan geli\xfemeleri, ekonomi ve spor ha"
+              "berleri ile hava durumu bu b\xfcltende. Sunucu: Ay\xfe""e Y\xfdlmaz. "
+              "T\xfcrkiye'nin d\xf6rt bir yan\xfdndan canl\xfd ba\xf0lant\xfdlar.") },
+  { "ru_8859_5",
+    BENCH_STR("\x01\xbd\xde\xd2\xde\xe1\xe2\xd8"),
+    BENCH_STR("\x01\xb3\xdb\xd0\xd2\xdd\xeb\xd5 \xe1\xde\xd1\xeb\xe2\xd8\xef \xd4"
+              "\xdd\xef \xd2 \xc0\xde\xe1\xe1\xd8\xd8 \xd8 \xdc\xd8\xe0\xd5. \xbf"
+              "\xde\xdb\xd8\xe2\xd8\xda\xd0, \xed\xda\xde\xdd\xde\xdc\xd8\xda\xd0, "
+              "\xda\xe3\xdb\xec\xe2\xe3\xe0\xd0 \xd8 \xe1\xdf\xde\xe0\xe2. \xb2 \xe1"
+              "\xe2\xe3\xd4\xd8\xd8 \xd2\xd5\xd4\xe3\xe9\xd8\xd5 \xdf\xe0\xde\xd3"
+              "\xe0\xd0\xdc\xdc\xeb, \xdf\xe0\xef\xdc\xeb\xd5 \xd2\xda\xdb\xee\xe7"
+              "\xd5\xdd\xd8\xef \xda\xde\xe0\xe0\xd5\xe1\xdf\xde\xdd\xd4\xd5\xdd\xe2"
+              "\xde\xd2 \xd8\xd7 \xe0\xd5\xd3\xd8\xde\xdd\xde\xd2.") },
+  { "el_8859_7",
+    BENCH_STR("\x03\xc5\xe9\xe4\xde\xf3\xe5\xe9\xf2"),
+    BENCH_STR("\x03\xcf\xe9 \xf3\xe7\xec\xe1\xed\xf4\xe9\xea\xfc\xf4\xe5\xf1\xe5\xf2"
+              " \xe5\xe9\xe4\xde\xf3\xe5\xe9\xf2 \xf4\xe7\xf2 \xe7\xec\xdd\xf1\xe1"
+              "\xf2 \xe1\xf0\xfc \xf4\xe7\xed \xc5\xeb\xeb\xdc\xe4\xe1 \xea\xe1\xe9 "
+              "\xf4\xef\xed \xea\xfc\xf3\xec\xef, \xec\xe5 \xf1\xe5\xf0\xef\xf1\xf4"
+              "\xdc\xe6 \xea\xe1\xe9 \xe1\xed\xe1\xeb\xfd\xf3\xe5\xe9\xf2 \xe1\xf0"
+              "\xfc \xf4\xef\xf5\xf2 \xf3\xf5\xed\xf4\xdc\xea\xf4\xe5\xf2 \xf4\xe7"
+              "\xf2 \xe5\xe9\xe4\xe7\xf3\xe5\xef\xe3\xf1\xe1\xf6\xdf\xe1\xf2.") },
+  { "utf8",
+    BENCH_STR("\x15\xc3\x8d""dolos \xe2\x80\x94 Gala Final"),
+    BENCH_STR("\x15""A grande final do concurso, com as atua\xc3\xa7\xc3\xb5""es dos"
+              " tr\xc3\xaas finalistas e a revela\xc3\xa7\xc3\xa3o do vencedor escol"
+              "hido pelo p\xc3\xba""blico. Apresenta\xc3\xa7\xc3\xa3o de Jo\xc3\xa3o"
+              " Manzarra e Cl\xc3\xa1udia Vieira.") }
+};
+
+/**
+ * Convert bench_charset_mb MB of each sample
+ */
+static void
+bench_charset(void)
+{
+  int nsamples = sizeof(bench_charset_samples) /
+    sizeof(bench_charset_samples[0]);
+  int i, k, n, errors = 0;
+  int64_t ts, t, t_total = 0;
+  double bytes, bytes_total = 0;
+  char buf[1024];
+  FILE *fp;
+
+  tvhlog(LOG_INFO, "bench", "Charset conversion of %d MB per sample",
+	 bench_charset_mb);
+
+  fp = bench_report_open();
+  fprintf(fp,
+	  "{\n"
+	  "  \"mode\": \"charset\",\n"
+	  "  \"samples\": {\n");
+
+  for(i = 0; i < nsamples; i++) {
+    const uint8_t *title = bench_charset_samples[i].title;
+    const uint8_t *desc  = bench_charset_samples[i].desc;
+    size_t tlen = bench_charset_samples[i].title_len;
+    size_t dlen = bench_charset_samples[i].desc_len;
+
+    n = (int64_t)bench_charset_mb * 1024 * 1024 / (tlen + dlen);
+    ts = getmonoclock();
+    for(k = 0; k < n; k++) {
+      errors += !!dvb_get_string(buf, sizeof(buf), title, tlen, NULL, NULL);
+      errors += !!dvb_get_string(buf, sizeof(buf), desc, dlen, NULL, NULL);
+    }
+    t = getmonoclock() - ts;
+    bytes = (double)n * (tlen + dlen);
+    t_total += t;
+    bytes_total += bytes;
+
+    fprintf(fp,
+	    "    \"%s\": { \"mb_per_sec\": %.1f, \"ns_per_string\": %.1f }%s\n",
+	    bench_charset_samples[i].name,
+	    bytes / (1024 * 1024) / (t / 1e6), t * 1000.0 / (2.0 * n),
+	    i < nsamples - 1 ? "," : "");
+  }
+
+  fprintf(fp,
+	  "  },\n"
+	  "  \"mb_per_sec\": %.1f,\n"
+	  "  \"errors\": %d\n"
+	  "}\n",
+	  bytes_total / (1024 * 1024) / (t_total / 1e6), errors);
+  bench_report_close(fp);
+}
+#endif
+
+
+/**
+ * Make tvheadend exit once we are done. SIGTERM stays blocked until the
+ * main thread waits in mainloop, so this can't race with it setting
+ * 'running'
+ */
+static void
+bench_exit(void)
+{
+  kill(getpid(), SIGTERM);
+}
+
+
+/**
+ *
+ */
+static void *
+bench_main(void *aux)
+{
+  service_t *svcs[BENCH_MAX_SERVICES];
+  bench_counters_t start, stop;
+  bench_sub_t *bs;
+  char name[64];
+  int i, j, n = 0, tries;
+
+  if(bench_epg_channels) {
+    bench_epg();
+    bench_exit();
+    return NULL;
+  }
+
+#if ENABLE_LINUXDVB
+  if(bench_charset_mb) {
+    bench_charset();
+    bench_exit();
+    return NULL;
+  }
+#endif
+
+  /* Wait for the replayed services to appear in the PATs */
+  for(tries = 0; tries < 300; tries++) {
+    pthread_mutex_lock(&global_lock);
+    n = bench_get_services(svcs);
+    pthread_mutex_unlock(&global_lock);
+    if(n > 0 && tries >= 10)
+      break;
+    usleep(100000);
+  }
+
+  if(n == 0) {
+    tvhlog(LOG_ERR, "bench", "No services to benchmark, use -r <tsfile>");
+    bench_exit();
+    return NULL;
+  }
+
+  tvhlog(LOG_INFO, "bench",
+	 "%d subscriptions on %d services, %s output to %s for %d seconds",
+	 bench_nsubs * n, n, bench_mode_txt[bench_mode],
+	 bench_tcp ? "loopback socket" : "/dev/null", bench_time);
+
+  bench_running = 1;
+  bench_counters_get(&start);
+
+  pthread_mutex_lock(&global_lock);
+  for(i = 0; i < n; i++) {
+    for(j = 0; j < bench_nsubs; j++) {
+      bs = calloc(1, sizeof(bench_sub_t));
+      bs->bs_index = i * bench_nsubs + j;
+      bs->bs_ts_size = 1024;
+      bs->bs_ts = malloc(sizeof(int64_t) * bs->bs_ts_size);
+      bs->bs_peer = -1;
+
+      if(bench_open_output(bs)) {
+	tvhlog(LOG_ERR, "bench", "Unable to open output -- %s",
+	       strerror(errno));
+	free(bs->bs_ts);
+	free(bs);
+	continue;
+      }
+
+      streaming_queue_init(&bs->bs_sq, 0);
+      streaming_target_init(&bs->bs_input, bench_input, bs, 0);
+      LIST_INSERT_HEAD(&bench_subs, bs, bs_link);
+
+      snprintf(name, sizeof(name), "bench%d", bs->bs_index);
+
+      if(bench_mode == BENCH_PASS) {
+	bs->bs_s = subscription_create_from_channel(svcs[i]->s_ch, 100, name,
+						    &bs->bs_input,
+						    SUBSCRIPTION_RAW_MPEGTS);
+      } else {
+	bs->bs_gh = globalheaders_create(&bs->bs_input);
+	bs->bs_tsfix = tsfix_create(bs->bs_gh);
+	bs->bs_s = subscription_create_from_channel(svcs[i]->s_ch, 100, name,
+						    bs->bs_tsfix, 0);
+      }
+    }
+  }
+  pthread_mutex_unlock(&global_lock);
+
+  /* Start consumers once all subscriptions exist (and are set in bs_s) */
+  LIST_FOREACH(bs, &bench_subs, bs_link)
+    pthread_create(&bs->bs_tid, NULL, bench_thread, bs);
+
+  for(i = 0; i < bench_time * 10 && running; i++)
+    usleep(100000);
+
+  bench_counters_get(&stop);
+  bench_running = 0;
+
+  LIST_FOREACH(bs, &bench_subs, bs_link)
+    pthread_join(bs->bs_tid, NULL);
+
+  pthread_mutex_lock(&global_lock);
+  LIST_FOREACH(bs, &bench_subs, bs_link)
+    if(bs->bs_s != NULL)
+      subscription_unsubscribe(bs->bs_s);
+  pthread_mutex_unlock(&global_lock);
+
+  LIST_FOREACH(bs, &bench_subs, bs_link) {
+    if(bs->bs_tsfix != NULL)
+      tsfix_destroy(bs->bs_tsfix);
+    if(bs->bs_gh != NULL)
+      globalheaders_destroy(bs->bs_gh);
+    streaming_queue_clear(&bs->bs_sq.sq_queue);
+
+    if(bs->bs_peer != -1) {
+      shutdown(bs->bs_fd, SHUT_RDWR);
+      pthread_join(bs->bs_drain_tid, NULL);
+      close(bs->bs_peer);
+    }
+    close(bs->bs_fd);
+  }
+
+  bench_report(&start, &stop, n);
+
+  bench_exit();
+  return NULL;
+}
+
+
+/**
+ * Start a benchmark, opts is a comma separated list of
+ *
+ *   subs=<n>     Subscriptions per service
+ *   mux=<type>   pass, matroska or htsp
+ *   time=<secs>  Duration
+ *   sink=<type>  null or tcp (loopback socket)
+ *   out=<file>   Write the JSON report to file instead of stdout
+ *   epg=<n>      Benchmark the EPG on a synthetic guide of n channels
+ *   days=<n>     Length of the synthetic guide
+ *   charset=<n>  Benchmark DVB text conversion, n MB per sample
+ */
+void
+bench_init(const char *opts)
+{
+  pthread_t ptid;
+  char *s = strdup(opts), *tok, *val, *saveptr = NULL;
+
+  for(tok = strtok_r(s, ",", &saveptr); tok != NULL;
+      tok = strtok_r(NULL, ",", &saveptr)) {
+
+    if((val = strchr(tok, '=')) == NULL) {
+      fprintf(stderr, "Invalid benchmark option '%s'\n", tok);
+      continue;
+    }
+    *val++ = 0;
+
+    if(!strcmp(tok, "subs"))
+      bench_nsubs = MAX(atoi(val), 1);
+    else if(!strcmp(tok, "time"))
+      bench_time = MAX(atoi(val), 1);
+    else if(!strcmp(tok, "sink"))
+      bench_tcp = !strcmp(val, "tcp");
+    else if(!strcmp(tok, "out"))
+      bench_output = strdup(val);
+    else if(!strcmp(tok, "epg"))
+      bench_epg_channels = MAX(atoi(val), 1);
+    else if(!strcmp(tok, "days"))
+      bench_epg_days = MAX(atoi(val), 1);
+    else if(!strcmp(tok, "charset"))
+      bench_charset_mb = MAX(atoi(val), 1);
+    else if(!strcmp(tok, "mux")) {
+      if(!strcmp(val, "pass"))
+	bench_mode = BENCH_PASS;
+      else if(!strcmp(val, "htsp"))
+	bench_mode = BENCH_HTSP;
+      else
+	bench_mode = BENCH_MATROSKA;
+    } else
+      fprintf(stderr, "Unknown benchmark option '%s'\n", tok);
+  }
+  free(s);
+
+  pthread_create(&ptid, NULL, bench_main, NULL);
+}
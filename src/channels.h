@@ -50,6 +50,12 @@ typedef struct channel {
   epg_broadcast_t      *ch_epg_now;
   epg_broadcast_t      *ch_epg_next;
   gtimer_t              ch_epg_timer;
+  epg_sched_rec_t      *ch_epg_index;
+  int                   ch_epg_index_len;
+  int                   ch_epg_index_size;
+  epg_hash_t            ch_epg_eids;
+  LIST_ENTRY(channel)   ch_epg_notify_link; // Now/next change not yet sent
+  int                   ch_epg_notify;
 
   gtimer_t ch_epg_timer_head;
   gtimer_t ch_epg_timer_current;
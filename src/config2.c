@@ -24,6 +24,17 @@
 
 static htsmsg_t *config;
 
+static int config_set_u32 ( const char *key, uint32_t val )
+{
+  uint32_t u32;
+  if (htsmsg_get_u32(config, key, &u32) || u32 != val) {
+    htsmsg_delete_field(config, key);
+    htsmsg_add_u32(config, key, val);
+    return 1;
+  }
+  return 0;
+}
+
 void config_init ( void )
 {
   config = hts_settings_load("config");
@@ -31,6 +42,10 @@ void config_init ( void )
     tvhlog(LOG_WARNING, "config", "no configuration, loading defaults");
     config = htsmsg_create_map();
   }
+  if (!htsmsg_get_u32_or_default(config, "serviceprobe_concurrency", 0))
+    config_set_u32("serviceprobe_concurrency", 8);
+  if (!htsmsg_get_u32_or_default(config, "serviceprobe_timeout", 0))
+    config_set_u32("serviceprobe_timeout", 30);
 }
 
 void config_save ( void )
@@ -74,3 +89,23 @@ int config_set_muxconfpath ( const char *path )
   }
   return 0;
 }
+
+uint32_t config_get_serviceprobe_concurrency ( void )
+{
+  return htsmsg_get_u32_or_default(config, "serviceprobe_concurrency", 8);
+}
+
+int config_set_serviceprobe_concurrency ( uint32_t num )
+{
+  return config_set_u32("serviceprobe_concurrency", num ?: 1);
+}
+
+uint32_t config_get_serviceprobe_timeout ( void )
+{
+  return htsmsg_get_u32_or_default(config, "serviceprobe_timeout", 30);
+}
+
+int config_set_serviceprobe_timeout ( uint32_t sec )
+{
+  return config_set_u32("serviceprobe_timeout", sec ?: 1);
+}
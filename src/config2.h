@@ -36,4 +36,12 @@ const char *config_get_language    ( void );
 int         config_set_language    ( const char *str )
   __attribute__((warn_unused_result));
 
+uint32_t    config_get_serviceprobe_concurrency ( void );
+int         config_set_serviceprobe_concurrency ( uint32_t num )
+  __attribute__((warn_unused_result));
+
+uint32_t    config_get_serviceprobe_timeout     ( void );
+int         config_set_serviceprobe_timeout     ( uint32_t sec )
+  __attribute__((warn_unused_result));
+
 #endif /* __TVH_CONFIG__H__ */
@@ -24,5 +24,6 @@
 void
 dvb_init(uint32_t adapter_mask)
 {
+  dvb_charset_init();
   dvb_adapter_init(adapter_mask);
 }
@@ -91,6 +91,7 @@ typedef struct th_dvb_mux_instance {
 
   LIST_ENTRY(th_dvb_mux_instance) tdmi_adapter_link;
   LIST_ENTRY(th_dvb_mux_instance) tdmi_adapter_hash_link;
+  LIST_ENTRY(th_dvb_mux_instance) tdmi_tsid_hash_link;
 
   struct th_dvb_adapter *tdmi_adapter;
 
@@ -125,18 +126,31 @@ typedef struct th_dvb_mux_instance {
   time_t tdmi_got_adapter;
   time_t tdmi_lost_adapter;
 
+  /**
+   * Dwell time of the last visit (ms) and how long it took until all
+   * the tables we wait for were complete (-1 if they never were)
+   */
+  int64_t tdmi_tune_time;
+  int tdmi_dwell;
+  int tdmi_tables_time;
+  int tdmi_scan_cycle;    // Last scan cycle of the adapter we were tuned in
+
   dvb_mux_conf_t tdmi_conf;
 
   /* Linked if tdmi_conf.dmc_satconf != NULL */
   LIST_ENTRY(th_dvb_mux_instance) tdmi_satconf_link;
 
   uint16_t tdmi_transport_stream_id;
+  uint16_t tdmi_network_id; /* original_network_id, 0 if not known */
 
   char *tdmi_identifier;
   char *tdmi_network;     /* Name of network, from NIT table */
 
   struct service_list tdmi_transports; /* via s_mux_link */
 
+#define TDMI_SID_HASH_WIDTH 31
+  struct service_list tdmi_sid_hash[TDMI_SID_HASH_WIDTH];
+
   TAILQ_ENTRY(th_dvb_mux_instance) tdmi_scan_link;
   struct th_dvb_mux_instance_queue *tdmi_scan_queue;
 
@@ -166,9 +180,18 @@ typedef struct th_dvb_adapter {
   struct th_dvb_mux_instance_queue tda_initial_scan_queue;
   int tda_initial_num_mux;
 
+  /**
+   * A scan cycle ends when every enabled mux has been tuned
+   */
+  int tda_scan_cycle;
+  int64_t tda_scan_cycle_start;
+  int tda_scan_cycle_time;  // Duration of the last complete cycle (ms)
+
   th_dvb_mux_instance_t *tda_mux_current;
 
   th_dvb_mux_instance_t *tda_mux_epg;
+  int tda_epg_visits;
+  int64_t tda_epg_time;     // Time tuned for EPG scans (ms)
 
   int tda_table_epollfd;
 
@@ -206,6 +229,13 @@ typedef struct th_dvb_adapter {
   pthread_mutex_t tda_delivery_mutex;
   struct service_list tda_transports; /* Currently bound transports */
 
+  /**
+   * Input statistics (everything read from the DVR device)
+   */
+  avgstat_t tda_rate;
+  avgstat_t tda_cc_errors;  // Summed over the services being delivered
+  avgstat_t tda_tei_errors;
+
   gtimer_t tda_fe_monitor_timer;
   int tda_fe_monitor_hold;
 
@@ -228,6 +258,14 @@ typedef struct th_dvb_adapter {
 
   uint32_t tda_extrapriority; // extra priority for choosing the best adapter/service
 
+  /**
+   * Service probe progress, see serviceprobe.c
+   */
+  int tda_sp_queued;  // Services queued or being probed
+  int tda_sp_done;    // Probes finished since tda_sp_start
+  time_t tda_sp_start;
+  int tda_sp_notify;
+
 } th_dvb_adapter_t;
 
 /**
@@ -265,6 +303,16 @@ typedef struct th_dvb_table {
   int tdt_count;
   int tdt_pid;
 
+  /**
+   * Sections received of the current version. The table is complete
+   * once all of 0 .. last_section_number have been seen. Only the first
+   * table_id_extension seen is tracked (several PMTs may share a PID)
+   */
+  uint32_t tdt_sections[8];
+  int tdt_version;
+  int tdt_ext;
+  int tdt_complete;
+
   struct dmx_sct_filter_params *tdt_fparams;
 
   int tdt_id;
@@ -275,6 +323,13 @@ typedef struct th_dvb_table {
 extern struct th_dvb_adapter_queue dvb_adapters;
 extern struct th_dvb_mux_instance_tree dvb_muxes;
 
+/**
+ * All muxes (on all adapters) hashed by TSID. The original network id
+ * is not part of the key since it's not known until the SDT is seen.
+ */
+#define DVB_MUX_TSID_HASH_WIDTH 521
+extern struct th_dvb_mux_instance_list dvb_mux_tsid_hash[];
+
 void dvb_init(uint32_t adapter_mask);
 
 /**
@@ -284,6 +339,14 @@ void dvb_adapter_init(uint32_t adapter_mask);
 
 void dvb_adapter_mux_scanner(void *aux);
 
+/**
+ * Don't leave a mux sooner than this (seconds) after tuning, the
+ * frontend monitor needs a few rounds to measure signal quality
+ */
+#define TDA_MUX_MIN_DWELL 5
+
+void dvb_adapter_mux_done(th_dvb_mux_instance_t *tdmi);
+
 void dvb_adapter_start (th_dvb_adapter_t *tda);
 
 void dvb_adapter_stop (th_dvb_adapter_t *tda);
@@ -360,6 +423,14 @@ void dvb_mux_set_networkname(th_dvb_mux_instance_t *tdmi, const char *name);
 
 void dvb_mux_set_tsid(th_dvb_mux_instance_t *tdmi, uint16_t tsid);
 
+void dvb_mux_set_onid(th_dvb_mux_instance_t *tdmi, uint16_t onid);
+
+th_dvb_mux_instance_t *dvb_mux_find_by_tsid(th_dvb_adapter_t *tda,
+					    uint16_t onid, uint16_t tsid);
+
+struct service *dvb_mux_find_service(uint16_t onid, uint16_t tsid,
+				     uint16_t sid);
+
 void dvb_mux_set_enable(th_dvb_mux_instance_t *tdmi, int enabled);
 
 void dvb_mux_set_satconf(th_dvb_mux_instance_t *tdmi, const char *scid,
@@ -387,8 +458,21 @@ const char *dvb_mux_add_by_params(th_dvb_adapter_t *tda,
 int dvb_mux_copy(th_dvb_adapter_t *dst, th_dvb_mux_instance_t *tdmi_src,
 		 dvb_satconf_t *satconf);
 
+int dvb_mux_copy_services(th_dvb_mux_instance_t *tdmi_dst,
+			  th_dvb_mux_instance_t *tdmi_src);
+
 void dvb_mux_add_to_scan_queue (th_dvb_mux_instance_t *tdmi);
 
+/**
+ * Initial scan coordination between adapters
+ */
+th_dvb_mux_instance_t *dvb_scan_next(th_dvb_adapter_t *tda);
+
+void dvb_scan_mux_discovered(th_dvb_mux_instance_t *tdmi,
+			     const dvb_mux_conf_t *dmc, uint16_t tsid);
+
+void dvb_scan_mux_complete(th_dvb_mux_instance_t *tdmi);
+
 /**
  * DVB Transport (aka DVB service)
  */
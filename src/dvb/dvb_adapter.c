@@ -44,6 +44,7 @@
 #include "service.h"
 #include "epggrab.h"
 #include "diseqc.h"
+#include "stats.h"
 
 struct th_dvb_adapter_queue dvb_adapters;
 struct th_dvb_mux_instance_tree dvb_muxes;
@@ -65,6 +66,11 @@ tda_alloc(void)
   TAILQ_INIT(&tda->tda_initial_scan_queue);
   TAILQ_INIT(&tda->tda_satconfs);
 
+  avgstat_init(&tda->tda_rate, 60);
+  avgstat_init(&tda->tda_cc_errors, 60);
+  avgstat_init(&tda->tda_tei_errors, 60);
+
+  tda->tda_scan_cycle = 1;
   tda->tda_allpids_dmx_fd = -1;
   tda->tda_dump_fd = -1;
 
@@ -585,14 +591,18 @@ dvb_adapter_mux_scanner(void *aux)
   if(service_compute_weight(&tda->tda_transports) > 0)
     return;
 
-  /* Check if we have muxes pending for quickscan, if so, choose them */
-  if((tdmi = TAILQ_FIRST(&tda->tda_initial_scan_queue)) != NULL) {
+  /* Check if we have muxes pending for quickscan, if so, choose them
+     (unless another adapter is already scanning them) */
+  if((tdmi = dvb_scan_next(tda)) != NULL) {
     dvb_fe_tune(tdmi, "Initial autoscan");
     return;
   }
 
   /* Check EPG */
   if (tda->tda_mux_epg) {
+    tdmi = tda->tda_mux_epg;
+    tda->tda_epg_time += tdmi == tda->tda_mux_current ?
+      (getmonoclock() - tdmi->tdmi_tune_time) / 1000 : tdmi->tdmi_dwell;
     epggrab_mux_stop(tda->tda_mux_epg, 1); // timeout anything not complete
     tda->tda_mux_epg = NULL; // skip this time
   } else {
@@ -605,6 +615,7 @@ dvb_adapter_mux_scanner(void *aux)
     if (period > 20)
       gtimer_arm(&tda->tda_mux_scanner_timer,
                  dvb_adapter_mux_scanner, tda, period);
+    tda->tda_epg_visits++;
     dvb_fe_tune(tda->tda_mux_epg, "EPG scan");
     return;
 
@@ -629,6 +640,52 @@ dvb_adapter_mux_scanner(void *aux)
     dvb_fe_stop(tda->tda_mux_current, 0);
 }
 
+/**
+ * All tables on the current mux are complete. Unless the EPG grabbers
+ * are still busy, move on to the next mux as soon as we have been here
+ * for TDA_MUX_MIN_DWELL, instead of waiting for the scanner period.
+ * On a mux tuned for EPG scanning, grabbers that have not started yet
+ * count as busy too (OpenTV waits for the whole BAT), so there the
+ * early exit only comes from epggrab_ota_complete().
+ * Not done when there is nothing else to scan, that would just retune
+ * the same mux over and over again.
+ */
+void
+dvb_adapter_mux_done(th_dvb_mux_instance_t *tdmi)
+{
+  th_dvb_adapter_t *tda = tdmi->tdmi_adapter;
+  int64_t t;
+  int i;
+
+  lock_assert(&global_lock);
+
+  if(tda->tda_mux_current != tdmi || tdmi->tdmi_tables_time < 0)
+    return;
+
+  if(tda->tda_mux_epg == tdmi ? epggrab_mux_pending(tdmi) :
+     epggrab_mux_running(tdmi))
+    return;
+
+  if(service_compute_weight(&tda->tda_transports) > 0)
+    return;
+
+  if(TAILQ_FIRST(&tda->tda_initial_scan_queue) == NULL &&
+     tda->tda_mux_epg != tdmi) {
+    if(!tda->tda_idlescan)
+      return;
+    for(i = 0; i < TDA_SCANQ_NUM; i++)
+      if(TAILQ_FIRST(&tda->tda_scan_queues[i]) != NULL)
+	break;
+    if(i == TDA_SCANQ_NUM)
+      return;
+  }
+
+  t = (getmonoclock() - tdmi->tdmi_tune_time) / 1000000;
+  gtimer_arm(&tda->tda_mux_scanner_timer, dvb_adapter_mux_scanner, tda,
+	     t < TDA_MUX_MIN_DWELL ? TDA_MUX_MIN_DWELL - t : 0);
+}
+
+
 /**
  * 
  */
@@ -703,10 +760,11 @@ static void *
 dvb_adapter_input_dvr(void *aux)
 {
   th_dvb_adapter_t *tda = aux;
-  int fd, i, r, c, efd, nfds;
+  int fd, i, r, c, efd, nfds, n, tei;
   uint8_t tsb[188 * 10];
   service_t *t;
   struct epoll_event ev;
+  STATS_SPAN(span);
 
   fd = tvh_open(tda->tda_dvr_path, O_RDONLY | O_NONBLOCK, 0);
   if(fd == -1) {
@@ -730,7 +788,9 @@ dvb_adapter_input_dvr(void *aux)
     if (nfds < 1) continue;
     if (ev.data.fd != fd) break;
 
+    STATS_ENTER(span);
     c = read(fd, tsb+r, sizeof(tsb)-r);
+    STATS_LEAVE(span, STATS_READ);
     if (c < 0) {
       if (errno == EAGAIN || errno == EINTR)
         continue;
@@ -761,11 +821,14 @@ dvb_adapter_input_dvr(void *aux)
         break;
 
     /* Process */
+    n = tei = 0;
     while (r >= 188) {
   
       /* sync */
       if (tsb[i] == 0x47) {
         if(t) ts_recv_packet1(t, tsb + i, NULL);
+        tei += tsb[i+1] >> 7;
+        n++;
         i += 188;
         r -= 188;
 
@@ -779,6 +842,10 @@ dvb_adapter_input_dvr(void *aux)
 
     pthread_mutex_unlock(&tda->tda_delivery_mutex);
 
+    avgstat_add(&tda->tda_rate, n * 188, dispatch_clock);
+    if(tei)
+      avgstat_add(&tda->tda_tei_errors, tei, dispatch_clock);
+
     /* reset buffer */
     if (r) {memmove(tsb, tsb+i, r);printf("move");}
     i = 0;
@@ -820,6 +887,17 @@ dvb_adapter_build_msg(th_dvb_adapter_t *tda)
   htsmsg_add_u32(m, "services", numsvc);
   htsmsg_add_u32(m, "muxes", nummux);
   htsmsg_add_u32(m, "initialMuxes", tda->tda_initial_num_mux);
+  htsmsg_add_u32(m, "scanCycle", (tda->tda_scan_cycle_time + 500) / 1000);
+
+  htsmsg_add_msg(m, "input", avgstat_input_msg(&tda->tda_rate,
+						&tda->tda_cc_errors,
+						&tda->tda_tei_errors,
+						dispatch_clock));
+
+  htsmsg_add_u32(m, "probeQueue", tda->tda_sp_queued);
+  htsmsg_add_u32(m, "probeEta", !tda->tda_sp_done ? 0 :
+                 (uint64_t)tda->tda_sp_queued *
+                 (dispatch_clock - tda->tda_sp_start) / tda->tda_sp_done);
 
   if(tda->tda_mux_current != NULL) {
     dvb_mux_nicename(buf, sizeof(buf), tda->tda_mux_current);
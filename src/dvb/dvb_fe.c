@@ -197,6 +197,38 @@ dvb_fe_monitor(void *aux)
 }
 
 
+/**
+ * A scan cycle is complete once every enabled mux on the adapter has
+ * been tuned, for whatever reason
+ */
+static void
+dvb_fe_scan_cycle(th_dvb_adapter_t *tda, th_dvb_mux_instance_t *tdmi)
+{
+  th_dvb_mux_instance_t *m;
+  int64_t now;
+
+  if(tda->tda_scan_cycle_start == 0)
+    tda->tda_scan_cycle_start = tdmi->tdmi_tune_time;
+
+  if(tdmi->tdmi_scan_cycle == tda->tda_scan_cycle)
+    return;
+  tdmi->tdmi_scan_cycle = tda->tda_scan_cycle;
+
+  LIST_FOREACH(m, &tda->tda_muxes, tdmi_adapter_link)
+    if(m->tdmi_enabled && m->tdmi_scan_cycle != tda->tda_scan_cycle)
+      return;
+
+  now = getmonoclock();
+  tda->tda_scan_cycle_time = (now - tda->tda_scan_cycle_start) / 1000;
+  tda->tda_scan_cycle_start = now;
+  tda->tda_scan_cycle++;
+
+  tvhlog(LOG_DEBUG, "dvb", "\"%s\" scan cycle completed in %d s",
+	 tda->tda_rootpath, (tda->tda_scan_cycle_time + 500) / 1000);
+  dvb_adapter_notify(tda);
+}
+
+
 /**
  * Stop the given TDMI
  */
@@ -208,6 +240,10 @@ dvb_fe_stop(th_dvb_mux_instance_t *tdmi, int retune)
   assert(tdmi == tda->tda_mux_current);
   tda->tda_mux_current = NULL;
 
+  tdmi->tdmi_dwell = (getmonoclock() - tdmi->tdmi_tune_time) / 1000;
+  dvb_fe_scan_cycle(tda, tdmi);
+  dvb_mux_notify(tdmi);
+
   if(tda->tda_allpids_dmx_fd != -1) {
     close(tda->tda_allpids_dmx_fd);
     tda->tda_allpids_dmx_fd = -1;
@@ -528,6 +564,8 @@ dvb_fe_tune(th_dvb_mux_instance_t *tdmi, const char *reason)
   }   
 
   tda->tda_mux_current = tdmi;
+  tdmi->tdmi_tune_time = getmonoclock();
+  tdmi->tdmi_tables_time = -1;
 
   if(tda->tda_dump_muxes)
     dvb_adapter_open_dump_file(tda);
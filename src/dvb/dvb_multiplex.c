@@ -47,6 +47,7 @@
 #include "epggrab.h"
 
 struct th_dvb_mux_instance_tree dvb_muxes;
+struct th_dvb_mux_instance_list dvb_mux_tsid_hash[DVB_MUX_TSID_HASH_WIDTH];
 
 static struct strtab muxfestatustab[] = {
   { "Unknown",      TDMI_FE_UNKNOWN },
@@ -145,6 +146,57 @@ tdmi_compare_conf(int adapter_type,
   return 0;
 }
 
+/**
+ * Change the TSID of a mux, keeping the TSID hash in sync
+ */
+static void
+dvb_mux_hash_tsid(th_dvb_mux_instance_t *tdmi, uint16_t tsid)
+{
+  LIST_REMOVE(tdmi, tdmi_tsid_hash_link);
+  tdmi->tdmi_transport_stream_id = tsid;
+  LIST_INSERT_HEAD(&dvb_mux_tsid_hash[tsid % DVB_MUX_TSID_HASH_WIDTH],
+		   tdmi, tdmi_tsid_hash_link);
+}
+
+/**
+ * Find a mux by original network id and transport stream id, on the
+ * given adapter or any if tda is NULL. An onid of 0 matches any network
+ * as does a mux whose network id is not known yet.
+ */
+th_dvb_mux_instance_t *
+dvb_mux_find_by_tsid(th_dvb_adapter_t *tda, uint16_t onid, uint16_t tsid)
+{
+  th_dvb_mux_instance_t *tdmi;
+
+  LIST_FOREACH(tdmi, &dvb_mux_tsid_hash[tsid % DVB_MUX_TSID_HASH_WIDTH],
+	       tdmi_tsid_hash_link)
+    if(tdmi->tdmi_transport_stream_id == tsid &&
+       (tda == NULL || tdmi->tdmi_adapter == tda) &&
+       (onid == 0 || tdmi->tdmi_network_id == 0 ||
+	tdmi->tdmi_network_id == onid))
+      return tdmi;
+  return NULL;
+}
+
+/**
+ * Find a service by (onid, tsid, sid) on any adapter
+ */
+service_t *
+dvb_mux_find_service(uint16_t onid, uint16_t tsid, uint16_t sid)
+{
+  th_dvb_mux_instance_t *tdmi;
+  service_t *t;
+
+  LIST_FOREACH(tdmi, &dvb_mux_tsid_hash[tsid % DVB_MUX_TSID_HASH_WIDTH],
+	       tdmi_tsid_hash_link)
+    if(tdmi->tdmi_transport_stream_id == tsid &&
+       (onid == 0 || tdmi->tdmi_network_id == 0 ||
+	tdmi->tdmi_network_id == onid) &&
+       (t = dvb_transport_find(tdmi, sid, 0, NULL)) != NULL)
+      return t;
+  return NULL;
+}
+
 /**
  * Create a new mux on the given adapter, return NULL if it already exists
  */
@@ -198,7 +250,7 @@ dvb_mux_create(th_dvb_adapter_t *tda, const struct dvb_mux_conf *dmc,
     }
 
     if(tdmi->tdmi_transport_stream_id != tsid) {
-      tdmi->tdmi_transport_stream_id = tsid;
+      dvb_mux_hash_tsid(tdmi, tsid);
       save = 1;
     }
 
@@ -269,6 +321,8 @@ dvb_mux_create(th_dvb_adapter_t *tda, const struct dvb_mux_conf *dmc,
   }
 
   LIST_INSERT_HEAD(&tda->tda_mux_hash[hash], tdmi, tdmi_adapter_hash_link);
+  LIST_INSERT_HEAD(&dvb_mux_tsid_hash[tsid % DVB_MUX_TSID_HASH_WIDTH],
+		   tdmi, tdmi_tsid_hash_link);
   LIST_INSERT_HEAD(&tda->tda_muxes, tdmi, tdmi_adapter_link);
 
   if(source != NULL) {
@@ -325,6 +379,7 @@ dvb_mux_destroy(th_dvb_mux_instance_t *tdmi)
   RB_REMOVE(&dvb_muxes, tdmi, tdmi_global_link);
   LIST_REMOVE(tdmi, tdmi_adapter_link);
   LIST_REMOVE(tdmi, tdmi_adapter_hash_link);
+  LIST_REMOVE(tdmi, tdmi_tsid_hash_link);
 
   if(tdmi->tdmi_scan_queue != NULL)
     TAILQ_REMOVE(tdmi->tdmi_scan_queue, tdmi, tdmi_scan_link);
@@ -553,6 +608,8 @@ dvb_mux_save(th_dvb_mux_instance_t *tdmi)
   htsmsg_add_str(m, "status", dvb_mux_status(tdmi));
 
   htsmsg_add_u32(m, "transportstreamid", tdmi->tdmi_transport_stream_id);
+  if(tdmi->tdmi_network_id)
+    htsmsg_add_u32(m, "originalnetworkid", tdmi->tdmi_network_id);
   if(tdmi->tdmi_network != NULL)
     htsmsg_add_str(m, "network", tdmi->tdmi_network);
 
@@ -779,6 +836,9 @@ tdmi_create_by_msg(th_dvb_adapter_t *tda, htsmsg_t *m, const char *identifier)
 
     if(tda->tda_qmon && !htsmsg_get_u32(m, "quality", &u32))
       tdmi->tdmi_quality = u32;
+
+    if(!htsmsg_get_u32(m, "originalnetworkid", &u32))
+      tdmi->tdmi_network_id = u32;
   }
   return NULL;
 }
@@ -826,6 +886,17 @@ dvb_mux_set_networkname(th_dvb_mux_instance_t *tdmi, const char *networkname)
 }
 
 
+/**
+ *
+ */
+void
+dvb_mux_set_onid(th_dvb_mux_instance_t *tdmi, uint16_t onid)
+{
+  tdmi->tdmi_network_id = onid;
+  dvb_mux_save(tdmi);
+}
+
+
 /**
  *
  */
@@ -834,7 +905,7 @@ dvb_mux_set_tsid(th_dvb_mux_instance_t *tdmi, uint16_t tsid)
 {
   htsmsg_t *m;
 
-  tdmi->tdmi_transport_stream_id = tsid;
+  dvb_mux_hash_tsid(tdmi, tsid);
  
   dvb_mux_save(tdmi);
 
@@ -989,6 +1060,12 @@ dvb_mux_build_msg(th_dvb_mux_instance_t *tdmi)
     htsmsg_add_u32(m, "muxid", tdmi->tdmi_transport_stream_id);
 
   htsmsg_add_u32(m, "quality", tdmi->tdmi_quality);
+
+  if(tdmi->tdmi_dwell > 0) {
+    htsmsg_add_u32(m, "dwell", tdmi->tdmi_dwell);
+    if(tdmi->tdmi_tables_time >= 0)
+      htsmsg_add_u32(m, "tablesTime", tdmi->tdmi_tables_time);
+  }
   return m;
 }
 
@@ -1138,9 +1215,6 @@ dvb_mux_copy(th_dvb_adapter_t *dst, th_dvb_mux_instance_t *tdmi_src,
              dvb_satconf_t *satconf)
 {
   th_dvb_mux_instance_t *tdmi_dst;
-  service_t *t_src, *t_dst;
-  elementary_stream_t *st_src, *st_dst;
-  caid_t *caid_src, *caid_dst;
 
   tdmi_dst = dvb_mux_create(dst, 
 			    &tdmi_src->tdmi_conf,
@@ -1152,10 +1226,37 @@ dvb_mux_copy(th_dvb_adapter_t *dst, th_dvb_mux_instance_t *tdmi_src,
   if(tdmi_dst == NULL)
     return -1; // Already exist
 
+  tdmi_dst->tdmi_network_id = tdmi_src->tdmi_network_id;
+
+  dvb_mux_copy_services(tdmi_dst, tdmi_src);
+  dvb_mux_save(tdmi_dst);
+  return 0;
+}
+
+
+/**
+ * Copy the services of tdmi_src that tdmi_dst does not already have,
+ * return the number of services copied
+ */
+int
+dvb_mux_copy_services(th_dvb_mux_instance_t *tdmi_dst,
+		      th_dvb_mux_instance_t *tdmi_src)
+{
+  service_t *t_src, *t_dst;
+  elementary_stream_t *st_src, *st_dst;
+  caid_t *caid_src, *caid_dst;
+  int n = 0;
+
+  lock_assert(&global_lock);
+
   LIST_FOREACH(t_src, &tdmi_src->tdmi_transports, s_group_link) {
+    if(dvb_transport_find(tdmi_dst, t_src->s_dvb_service_id, 0, NULL))
+      continue;
+
     t_dst = dvb_transport_find(tdmi_dst, 
 			       t_src->s_dvb_service_id,
 			       t_src->s_pmt_pid, NULL);
+    n++;
 
     t_dst->s_pcr_pid     = t_src->s_pcr_pid;
     t_dst->s_enabled     = t_src->s_enabled;
@@ -1203,8 +1304,7 @@ dvb_mux_copy(th_dvb_adapter_t *dst, th_dvb_mux_instance_t *tdmi_src,
     t_dst->s_config_save(t_dst); // Save config
 
   }
-  dvb_mux_save(tdmi_dst);
-  return 0;
+  return n;
 }
 
 void dvb_mux_add_to_scan_queue ( th_dvb_mux_instance_t *tdmi )
@@ -0,0 +1,273 @@
+/*
+ *  Initial scan coordination between DVB adapters
+ *  Copyright (C) 2012
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Each adapter keeps its own initial scan queue. When several adapters
+ * can receive the same network (same frontend type and, for satellite,
+ * an equivalent satconf) they would all tune every mux in turn. Instead
+ * an adapter skips muxes that a sibling adapter is scanning right now,
+ * and once a mux is complete its services are handed to the copies on
+ * the other adapters so they never have to tune it. Muxes found in the
+ * NIT are created on all sibling adapters, dvb_mux_create() already
+ * drops the ones that exist.
+ *
+ * Terrestrial and cable adapters of the same type may well be connected
+ * to different networks, so nothing is shared with an adapter until it
+ * is known to receive the same network (see dvb_scan_same_network()).
+ */
+
+#include <string.h>
+
+#include "tvheadend.h"
+#include "dvb.h"
+#include "dvb_support.h"
+
+
+/**
+ * Satconfs are per adapter (so are their ids), two are considered to
+ * point at the same orbital position if they have the same name
+ */
+static int
+dvb_scan_satconf_equal(const dvb_satconf_t *a, const dvb_satconf_t *b)
+{
+  if(a == b)
+    return 1;
+  if(a == NULL || b == NULL || a->sc_name == NULL || b->sc_name == NULL)
+    return 0;
+  return !strcmp(a->sc_name, b->sc_name);
+}
+
+
+/**
+ * Map a satconf onto the equivalent one on another adapter,
+ * return -1 if there is none
+ */
+static int
+dvb_scan_satconf_map(th_dvb_adapter_t *tda, dvb_satconf_t *sc,
+		     dvb_satconf_t **res)
+{
+  dvb_satconf_t *s;
+
+  *res = NULL;
+  if(sc == NULL)
+    return 0;
+
+  TAILQ_FOREACH(s, &tda->tda_satconfs, sc_adapter_link)
+    if(dvb_scan_satconf_equal(s, sc)) {
+      *res = s;
+      return 0;
+    }
+  return -1;
+}
+
+
+/**
+ * Adapters other than the one tdmi belongs to that could receive it
+ */
+static int
+dvb_scan_sibling_adapter(th_dvb_adapter_t *tda, th_dvb_mux_instance_t *tdmi)
+{
+  return tda != tdmi->tdmi_adapter && tda->tda_rootpath != NULL &&
+    tda->tda_type == tdmi->tdmi_adapter->tda_type;
+}
+
+
+/**
+ * Return 1 if tda is known to receive the network tdmi is on. With a
+ * satconf that is a satconf of the same name, otherwise one of the
+ * muxes of tda must carry the same original network id or name.
+ */
+static int
+dvb_scan_same_network(th_dvb_adapter_t *tda, th_dvb_mux_instance_t *tdmi)
+{
+  th_dvb_mux_instance_t *m;
+  dvb_satconf_t *sc;
+
+  if(tdmi->tdmi_conf.dmc_satconf != NULL)
+    return !dvb_scan_satconf_map(tda, tdmi->tdmi_conf.dmc_satconf, &sc);
+
+  LIST_FOREACH(m, &tda->tda_muxes, tdmi_adapter_link) {
+    if(tdmi->tdmi_network_id != 0 &&
+       m->tdmi_network_id == tdmi->tdmi_network_id)
+      return 1;
+    if(tdmi->tdmi_network != NULL && m->tdmi_network != NULL &&
+       !strcmp(tdmi->tdmi_network, m->tdmi_network))
+      return 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Find the copy of tdmi on another adapter, ie. a mux on the same
+ * frequency that isn't known to carry another network or stream
+ */
+static th_dvb_mux_instance_t *
+dvb_scan_sibling(th_dvb_adapter_t *tda, th_dvb_mux_instance_t *tdmi)
+{
+  const dvb_mux_conf_t *dmc = &tdmi->tdmi_conf;
+  th_dvb_mux_instance_t *sib;
+  unsigned int hash;
+
+  hash = (dmc->dmc_fe_params.frequency +
+	  dmc->dmc_polarisation) % TDA_MUX_HASH_WIDTH;
+
+  LIST_FOREACH(sib, &tda->tda_mux_hash[hash], tdmi_adapter_hash_link) {
+    if(sib->tdmi_conf.dmc_fe_params.frequency != dmc->dmc_fe_params.frequency||
+       sib->tdmi_conf.dmc_polarisation != dmc->dmc_polarisation ||
+       !dvb_scan_satconf_equal(sib->tdmi_conf.dmc_satconf, dmc->dmc_satconf))
+      continue;
+
+    /* Same frequency, but known to be something else */
+    if(sib->tdmi_network_id != 0 && tdmi->tdmi_network_id != 0 &&
+       sib->tdmi_network_id != tdmi->tdmi_network_id)
+      continue;
+    if(sib->tdmi_transport_stream_id != 0xffff &&
+       tdmi->tdmi_transport_stream_id != 0xffff &&
+       sib->tdmi_transport_stream_id != tdmi->tdmi_transport_stream_id)
+      continue;
+    return sib;
+  }
+  return NULL;
+}
+
+
+/**
+ * Return 1 if another adapter is doing the initial scan of this mux
+ */
+static int
+dvb_scan_busy(th_dvb_mux_instance_t *tdmi)
+{
+  th_dvb_adapter_t *tda;
+  th_dvb_mux_instance_t *cur;
+
+  TAILQ_FOREACH(tda, &dvb_adapters, tda_global_link) {
+    if(!dvb_scan_sibling_adapter(tda, tdmi))
+      continue;
+    cur = tda->tda_mux_current;
+    if(cur != NULL && cur->tdmi_table_initial &&
+       dvb_scan_sibling(tda, tdmi) == cur && dvb_scan_same_network(tda, tdmi))
+      return 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Pick the next mux for initial scan on the given adapter, skipping
+ * the ones that are being scanned by a sibling adapter
+ */
+th_dvb_mux_instance_t *
+dvb_scan_next(th_dvb_adapter_t *tda)
+{
+  th_dvb_mux_instance_t *tdmi;
+
+  lock_assert(&global_lock);
+
+  TAILQ_FOREACH(tdmi, &tda->tda_initial_scan_queue, tdmi_scan_link)
+    if(!dvb_scan_busy(tdmi))
+      return tdmi;
+  return NULL;
+}
+
+
+/**
+ * A mux was found in the NIT of tdmi, create it on every adapter that
+ * can receive it. Existing muxes are left alone by dvb_mux_create()
+ */
+void
+dvb_scan_mux_discovered(th_dvb_mux_instance_t *tdmi,
+			const dvb_mux_conf_t *dmc, uint16_t tsid)
+{
+  th_dvb_adapter_t *tda;
+  dvb_mux_conf_t conf;
+  char buf[100];
+
+  lock_assert(&global_lock);
+
+  TAILQ_FOREACH(tda, &dvb_adapters, tda_global_link) {
+    if(!dvb_scan_sibling_adapter(tda, tdmi) || !tda->tda_autodiscovery ||
+       !dvb_scan_same_network(tda, tdmi))
+      continue;
+
+    conf = *dmc;
+    if(dvb_scan_satconf_map(tda, dmc->dmc_satconf, &conf.dmc_satconf))
+      continue;
+
+    snprintf(buf, sizeof(buf), "automatic mux discovery on \"%s\"",
+	     tdmi->tdmi_adapter->tda_displayname);
+    dvb_mux_create(tda, &conf, tsid, NULL, buf, 1, 1, NULL, NULL);
+  }
+}
+
+
+/**
+ * Initial scan of tdmi is complete, the copies on other adapters get
+ * its services and leave their initial scan queues
+ */
+void
+dvb_scan_mux_complete(th_dvb_mux_instance_t *tdmi)
+{
+  th_dvb_adapter_t *tda;
+  th_dvb_mux_instance_t *sib;
+  char buf[100];
+  int n, adapters = 0;
+
+  lock_assert(&global_lock);
+
+  TAILQ_FOREACH(tda, &dvb_adapters, tda_global_link) {
+    if(!dvb_scan_sibling_adapter(tda, tdmi) ||
+       !dvb_scan_same_network(tda, tdmi))
+      continue;
+
+    sib = dvb_scan_sibling(tda, tdmi);
+    if(sib == NULL || !sib->tdmi_table_initial || sib == tda->tda_mux_current)
+      continue;
+
+    if(sib->tdmi_transport_stream_id == 0xffff &&
+       tdmi->tdmi_transport_stream_id != 0xffff)
+      dvb_mux_set_tsid(sib, tdmi->tdmi_transport_stream_id);
+    if(sib->tdmi_network_id == 0 && tdmi->tdmi_network_id != 0)
+      dvb_mux_set_onid(sib, tdmi->tdmi_network_id);
+    if(sib->tdmi_network == NULL && tdmi->tdmi_network != NULL)
+      dvb_mux_set_networkname(sib, tdmi->tdmi_network);
+
+    n = dvb_mux_copy_services(sib, tdmi);
+
+    sib->tdmi_table_initial = 0;
+    tda->tda_initial_num_mux--;
+    if(sib->tdmi_scan_queue != NULL) {
+      TAILQ_REMOVE(sib->tdmi_scan_queue, sib, tdmi_scan_link);
+      sib->tdmi_scan_queue = NULL;
+    }
+    dvb_mux_add_to_scan_queue(sib);
+    dvb_mux_save(sib);
+
+    if(n > 0)
+      dvb_transport_notify_by_adapter(tda);
+    dvb_adapter_notify(tda);
+    adapters++;
+  }
+
+  if(adapters) {
+    dvb_mux_nicename(buf, sizeof(buf), tdmi);
+    tvhlog(LOG_DEBUG, "dvb",
+	   "\"%s\" initial scan result shared with %d other adapter(s)",
+	   buf, adapters);
+  }
+}
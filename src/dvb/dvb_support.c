@@ -30,6 +30,12 @@
 
 #include <linux/dvb/frontend.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "tvheadend.h"
 #include "dvb_support.h"
 #include "dvb.h"
@@ -66,15 +72,105 @@ static inline int encode_utf8(unsigned int c, char *outb, int outleft)
   }
 }
 
+/**
+ * UTF-8 encoding of the upper half (0x80 - 0xff) of the ISO-8859 and
+ * ISO6937 single byte tables: up to three bytes followed by the length.
+ * Control codes 0x80 - 0x9f are mapped to ' ', unmapped characters
+ * have length 0.
+ */
+static uint8_t conv_8859_utf8[14][128][4];
+static uint8_t iso6937_utf8[128][4];
+
+static void utf8_table_build(uint8_t (*dst)[4], const uint16_t *src)
+{
+  int i, len;
+
+  for (i = 0; i < 32; i++) {
+    dst[i][0] = ' ';
+    dst[i][3] = 1;
+  }
+  for (i = 0; i < 96; i++) {
+    if (src[i] == 0)
+      continue;
+    len = encode_utf8(src[i], (char*)dst[i + 32], 3);
+    dst[i + 32][3] = len < 0 ? 0 : len;
+  }
+}
+
+void dvb_charset_init(void)
+{
+  int i;
+
+  for (i = 0; i < 14; i++)
+    utf8_table_build(conv_8859_utf8[i], conv_8859_table[i]);
+  utf8_table_build(iso6937_utf8, iso6937_single_byte);
+}
+
+/**
+ * Append a character from the tables above
+ */
+static inline int put_utf8_seq(const uint8_t *seq, char **dst,
+                               size_t *dstlen)
+{
+  if (*dstlen >= 4) {
+    // the length byte is overwritten by whatever comes next
+    memcpy(*dst, seq, 4);
+  } else if (seq[3] <= *dstlen) {
+    memcpy(*dst, seq, seq[3]);
+  } else {
+    errno = E2BIG;
+    return -1;
+  }
+  *dst    += seq[3];
+  *dstlen -= seq[3];
+  return 0;
+}
+
+/**
+ * Copy the run of 7-bit characters at the start of src (these are the
+ * same in every supported charset and in UTF-8), returns its length
+ */
+static inline size_t conv_ascii(const uint8_t *src, size_t srclen,
+                                char *dst, size_t dstlen)
+{
+  size_t i = 0, n = srclen < dstlen ? srclen : dstlen;
+  uint64_t w;
+  int m;
+
+#if defined(__AVX2__)
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+    _mm256_storeu_si256((__m256i*)(dst + i), v);
+    if ((m = _mm256_movemask_epi8(v)))
+      return i + __builtin_ctz(m);
+  }
+#elif defined(__SSE2__)
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+    _mm_storeu_si128((__m128i*)(dst + i), v);
+    if ((m = _mm_movemask_epi8(v)))
+      return i + __builtin_ctz(m);
+  }
+#endif
+  for (; i + 8 <= n; i += 8) {
+    memcpy(&w, src + i, 8);
+    memcpy(dst + i, &w, 8);
+    if (w & 0x8080808080808080ULL)
+      break;
+  }
+  for (; i < n && src[i] < 0x80; i++)
+    dst[i] = src[i];
+  return i;
+}
+
 static inline size_t conv_utf8(const uint8_t *src, size_t srclen,
                               char *dst, size_t *dstlen)
 {
-  while (srclen>0 && (*dstlen)>0) {
-    *dst = (char) *src;
-    srclen--; (*dstlen)--;
-    src++; dst++;
-  }
-  if (srclen>0) {
+  size_t n = srclen < *dstlen ? srclen : *dstlen;
+
+  memcpy(dst, src, n);
+  (*dstlen) -= n;
+  if (srclen > n) {
     errno = E2BIG;
     return -1;
   }
@@ -85,35 +181,20 @@ static inline size_t conv_8859(int conv,
                               const uint8_t *src, size_t srclen,
                               char *dst, size_t *dstlen)
 {
-  uint16_t *table = conv_8859_table[conv];
+  uint8_t (*table)[4] = conv_8859_utf8[conv];
+  size_t n;
 
   while (srclen>0 && (*dstlen)>0) {
-    uint8_t c = *src;
-    if (c <= 0x7f) {
+    if (*src <= 0x7f) {
       // lower half of iso-8859-* is identical to utf-8
-      *dst = (char) *src;
-      (*dstlen)--;
-      dst++;
-    } else if (c <= 0x9f) {
-      // codes 0x80 - 0x9f (control codes) are mapped to ' '
-      *dst = ' ';
-      (*dstlen)--;
-      dst++;
-    } else {
-      // map according to character table, skipping
-      // unmapped chars (value 0 in the table)
-      uint16_t uc = table[c-0xa0];
-      if (uc != 0) {
-        int len = encode_utf8(uc, dst, *dstlen);
-        if (len == -1) {
-          errno = E2BIG;
-          return -1;
-        } else {
-          (*dstlen) -= len;
-          dst += len;
-        }
-      }
+      n = conv_ascii(src, srclen, dst, *dstlen);
+      src += n; srclen -= n;
+      dst += n; (*dstlen) -= n;
+      continue;
     }
+    // map according to character table
+    if (put_utf8_seq(table[*src - 0x80], &dst, dstlen))
+      return -1;
     srclen--;
     src++;
   }
@@ -127,42 +208,34 @@ static inline size_t conv_8859(int conv,
 static inline size_t conv_6937(const uint8_t *src, size_t srclen,
                               char *dst, size_t *dstlen)
 {
+  size_t n;
+
   while (srclen>0 && (*dstlen)>0) {
     uint8_t c = *src;
     if (c <= 0x7f) {
       // lower half of iso6937 is identical to utf-8
-      *dst = (char) *src;
-      (*dstlen)--;
-      dst++;
-    } else if (c <= 0x9f) {
-      // codes 0x80 - 0x9f (control codes) are mapped to ' '
-      *dst = ' ';
-      (*dstlen)--;
-      dst++;
-    } else {
+      n = conv_ascii(src, srclen, dst, *dstlen);
+      src += n; srclen -= n;
+      dst += n; (*dstlen) -= n;
+      continue;
+    } else if (c >= 0xc0 && c <= 0xcf) {
+      // map two-byte sequence, skipping illegal combinations.
       uint16_t uc;
-      if (c <= 0x9f) {
-        // map two-byte sequence, skipping illegal combinations.
-        if (srclen<2) {
-          errno = EINVAL;
-          return -1;
-        }
-        srclen--;
-        src++;
-        uint8_t c2 = *src;
-        if (c2 == 0x20) {
-          uc = iso6937_lone_accents[c-0xc0];
-        } else if (c2 >= 0x41 && c2 <= 0x5a) {
-          uc = iso6937_multi_byte[c-0xc0][c2-0x41];
-        } else if (c2 >= 0x61 && c2 <= 0x7a) {
-          uc = iso6937_multi_byte[c-0xc0][c2-0x61];
-        } else {
-          uc = 0;
-        }
+      if (srclen<2) {
+        errno = EINVAL;
+        return -1;
+      }
+      srclen--;
+      src++;
+      uint8_t c2 = *src;
+      if (c2 == 0x20) {
+        uc = iso6937_lone_accents[c-0xc0];
+      } else if (c2 >= 0x41 && c2 <= 0x5a) {
+        uc = iso6937_multi_byte[c-0xc0][c2-0x41];
+      } else if (c2 >= 0x61 && c2 <= 0x7a) {
+        uc = iso6937_multi_byte[c-0xc0][c2-0x61+26];
       } else {
-        // map according to single character table, skipping
-        // unmapped chars (value 0 in the table)
-        uc = iso6937_single_byte[c-0xa0];
+        uc = 0;
       }
       if (uc != 0) {
         int len = encode_utf8(uc, dst, *dstlen);
@@ -174,6 +247,10 @@ static inline size_t conv_6937(const uint8_t *src, size_t srclen,
           dst += len;
         }
       }
+    } else {
+      // map according to single character table
+      if (put_utf8_seq(iso6937_utf8[c - 0x80], &dst, dstlen))
+        return -1;
     }
     srclen--;
     src++;
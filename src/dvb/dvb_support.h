@@ -53,6 +53,8 @@
 #define DVB_DESC_AAC          0x7c
 #define DVB_DESC_LOCAL_CHAN   0x83
 
+void dvb_charset_init(void);
+
 typedef struct dvb_string_conv
 {
   uint8_t type;
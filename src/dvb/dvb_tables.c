@@ -63,17 +63,26 @@ dvb_table_fastswitch(th_dvb_mux_instance_t *tdmi)
   th_dvb_adapter_t *tda = tdmi->tdmi_adapter;
   char buf[100];
 
-  if(!tdmi->tdmi_table_initial)
-    return;
-
   LIST_FOREACH(tdt, &tdmi->tdmi_tables, tdt_link)
-    if((tdt->tdt_flags & TDT_QUICKREQ) && tdt->tdt_count == 0)
+    if((tdt->tdt_flags & TDT_QUICKREQ) && !tdt->tdt_complete)
       return;
 
+  if(tdmi->tdmi_tables_time < 0) {
+    tdmi->tdmi_tables_time = (getmonoclock() - tdmi->tdmi_tune_time) / 1000;
+    dvb_mux_nicename(buf, sizeof(buf), tdmi);
+    tvhlog(LOG_DEBUG, "dvb", "\"%s\" tables complete for \"%s\" after %d ms",
+	   tda->tda_rootpath, buf, tdmi->tdmi_tables_time);
+  }
+
+  if(!tdmi->tdmi_table_initial) {
+    dvb_adapter_mux_done(tdmi);
+    return;
+  }
+
   tdmi->tdmi_table_initial = 0;
   tda->tda_initial_num_mux--;
   dvb_mux_save(tdmi);
-
+  dvb_scan_mux_complete(tdmi);
 
   dvb_mux_nicename(buf, sizeof(buf), tdmi);
   tvhlog(LOG_DEBUG, "dvb", "\"%s\" initial scan completed for \"%s\"",
@@ -137,6 +146,57 @@ tdt_close_fd(th_dvb_mux_instance_t *tdmi, th_dvb_table_t *tdt)
 }
 
 
+/**
+ * Mark a section as received, return 1 if this completed the table
+ */
+static int
+dvb_table_section(th_dvb_table_t *tdt, const uint8_t *sec, int r)
+{
+  int ver, num, last, ext, i;
+
+  if(tdt->tdt_complete)
+    return 0;
+
+  /* Short form sections (TDT, TOT, ...) are tables of their own */
+  if(!(sec[1] & 0x80) || r < 8) {
+    tdt->tdt_complete = 1;
+    return 1;
+  }
+
+  if(!(sec[5] & 1))
+    return 0; // Not applicable yet
+
+  ext  = sec[3] << 8 | sec[4];
+  ver  = (sec[5] >> 1) & 0x1f;
+  num  = sec[6];
+  last = sec[7];
+
+  if(tdt->tdt_ext == -1)
+    tdt->tdt_ext = ext;
+  else if(tdt->tdt_ext != ext)
+    return 0;
+
+  if(tdt->tdt_version != ver) {
+    memset(tdt->tdt_sections, 0, sizeof(tdt->tdt_sections));
+    tdt->tdt_version = ver;
+  }
+
+  if(num > last)
+    return 0;
+
+  tdt->tdt_sections[num >> 5] |= 1U << (num & 31);
+
+  for(i = 0; i < last >> 5; i++)
+    if(tdt->tdt_sections[i] != 0xffffffff)
+      return 0;
+  if(~tdt->tdt_sections[i] & (0xffffffff >> (31 - (last & 31))))
+    return 0;
+
+  tdt->tdt_complete = 1;
+  return 1;
+}
+
+
 /**
  *
  */
@@ -145,7 +205,7 @@ dvb_proc_table(th_dvb_mux_instance_t *tdmi, th_dvb_table_t *tdt, uint8_t *sec,
 	       int r)
 {
   int chkcrc = tdt->tdt_flags & TDT_CRC;
-  int tableid, len;
+  int tableid, len, sr = r;
   uint8_t *ptr;
   int ret;
 
@@ -172,11 +232,12 @@ dvb_proc_table(th_dvb_mux_instance_t *tdmi, th_dvb_table_t *tdt, uint8_t *sec,
   else
     ret = tdt->tdt_callback(tdmi, ptr, len, tableid, tdt->tdt_opaque);
   
-  if(ret == 0)
+  if(ret == 0) {
     tdt->tdt_count++;
 
-  if(tdt->tdt_flags & TDT_QUICKREQ)
-    dvb_table_fastswitch(tdmi);
+    if(dvb_table_section(tdt, sec, sr) && (tdt->tdt_flags & TDT_QUICKREQ))
+      dvb_table_fastswitch(tdmi);
+  }
 }
 
 /**
@@ -313,6 +374,8 @@ tdt_add(th_dvb_mux_instance_t *tdmi, struct dmx_sct_filter_params *fparams,
   tdt->tdt_pid = pid;
   tdt->tdt_flags = flags;
   tdt->tdt_fparams = fparams;
+  tdt->tdt_version = -1;
+  tdt->tdt_ext = -1;
   LIST_INSERT_HEAD(&tdmi->tdmi_tables, tdt, tdt_link);
   tdt->tdt_fd = -1;
   TAILQ_INSERT_TAIL(&tdmi->tdmi_table_queue, tdt, tdt_pending_link);
@@ -358,6 +421,7 @@ dvb_sdt_callback(th_dvb_mux_instance_t *tdmi, uint8_t *ptr, int len,
   service_t *t;
   uint16_t service_id;
   uint16_t transport_stream_id;
+  uint16_t original_network_id;
   int free_ca_mode;
   int dllen;
   uint8_t dtag, dlen;
@@ -378,7 +442,7 @@ dvb_sdt_callback(th_dvb_mux_instance_t *tdmi, uint8_t *ptr, int len,
   //  version                     = ptr[2] >> 1 & 0x1f;
   //  section_number              = ptr[3];
   //  last_section_number         = ptr[4];
-  //  original_network_id         = ptr[5] << 8 | ptr[6];
+  original_network_id         = ptr[5] << 8 | ptr[6];
   //  reserved                    = ptr[7];
 
   if((ptr[2] & 1) == 0) {
@@ -386,6 +450,9 @@ dvb_sdt_callback(th_dvb_mux_instance_t *tdmi, uint8_t *ptr, int len,
     return -1;
   }
 
+  if(tdmi->tdmi_network_id != original_network_id)
+    dvb_mux_set_onid(tdmi, original_network_id);
+
   len -= 8;
   ptr += 8;
 
@@ -498,8 +565,9 @@ dvb_pat_callback(th_dvb_mux_instance_t *tdmi, uint8_t *ptr, int len,
   // Make sure this TSID is not already known on another mux
   // That might indicate that we have accedentally received a PAT
   // from another mux
-  LIST_FOREACH(other, &tda->tda_muxes, tdmi_adapter_link)
-    if(other != tdmi && 
+  LIST_FOREACH(other, &dvb_mux_tsid_hash[tsid % DVB_MUX_TSID_HASH_WIDTH],
+	       tdmi_tsid_hash_link)
+    if(other != tdmi && other->tdmi_adapter == tda &&
        other->tdmi_conf.dmc_satconf == tdmi->tdmi_conf.dmc_satconf &&
        other->tdmi_transport_stream_id == tsid)
       return -1;
@@ -657,6 +725,7 @@ dvb_table_cable_delivery(th_dvb_mux_instance_t *tdmi, uint8_t *ptr, int len,
 
   dvb_mux_create(tdmi->tdmi_adapter, &dmc, tsid, NULL,
 		 "automatic mux discovery", 1, 1, NULL, NULL);
+  dvb_scan_mux_discovered(tdmi, &dmc, tsid);
   return 0;
 }
 
@@ -742,6 +811,7 @@ dvb_table_sat_delivery(th_dvb_mux_instance_t *tdmi, uint8_t *ptr, int len,
 #endif
   dvb_mux_create(tdmi->tdmi_adapter, &dmc, tsid, NULL,
 		 "automatic mux discovery", 1, 1, NULL, NULL);
+  dvb_scan_mux_discovered(tdmi, &dmc, tsid);
   
   return 0;
 }
@@ -752,17 +822,13 @@ dvb_table_sat_delivery(th_dvb_mux_instance_t *tdmi, uint8_t *ptr, int len,
  */
 static void
 dvb_table_local_channel(th_dvb_mux_instance_t *tdmi, uint8_t *ptr, int len,
-			uint16_t tsid)
+			uint16_t onid, uint16_t tsid)
 {
   uint16_t sid, chan;
   th_dvb_adapter_t *tda = tdmi->tdmi_adapter;
   service_t *t;
 
-  LIST_FOREACH(tdmi, &tda->tda_muxes, tdmi_adapter_link)
-    if(tdmi->tdmi_transport_stream_id == tsid)
-      break;
-
-  if(tdmi == NULL)
+  if((tdmi = dvb_mux_find_by_tsid(tda, onid, tsid)) == NULL)
     return;
 
   while(len >= 4) {
@@ -797,7 +863,7 @@ dvb_nit_callback(th_dvb_mux_instance_t *tdmi, uint8_t *ptr, int len,
   uint8_t tag, tlen;
   int ntl;
   char networkname[256];
-  uint16_t tsid;
+  uint16_t tsid, onid;
   uint16_t network_id = (ptr[0] << 8) | ptr[1];
 
   if(tdmi->tdmi_adapter->tda_nitoid) {
@@ -859,6 +925,7 @@ dvb_nit_callback(th_dvb_mux_instance_t *tdmi, uint8_t *ptr, int len,
 
   while(len >= 6) {
     tsid = ( ptr[0]        << 8) | ptr[1];
+    onid = ( ptr[2]        << 8) | ptr[3];
     ntl =  ((ptr[4] & 0xf) << 8) | ptr[5];
 
     ptr += 6;
@@ -882,7 +949,7 @@ dvb_nit_callback(th_dvb_mux_instance_t *tdmi, uint8_t *ptr, int len,
           dvb_table_cable_delivery(tdmi, ptr, tlen, tsid);
         break;
       case DVB_DESC_LOCAL_CHAN:
-        dvb_table_local_channel(tdmi, ptr, tlen, tsid);
+        dvb_table_local_channel(tdmi, ptr, tlen, onid, tsid);
         break;
       }
 
@@ -936,11 +1003,7 @@ atsc_vct_callback(th_dvb_mux_instance_t *tdmi, uint8_t *ptr, int len,
     transport_stream_id = (ptr[22] << 8) | ptr[23];
     
     /* Search all muxes on adapter */
-    LIST_FOREACH(tdmi, &tda->tda_muxes, tdmi_adapter_link)
-      if(tdmi->tdmi_transport_stream_id == transport_stream_id)
-	break;
-    
-    if(tdmi == NULL)
+    if((tdmi = dvb_mux_find_by_tsid(tda, 0, transport_stream_id)) == NULL)
       continue;
 
     service_id = (ptr[24] << 8) | ptr[25];
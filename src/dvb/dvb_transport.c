@@ -244,6 +244,9 @@ dvb_transport_load(th_dvb_mux_instance_t *tdmi)
       u32 = 1;
     t->s_dvb_eit_enable = u32;
 
+    if(!htsmsg_get_u32(c, "gop_cache", &u32))
+      t->s_gop_cache_enable = u32;
+
     s = htsmsg_get_str(c, "channelname");
     if(htsmsg_get_u32(c, "mapped", &u32))
       u32 = 0;
@@ -285,6 +288,7 @@ dvb_transport_save(service_t *t)
     htsmsg_add_str(m, "dvb_default_charset", t->s_dvb_default_charset);
   
   htsmsg_add_u32(m, "dvb_eit_enable", t->s_dvb_eit_enable);
+  htsmsg_add_u32(m, "gop_cache", t->s_gop_cache_enable);
 
   pthread_mutex_lock(&t->s_stream_mutex);
   psi_save_service_settings(m, t);
@@ -358,6 +362,16 @@ dvb_grace_period(service_t *t)
 }
 
 
+/**
+ * Called from service_destroy()
+ */
+static void
+dvb_transport_dtor(service_t *t)
+{
+  LIST_REMOVE(t, s_dvb_sid_link);
+}
+
+
 /**
  * Find a transport based on 'serviceid' on the given mux
  *
@@ -380,7 +394,8 @@ dvb_transport_find2(th_dvb_mux_instance_t *tdmi, uint16_t sid, int pmt_pid,
 
   lock_assert(&global_lock);
 
-  LIST_FOREACH(t, &tdmi->tdmi_transports, s_group_link) {
+  LIST_FOREACH(t, &tdmi->tdmi_sid_hash[sid % TDMI_SID_HASH_WIDTH],
+	       s_dvb_sid_link) {
     if(t->s_dvb_service_id == sid)
       return t;
   }
@@ -409,9 +424,13 @@ dvb_transport_find2(th_dvb_mux_instance_t *tdmi, uint16_t sid, int pmt_pid,
   t->s_setsourceinfo = dvb_transport_setsourceinfo;
   t->s_quality_index = dvb_transport_quality;
   t->s_grace_period  = dvb_grace_period;
+  t->s_dtor          = dvb_transport_dtor;
 
   t->s_dvb_mux_instance = tdmi;
+  t->s_input_cc_errors  = &tdmi->tdmi_adapter->tda_cc_errors;
   LIST_INSERT_HEAD(&tdmi->tdmi_transports, t, s_group_link);
+  LIST_INSERT_HEAD(&tdmi->tdmi_sid_hash[sid % TDMI_SID_HASH_WIDTH],
+		   t, s_dvb_sid_link);
 
   pthread_mutex_lock(&t->s_stream_mutex); 
   service_make_nicename(t);
@@ -457,6 +476,7 @@ dvb_transport_build_msg(service_t *t)
     htsmsg_add_str(m, "dvb_default_charset", t->s_dvb_default_charset);
 
   htsmsg_add_u32(m, "dvb_eit_enable", t->s_dvb_eit_enable);
+  htsmsg_add_u32(m, "gop_cache", t->s_gop_cache_enable);
 
   return m;
 }
@@ -192,6 +192,12 @@ typedef struct dvr_entry {
 
   struct muxer *de_mux;
 
+  /**
+   * Tuner plan, see dvr_plan.c
+   */
+  struct service *de_plan_service; /* Service to record from (referenced) */
+  int de_plan_conflict;            /* No tuner free for all of it */
+
 } dvr_entry_t;
 
 
@@ -232,6 +238,12 @@ typedef struct dvr_autorec_entry {
   epg_season_t *dae_season;
   epg_episode_num_t dae_epnum;
 
+  /* Matching index, see dvr_autorec.c */
+  LIST_ENTRY(dvr_autorec_entry) dae_index_link;
+  const void *dae_index_key;
+  char *dae_title_lit;  /* Literal the title must contain, or NULL */
+  int dae_rescan;       /* 1 = queued, 2 = being rescanned */
+
 } dvr_autorec_entry_t;
 
 
@@ -284,6 +296,10 @@ void dvr_destroy_by_channel(channel_t *ch);
 
 void dvr_rec_subscribe(dvr_entry_t *de);
 
+void dvr_plan_schedule(void);
+
+void dvr_plan_release(dvr_entry_t *de);
+
 void dvr_rec_unsubscribe(dvr_entry_t *de, int stopcode);
 
 void dvr_event_replaced(epg_broadcast_t *e, epg_broadcast_t *new_e);
@@ -349,9 +365,12 @@ void dvr_autorec_add_series_link(const char *dvr_config_name,
                         		     const char *creator, const char *comment);
 
 void dvr_autorec_check_event(epg_broadcast_t *e);
+void dvr_autorec_check_done(void);
 void dvr_autorec_check_brand(epg_brand_t *b);
 void dvr_autorec_check_season(epg_season_t *s);
 
+void dvr_autorec_config_changed(void);
+
 
 void autorec_destroy_by_channel(channel_t *ch);
 
@@ -16,6 +16,7 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE /* for strcasestr() */
 #include <pthread.h>
 #include <ctype.h>
 #include <assert.h>
@@ -42,6 +43,31 @@ struct dvr_autorec_entry_queue autorec_entries;
 
 static void dvr_autorec_changed(dvr_autorec_entry_t *dae);
 
+/**
+ * Rules are indexed by the most selective thing an event must have for
+ * them to match: its season, brand, channel, one of the channel's tags or
+ * the major nibble of one of its genres. An updated event is only compared
+ * against the rules filed under its own keys, plus the few that have none.
+ */
+#define AUTOREC_HASH_SIZE 128
+
+LIST_HEAD(autorec_index_list, dvr_autorec_entry);
+
+static struct autorec_index_list autorec_index[AUTOREC_HASH_SIZE];
+static struct autorec_index_list autorec_unkeyed;
+static int autorec_index_dirty = 1;
+static int autorec_nrules;
+static char autorec_genre_key[16];
+
+static struct {
+  int events;
+  int rules;
+  int64_t time;
+} autorec_stats;
+
+static pthread_cond_t autorec_rescan_cond;
+static int autorec_rescan_pending;
+
 /**
  *
  */
@@ -92,7 +118,9 @@ autorec_cmp(dvr_autorec_entry_t *dae, epg_broadcast_t *e)
     lang_str_ele_t *ls;
     if(!e->episode->title) return 0;
     RB_FOREACH(ls, e->episode->title, link)
-      if (!regexec(&dae->dae_title_preg, ls->str, 0, NULL, 0)) break;
+      if ((dae->dae_title_lit == NULL ||
+           strcasestr(ls->str, dae->dae_title_lit) != NULL) &&
+          !regexec(&dae->dae_title_preg, ls->str, 0, NULL, 0)) break;
     if (!ls) return 0;
   }
 
@@ -147,6 +175,129 @@ autorec_cmp(dvr_autorec_entry_t *dae, epg_broadcast_t *e)
 }
 
 
+/**
+ * Find the longest literal a title must contain to match the regex, so
+ * most titles can be rejected with a substring search. Only simple
+ * patterns (text, a leading ^, a trailing $ and .*) are understood.
+ */
+static char *
+autorec_title_literal(const char *re)
+{
+  const char *s, *seg = re, *best = NULL;
+  size_t len, bestlen = 0;
+
+  for(s = re; ; s++) {
+    if(*s == '\0' || (*s == '.' && s[1] == '*') ||
+       (*s == '^' && s == re) || (*s == '$' && s[1] == '\0') ||
+       (*s & 0x80)) {
+      /* Non-ASCII ends a segment too, case folding is up to the locale */
+      len = s - seg;
+      if(len > bestlen) {
+	best = seg;
+	bestlen = len;
+      }
+      if(*s == '\0')
+	break;
+      if(*s == '.')
+	s++;
+      seg = s + 1;
+    } else if(strchr("\\[](){}|?+*.^$", *s) != NULL) {
+      return NULL;
+    }
+  }
+  return best ? strndup(best, bestlen) : NULL;
+}
+
+
+/**
+ *
+ */
+static const void *
+autorec_key(dvr_autorec_entry_t *dae)
+{
+  dvr_config_t *cfg;
+
+  if(dae->dae_season)
+    return dae->dae_season;
+  if(dae->dae_brand)
+    return dae->dae_brand;
+  if(dae->dae_channel) {
+    cfg = dvr_config_find_by_name_default(dae->dae_config_name);
+    if(cfg->dvr_sl_quality_lock)
+      return dae->dae_channel;
+  }
+  if(dae->dae_channel_tag)
+    return dae->dae_channel_tag;
+  if(dae->dae_content_type.code)
+    return &autorec_genre_key[dae->dae_content_type.code >> 4];
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static inline unsigned int
+autorec_hash(const void *key)
+{
+  return ((uintptr_t)key * 2654435761U >> 8) & (AUTOREC_HASH_SIZE - 1);
+}
+
+
+/**
+ * Rebuilt from scratch whenever a rule changes, there are never many
+ */
+static void
+autorec_index_build(void)
+{
+  dvr_autorec_entry_t *dae;
+  int i;
+
+  for(i = 0; i < AUTOREC_HASH_SIZE; i++)
+    LIST_INIT(&autorec_index[i]);
+  LIST_INIT(&autorec_unkeyed);
+  autorec_nrules = 0;
+
+  TAILQ_FOREACH(dae, &autorec_entries, dae_link) {
+    if(dae->dae_enabled == 0 || dae->dae_weekdays == 0)
+      continue;
+    autorec_nrules++;
+    dae->dae_index_key = autorec_key(dae);
+    if(dae->dae_index_key != NULL)
+      LIST_INSERT_HEAD(&autorec_index[autorec_hash(dae->dae_index_key)],
+		       dae, dae_index_link);
+    else
+      LIST_INSERT_HEAD(&autorec_unkeyed, dae, dae_index_link);
+  }
+  autorec_index_dirty = 0;
+}
+
+
+/**
+ * Match an event against the rules filed under 'key', returns the
+ * number of rules tried
+ */
+static int
+autorec_check_key(struct autorec_index_list *l, const void *key,
+		  epg_broadcast_t *e)
+{
+  dvr_autorec_entry_t *dae;
+  int n = 0;
+
+  LIST_FOREACH(dae, l, dae_index_link) {
+    if(dae->dae_index_key != key)
+      continue;
+    n++;
+    if(autorec_cmp(dae, e) && dvr_entry_find_by_event_fuzzy(e) == NULL)
+      dvr_entry_create_by_autorec(e, dae);
+  }
+  return n;
+}
+
+#define autorec_check_hashed(key, e) \
+  autorec_check_key(&autorec_index[autorec_hash(key)], key, e)
+
+
 /**
  *
  */
@@ -191,6 +342,7 @@ static void
 autorec_entry_destroy(dvr_autorec_entry_t *dae)
 {
   dvr_autorec_purge_spawns(dae);
+  autorec_index_dirty = 1;
 
   free(dae->dae_id);
 
@@ -200,6 +352,7 @@ autorec_entry_destroy(dvr_autorec_entry_t *dae)
 
   if(dae->dae_title != NULL) {
     free(dae->dae_title);
+    free(dae->dae_title_lit);
     regfree(&dae->dae_title_preg);
   }
 
@@ -369,13 +522,16 @@ autorec_record_update(void *opaque, const char *id, htsmsg_t *values,
   if((s = htsmsg_get_str(values, "title")) != NULL) {
     if(dae->dae_title != NULL) {
       free(dae->dae_title);
+      free(dae->dae_title_lit);
       dae->dae_title = NULL;
+      dae->dae_title_lit = NULL;
       regfree(&dae->dae_title_preg);
     }
 
     if(!regcomp(&dae->dae_title_preg, s,
 		REG_ICASE | REG_EXTENDED | REG_NOSUB)) {
       dae->dae_title = strdup(s);
+      dae->dae_title_lit = autorec_title_literal(s);
     }
   }
 
@@ -460,13 +616,91 @@ static const dtable_class_t autorec_dtc = {
   .dtc_mutex = &global_lock,
 };
 
+/**
+ * Match changed rules against the whole EPG. That means walking every
+ * broadcast, so it is done here rather than in the request that changed
+ * the rule, and global_lock is dropped between channels to let the
+ * streaming and EPG threads in.
+ */
+static void *
+autorec_rescan_thread(void *aux)
+{
+  dvr_autorec_entry_t *dae;
+  epg_broadcast_t *e;
+  channel_t *ch;
+  int *ids, nids, i, rules, events, matches;
+  int64_t t0;
+
+  pthread_mutex_lock(&global_lock);
+
+  while(1) {
+    while(!autorec_rescan_pending)
+      pthread_cond_wait(&autorec_rescan_cond, &global_lock);
+    autorec_rescan_pending = 0;
+
+    /* Rules changed again while we are at it drop to 1 and are redone */
+    rules = 0;
+    TAILQ_FOREACH(dae, &autorec_entries, dae_link)
+      if(dae->dae_rescan) {
+	dae->dae_rescan = 2;
+	rules++;
+      }
+    if(rules == 0)
+      continue;
+
+    t0 = getmonoclock();
+
+    /* Channels may come and go while the lock is released */
+    nids = 0;
+    RB_FOREACH(ch, &channel_name_tree, ch_name_link)
+      nids++;
+    ids = malloc(sizeof(int) * (nids ?: 1));
+    i = 0;
+    RB_FOREACH(ch, &channel_name_tree, ch_name_link)
+      ids[i++] = ch->ch_id;
+
+    events = matches = 0;
+    for(i = 0; i < nids; i++) {
+      pthread_mutex_unlock(&global_lock);
+      pthread_mutex_lock(&global_lock);
+
+      if((ch = channel_find_by_identifier(ids[i])) == NULL)
+	continue;
+      RB_FOREACH(e, &ch->ch_epg_schedule, sched_link) {
+	events++;
+	TAILQ_FOREACH(dae, &autorec_entries, dae_link) {
+	  if(dae->dae_rescan == 2 && autorec_cmp(dae, e)) {
+	    matches++;
+	    dvr_entry_create_by_autorec(e, dae);
+	  }
+	}
+      }
+    }
+    free(ids);
+
+    TAILQ_FOREACH(dae, &autorec_entries, dae_link)
+      if(dae->dae_rescan == 2)
+	dae->dae_rescan = 0;
+
+    tvhlog(LOG_DEBUG, "autorec",
+	   "Rescanned %d events for %d rules, %d matches, in %"PRId64"ms",
+	   events, rules, matches, (getmonoclock() - t0) / 1000);
+  }
+  return NULL;
+}
+
+
 /**
  *
  */
 void
 dvr_autorec_init(void)
 {
+  pthread_t tid;
+
   TAILQ_INIT(&autorec_entries);
+  pthread_cond_init(&autorec_rescan_cond, NULL);
+  pthread_create(&tid, NULL, autorec_rescan_thread, NULL);
   autorec_dt = dtable_create(&autorec_dtc, "autorec", NULL);
   dtable_load(autorec_dt);
 }
@@ -500,6 +734,7 @@ _dvr_autorec_add(const char *config_name,
      !regcomp(&dae->dae_title_preg, title,
 	      REG_ICASE | REG_EXTENDED | REG_NOSUB)) {
     dae->dae_title = strdup(title);
+    dae->dae_title_lit = autorec_title_literal(title);
   }
 
   if(tag != NULL && (ct = channel_tag_find_by_name(tag, 0)) != NULL) {
@@ -593,19 +828,54 @@ void dvr_autorec_add_series_link
 void
 dvr_autorec_check_event(epg_broadcast_t *e)
 {
-  dvr_autorec_entry_t *dae;
-  dvr_entry_t *existingde;
+  channel_tag_mapping_t *ctm;
+  epg_genre_t *g;
+  int64_t t0;
+  int i, n, majors = 0;
 
-  TAILQ_FOREACH(dae, &autorec_entries, dae_link)
-    if(autorec_cmp(dae, e)) {
-      existingde = dvr_entry_find_by_event_fuzzy(e);
-      if (existingde == NULL)
-        dvr_entry_create_by_autorec(e, dae);
-    }
+  if(!e->channel || !e->episode)
+    return;
+
+  t0 = getmonoclock();
+  if(autorec_index_dirty)
+    autorec_index_build();
+
+  n = autorec_check_key(&autorec_unkeyed, NULL, e);
+  if(e->episode->season)
+    n += autorec_check_hashed(e->episode->season, e);
+  if(e->episode->brand)
+    n += autorec_check_hashed(e->episode->brand, e);
+  n += autorec_check_hashed(e->channel, e);
+  LIST_FOREACH(ctm, &e->channel->ch_ctms, ctm_channel_link)
+    n += autorec_check_hashed(ctm->ctm_tag, e);
+  LIST_FOREACH(g, &e->episode->genre, link)
+    majors |= 1 << (g->code >> 4);
+  for(i = 0; i < 16; i++)
+    if(majors & (1 << i))
+      n += autorec_check_hashed(&autorec_genre_key[i], e);
+
+  autorec_stats.events++;
+  autorec_stats.rules += n;
+  autorec_stats.time += getmonoclock() - t0;
   // Note: no longer updating event here as it will be done from EPG
   //       anyway
 }
 
+/**
+ * End of an EPG update batch
+ */
+void
+dvr_autorec_check_done(void)
+{
+  if(autorec_stats.events == 0)
+    return;
+  tvhlog(LOG_DEBUG, "autorec",
+	 "Checked %d events against %d of %d rules in %"PRId64"us",
+	 autorec_stats.events, autorec_stats.rules,
+	 autorec_stats.events * autorec_nrules, autorec_stats.time);
+  memset(&autorec_stats, 0, sizeof(autorec_stats));
+}
+
 void dvr_autorec_check_brand(epg_brand_t *b)
 {
 // Note: for the most part this will only be relevant should an episode
@@ -625,17 +895,23 @@ void dvr_autorec_check_season(epg_season_t *s)
 static void
 dvr_autorec_changed(dvr_autorec_entry_t *dae)
 {
-  channel_t *ch;
-  epg_broadcast_t *e;
-
   dvr_autorec_purge_spawns(dae);
+  autorec_index_dirty = 1;
 
-  RB_FOREACH(ch, &channel_name_tree, ch_name_link) {
-    RB_FOREACH(e, &ch->ch_epg_schedule, sched_link) {
-      if(autorec_cmp(dae, e))
-	      dvr_entry_create_by_autorec(e, dae);
-    }
-  }
+  dae->dae_rescan = 1;
+  autorec_rescan_pending = 1;
+  pthread_cond_signal(&autorec_rescan_cond);
+}
+
+
+/**
+ * A DVR config was saved or deleted, the index keys depend on the
+ * series link options of the configs the rules use
+ */
+void
+dvr_autorec_config_changed(void)
+{
+  autorec_index_dirty = 1;
 }
 
 
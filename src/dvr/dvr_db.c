@@ -50,6 +50,8 @@ dvr_entry_status(dvr_entry_t *de)
 {
   switch(de->de_sched_state) {
   case DVR_SCHEDULED:
+    if(de->de_plan_conflict)
+      return "Tuner conflict";
     return "Scheduled for recording";
     
   case DVR_RECORDING:
@@ -120,6 +122,7 @@ dvrdb_changed(void)
   htsmsg_t *m = htsmsg_create_map();
   htsmsg_add_u32(m, "reload", 1);
   notify_by_msg("dvrdb", m);
+  dvr_plan_schedule();
 }
 
 /**
@@ -131,6 +134,8 @@ dvrconfig_changed(void)
   htsmsg_t *m = htsmsg_create_map();
   htsmsg_add_u32(m, "reload", 1);
   notify_by_msg("dvrconfig", m);
+
+  dvr_autorec_config_changed();
 }
 
 
@@ -146,6 +151,7 @@ dvr_entry_notify(dvr_entry_t *de)
   htsmsg_add_u32(m, "id", de->de_id);
   htsmsg_add_str(m, "status", dvr_entry_status(de));
   htsmsg_add_str(m, "schedstate", dvr_entry_schedstatus(de));
+  htsmsg_add_u32(m, "conflict", de->de_plan_conflict);
   notify_by_msg("dvrdb", m);
 }
 
@@ -448,6 +454,7 @@ dvr_entry_remove(dvr_entry_t *de)
   LIST_REMOVE(de, de_channel_link);
   LIST_REMOVE(de, de_global_link);
   de->de_channel = NULL;
+  dvr_plan_release(de);
 
   dvrdb_changed();
 
@@ -694,6 +701,7 @@ static dvr_entry_t *_dvr_entry_update
     dvr_entry_save(de);
     htsp_dvr_entry_update(de);
     dvr_entry_notify(de);
+    dvr_plan_schedule();
     tvhlog(LOG_INFO, "dvr", "\"%s\" on \"%s\": Updated Timer",
            lang_str_get(de->de_title, NULL), de->de_channel->ch_name);
   }
@@ -761,6 +769,7 @@ dvr_stop_recording(dvr_entry_t *de, int stopcode)
   dvr_entry_save(de);
   htsp_dvr_entry_update(de);
   dvr_entry_notify(de);
+  dvr_plan_schedule();
 
   gtimer_arm_abs(&de->de_timer, dvr_timer_expire, de, 
 		 de->de_stop + cfg->dvr_retention_days * 86400);
@@ -1028,6 +1037,8 @@ dvr_init(void)
   dvr_db_load();
 
   dvr_autorec_init();
+
+  dvr_plan_schedule();
 }
 
 /**
@@ -0,0 +1,332 @@
+/*
+ *  tvheadend, look-ahead tuner planning for recordings
+ *  Copyright (C) 2012
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Every time the schedule changes we work out which service (and thus
+ * which adapter and mux) each recording in the next DVR_PLAN_DAYS days
+ * will use, padding included. Recordings are placed in order of start
+ * time, preferring an adapter that will already be tuned to the mux,
+ * then a free one. If no adapter is free, recordings of lower priority
+ * are pushed out of the way. Whatever does not fit is flagged as a
+ * conflict, long before the timer fires.
+ *
+ * The chosen service is handed to the subscription when the recording
+ * starts, so it is tried first instead of probing the candidates.
+ *
+ * Live viewing is not known in advance and is not planned for.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tvheadend.h"
+#include "dvr.h"
+#include "service.h"
+#include "subscriptions.h"
+#include "htsp.h"
+#include "dvb/dvb.h"
+
+#define DVR_PLAN_DAYS 7
+
+typedef struct dvr_plan {
+  dvr_entry_t *dp_de;
+  time_t dp_start;
+  time_t dp_stop;
+  service_t *dp_t;      // Assigned service, NULL if none
+  int dp_conflict;
+} dvr_plan_t;
+
+static gtimer_t dvr_plan_timer;
+
+
+/**
+ * Does the assignment of a (DVB) service to a recording collide with
+ * what has been planned so far. Returns the number of recordings
+ * that are in the way and the most important priority among them
+ * (-1 if one is already recording), and sets *share if the mux will
+ * already be tuned
+ */
+static int
+dvr_plan_blockers(dvr_plan_t *vec, int cnt, dvr_plan_t *dp, service_t *t,
+		  int *share, int *worst)
+{
+  th_dvb_mux_instance_t *tdmi = t->s_dvb_mux_instance;
+  th_dvb_adapter_t *tda = tdmi->tdmi_adapter;
+  service_t *o;
+  int i, n = 0;
+
+  *share = 0;
+  *worst = DVR_PRIO_UNIMPORTANT;
+
+  for(i = 0; i < cnt; i++) {
+    o = vec[i].dp_t;
+    if(&vec[i] == dp || o == NULL || o->s_type != SERVICE_TYPE_DVB ||
+       o->s_dvb_mux_instance == NULL ||
+       o->s_dvb_mux_instance->tdmi_adapter != tda)
+      continue;
+    if(vec[i].dp_stop <= dp->dp_start || vec[i].dp_start >= dp->dp_stop)
+      continue;
+
+    if(o->s_dvb_mux_instance == tdmi &&
+       (tda->tda_hostconnection != HOSTCONNECTION_USB12 || o == t)) {
+      *share = 1;
+      continue;
+    }
+    n++;
+    if(vec[i].dp_de->de_sched_state == DVR_RECORDING)
+      *worst = -1;
+    else if((int)vec[i].dp_de->de_pri < *worst)
+      *worst = vec[i].dp_de->de_pri;
+  }
+  return n;
+}
+
+
+/**
+ *
+ */
+static int
+dvr_plan_muxes(service_t *t)
+{
+  th_dvb_mux_instance_t *tdmi;
+  int n = 0;
+  LIST_FOREACH(tdmi, &t->s_dvb_mux_instance->tdmi_adapter->tda_muxes,
+	       tdmi_adapter_link)
+    n++;
+  return n;
+}
+
+
+/**
+ * Place a recording. If 'evict' is set, recordings of lower priority
+ * may be unassigned to make room, they are flagged as conflicting.
+ */
+static int
+dvr_plan_place(dvr_plan_t *vec, int cnt, dvr_plan_t *dp, int evict)
+{
+  channel_t *ch = dp->dp_de->de_channel;
+  service_t *t, *best = NULL;
+  int score, best_score = INT32_MAX, share, n, i, worst;
+
+  LIST_FOREACH(t, &ch->ch_services, s_ch_link) {
+    if(!t->s_enabled)
+      continue;
+
+    if(t->s_type != SERVICE_TYPE_DVB || t->s_dvb_mux_instance == NULL) {
+      score = 2000; // No tuner involved
+    } else {
+      if(!t->s_dvb_mux_instance->tdmi_enabled ||
+	 t->s_dvb_mux_instance->tdmi_adapter->tda_rootpath == NULL)
+	continue;
+      n = dvr_plan_blockers(vec, cnt, dp, t, &share, &worst);
+      if(n > 0) {
+	if(!evict || worst <= (int)dp->dp_de->de_pri)
+	  continue;
+	score = 3000 + n;
+      } else {
+	score = (share ? 0 : 1000) + dvr_plan_muxes(t);
+      }
+    }
+
+    if(score < best_score) {
+      best = t;
+      best_score = score;
+    }
+  }
+
+  if(best == NULL)
+    return -1;
+
+  if(best_score >= 3000) {
+    /* Push the others out */
+    for(i = 0; i < cnt; i++) {
+      t = vec[i].dp_t;
+      if(t == NULL || t->s_type != SERVICE_TYPE_DVB ||
+	 t->s_dvb_mux_instance == NULL ||
+	 t->s_dvb_mux_instance->tdmi_adapter !=
+	 best->s_dvb_mux_instance->tdmi_adapter ||
+	 t->s_dvb_mux_instance == best->s_dvb_mux_instance ||
+	 vec[i].dp_stop <= dp->dp_start || vec[i].dp_start >= dp->dp_stop)
+	continue;
+      vec[i].dp_t = NULL;
+      vec[i].dp_conflict = 1;
+    }
+  }
+
+  dp->dp_t = best;
+  dp->dp_conflict = 0;
+  return 0;
+}
+
+
+/**
+ *
+ */
+static int
+dvr_plan_cmp(const void *A, const void *B)
+{
+  const dvr_plan_t *a = A, *b = B;
+  if(a->dp_start != b->dp_start)
+    return a->dp_start < b->dp_start ? -1 : 1;
+  return a->dp_de->de_pri - b->dp_de->de_pri;
+}
+
+
+/**
+ * Store the outcome in the entries and tell everyone who cares
+ */
+static void
+dvr_plan_apply(dvr_plan_t *dp)
+{
+  dvr_entry_t *de = dp->dp_de;
+  int changed = de->de_plan_conflict != dp->dp_conflict;
+
+  if(de->de_plan_service != dp->dp_t) {
+    if(de->de_plan_service != NULL)
+      service_unref(de->de_plan_service);
+    if(dp->dp_t != NULL)
+      service_ref(dp->dp_t);
+    de->de_plan_service = dp->dp_t;
+  }
+
+  if(!changed)
+    return;
+
+  de->de_plan_conflict = dp->dp_conflict;
+  if(de->de_sched_state == DVR_SCHEDULED) {
+    if(dp->dp_conflict)
+      tvhlog(LOG_WARNING, "dvr", "\"%s\" on \"%s\": No tuner free, "
+	     "recording will fail unless the schedule is changed",
+	     lang_str_get(de->de_title, NULL), de->de_channel->ch_name);
+    else
+      tvhlog(LOG_INFO, "dvr", "\"%s\" on \"%s\": Tuner conflict resolved",
+	     lang_str_get(de->de_title, NULL), de->de_channel->ch_name);
+  }
+
+  htsp_dvr_entry_update(de);
+  dvr_entry_notify(de);
+}
+
+
+/**
+ *
+ */
+static void
+dvr_plan_run(void *aux)
+{
+  dvr_entry_t *de;
+  dvr_plan_t *vec, *dp, none;
+  th_subscription_t *s;
+  time_t now, horizon;
+  int cnt = 0, conflicts = 0, i, j;
+  int64_t mono = getmonoclock();
+
+  lock_assert(&global_lock);
+
+  time(&now);
+  horizon = now + DVR_PLAN_DAYS * 86400;
+
+  LIST_FOREACH(de, &dvrentries, de_global_link)
+    cnt++;
+  vec = calloc(cnt + 1, sizeof(dvr_plan_t));
+  cnt = 0;
+
+  LIST_FOREACH(de, &dvrentries, de_global_link) {
+    if(de->de_sched_state != DVR_SCHEDULED &&
+       de->de_sched_state != DVR_RECORDING) {
+      memset(&none, 0, sizeof(none));
+      none.dp_de = de;
+      dvr_plan_apply(&none);
+      continue;
+    }
+
+    dp = &vec[cnt];
+    dp->dp_de    = de;
+    dp->dp_start = de->de_start - 60 * de->de_start_extra - 30;
+    dp->dp_stop  = de->de_stop  + 60 * de->de_stop_extra;
+
+    /* Running recordings keep what they have */
+    if(de->de_sched_state == DVR_RECORDING) {
+      s = de->de_s;
+      dp->dp_t = s != NULL ? s->ths_service : NULL;
+      if(dp->dp_t == NULL) {
+	/* Still looking for a service, nothing to plan around */
+	dvr_plan_apply(dp);
+	continue;
+      }
+    } else if(dp->dp_start >= horizon) {
+      dvr_plan_apply(dp);
+      continue;
+    }
+    cnt++;
+  }
+
+  qsort(vec, cnt, sizeof(dvr_plan_t), dvr_plan_cmp);
+
+  for(i = 0; i < cnt; i++) {
+    dp = &vec[i];
+    if(dp->dp_t != NULL)
+      continue;
+
+    if(dvr_plan_place(vec, i, dp, 1) == 0) {
+      /* Give whatever got pushed out a chance elsewhere */
+      for(j = 0; j < i; j++)
+	if(vec[j].dp_conflict && vec[j].dp_t == NULL)
+	  dvr_plan_place(vec, i + 1, &vec[j], 0);
+    } else {
+      dp->dp_conflict = 1;
+    }
+  }
+
+  for(i = 0; i < cnt; i++) {
+    conflicts += vec[i].dp_conflict;
+    dvr_plan_apply(&vec[i]);
+  }
+
+  tvhlog(LOG_DEBUG, "dvr", "Planned %d recordings, %d conflicts, in %"PRId64"us",
+	 cnt, conflicts, getmonoclock() - mono);
+
+  free(vec);
+
+  /* The window moves on, and adapters and services come and go */
+  gtimer_arm(&dvr_plan_timer, dvr_plan_run, NULL, 3600);
+}
+
+
+/**
+ * Replan soon, many changes in a row (autorec) are handled at once
+ */
+void
+dvr_plan_schedule(void)
+{
+  gtimer_arm(&dvr_plan_timer, dvr_plan_run, NULL, 1);
+}
+
+
+/**
+ * An entry is going away
+ */
+void
+dvr_plan_release(dvr_entry_t *de)
+{
+  if(de->de_plan_service != NULL) {
+    service_unref(de->de_plan_service);
+    de->de_plan_service = NULL;
+  }
+  de->de_plan_conflict = 0;
+}
@@ -34,6 +34,7 @@
 #include "plumbing/globalheaders.h"
 
 #include "muxer.h"
+#include "stats.h"
 
 /**
  *
@@ -85,8 +86,9 @@ dvr_rec_subscribe(dvr_entry_t *de)
     flags = 0;
   }
 
-  de->de_s = subscription_create_from_channel(de->de_channel, weight,
-					      buf, st, flags);
+  de->de_s = subscription_create_from_channel_prefer(de->de_channel,
+						     de->de_plan_service,
+						     weight, buf, st, flags);
 
   pthread_create(&de->de_thread, NULL, dvr_thread, de);
 }
@@ -430,6 +432,8 @@ dvr_thread(void *aux)
 
     pthread_mutex_unlock(&sq->sq_mutex);
 
+    STATS_SINCE(sm->sm_time, STATS_QUEUE);
+
     switch(sm->sm_type) {
     case SMT_MPEGTS:
     case SMT_PACKET:
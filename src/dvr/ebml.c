@@ -25,43 +25,54 @@
 #include <stdio.h>
 #include "ebml.h"
 
-void
-ebml_append_id(htsbuf_queue_t *q, uint32_t id)
+size_t
+ebml_put_id(uint8_t *dst, uint32_t id)
 {
   uint8_t u8[4] = {id >> 24, id >> 16, id >> 8, id};
+  size_t len = u8[0] ? 4 : u8[1] ? 3 : u8[2] ? 2 : 1;
 
-  if(u8[0])
-    return htsbuf_append(q, u8, 4);
-  if(u8[1])
-    return htsbuf_append(q, u8+1, 3);
-  if(u8[2])
-    return htsbuf_append(q, u8+2, 2);
-  return htsbuf_append(q, u8+3, 1);
+  memcpy(dst, u8 + 4 - len, len);
+  return len;
 }
 
-void
-ebml_append_size(htsbuf_queue_t *q, uint32_t size)
+size_t
+ebml_put_size(uint8_t *dst, uint32_t size)
 {
   uint8_t u8[5] = { 0x08, size >> 24, size >> 16, size >> 8, size };
+  size_t len;
 
   if(size < 0x7f) {
     u8[4] |= 0x80;
-    return htsbuf_append(q, u8+4, 1);
-  }
-
-  if(size < 0x3fff) {
+    len = 1;
+  } else if(size < 0x3fff) {
     u8[3] |= 0x40;
-    return htsbuf_append(q, u8+3, 2);
-  }
-  if(size < 0x1fffff) {
+    len = 2;
+  } else if(size < 0x1fffff) {
     u8[2] |= 0x20;
-    return htsbuf_append(q, u8+2, 3);
-  }
-  if(size < 0x0fffffff) {
+    len = 3;
+  } else if(size < 0x0fffffff) {
     u8[1] |= 0x10;
-    return htsbuf_append(q, u8+1, 4);
+    len = 4;
+  } else {
+    len = 5;
   }
-  return htsbuf_append(q, u8, 5);
+
+  memcpy(dst, u8 + 5 - len, len);
+  return len;
+}
+
+void
+ebml_append_id(htsbuf_queue_t *q, uint32_t id)
+{
+  uint8_t u8[4];
+  return htsbuf_append(q, u8, ebml_put_id(u8, id));
+}
+
+void
+ebml_append_size(htsbuf_queue_t *q, uint32_t size)
+{
+  uint8_t u8[5];
+  return htsbuf_append(q, u8, ebml_put_size(u8, size));
 }
 
 
@@ -3,6 +3,10 @@
 
 #include "htsbuf.h"
 
+size_t ebml_put_id(uint8_t *dst, uint32_t id);
+
+size_t ebml_put_size(uint8_t *dst, uint32_t size);
+
 void ebml_append_id(htsbuf_queue_t *q, uint32_t id);
 
 void ebml_append_size(htsbuf_queue_t *q, uint32_t size);
@@ -20,6 +20,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
@@ -30,13 +31,19 @@
 #include "dvr.h"
 #include "mkmux.h"
 #include "ebml.h"
+#include "stats.h"
 
 extern int dvr_iov_max;
 
-TAILQ_HEAD(mk_cue_queue, mk_cue);
-
 #define MATROSKA_TIMESCALE 1000000 // in nS
 
+/*
+ * Room left in front of the cluster buffer for the cluster ID (4 bytes)
+ * and its EBML coded size (at most 5 bytes), filled in when the cluster
+ * is closed so that it can go out with a single write()
+ */
+#define MK_CLUSTER_HDRSPACE 9
+
 
 /**
  *
@@ -55,7 +62,6 @@ typedef struct mk_track {
  *
  */
 struct mk_cue {
-  TAILQ_ENTRY(mk_cue) link;
   int64_t ts;
   int tracknum;
   off_t cluster_pos;
@@ -70,6 +76,8 @@ struct mk_mux {
   int error;
   off_t fdpos; // Current position in file
   int seekable;
+  uint64_t bytes;  // Total number of bytes written
+  uint64_t writes; // Number of write calls
 
   mk_track *tracks;
   int ntracks;
@@ -77,7 +85,10 @@ struct mk_mux {
 
   int64_t totduration;
 
-  htsbuf_queue_t *cluster;
+  uint8_t *cluster;     // Cluster being built, header space included
+  size_t cluster_len;   // 0 when no cluster is open
+  size_t cluster_size;  // Allocated size of cluster
+  size_t cluster_last;  // Length of the previously written cluster
   int64_t cluster_tc;
   off_t cluster_pos;
   int cluster_maxsize;
@@ -93,7 +104,9 @@ struct mk_mux {
 
   int addcue;
 
-  struct mk_cue_queue cues;
+  struct mk_cue *cues;
+  int ncues;
+  int cues_size;
 
   char uuid[16];
   char *title;
@@ -333,11 +346,18 @@ mk_write_to_fd(mk_mux_t *mkm, htsbuf_queue_t *hq)
   do {
     ssize_t r;
     int iovcnt = i < dvr_iov_max ? i : dvr_iov_max;
-    if((r = writev(mkm->fd, iov, iovcnt)) == -1) {
+    STATS_SPAN(span);
+
+    STATS_ENTER(span);
+    r = writev(mkm->fd, iov, iovcnt);
+    STATS_LEAVE(span, STATS_WRITE);
+    if(r == -1) {
       mkm->error = errno;
       return -1;
     }
     mkm->fdpos += r;
+    mkm->bytes += r;
+    mkm->writes++;
     i -= iovcnt;
     iov += iovcnt;
   } while(i);
@@ -649,11 +669,72 @@ mk_build_segment(mk_mux_t *mkm,
 static void
 addcue(mk_mux_t *mkm, int64_t pts, int tracknum)
 {
-  struct mk_cue *mc = malloc(sizeof(struct mk_cue));
+  struct mk_cue *mc;
+
+  if(mkm->ncues == mkm->cues_size) {
+    mkm->cues_size = mkm->cues_size ? mkm->cues_size * 2 : 256;
+    mkm->cues = realloc(mkm->cues, sizeof(struct mk_cue) * mkm->cues_size);
+  }
+
+  mc = &mkm->cues[mkm->ncues++];
   mc->ts = pts;
   mc->tracknum = tracknum;
   mc->cluster_pos = mkm->cluster_pos;
-  TAILQ_INSERT_TAIL(&mkm->cues, mc, link);
+}
+
+
+/**
+ * Make sure there is room for len more bytes in the cluster buffer.
+ * The buffer is kept between clusters so once it has grown to the
+ * typical cluster size no further allocations are needed.
+ */
+static void
+mk_cluster_reserve(mk_mux_t *mkm, size_t len)
+{
+  size_t size = mkm->cluster_size ?: 65536;
+
+  if(mkm->cluster_len + len <= mkm->cluster_size)
+    return;
+
+  while(size < mkm->cluster_len + len)
+    size *= 2;
+
+  mkm->cluster = realloc(mkm->cluster, size);
+  mkm->cluster_size = size;
+}
+
+
+/**
+ *
+ */
+static void
+mk_cluster_append(mk_mux_t *mkm, const void *data, size_t len)
+{
+  mk_cluster_reserve(mkm, len);
+  memcpy(mkm->cluster + mkm->cluster_len, data, len);
+  mkm->cluster_len += len;
+}
+
+
+/**
+ *
+ */
+static void
+mk_cluster_append_uint(mk_mux_t *mkm, unsigned id, int64_t ui)
+{
+  uint8_t u8[8] = {ui >> 56, ui >> 48, ui >> 40, ui >> 32, 
+		   ui >> 24, ui >> 16, ui >>  8, ui };
+  uint8_t hdr[9];
+  size_t hlen;
+  int i = 0;
+
+  while( i < 7 && !u8[i] )
+    ++i;
+
+  hlen  = ebml_put_id(hdr, id);
+  hlen += ebml_put_size(hdr + hlen, 8 - i);
+  mk_cluster_append(mkm, hdr, hlen);
+  mk_cluster_append(mkm, u8 + i, 8 - i);
 }
 
 
@@ -661,11 +742,69 @@ addcue(mk_mux_t *mkm, int64_t pts, int tracknum)
  *
  */
 static void
+mk_open_cluster(mk_mux_t *mkm, int64_t pts)
+{
+  mkm->cluster_tc = pts;
+  mkm->cluster_pos = mkm->fdpos;
+  mkm->addcue = 1;
+
+  mkm->cluster_len = MK_CLUSTER_HDRSPACE;
+  mk_cluster_reserve(mkm, mkm->cluster_last);
+  mk_cluster_append_uint(mkm, 0xe7, mkm->cluster_tc);
+}
+
+
+/**
+ *
+ */
+static void
+mk_write_buf(mk_mux_t *mkm, const uint8_t *buf, size_t len)
+{
+  ssize_t r;
+  STATS_SPAN(span);
+
+  while(!mkm->error && len) {
+    STATS_ENTER(span);
+    r = write(mkm->fd, buf, len);
+    STATS_LEAVE(span, STATS_WRITE);
+    if(r == -1) {
+      if(errno == EINTR)
+	continue;
+      mkm->error = errno;
+      tvhlog(LOG_ERR, "mkv", "%s: Write failed -- %s", mkm->filename, 
+	     strerror(errno));
+      break;
+    }
+    mkm->fdpos += r;
+    mkm->bytes += r;
+    mkm->writes++;
+    buf += r;
+    len -= r;
+  }
+}
+
+
+/**
+ * Prepend the cluster header to the buffered cluster and write it out
+ */
+static void
 mk_close_cluster(mk_mux_t *mkm)
 {
-  if(mkm->cluster != NULL)
-    mk_write_master(mkm, 0x1f43b675, mkm->cluster);
-  mkm->cluster = NULL;
+  uint8_t hdr[MK_CLUSTER_HDRSPACE];
+  size_t hlen, blen;
+
+  if(!mkm->cluster_len)
+    return;
+
+  blen  = mkm->cluster_len - MK_CLUSTER_HDRSPACE;
+  hlen  = ebml_put_id(hdr, 0x1f43b675);
+  hlen += ebml_put_size(hdr + hlen, blen);
+  memcpy(mkm->cluster + MK_CLUSTER_HDRSPACE - hlen, hdr, hlen);
+
+  mk_write_buf(mkm, mkm->cluster + MK_CLUSTER_HDRSPACE - hlen, hlen + blen);
+
+  mkm->cluster_last = mkm->cluster_len;
+  mkm->cluster_len = 0;
 }
 
 
@@ -676,7 +815,8 @@ static void
 mk_write_frame_i(mk_mux_t *mkm, mk_track *t, th_pkt_t *pkt)
 {
   int64_t pts = pkt->pkt_pts, delta, nxt;
-  unsigned char c_delta_flags[3];
+  uint8_t hdr[16];
+  size_t hlen;
 
   int keyframe  = pkt->pkt_frametype < PKT_P_FRAME;
   int skippable = pkt->pkt_frametype == PKT_B_FRAME;
@@ -713,23 +853,17 @@ mk_write_frame_i(mk_mux_t *mkm, mk_track *t, th_pkt_t *pkt)
     return;
   }
 
-  if(vkeyframe && mkm->cluster && mkm->cluster->hq_size > mkm->cluster_maxsize)
+  if(vkeyframe && mkm->cluster_len > mkm->cluster_maxsize)
     mk_close_cluster(mkm);
 
-  else if(!mkm->has_video && mkm->cluster && mkm->cluster->hq_size > clusersizemax/40)
+  else if(!mkm->has_video && mkm->cluster_len > clusersizemax/40)
     mk_close_cluster(mkm);
 
-  else if(mkm->cluster && mkm->cluster->hq_size > clusersizemax)
+  else if(mkm->cluster_len > clusersizemax)
     mk_close_cluster(mkm);
 
-  if(mkm->cluster == NULL) {
-    mkm->cluster_tc = pts;
-    mkm->cluster = htsbuf_queue_alloc(0);
-
-    mkm->cluster_pos = mkm->fdpos;
-    mkm->addcue = 1;
-
-    ebml_append_uint(mkm->cluster, 0xe7, mkm->cluster_tc);
+  if(!mkm->cluster_len) {
+    mk_open_cluster(mkm, pts);
     delta = 0;
   }
 
@@ -748,15 +882,17 @@ mk_write_frame_i(mk_mux_t *mkm, mk_track *t, th_pkt_t *pkt)
   }
 
 
-  ebml_append_id(mkm->cluster, 0xa3 ); // SimpleBlock
-  ebml_append_size(mkm->cluster, len + 4);
-  ebml_append_size(mkm->cluster, t->tracknum);
+  hlen  = ebml_put_id(hdr, 0xa3); // SimpleBlock
+  hlen += ebml_put_size(hdr + hlen, len + 4);
+  hlen += ebml_put_size(hdr + hlen, t->tracknum);
+
+  hdr[hlen++] = delta >> 8;
+  hdr[hlen++] = delta;
+  hdr[hlen++] = (keyframe << 7) | skippable;
 
-  c_delta_flags[0] = delta >> 8;
-  c_delta_flags[1] = delta;
-  c_delta_flags[2] = (keyframe << 7) | skippable;
-  htsbuf_append(mkm->cluster, c_delta_flags, 3);
-  htsbuf_append(mkm->cluster, data, len);
+  mk_cluster_reserve(mkm, hlen + len);
+  mk_cluster_append(mkm, hdr, hlen);
+  mk_cluster_append(mkm, data, len);
 }
 
 
@@ -768,14 +904,15 @@ mk_write_cues(mk_mux_t *mkm)
 {
   struct mk_cue *mc;
   htsbuf_queue_t *q, *c, *p;
+  int i;
 
-  if(TAILQ_FIRST(&mkm->cues) == NULL)
+  if(!mkm->ncues)
     return;
 
   q = htsbuf_queue_alloc(0);
 
-  while((mc = TAILQ_FIRST(&mkm->cues)) != NULL) {
-    TAILQ_REMOVE(&mkm->cues, mc, link);
+  for(i = 0; i < mkm->ncues; i++) {
+    mc = &mkm->cues[i];
 
     c = htsbuf_queue_alloc(0);
     
@@ -787,8 +924,8 @@ mk_write_cues(mk_mux_t *mkm)
 
     ebml_append_master(c, 0xb7, p);
     ebml_append_master(q, 0xbb, c);
-    free(mc);
   }
+  mkm->ncues = 0;
 
   mkm->cue_pos = mkm->fdpos;
   mk_write_master(mkm, 0x1c53bb6b, q);
@@ -859,8 +996,6 @@ mk_mux_init(mk_mux_t *mkm, const char *title, const struct streaming_start *ss)
   else
     mkm->title = strdup(mkm->filename);
 
-  TAILQ_INIT(&mkm->cues);
-
   htsbuf_queue_init(&q, 0);
 
   ebml_append_master(&q, 0x1a45dfa3, mk_build_ebmlheader());
@@ -926,6 +1061,17 @@ mk_mux_write_meta(mk_mux_t *mkm, const dvr_entry_t *de,
 }
 
 
+/**
+ * Get output statistics
+ */
+void
+mk_mux_get_stats(mk_mux_t *mkm, uint64_t *bytes, uint64_t *writes)
+{
+  *bytes  = mkm->bytes;
+  *writes = mkm->writes;
+}
+
+
 /**
  * Close the muxer
  */
@@ -978,5 +1124,7 @@ mk_mux_destroy(mk_mux_t *mkm)
   free(mkm->filename);
   free(mkm->tracks);
   free(mkm->title);
+  free(mkm->cluster);
+  free(mkm->cues);
   free(mkm);
 }
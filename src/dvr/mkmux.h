@@ -40,6 +40,8 @@ int mk_mux_write_pkt (mk_mux_t *mkm, struct th_pkt *pkt);
 int mk_mux_write_meta(mk_mux_t *mkm, const struct dvr_entry *de,
 		      const struct epg_broadcast *eb);
 
+void mk_mux_get_stats(mk_mux_t *mkm, uint64_t *bytes, uint64_t *writes);
+
 int  mk_mux_close  (mk_mux_t *mkm);
 void mk_mux_destroy(mk_mux_t *mkm);
 
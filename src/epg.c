@@ -17,6 +17,7 @@
  */
 
 #include <stdio.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,10 +33,14 @@
 #include "dvr/dvr.h"
 #include "htsp.h"
 #include "epggrab.h"
+#include "htsbuf.h"
+#include "strpool.h"
 
-/* Broadcast hashing */
-#define EPG_HASH_WIDTH 1024
-#define EPG_HASH_MASK  (EPG_HASH_WIDTH - 1)
+/* Buckets moved per hash operation while growing */
+#define EPG_HASH_STEP  4
+
+#define EPG_HASH_ENTRY(l, type, field) \
+  ((type*)((char*)(l) - offsetof(type, field)))
 
 /* URI lists */
 epg_object_tree_t epg_brands;
@@ -43,13 +48,26 @@ epg_object_tree_t epg_seasons;
 epg_object_tree_t epg_episodes;
 
 /* Other special case lists */
-epg_object_list_t epg_objects[EPG_HASH_WIDTH];
+epg_hash_t        epg_objects;
 epg_object_list_t epg_object_unref;
 epg_object_list_t epg_object_updated;
 
 /* Global counter */
 static uint64_t _epg_object_idx    = 0;
 
+/* Batched updates */
+static int      _epg_batch_depth;
+static int      _epg_commit_pending;
+static gtimer_t _epg_commit_timer;
+static LIST_HEAD(, channel) _epg_channel_notify;
+static struct {
+  uint32_t commits;
+  uint32_t max_objects;
+  uint64_t objects;
+  int64_t  time;                      ///< us
+  int64_t  max_time;
+} _epg_commit_stats;
+
 /* **************************************************************************
  * Comparators / Ordering
  * *************************************************************************/
@@ -92,9 +110,21 @@ static int _episode_order ( const void *_a, const void *_b )
   return a->epnum.p_num - b->epnum.p_num;
 }
 
-void epg_updated ( void )
+/*
+ * Deliver everything that changed since the last commit
+ */
+static void _epg_commit ( void )
 {
   epg_object_t *eo;
+  channel_t *ch;
+  int64_t t0, t;
+  int n = 0, nb = 0, nc = 0;
+
+  if (_epg_commit_pending) {
+    gtimer_disarm(&_epg_commit_timer);
+    _epg_commit_pending = 0;
+  }
+  t0 = getmonoclock();
 
   /* Remove unref'd */
   while ((eo = LIST_FIRST(&epg_object_unref))) {
@@ -109,10 +139,252 @@ void epg_updated ( void )
 
   /* Update updated */
   while ((eo = LIST_FIRST(&epg_object_updated))) {
+    if (eo->type == EPG_BROADCAST) nb++;
     eo->updated(eo);
     LIST_REMOVE(eo, up_link);
     eo->_updated = 0;
+    n++;
+  }
+
+  dvr_autorec_check_done();
+
+  /* Now/next changes */
+  while ((ch = LIST_FIRST(&_epg_channel_notify))) {
+    LIST_REMOVE(ch, ch_epg_notify_link);
+    ch->ch_epg_notify = 0;
+    htsp_channel_update_current(ch);
+    nc++;
+  }
+
+  if (!n && !nc) return;
+  t = getmonoclock() - t0;
+  _epg_commit_stats.commits++;
+  _epg_commit_stats.objects += n;
+  _epg_commit_stats.time    += t;
+  if (n > _epg_commit_stats.max_objects) _epg_commit_stats.max_objects = n;
+  if (t > _epg_commit_stats.max_time)    _epg_commit_stats.max_time    = t;
+  tvhlog(LOG_DEBUG, "epg",
+         "commit %d objects (%d broadcasts), %d now/next changes in %"PRId64"us",
+         n, nb, nc, t);
+}
+
+void epg_updated ( void )
+{
+  if (!_epg_batch_depth) _epg_commit();
+}
+
+void epg_begin ( void )
+{
+  _epg_batch_depth++;
+}
+
+void epg_commit ( void )
+{
+  assert(_epg_batch_depth > 0);
+  if (!--_epg_batch_depth) _epg_commit();
+}
+
+static void _epg_commit_timer_callback ( void *p )
+{
+  _epg_commit_pending = 0;
+  epg_updated();
+}
+
+void epg_updated_later ( void )
+{
+  if (!_epg_commit_pending) {
+    _epg_commit_pending = 1;
+    gtimer_arm(&_epg_commit_timer, _epg_commit_timer_callback, NULL,
+               EPG_COMMIT_DELAY);
+  }
+}
+
+/*
+ * Send a now/next change to HTSP clients, held back if a commit is due
+ */
+static void _epg_channel_notify_current ( channel_t *ch )
+{
+  if (!_epg_batch_depth && !_epg_commit_pending) {
+    htsp_channel_update_current(ch);
+  } else if (!ch->ch_epg_notify) {
+    ch->ch_epg_notify = 1;
+    LIST_INSERT_HEAD(&_epg_channel_notify, ch, ch_epg_notify_link);
+  }
+}
+
+/* **************************************************************************
+ * Memory
+ * *************************************************************************/
+
+/*
+ * Objects are carved out of large blocks, one pool per type, and recycled
+ * through a free list. A big guide has millions of them, malloc() would
+ * add a header to each and fragment the heap as old broadcasts expire and
+ * new ones arrive. Blocks are never given back.
+ */
+#define EPG_POOL_BLOCK (64 * 1024)
+#define EPG_POOL_SIZE(t) ((sizeof(t) + 7) & ~7)
+
+typedef struct epg_pool
+{
+  const char *name;
+  size_t      size;
+  void       *free;
+  int         blocks;
+  int         inuse;
+} epg_pool_t;
+
+static epg_pool_t _epg_pools[] = {
+  [EPG_BRAND]     = { "Brands",     EPG_POOL_SIZE(epg_brand_t) },
+  [EPG_SEASON]    = { "Seasons",    EPG_POOL_SIZE(epg_season_t) },
+  [EPG_EPISODE]   = { "Episodes",   EPG_POOL_SIZE(epg_episode_t) },
+  [EPG_BROADCAST] = { "Broadcasts", EPG_POOL_SIZE(epg_broadcast_t) },
+};
+
+static void *_epg_alloc ( epg_object_type_t type )
+{
+  epg_pool_t *p = &_epg_pools[type];
+  char *b;
+  void *o;
+  int i, n;
+
+  lock_assert(&global_lock);
+
+  if (!p->free) {
+    n = EPG_POOL_BLOCK / p->size;
+    b = malloc(n * p->size);
+    for (i = n - 1; i >= 0; i--) {
+      *(void**)(b + i * p->size) = p->free;
+      p->free = b + i * p->size;
+    }
+    p->blocks++;
+  }
+  o       = p->free;
+  p->free = *(void**)o;
+  p->inuse++;
+  return memset(o, 0, p->size);
+}
+
+static void _epg_free ( epg_object_type_t type, void *o )
+{
+  epg_pool_t *p = &_epg_pools[type];
+  *(void**)o = p->free;
+  p->free    = o;
+  p->inuse--;
+}
+
+void epg_memory_dump ( htsbuf_queue_t *hq )
+{
+  int i;
+  epg_pool_t *p;
+
+  for (i = EPG_BRAND; i <= EPG_BROADCAST; i++) {
+    p = &_epg_pools[i];
+    htsbuf_qprintf(hq, "%-12s %8d objects, %10zu bytes used, "
+                   "%10zu bytes allocated\n",
+                   p->name, p->inuse, p->inuse * p->size,
+                   (size_t)p->blocks * (EPG_POOL_BLOCK / p->size) * p->size);
+  }
+  htsbuf_qprintf(hq, "\n");
+  strpool_dump(hq);
+}
+
+void epg_commit_dump ( htsbuf_queue_t *hq )
+{
+  htsbuf_qprintf(hq, "EPG commits: %u, %"PRIu64" objects (largest %u), "
+                 "%"PRId64" ms total (longest %"PRId64" us)\n",
+                 _epg_commit_stats.commits, _epg_commit_stats.objects,
+                 _epg_commit_stats.max_objects,
+                 _epg_commit_stats.time / 1000, _epg_commit_stats.max_time);
+}
+
+/* **************************************************************************
+ * Hashing
+ * *************************************************************************/
+
+static inline uint32_t _epg_hash_fn ( uint64_t key )
+{
+  return (key * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+static void _epg_hash_step ( epg_hash_t *h )
+{
+  int n = EPG_HASH_STEP;
+  uint32_t b;
+  epg_hash_link_t *l;
+
+  while (h->tab[1] && n--) {
+    while ((l = h->tab[0][h->rehash])) {
+      h->tab[0][h->rehash] = l->next;
+      b = _epg_hash_fn(l->key) & (h->size[1] - 1);
+      l->next = h->tab[1][b];
+      h->tab[1][b] = l;
+    }
+    if (++h->rehash == h->size[0]) {
+      free(h->tab[0]);
+      h->tab[0]  = h->tab[1];
+      h->size[0] = h->size[1];
+      h->tab[1]  = NULL;
+      h->size[1] = 0;
+      h->rehash  = 0;
+    }
+  }
+}
+
+static void _epg_hash_add ( epg_hash_t *h, epg_hash_link_t *l, uint64_t key )
+{
+  int t;
+  uint32_t b;
+
+  _epg_hash_step(h);
+  if (!h->tab[0]) {
+    h->size[0] = 16;
+    h->tab[0]  = calloc(h->size[0], sizeof(epg_hash_link_t*));
+  } else if (!h->tab[1] && h->count >= h->size[0]) {
+    h->size[1] = h->size[0] * 2;
+    h->tab[1]  = calloc(h->size[1], sizeof(epg_hash_link_t*));
+    h->rehash  = 0;
+  }
+  t = h->tab[1] ? 1 : 0;
+  b = _epg_hash_fn(key) & (h->size[t] - 1);
+  l->key  = key;
+  l->next = h->tab[t][b];
+  h->tab[t][b] = l;
+  h->count++;
+}
+
+static void _epg_hash_rem ( epg_hash_t *h, epg_hash_link_t *l )
+{
+  int t;
+  epg_hash_link_t **p;
+
+  for (t = 0; t < 2 && h->tab[t]; t++) {
+    p = &h->tab[t][_epg_hash_fn(l->key) & (h->size[t] - 1)];
+    for (; *p; p = &(*p)->next) {
+      if (*p == l) {
+        *p = l->next;
+        h->count--;
+        return;
+      }
+    }
   }
+  assert(0);
+}
+
+/* Chain that key is on in table t (0 or 1), iterate both */
+static epg_hash_link_t *_epg_hash_chain
+  ( epg_hash_t *h, int t, uint64_t key )
+{
+  if (t == 0) _epg_hash_step(h);
+  if (!h->tab[t]) return NULL;
+  return h->tab[t][_epg_hash_fn(key) & (h->size[t] - 1)];
+}
+
+static void _epg_hash_free ( epg_hash_t *h )
+{
+  free(h->tab[0]);
+  free(h->tab[1]);
+  memset(h, 0, sizeof(epg_hash_t));
 }
 
 /* **************************************************************************
@@ -130,7 +402,7 @@ static void _epg_object_destroy
   if (eo->uri) free(eo->uri);
   if (tree) RB_REMOVE(tree, eo, uri_link);
   if (eo->_updated) LIST_REMOVE(eo, up_link);
-  LIST_REMOVE(eo, id_link);
+  _epg_hash_rem(&epg_objects, &eo->id_link);
 }
 
 static void _epg_object_getref ( void *o )
@@ -178,7 +450,7 @@ static void _epg_object_create ( void *o )
   if (!eo->putref) eo->putref = _epg_object_putref;
   _epg_object_set_updated(eo);
   LIST_INSERT_HEAD(&epg_object_unref, eo, un_link);
-  LIST_INSERT_HEAD(&epg_objects[eo->id & EPG_HASH_MASK], eo, id_link);
+  _epg_hash_add(&epg_objects, &eo->id_link, eo->id);
 #ifdef EPG_TRACE
   tvhlog(LOG_DEBUG, "epg", "eo [%p, %d, %lu, %s] created",
          eo, eo->id, eo->type, eo->uri, eo->refcount-1);
@@ -216,9 +488,15 @@ static epg_object_t *_epg_object_find_by_uri
 
 static epg_object_t *_epg_object_find_by_id ( uint64_t id, epg_object_type_t type )
 {
+  int t;
   epg_object_t *eo;
-  LIST_FOREACH(eo, &epg_objects[id & EPG_HASH_MASK], id_link) {
-    if (eo->id == id) return eo->type == type ? eo : NULL;
+  epg_hash_link_t *l;
+  for (t = 0; t < 2; t++) {
+    for (l = _epg_hash_chain(&epg_objects, t, id); l; l = l->next) {
+      if (l->key != id) continue;
+      eo = EPG_HASH_ENTRY(l, epg_object_t, id_link);
+      return eo->type == type ? eo : NULL;
+    }
   }
   return NULL;
 }
@@ -284,6 +562,23 @@ static int _epg_object_set_str
   return save;
 }
 
+/* As above, for strings that are often the same (images) */
+static int _epg_object_set_shared_str
+  ( void *o, const char **old, const char *new, epggrab_module_t *src )
+{
+  int save = 0;
+  epg_object_t *eo = o;
+  if ( !eo || !new ) return 0;
+  if ( !_epg_object_set_grabber(eo, src) && *old ) return 0;
+  if ( !*old || strcmp(*old, new) ) {
+    strpool_put(*old);
+    *old = strpool_get(new);
+    _epg_object_set_updated(eo);
+    save = 1;
+  }
+  return save;
+}
+
 static int _epg_object_set_lang_str
   ( void *o, lang_str_t **old, const char *newstr, const char *newlang,
     epggrab_module_t *src )
@@ -343,8 +638,8 @@ static void _epg_brand_destroy ( void *eo )
   _epg_object_destroy(eo, &epg_brands);
   if (eb->title)   lang_str_destroy(eb->title);
   if (eb->summary) lang_str_destroy(eb->summary);
-  if (eb->image)   free(eb->image);
-  free(eb);
+  strpool_put(eb->image);
+  _epg_free(EPG_BRAND, eb);
 }
 
 static void _epg_brand_updated ( void *o )
@@ -356,7 +651,7 @@ static epg_object_t **_epg_brand_skel ( void )
 {
   static epg_object_t *skel = NULL;
   if ( !skel ) {
-    skel = calloc(1, sizeof(epg_brand_t));
+    skel = _epg_alloc(EPG_BRAND);
     skel->type    = EPG_BRAND;
     skel->destroy = _epg_brand_destroy;
     skel->updated = _epg_brand_updated;
@@ -398,7 +693,7 @@ int epg_brand_set_image
   ( epg_brand_t *brand, const char *image, epggrab_module_t *src )
 {
   if (!brand || !image) return 0;
-  return _epg_object_set_str(brand, &brand->image, image, src);
+  return _epg_object_set_shared_str(brand, &brand->image, image, src);
 }
 
 int epg_brand_set_season_count
@@ -520,8 +815,8 @@ static void _epg_season_destroy ( void *eo )
   _epg_object_destroy(eo, &epg_seasons);
   if (es->brand)   _epg_brand_rem_season(es->brand, es);
   if (es->summary) lang_str_destroy(es->summary);
-  if (es->image)   free(es->image);
-  free(es);
+  strpool_put(es->image);
+  _epg_free(EPG_SEASON, es);
 }
 
 static void _epg_season_updated ( void *eo )
@@ -533,7 +828,7 @@ static epg_object_t **_epg_season_skel ( void )
 {
   static epg_object_t *skel = NULL;
   if ( !skel ) {
-    skel = calloc(1, sizeof(epg_season_t));
+    skel = _epg_alloc(EPG_SEASON);
     skel->type    = EPG_SEASON;
     skel->destroy = _epg_season_destroy;
     skel->updated = _epg_season_updated;
@@ -567,7 +862,7 @@ int epg_season_set_image
   ( epg_season_t *season, const char *image, epggrab_module_t *src )
 {
   if (!season || !image) return 0;
-  return _epg_object_set_str(season, &season->image, image, src);
+  return _epg_object_set_shared_str(season, &season->image, image, src);
 }
 
 int epg_season_set_episode_count
@@ -742,9 +1037,9 @@ static void _epg_episode_destroy ( void *eo )
     LIST_REMOVE(g, link);
     free(g);
   }
-  if (ee->image)       free(ee->image);
+  strpool_put(ee->image);
   if (ee->epnum.text)  free(ee->epnum.text);
-  free(ee);
+  _epg_free(EPG_EPISODE, ee);
 }
 
 static void _epg_episode_updated ( void *eo )
@@ -755,7 +1050,7 @@ static epg_object_t **_epg_episode_skel ( void )
 {
   static epg_object_t *skel = NULL;
   if ( !skel ) {
-    skel = calloc(1, sizeof(epg_episode_t));
+    skel = _epg_alloc(EPG_EPISODE);
     skel->type    = EPG_EPISODE;
     skel->destroy = _epg_episode_destroy;
     skel->updated = _epg_episode_updated;
@@ -816,7 +1111,7 @@ int epg_episode_set_image
   ( epg_episode_t *episode, const char *image, epggrab_module_t *src )
 {
   if (!episode || !image) return 0;
-  return _epg_object_set_str(episode, &episode->image, image, src);
+  return _epg_object_set_shared_str(episode, &episode->image, image, src);
 }
 
 int epg_episode_set_number
@@ -914,6 +1209,7 @@ int epg_episode_set_genre
     g2 = LIST_NEXT(g1, link);
     if (!epg_genre_list_contains(genre, g1, 0)) {
       LIST_REMOVE(g1, link);
+      free(g1);
       save = 1;
     }
     g1 = g2;
@@ -1145,11 +1441,69 @@ const char *epg_episode_get_description
  * Channel
  * *************************************************************************/
 
+/* Index of the first record that starts at or after t */
+static int _epg_index_start ( channel_t *ch, time_t t )
+{
+  int lo = 0, hi = ch->ch_epg_index_len, mid;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (ch->ch_epg_index[mid].start < t) lo = mid + 1;
+    else                                 hi = mid;
+  }
+  return lo;
+}
+
+/* Index of the first record that stops after t */
+static int _epg_index_stop ( channel_t *ch, time_t t )
+{
+  int lo = 0, hi = ch->ch_epg_index_len, mid;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (ch->ch_epg_index[mid].stop <= t) lo = mid + 1;
+    else                                 hi = mid;
+  }
+  return lo;
+}
+
+static void _epg_index_add ( channel_t *ch, epg_broadcast_t *ebc )
+{
+  int i = _epg_index_start(ch, ebc->start);
+  if (ch->ch_epg_index_len == ch->ch_epg_index_size) {
+    ch->ch_epg_index_size = MAX(64, ch->ch_epg_index_size * 2);
+    ch->ch_epg_index = realloc(ch->ch_epg_index,
+                               ch->ch_epg_index_size * sizeof(epg_sched_rec_t));
+  }
+  memmove(ch->ch_epg_index + i + 1, ch->ch_epg_index + i,
+          (ch->ch_epg_index_len - i) * sizeof(epg_sched_rec_t));
+  ch->ch_epg_index[i].start = ebc->start;
+  ch->ch_epg_index[i].stop  = ebc->stop;
+  ch->ch_epg_index[i].ebc   = ebc;
+  ch->ch_epg_index_len++;
+}
+
+static void _epg_index_rem ( channel_t *ch, epg_broadcast_t *ebc )
+{
+  int i = _epg_index_start(ch, ebc->start);
+  assert(i < ch->ch_epg_index_len && ch->ch_epg_index[i].ebc == ebc);
+  ch->ch_epg_index_len--;
+  memmove(ch->ch_epg_index + i, ch->ch_epg_index + i + 1,
+          (ch->ch_epg_index_len - i) * sizeof(epg_sched_rec_t));
+}
+
+static void _epg_index_set_stop ( channel_t *ch, epg_broadcast_t *ebc )
+{
+  int i = _epg_index_start(ch, ebc->start);
+  assert(i < ch->ch_epg_index_len && ch->ch_epg_index[i].ebc == ebc);
+  ch->ch_epg_index[i].stop = ebc->stop;
+}
+
 static void _epg_channel_rem_broadcast 
   ( channel_t *ch, epg_broadcast_t *ebc, epg_broadcast_t *new )
 {
   if (new) dvr_event_replaced(ebc, new);
   RB_REMOVE(&ch->ch_epg_schedule, ebc, sched_link);
+  _epg_index_rem(ch, ebc);
+  if (ebc->dvb_eid) _epg_hash_rem(&ch->ch_epg_eids, &ebc->eid_link);
   _epg_object_putref(ebc);
 }
 
@@ -1206,7 +1560,7 @@ static void _epg_channel_timer_callback ( void *p )
   if ( cur != ch->ch_epg_now ) {
     tvhlog(LOG_DEBUG, "epg", "inform HTSP of now event change on %s",
            ch->ch_name);
-    htsp_channel_update_current(ch);
+    _epg_channel_notify_current(ch);
   }
 }
 
@@ -1232,13 +1586,21 @@ static epg_broadcast_t *_epg_channel_add_broadcast
       *save  = 1;
       ret    = *bcast;
       *bcast = NULL;
+      _epg_index_add(ch, ret);
+      if (ret->dvb_eid)
+        _epg_hash_add(&ch->ch_epg_eids, &ret->eid_link, ret->dvb_eid);
       _epg_object_create(ret);
       // Note: sets updated
       _epg_object_getref(ret);
 
     /* Existing */
     } else {
-      *save |= _epg_object_set_u16(ret, &ret->dvb_eid, (*bcast)->dvb_eid, NULL);
+      if (ret->dvb_eid != (*bcast)->dvb_eid) {
+        if (ret->dvb_eid) _epg_hash_rem(&ch->ch_epg_eids, &ret->eid_link);
+        *save |= _epg_object_set_u16(ret, &ret->dvb_eid, (*bcast)->dvb_eid, NULL);
+        if (ret->dvb_eid)
+          _epg_hash_add(&ch->ch_epg_eids, &ret->eid_link, ret->dvb_eid);
+      }
 
       /* No time change */
       if ( ret->stop == (*bcast)->stop ) {
@@ -1247,6 +1609,7 @@ static epg_broadcast_t *_epg_channel_add_broadcast
       /* Extend in time */
       } else {
         ret->stop = (*bcast)->stop;
+        _epg_index_set_stop(ch, ret);
         _epg_object_set_updated(ret);
       }
     }
@@ -1284,12 +1647,36 @@ static epg_broadcast_t *_epg_channel_add_broadcast
 void epg_channel_unlink ( channel_t *ch )
 {
   epg_broadcast_t *ebc;
-  while ( (ebc = RB_FIRST(&ch->ch_epg_schedule)) ) {
+  // Note: from the end, so the index never has to be shifted
+  while ( (ebc = RB_LAST(&ch->ch_epg_schedule)) ) {
     _epg_channel_rem_broadcast(ch, ebc, NULL);
   }
+  free(ch->ch_epg_index);
+  _epg_hash_free(&ch->ch_epg_eids);
+  if (ch->ch_epg_notify) {
+    LIST_REMOVE(ch, ch_epg_notify_link);
+    ch->ch_epg_notify = 0;
+  }
+  ch->ch_epg_index      = NULL;
+  ch->ch_epg_index_len  = ch->ch_epg_index_size = 0;
   gtimer_disarm(&ch->ch_epg_timer);
 }
 
+epg_broadcast_t *epg_channel_find_at ( channel_t *ch, time_t when )
+{
+  int i = _epg_index_stop(ch, when);
+  return i < ch->ch_epg_index_len ? ch->ch_epg_index[i].ebc : NULL;
+}
+
+int epg_channel_get_window
+  ( channel_t *ch, time_t start, time_t stop, epg_sched_rec_t **ret )
+{
+  int i = _epg_index_stop(ch, start);
+  int j = stop ? _epg_index_start(ch, stop) : ch->ch_epg_index_len;
+  *ret = ch->ch_epg_index + i;
+  return MAX(j - i, 0);
+}
+
 /* **************************************************************************
  * Broadcast
  * *************************************************************************/
@@ -1299,7 +1686,7 @@ static void _epg_broadcast_destroy ( void *eo )
   epg_broadcast_t *ebc = eo;
   _epg_object_destroy(eo, NULL);
   if (ebc->episode) _epg_episode_rem_broadcast(ebc->episode, ebc);
-  free(ebc);
+  _epg_free(EPG_BROADCAST, ebc);
 }
 
 static void _epg_broadcast_updated ( void *eo )
@@ -1312,7 +1699,7 @@ static epg_broadcast_t **_epg_broadcast_skel ( void )
 {
   static epg_broadcast_t *skel = NULL;
   if ( !skel ) {
-    skel = calloc(1, sizeof(epg_broadcast_t));
+    skel = _epg_alloc(EPG_BROADCAST);
     skel->type    = EPG_BROADCAST;
     skel->destroy = _epg_broadcast_destroy;
     skel->updated = _epg_broadcast_updated;
@@ -1346,11 +1733,26 @@ epg_broadcast_t *epg_broadcast_find_by_id ( uint64_t id, channel_t *ch )
 
 epg_broadcast_t *epg_broadcast_find_by_eid ( channel_t *ch, uint16_t eid )
 {
-  epg_broadcast_t *e;
-  RB_FOREACH(e, &ch->ch_epg_schedule, sched_link) {
-    if (e->dvb_eid == eid) return e;
+  int t;
+  epg_broadcast_t *e, *ret = NULL;
+  epg_hash_link_t *l;
+
+  /* Not indexed */
+  if (!eid) {
+    RB_FOREACH(e, &ch->ch_epg_schedule, sched_link)
+      if (!e->dvb_eid) return e;
+    return NULL;
   }
-  return NULL;
+
+  /* Earliest, if an id is reused */
+  for (t = 0; t < 2; t++) {
+    for (l = _epg_hash_chain(&ch->ch_epg_eids, t, eid); l; l = l->next) {
+      if (l->key != eid) continue;
+      e = EPG_HASH_ENTRY(l, epg_broadcast_t, eid_link);
+      if (!ret || e->start < ret->start) ret = e;
+    }
+  }
+  return ret;
 }
 
 int epg_broadcast_set_episode 
@@ -1887,9 +2289,11 @@ static void _eqr_add_channel
   ( epg_query_result_t *eqr, channel_t *ch, epg_genre_t *genre,
     regex_t *preg, time_t start, const char *lang, int repeats )
 {
-  epg_broadcast_t *ebc;
-  RB_FOREACH(ebc, &ch->ch_epg_schedule, sched_link) {
-    if ( ebc->episode ) _eqr_add(eqr, ebc, genre, preg, start, lang, repeats);
+  epg_sched_rec_t *r;
+  int i, n = epg_channel_get_window(ch, start, 0, &r);
+  for (i = 0; i < n; i++) {
+    if ( r[i].ebc->episode )
+      _eqr_add(eqr, r[i].ebc, genre, preg, start, lang, repeats);
   }
 }
 
@@ -57,6 +57,28 @@ typedef struct epg_broadcast_tree  epg_broadcast_tree_t;
 typedef struct epg_object_list     epg_object_list_t;
 typedef struct epg_object_tree     epg_object_tree_t;
 typedef struct epg_genre_list      epg_genre_list_t;
+typedef struct epg_sched_rec       epg_sched_rec_t;
+typedef struct epg_hash_link       epg_hash_link_t;
+typedef struct epg_hash            epg_hash_t;
+
+/*
+ * Hash table (object ids, DVB event ids) that doubles in size when full.
+ * Buckets are moved to the new table a few at a time on later inserts
+ * and lookups, so no single call pays for rehashing all of it.
+ */
+struct epg_hash_link
+{
+  epg_hash_link_t           *next;
+  uint64_t                   key;
+};
+
+struct epg_hash
+{
+  epg_hash_link_t          **tab[2];  ///< Current, and new while growing
+  uint32_t                   size[2];
+  uint32_t                   count;
+  uint32_t                   rehash;  ///< Next bucket of tab[0] to move
+};
 
 /* ************************************************************************
  * Genres
@@ -107,7 +129,7 @@ typedef enum epg_object_type
 struct epg_object
 {
   RB_ENTRY(epg_object)    uri_link;    ///< Global URI link
-  LIST_ENTRY(epg_object)  id_link;     ///< Global (ID) link
+  epg_hash_link_t         id_link;     ///< Global (ID) link
   LIST_ENTRY(epg_object)  un_link;     ///< Global unref'd link
   LIST_ENTRY(epg_object)  up_link;     ///< Global updated link
  
@@ -140,7 +162,7 @@ struct epg_brand
   lang_str_t                *title;        ///< Brand name
   lang_str_t                *summary;      ///< Brand summary
   uint16_t                   season_count; ///< Total number of seasons
-  char                      *image;        ///< Brand image
+  const char                *image;        ///< Brand image
 
   epg_season_list_t          seasons;      ///< Season list
   epg_episode_list_t         episodes;     ///< Episode list
@@ -192,7 +214,7 @@ struct epg_season
   lang_str_t                *summary;       ///< Season summary
   uint16_t                   number;        ///< The season number
   uint16_t                   episode_count; ///< Total number of episodes
-  char                      *image;         ///< Season image
+  const char                *image;         ///< Season image
 
   LIST_ENTRY(epg_season)     blink;         ///< Brand list link
   epg_brand_t               *brand;         ///< Parent brand
@@ -258,7 +280,7 @@ struct epg_episode
   lang_str_t                *subtitle;      ///< Sub-title
   lang_str_t                *summary;       ///< Summary
   lang_str_t                *description;   ///< An extended description
-  char                      *image;         ///< Episode image
+  const char                *image;         ///< Episode image
   epg_genre_list_t           genre;         ///< Episode genre(s)
   epg_episode_num_t          epnum;         ///< Episode numbering
   // Note: do not use epnum directly! use the accessor routine
@@ -391,6 +413,7 @@ struct epg_broadcast
   uint8_t                    is_repeat;        ///< Repeat screening
 
   RB_ENTRY(epg_broadcast)    sched_link;       ///< Schedule link
+  epg_hash_link_t            eid_link;         ///< Channel DVB event id link
   LIST_ENTRY(epg_broadcast)  ep_link;          ///< Episode link
   epg_episode_t             *episode;          ///< Episode shown
   struct channel            *channel;          ///< Channel being broadcast on
@@ -448,9 +471,29 @@ epg_broadcast_t *epg_broadcast_deserialize
  * Channel - provides mapping from EPG channels to real channels
  * ***********************************************************************/
 
+/*
+ * Compact copy of a channel schedule, an array sorted by start time kept
+ * in step with ch_epg_schedule. Broadcasts never overlap so it is sorted
+ * by stop time too, and time lookups are a binary search that does not
+ * touch the broadcasts themselves.
+ */
+struct epg_sched_rec
+{
+  time_t                     start;
+  time_t                     stop;
+  epg_broadcast_t           *ebc;
+};
+
 /* Unlink */
 void epg_channel_unlink ( struct channel *ch );
 
+/* First broadcast still running at (or starting after) the given time */
+epg_broadcast_t *epg_channel_find_at ( struct channel *ch, time_t when );
+
+/* Broadcasts that overlap [start, stop), returns count, *ret is internal */
+int epg_channel_get_window
+  ( struct channel *ch, time_t start, time_t stop, epg_sched_rec_t **ret );
+
 /* ************************************************************************
  * Querying
  * ***********************************************************************/
@@ -486,6 +529,24 @@ void epg_init    (void);
 void epg_save    (void);
 void epg_updated (void);
 
+/*
+ * Batched updates
+ *
+ * Between epg_begin() and epg_commit() changes are only collected, the
+ * DVR/autorec checks and HTSP now/next notifications are done once per
+ * changed object when the outermost batch is committed.
+ * epg_updated_later() commits within EPG_COMMIT_DELAY seconds instead,
+ * for grabbers that deliver a steady trickle of small changes.
+ */
+#define EPG_COMMIT_DELAY 2
+void epg_begin         ( void );
+void epg_commit        ( void );
+void epg_updated_later ( void );
+
+struct htsbuf_queue;
+void epg_memory_dump ( struct htsbuf_queue *hq );
+void epg_commit_dump ( struct htsbuf_queue *hq );
+
 /* ************************************************************************
  * Miscellaneous
  * ***********************************************************************/
@@ -27,6 +27,7 @@
 
 struct th_dvb_mux_instance;
 struct th_dvb_adapter;
+struct htsbuf_queue;
 
 typedef struct epggrab_module       epggrab_module_t;
 typedef struct epggrab_module_int   epggrab_module_int_t;
@@ -257,6 +258,8 @@ void epggrab_mux_start  ( struct th_dvb_mux_instance *tdmi );
 void epggrab_mux_stop   ( struct th_dvb_mux_instance *tdmi, int timeout );
 void epggrab_mux_delete ( struct th_dvb_mux_instance *tdmi );
 int  epggrab_mux_period ( struct th_dvb_mux_instance *tdmi );
+int  epggrab_mux_running ( struct th_dvb_mux_instance *tdmi );
+int  epggrab_mux_pending ( struct th_dvb_mux_instance *tdmi );
 struct th_dvb_mux_instance *epggrab_mux_next ( struct th_dvb_adapter *tda );
 
 /*
@@ -264,6 +267,13 @@ struct th_dvb_mux_instance *epggrab_mux_next ( struct th_dvb_adapter *tda );
  */
 void epggrab_resched     ( void );
 
+/*
+ * Statistics
+ */
+void eit_stats_dump      ( struct htsbuf_queue *hq );
+void epggrab_ota_stats_dump ( struct htsbuf_queue *hq );
+void opentv_stats_dump   ( struct htsbuf_queue *hq );
+
 #endif /* __EPGGRAB_H__ */
 
 /* **************************************************************************
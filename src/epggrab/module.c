@@ -105,7 +105,6 @@ void epggrab_module_parse
   ( void *m, htsmsg_t *data )
 {
   time_t tm1, tm2;
-  int save = 0;
   epggrab_stats_t stats;
   epggrab_module_int_t *mod = m;
 
@@ -113,9 +112,10 @@ void epggrab_module_parse
   memset(&stats, 0, sizeof(stats));
   pthread_mutex_lock(&global_lock);
   time(&tm1);
-  save |= mod->parse(mod, data, &stats);
+  epg_begin();
+  mod->parse(mod, data, &stats);
+  epg_commit();
   time(&tm2);
-  if (save) epg_updated();  
   pthread_mutex_unlock(&global_lock);
   htsmsg_destroy(data);
 
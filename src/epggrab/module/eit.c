@@ -26,6 +26,7 @@
 #include "epg.h"
 #include "epggrab.h"
 #include "epggrab/private.h"
+#include "htsbuf.h"
 
 /* ************************************************************************
  * Status handling
@@ -89,6 +90,83 @@ static eit_status_t *eit_status_find
   return sta;
 }
 
+static void eit_status_clear ( eit_status_list_t *el )
+{
+  eit_status_t *sta;
+
+  while ((sta = LIST_FIRST(el))) {
+    LIST_REMOVE(sta, link);
+    free(sta);
+  }
+}
+
+/* ************************************************************************
+ * Section cache
+ * ***********************************************************************/
+
+/*
+ * Broadcasters repeat the same sections over and over, so remember the
+ * version and CRC of every section that has been processed and drop
+ * repeats before any of the events are decoded. The cache only lives
+ * for one grab, so events removed or expired locally since are
+ * re-created from the next grab.
+ */
+typedef struct eit_section
+{
+  RB_ENTRY(eit_section)  link;
+  uint64_t               key;  ///< tableid, tsid, sid, section number
+  uint32_t               crc;
+  uint8_t                ver;
+  int                    chid; ///< Channel the events were added to
+} eit_section_t;
+
+typedef struct eit_ota
+{
+  eit_status_list_t      status;
+  RB_HEAD(, eit_section) sections;
+  uint32_t               skipped;
+  uint32_t               processed;
+} eit_ota_t;
+
+static uint64_t eit_sections_skipped;
+static uint64_t eit_sections_processed;
+
+static int _eit_section_cmp ( void *a, void *b )
+{
+  uint64_t x = ((eit_section_t*)a)->key;
+  uint64_t y = ((eit_section_t*)b)->key;
+  return x < y ? -1 : x > y;
+}
+
+static void eit_sections_clear ( eit_ota_t *eo )
+{
+  eit_section_t *es;
+  while ((es = RB_FIRST(&eo->sections))) {
+    RB_REMOVE(&eo->sections, es, link);
+    free(es);
+  }
+}
+
+static eit_section_t *eit_section_find
+  ( eit_ota_t *eo, int tableid, uint16_t tsid, uint16_t sid, uint8_t sec )
+{
+  static eit_section_t *skel = NULL;
+  eit_section_t *es;
+
+  if (!skel) skel = calloc(1, sizeof(eit_section_t));
+  skel->key = (uint64_t)tableid << 40 | (uint64_t)tsid << 24 |
+              (uint64_t)sid << 8 | sec;
+
+  es = RB_INSERT_SORTED(&eo->sections, skel, link, _eit_section_cmp);
+  if (!es) {
+    es       = skel;
+    es->ver  = 0xff; // never matches a real version
+    es->chid = -1;
+    skel     = NULL;
+  }
+  return es;
+}
+
 typedef struct eit_event
 {
   char              uri[257];
@@ -557,12 +635,14 @@ static int _eit_callback
 {
   epggrab_module_t *mod = opaque;
   epggrab_ota_mux_t *ota;
-  th_dvb_adapter_t *tda;
   service_t *svc;
-  eit_status_list_t *stal;
+  eit_ota_t *eo;
   eit_status_t *sta;
+  eit_section_t *es;
   int resched = 0, save = 0;
-  uint16_t tsid, sid;
+  uint16_t onid, tsid, sid;
+  uint32_t crc;
+  uint8_t ver;
 
   /* Invalid */
   if(tableid < 0x4e || tableid > 0x6f || len < 11) return -1;
@@ -573,24 +653,25 @@ static int _eit_callback
   /* Get OTA */
   ota = epggrab_ota_find((epggrab_module_ota_t*)mod, tdmi);
   if (!ota || !ota->status) return -1;
-  stal = ota->status;
+  eo = ota->status;
 
   /* Already complete */
   if (epggrab_ota_is_complete(ota)) return 0;
 
+  /* New grab (sections must all be seen again to complete) */
+  if (ota->state == EPGGRAB_OTA_MUX_IDLE)
+    eit_status_clear(&eo->status);
+
   /* Get tsid/sid */
   sid  = ptr[0] << 8 | ptr[1];
   tsid = ptr[5] << 8 | ptr[6];
+  onid = ptr[7] << 8 | ptr[8];
 
   /* Get transport stream */
   // Note: tableid=0x4f,0x60-0x6f is other TS
   //       so must find the tdmi
-  if(tableid == 0x4f || tableid >= 0x60) {
-    tda = tdmi->tdmi_adapter;
-    LIST_FOREACH(tdmi, &tda->tda_muxes, tdmi_adapter_link)
-      if(tdmi->tdmi_transport_stream_id == tsid)
-        break;
-  }
+  if(tableid == 0x4f || tableid >= 0x60)
+    tdmi = dvb_mux_find_by_tsid(tdmi->tdmi_adapter, onid, tsid);
   if(!tdmi) return 0;
 
   /* Get service */
@@ -600,17 +681,18 @@ static int _eit_callback
   /* Ignore (not primary EPG service) */
   if (!service_is_primary_epg(svc)) return 0;
 
-  sta = eit_status_find(stal, tableid, tsid, sid, ptr[3], ptr[4],
+  sta = eit_status_find(&eo->status, tableid, tsid, sid, ptr[3], ptr[4],
                         ptr[9]);
   if (!sta) return 0;
 
   /* Started */
   if (epggrab_ota_begin(ota)) {
-    // nothing/clear?
+    eo->skipped = eo->processed = 0;
+    eit_sections_clear(eo);
 
   /* Check end */
   } else if (sta->done) {
-    LIST_FOREACH(sta, stal, link)
+    LIST_FOREACH(sta, &eo->status, link)
       if (!sta->done) break;
   }
 
@@ -622,24 +704,44 @@ static int _eit_callback
   // Note: this does mean you will get a slight oddity for muxes that
   //       carry both, since they will end up with setting of 600/300 
 
+  /* Unchanged (CRC follows the section data) */
+  ver = (ptr[2] >> 1) & 0x1f;
+  crc = ptr[len] << 24 | ptr[len+1] << 16 | ptr[len+2] << 8 | ptr[len+3];
+  es  = eit_section_find(eo, tableid, tsid, sid, ptr[3]);
+  if (es->ver == ver && es->crc == crc && es->chid == svc->s_ch->ch_id) {
+    eo->skipped++;
+    eit_sections_skipped++;
+
   /* Process events */
-  len -= 11;
-  ptr += 11;
-  while (len) {
-    int r;
-    if ((r = _eit_process_event(mod, tableid, svc, ptr, len,
-                                &resched, &save)) < 0)
-      break;
-    len -= r;
-    ptr += r;
+  } else {
+    es->ver  = ver;
+    es->crc  = crc;
+    es->chid = svc->s_ch->ch_id;
+    eo->processed++;
+    eit_sections_processed++;
+
+    len -= 11;
+    ptr += 11;
+    while (len) {
+      int r;
+      if ((r = _eit_process_event(mod, tableid, svc, ptr, len,
+                                  &resched, &save)) < 0)
+        break;
+      len -= r;
+      ptr += r;
+    }
   }
 
   /* Complete */
-  if (!sta) epggrab_ota_complete(ota);
+  if (!sta) {
+    tvhlog(LOG_DEBUG, mod->id, "%d sections processed, %d unchanged",
+           eo->processed, eo->skipped);
+    epggrab_ota_complete(ota);
+  }
   
   /* Update EPG */
   if (resched) epggrab_resched();
-  if (save)    epg_updated();
+  if (save)    epg_updated_later();
 
   return 0;
 }
@@ -650,16 +752,13 @@ static int _eit_callback
 
 static void _eit_ota_destroy ( epggrab_ota_mux_t *ota )
 {
-  eit_status_t      *sta;
-  eit_status_list_t *stal = ota->status;
+  eit_ota_t     *eo = ota->status;
 
   /* Remove all entries */
-  while ((sta = LIST_FIRST(stal))) {
-    LIST_REMOVE(sta, link);
-    free(sta);
-  }
+  eit_status_clear(&eo->status);
+  eit_sections_clear(eo);
 
-  free(stal);
+  free(eo);
   free(ota);
 }
 
@@ -680,7 +779,7 @@ static void _eit_start
   /* Register */
   if (!(ota = epggrab_ota_create(m, tdmi))) return;
   if (!ota->status) {
-    ota->status  = calloc(1, sizeof(eit_status_list_t));
+    ota->status  = calloc(1, sizeof(eit_ota_t));
     ota->destroy = _eit_ota_destroy;
   }
 
@@ -738,3 +837,10 @@ void eit_init ( void )
 void eit_load ( void )
 {
 }
+
+void eit_stats_dump ( htsbuf_queue_t *hq )
+{
+  htsbuf_qprintf(hq, "EIT sections: %"PRIu64" processed, "
+                 "%"PRIu64" unchanged\n",
+                 eit_sections_processed, eit_sections_skipped);
+}
@@ -19,8 +19,10 @@
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <linux/dvb/dmx.h>
 #include "tvheadend.h"
+#include "htsbuf.h"
 #include "dvb/dvb.h"
 #include "channels.h"
 #include "huffman.h"
@@ -43,6 +45,8 @@ static epggrab_channel_tree_t _opentv_channels;
 typedef struct opentv_event
 { 
   RB_ENTRY(opentv_event) ev_link;     ///< List of partial events
+  TAILQ_ENTRY(opentv_event) ev_q_link; ///< Decoded, waiting for merge
+  struct opentv_module_t *mod;        ///< Provider
   uint16_t               cid;         ///< Channel ID
   uint16_t               eid;         ///< Events ID
   time_t                 start;       ///< Start time
@@ -56,6 +60,9 @@ typedef struct opentv_event
   uint8_t                type;        ///< 0x1=title, 0x2=summary
 } opentv_event_t;
 
+TAILQ_HEAD(opentv_event_queue, opentv_event);
+RB_HEAD(opentv_event_tree, opentv_event);
+
 /* PID status (for event PIDs) */
 typedef struct opentv_pid
 {
@@ -75,7 +82,6 @@ typedef struct opentv_status
   int                     begbat;
   int                     endbat;
   LIST_HEAD(, opentv_pid) pids;
-  RB_HEAD(, opentv_event) events;
 } opentv_status_t;
 
 /* Get a pid entry */
@@ -94,16 +100,22 @@ static opentv_pid_t *_opentv_status_get_pid
   return p;
 }
 
+/* Free an event */
+static void _opentv_event_free ( opentv_event_t *ev )
+{
+  if (ev->title)   free(ev->title);
+  if (ev->summary) free(ev->summary);
+  if (ev->desc)    free(ev->desc);
+  free(ev);
+}
+
 /* Clear events */
-static void _opentv_status_remove_events ( opentv_status_t *sta )
+static void _opentv_remove_events ( struct opentv_event_tree *events )
 {
   opentv_event_t *ev;
-  while ((ev = RB_FIRST(&sta->events))) {
-    RB_REMOVE(&sta->events, ev, ev_link);
-    if (ev->title)   free(ev->title);
-    if (ev->summary) free(ev->summary);
-    if (ev->desc)    free(ev->desc);
-    free(ev);
+  while ((ev = RB_FIRST(events))) {
+    RB_REMOVE(events, ev, ev_link);
+    _opentv_event_free(ev);
   }
 }
 
@@ -139,6 +151,17 @@ typedef struct opentv_module_t
   int                   *summary;
   opentv_dict_t         *dict;
   opentv_genre_t        *genre;
+
+  struct opentv_event_tree events; ///< Summaries waiting for their title
+
+  /* Statistics */
+  uint64_t              sections;     ///< Decoded (_opentv_mutex)
+  int64_t               decode_time;  ///< us decoding (_opentv_mutex)
+  uint64_t              events_total; ///< Merged
+  int64_t               merge_time;   ///< us merging (global_lock)
+  int64_t               sweep_start;
+  int64_t               sweep_last;
+  int                   sweep_events;
   
 } opentv_module_t;
 
@@ -210,22 +233,6 @@ static epg_episode_t *_opentv_find_episode
   return NULL;
 }
 
-static service_t *_opentv_find_service ( int tsid, int sid )
-{
-  th_dvb_adapter_t *tda;
-  th_dvb_mux_instance_t *tdmi;
-  service_t *t = NULL;
-  TAILQ_FOREACH(tda, &dvb_adapters, tda_global_link) {
-    LIST_FOREACH(tdmi, &tda->tda_muxes, tdmi_adapter_link) {
-      if (tdmi->tdmi_transport_stream_id != tsid) continue;
-      LIST_FOREACH(t, &tdmi->tdmi_transports, s_group_link) {
-        if (t->s_dvb_service_id == sid) return t;
-      }
-    }
-  }
-  return NULL;
-}
-
 /* ************************************************************************
  * OpenTV event processing
  * ***********************************************************************/
@@ -315,25 +322,16 @@ static int _opentv_parse_event_record
 
 /* Parse a specific event */
 static int _opentv_parse_event
-  ( opentv_module_t *prov, opentv_status_t *sta,
-    uint8_t *buf, int len, int cid, time_t mjd,
+  ( opentv_module_t *prov, uint8_t *buf, int len, int cid, time_t mjd,
     opentv_event_t *ev, int type )
 {
   int      slen = ((int)buf[2] & 0xf << 8) | buf[3];
   int      i    = 4;
-  opentv_event_t *e;
 
-  ev->cid = cid;
-  ev->eid = ((uint16_t)buf[0] << 8) | buf[1];
-
-  /* Get existing summary */
-  e = RB_FIND(&sta->events, ev, ev_link, _ev_cmp);
-  if (e) {
-    RB_REMOVE(&sta->events, e, ev_link);
-    memcpy(ev, e, sizeof(opentv_event_t));
-    free(e);
-  }
-  ev->type |= type;
+  ev->mod  = prov;
+  ev->cid  = cid;
+  ev->eid  = ((uint16_t)buf[0] << 8) | buf[1];
+  ev->type = type;
 
   /* Process records */ 
   while (i < slen+4) {
@@ -342,109 +340,367 @@ static int _opentv_parse_event
   return slen+4;
 }
 
-/* Parse an event section */
-static int _opentv_parse_event_section
-  ( opentv_module_t *mod, opentv_status_t *sta,
-    uint8_t *buf, int len, int type )
+/* Decode an event section (no locks required) */
+static int _opentv_decode_event_section
+  ( opentv_module_t *mod, uint8_t *buf, int len, int type,
+    struct opentv_event_queue *q )
 {
-  int i, cid, save = 0;
+  int i, cid, n = 0;
   time_t mjd;
+  opentv_event_t *ev;
+
+  /* Channel */
+  cid = ((int)buf[0] << 8) | buf[1];
+
+  /* Time (start/stop referenced to this) */
+  mjd = ((int)buf[5] << 8) | buf[6];
+  mjd = (mjd - 40587) * 86400;
+
+  /* Loop around event entries */
+  i = 7;
+  while (i < len) {
+    ev = calloc(1, sizeof(opentv_event_t));
+    i += _opentv_parse_event(mod, buf+i, len-i, cid, mjd, ev, type);
+    TAILQ_INSERT_TAIL(q, ev, ev_q_link);
+    n++;
+  }
+  return n;
+}
+
+/* Channel that events for the given cid go to (if any) */
+static channel_t *_opentv_event_channel ( opentv_module_t *mod, int cid )
+{
   epggrab_channel_t *ec;
+  if (!(ec = _opentv_find_epggrab_channel(mod, cid, 0, NULL))) return NULL;
+  if (!ec->channel) return NULL;
+  if (!*ec->channel->ch_name) return NULL; // ignore unnamed channels
+  return ec->channel;
+}
+
+/* Combine with the stored summary (decoded first, so its text wins) */
+static void _opentv_event_combine ( opentv_event_t *ev, opentv_event_t *e )
+{
+  if (e->title) {
+    if (ev->title) free(ev->title);
+    ev->title = e->title;
+  }
+  if (e->summary) {
+    if (ev->summary) free(ev->summary);
+    ev->summary = e->summary;
+  }
+  if (e->desc) {
+    if (ev->desc) free(ev->desc);
+    ev->desc = e->desc;
+  }
+  if (!(ev->type & OPENTV_TITLE)) {
+    ev->start = e->start;
+    ev->stop  = e->stop;
+    ev->cat   = e->cat;
+  }
+  if (!ev->series) ev->series = e->series;
+  ev->type |= e->type;
+  free(e);
+}
+
+/* Merge a decoded event into the EPG (takes ownership of ev) */
+static int _opentv_merge_event ( opentv_event_t *ev )
+{
+  int save = 0;
+  channel_t *ch;
+  opentv_event_t *e;
+  opentv_module_t *mod = ev->mod;
   epg_broadcast_t *ebc;
   epg_episode_t *ee;
   epg_season_t *es;
-  opentv_event_t ev;
   epggrab_module_t *src = (epggrab_module_t*)mod;
   const char *lang = NULL;
   const char *str;
 
+  lock_assert(&global_lock);
+
   /* Get language (bit of a hack) */
   if      (!strcmp(mod->dict->id, "skyit"))  lang = "it";
   else if (!strcmp(mod->dict->id, "skyeng")) lang = "eng";
 
   /* Channel */
-  cid = ((int)buf[0] << 8) | buf[1];
-  if (!(ec = _opentv_find_epggrab_channel(mod, cid, 0, NULL))) return 0;
-  if (!ec->channel) return 0;
-  if (!*ec->channel->ch_name) return 0; // ignore unnamed channels
-  
-  /* Time (start/stop referenced to this) */
-  mjd = ((int)buf[5] << 8) | buf[6];
-  mjd = (mjd - 40587) * 86400;
+  if (!(ch = _opentv_event_channel(mod, ev->cid))) {
+    _opentv_event_free(ev);
+    return 0;
+  }
 
-  /* Loop around event entries */
-  i = 7;
-  while (i < len) {
-    memset(&ev, 0, sizeof(opentv_event_t));
-    i += _opentv_parse_event(mod, sta, buf+i, len-i, cid, mjd, &ev, type);
-
-    /* Find broadcast */
-    if (ev.type & OPENTV_TITLE) {
-      ebc = epg_broadcast_find_by_time(ec->channel, ev.start, ev.stop, ev.eid,
-                                       1, &save);
-
-    /* Store */
-    } else if (!(ebc = epg_broadcast_find_by_eid(ec->channel, ev.eid))) {
-      opentv_event_t *skel = malloc(sizeof(opentv_event_t));
-      memcpy(skel, &ev, sizeof(opentv_event_t));
-      assert(!RB_INSERT_SORTED(&sta->events, skel, ev_link, _ev_cmp));
-      continue; // don't want to free() anything
-    }
+  /* Get existing summary */
+  if ((e = RB_FIND(&mod->events, ev, ev_link, _ev_cmp))) {
+    RB_REMOVE(&mod->events, e, ev_link);
+    _opentv_event_combine(ev, e);
+  }
+
+  /* Find broadcast */
+  if (ev->type & OPENTV_TITLE) {
+    ebc = epg_broadcast_find_by_time(ch, ev->start, ev->stop, ev->eid,
+                                     1, &save);
+
+  /* Store */
+  } else if (!(ebc = epg_broadcast_find_by_eid(ch, ev->eid))) {
+    assert(!RB_INSERT_SORTED(&mod->events, ev, ev_link, _ev_cmp));
+    return 0; // don't want to free() anything
+  }
+
+  /* Find episode */
+  if (ebc) {
+    ee = NULL;
 
     /* Find episode */
-    if (ebc) {
-      ee = NULL;
-
-      /* Find episode */
-      if (ev.type & OPENTV_SUMMARY || !ebc->episode)
-        ee = _opentv_find_episode(mod, cid, &ev, &save);
-
-      /* Use existing */
-      if (!ee) ee = ebc->episode;
-
-      /* Update */
-      if (ee) {
-        if (!ev.title && ebc->episode) {
-          if ((str = epg_episode_get_title(ebc->episode, NULL)))
-            save |= epg_episode_set_title(ee, str, lang, NULL);
-        } else if (ev.title)
-          save |= epg_episode_set_title(ee, ev.title, lang, src);
-        if (ev.summary)
-          save |= epg_episode_set_summary(ee, ev.summary, lang, src);
-        if (ev.desc)
-          save |= epg_episode_set_description(ee, ev.desc, lang, src);
-        if (ev.cat) {
-          epg_genre_list_t *egl = calloc(1, sizeof(epg_genre_list_t));
-          epg_genre_list_add_by_eit(egl, ev.cat);
-          save |= epg_episode_set_genre(ee, egl, src);
-          epg_genre_list_destroy(egl);
-        }
-        if (ev.series) {
-          es = _opentv_find_season(mod, cid, &ev, &save);
-          if (es) save |= epg_episode_set_season(ee, es, src);
-        }
-
-        save |= epg_broadcast_set_episode(ebc, ee, src);
+    if (ev->type & OPENTV_SUMMARY || !ebc->episode)
+      ee = _opentv_find_episode(mod, ev->cid, ev, &save);
+
+    /* Use existing */
+    if (!ee) ee = ebc->episode;
+
+    /* Update */
+    if (ee) {
+      if (!ev->title && ebc->episode) {
+        if ((str = epg_episode_get_title(ebc->episode, NULL)))
+          save |= epg_episode_set_title(ee, str, lang, NULL);
+      } else if (ev->title)
+        save |= epg_episode_set_title(ee, ev->title, lang, src);
+      if (ev->summary)
+        save |= epg_episode_set_summary(ee, ev->summary, lang, src);
+      if (ev->desc)
+        save |= epg_episode_set_description(ee, ev->desc, lang, src);
+      if (ev->cat) {
+        epg_genre_list_t *egl = calloc(1, sizeof(epg_genre_list_t));
+        epg_genre_list_add_by_eit(egl, ev->cat);
+        save |= epg_episode_set_genre(ee, egl, src);
+        epg_genre_list_destroy(egl);
+      }
+      if (ev->series) {
+        es = _opentv_find_season(mod, ev->cid, ev, &save);
+        if (es) save |= epg_episode_set_season(ee, es, src);
       }
+
+      save |= epg_broadcast_set_episode(ebc, ee, src);
     }
+  }
+
+  /* Cleanup */
+  _opentv_event_free(ev);
+  return save;
+}
 
-    /* Cleanup */
-    if (ev.title)   free(ev.title);
-    if (ev.summary) free(ev.summary);
-    if (ev.desc)    free(ev.desc);
+/* Merge a batch of decoded events */
+static void _opentv_merge ( struct opentv_event_queue *q )
+{
+  int save = 0;
+  int64_t t0, t;
+  opentv_event_t *ev;
+  opentv_module_t *mod;
+
+  lock_assert(&global_lock);
+
+  t0 = getmonoclock();
+  while ((ev = TAILQ_FIRST(q))) {
+    TAILQ_REMOVE(q, ev, ev_q_link);
+    mod = ev->mod;
+    mod->events_total++;
+    mod->sweep_events++;
+    save |= _opentv_merge_event(ev);
+
+    /* Time is charged to the provider of the last event (close enough) */
+    if (!TAILQ_FIRST(q) || TAILQ_FIRST(q)->mod != mod) {
+      t = getmonoclock();
+      mod->merge_time += t - t0;
+      mod->sweep_last  = t;
+      t0 = t;
+    }
   }
 
   /* Update EPG */
-  if (save) epg_updated();
+  if (save) epg_updated_later();
+}
+
+/* ************************************************************************
+ * Decode workers
+ * ***********************************************************************/
+
+/*
+ * Event sections are Huffman decoded by a pool of worker threads that
+ * don't hold global_lock, the decoded events are merged into the EPG in
+ * batches of (at least) OPENTV_MERGE_BATCH. If the workers fall behind
+ * by more than OPENTV_QUEUE_MAX sections, sections are decoded in the
+ * table thread instead, so memory use stays bounded.
+ */
+#define OPENTV_WORKERS_MAX 4
+#define OPENTV_QUEUE_MAX   1024
+#define OPENTV_MERGE_BATCH 256
+
+typedef struct opentv_job
+{
+  TAILQ_ENTRY(opentv_job) link;
+  opentv_module_t         *mod;
+  int                      type;
+  int                      len;
+  uint8_t                  buf[0];
+} opentv_job_t;
+
+static pthread_mutex_t _opentv_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  _opentv_cond  = PTHREAD_COND_INITIALIZER;
+static TAILQ_HEAD(, opentv_job) _opentv_jobs;
+static int _opentv_njobs;
+static struct opentv_event_queue _opentv_decoded;
+static int _opentv_ndecoded;
+static int _opentv_workers;
+
+static void *_opentv_worker ( void *p )
+{
+  int n;
+  int64_t t;
+  opentv_job_t *job;
+  opentv_event_t *ev;
+  struct opentv_event_queue q;
+
+  pthread_mutex_lock(&_opentv_mutex);
+  while (1) {
+    while (!(job = TAILQ_FIRST(&_opentv_jobs)))
+      pthread_cond_wait(&_opentv_cond, &_opentv_mutex);
+    TAILQ_REMOVE(&_opentv_jobs, job, link);
+    _opentv_njobs--;
+    pthread_mutex_unlock(&_opentv_mutex);
+
+    /* Decode */
+    TAILQ_INIT(&q);
+    t = getmonoclock();
+    n = _opentv_decode_event_section(job->mod, job->buf, job->len,
+                                     job->type, &q);
+    t = getmonoclock() - t;
+
+    pthread_mutex_lock(&_opentv_mutex);
+    job->mod->sections++;
+    job->mod->decode_time += t;
+    free(job);
+    while ((ev = TAILQ_FIRST(&q))) {
+      TAILQ_REMOVE(&q, ev, ev_q_link);
+      TAILQ_INSERT_TAIL(&_opentv_decoded, ev, ev_q_link);
+    }
+    _opentv_ndecoded += n;
+
+    /* Merge (batch is full, or nothing else to do) */
+    if (_opentv_ndecoded &&
+        (_opentv_ndecoded >= OPENTV_MERGE_BATCH || !_opentv_njobs)) {
+      TAILQ_MOVE(&q, &_opentv_decoded, ev_q_link);
+      TAILQ_INIT(&_opentv_decoded);
+      _opentv_ndecoded = 0;
+      pthread_mutex_unlock(&_opentv_mutex);
+
+      pthread_mutex_lock(&global_lock);
+      _opentv_merge(&q);
+      pthread_mutex_unlock(&global_lock);
+
+      pthread_mutex_lock(&_opentv_mutex);
+    }
+  }
+  return NULL;
+}
+
+static void _opentv_workers_start ( void )
+{
+  int i;
+  pthread_t tid;
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  _opentv_workers = MAX(1, MIN(OPENTV_WORKERS_MAX, n));
+  TAILQ_INIT(&_opentv_jobs);
+  TAILQ_INIT(&_opentv_decoded);
+  for (i = 0; i < _opentv_workers; i++)
+    pthread_create(&tid, NULL, _opentv_worker, NULL);
+  tvhlog(LOG_DEBUG, "opentv", "%d decode workers", _opentv_workers);
+}
+
+/* Queue an event section for decoding (or decode now if backlogged) */
+static int _opentv_queue_event_section
+  ( opentv_module_t *mod, uint8_t *buf, int len, int type )
+{
+  opentv_job_t *job;
+  struct opentv_event_queue q;
+  int64_t t;
+
+  lock_assert(&global_lock);
+
+  /* Don't bother with channels we don't have */
+  if (!_opentv_event_channel(mod, ((int)buf[0] << 8) | buf[1])) return 0;
+
+  if (!_opentv_workers) _opentv_workers_start();
+
+  pthread_mutex_lock(&_opentv_mutex);
+  if (_opentv_njobs < OPENTV_QUEUE_MAX) {
+    job = malloc(sizeof(opentv_job_t) + len);
+    job->mod  = mod;
+    job->type = type;
+    job->len  = len;
+    memcpy(job->buf, buf, len);
+    TAILQ_INSERT_TAIL(&_opentv_jobs, job, link);
+    _opentv_njobs++;
+    pthread_cond_signal(&_opentv_cond);
+    pthread_mutex_unlock(&_opentv_mutex);
+    return 0;
+  }
+  pthread_mutex_unlock(&_opentv_mutex);
+
+  /* Backlogged */
+  TAILQ_INIT(&q);
+  t = getmonoclock();
+  _opentv_decode_event_section(mod, buf, len, type, &q);
+  t = getmonoclock() - t;
+  pthread_mutex_lock(&_opentv_mutex);
+  mod->sections++;
+  mod->decode_time += t;
+  pthread_mutex_unlock(&_opentv_mutex);
+  _opentv_merge(&q);
   return 0;
 }
 
+/* Sweep rate (events still being decoded are counted in the dump) */
+static void _opentv_sweep_log ( opentv_module_t *mod )
+{
+  int64_t t = getmonoclock() - mod->sweep_start;
+  tvhlog(LOG_DEBUG, mod->id, "sweep complete, %d events in %"PRId64" ms "
+         "(%d events/s)", mod->sweep_events, t / 1000,
+         t > 0 ? (int)(mod->sweep_events * 1000000LL / t) : 0);
+}
+
+/* Statistics */
+void opentv_stats_dump ( htsbuf_queue_t *hq )
+{
+  epggrab_module_t *m;
+  opentv_module_t *mod;
+  uint64_t sections;
+  int64_t decode, sweep;
+
+  LIST_FOREACH(m, &epggrab_modules, link) {
+    if (strncmp(m->id, "opentv-", 7) || m->type != EPGGRAB_OTA) continue;
+    mod = (opentv_module_t*)m;
+    if (!mod->events_total) continue;
+    pthread_mutex_lock(&_opentv_mutex);
+    sections = mod->sections;
+    decode   = mod->decode_time;
+    pthread_mutex_unlock(&_opentv_mutex);
+    sweep = mod->sweep_last - mod->sweep_start;
+    htsbuf_qprintf(hq, "%s: %"PRIu64" sections, %"PRIu64" events, "
+                   "decode %"PRId64" ms, merge %"PRId64" ms, "
+                   "last sweep %d events at %d events/s\n",
+                   m->id, sections, mod->events_total,
+                   decode / 1000, mod->merge_time / 1000, mod->sweep_events,
+                   sweep > 0 ? (int)(mod->sweep_events * 1000000LL / sweep)
+                             : 0);
+  }
+}
+
 /* ************************************************************************
  * OpenTV channel processing
  * ***********************************************************************/
 
 static void _opentv_parse_channels
-  ( opentv_module_t *mod, uint8_t *buf, int len, uint16_t tsid )
+  ( opentv_module_t *mod, uint8_t *buf, int len, uint16_t onid,
+    uint16_t tsid )
 {
   epggrab_channel_t *ec;
   service_t *svc;
@@ -457,7 +713,7 @@ static void _opentv_parse_channels
     cnum = ((int)buf[i+5] << 8) | buf[i+6];
 
     /* Find the service */
-    svc = _opentv_find_service(tsid, sid);
+    svc = dvb_mux_find_service(onid, tsid, sid);
     if (svc && svc->s_ch) {
       ec  =_opentv_find_epggrab_channel(mod, cid, 1, &save);
       if (service_is_primary_epg(svc))
@@ -471,13 +727,14 @@ static void _opentv_parse_channels
 }
 
 static int _opentv_parse_ts_desc
-  ( opentv_module_t *mod, uint8_t *buf, int len, uint16_t tsid )
+  ( opentv_module_t *mod, uint8_t *buf, int len, uint16_t onid,
+    uint16_t tsid )
 {
   int dtag = buf[0];
   int dlen = buf[1];
   if (dlen+2 > len) return -1;
   if (dtag == 0xb1)
-    _opentv_parse_channels(mod, buf+2, dlen, tsid);
+    _opentv_parse_channels(mod, buf+2, dlen, onid, tsid);
   return dlen + 2;
 }
 
@@ -486,7 +743,7 @@ static int _opentv_bat_section
 {
   int i, r;
   int bdlen, tllen, tdlen;
-  uint16_t bid, tsid;
+  uint16_t bid, onid, tsid;
   uint8_t sec;
 
   /* Skip (not yet applicable) */
@@ -522,14 +779,14 @@ static int _opentv_bat_section
   if (tllen > len) return -1;
   while (len > 0) {
     tsid  = ((int)buf[0] << 8) | buf[1];
-    //nid  = ((int)buf[2] << 8) | buf[3];
+    onid  = ((int)buf[2] << 8) | buf[3];
     tdlen = ((int)buf[4] & 0xf) << 8 | buf[5];
     buf += 6;
     len -= 6;
     if (tdlen > len) return -1;
     i = 0;
     while (i < tdlen) {
-      r = _opentv_parse_ts_desc(mod, buf+i, tdlen-i, tsid);
+      r = _opentv_parse_ts_desc(mod, buf+i, tdlen-i, onid, tsid);
       if (r < 0) return -1;
       i += r;
     }
@@ -570,7 +827,9 @@ static epggrab_ota_mux_t *_opentv_event_callback
   if (epggrab_ota_begin(ota)) {
 
     /* Remove outstanding event data */
-    _opentv_status_remove_events(sta);
+    _opentv_remove_events(&mod->events);
+    mod->sweep_start  = mod->sweep_last = getmonoclock();
+    mod->sweep_events = 0;
 
     /* Reset status */
     LIST_FOREACH(pid, &sta->pids, link)
@@ -605,6 +864,7 @@ static epggrab_ota_mux_t *_opentv_event_callback
 
   /* Mark complete */
   epggrab_ota_complete(ota);
+  _opentv_sweep_log((opentv_module_t*)ota->grab);
   
   return NULL;
 }
@@ -614,8 +874,7 @@ static int _opentv_title_callback
 {
   epggrab_ota_mux_t *ota = _opentv_event_callback(tdmi, buf, len, tid, p);
   if (ota)
-    return _opentv_parse_event_section((opentv_module_t*)ota->grab,
-                                       (opentv_status_t*)ota->status,
+    return _opentv_queue_event_section((opentv_module_t*)ota->grab,
                                        buf, len, OPENTV_TITLE);
   return 0;
 }
@@ -625,8 +884,7 @@ static int _opentv_summary_callback
 {
   epggrab_ota_mux_t *ota = _opentv_event_callback(tdmi, buf, len, tid, p);
   if (ota)
-    return _opentv_parse_event_section((opentv_module_t*)ota->grab,
-                                       (opentv_status_t*)ota->status,
+    return _opentv_queue_event_section((opentv_module_t*)ota->grab,
                                        buf, len, OPENTV_SUMMARY);
   return 0;
 }
@@ -653,9 +911,6 @@ static void _opentv_ota_destroy ( epggrab_ota_mux_t *ota )
   opentv_status_t *sta = ota->status;
   opentv_pid_t    *pid;
 
-  /* Empty the events */
-  _opentv_status_remove_events(sta);
-
   /* Empty pids */
   while ((pid = LIST_FIRST(&sta->pids))) {
     LIST_REMOVE(pid, link);
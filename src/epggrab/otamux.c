@@ -17,13 +17,18 @@
  */
 
 /*
- * TODO: currently I don't try to block multiple scans of the same
- *       tdmi on different adapters
+ * EPG data for a mux is the same whichever adapter it is received on,
+ * so a mux is only scheduled for an EPG scan if no copy of it (same
+ * original network id and tsid) has fresh data or is tuned right now.
+ * Muxes that are tuned for recordings or live viewing are grabbed as
+ * a side effect (epggrab_mux_start() is called for every tune), idle
+ * tuners are only sent to what remains, oldest data first.
  */
 
 #include <string.h>
 
 #include "tvheadend.h"
+#include "htsbuf.h"
 #include "queue.h"
 #include "epg.h"
 #include "dvb/dvb.h"
@@ -32,6 +37,38 @@
 
 TAILQ_HEAD(, epggrab_ota_mux) ota_mux_all;
 
+/* Grabs completed on EPG scans vs on muxes tuned for other reasons */
+static uint32_t ota_complete_scan;
+static uint32_t ota_complete_piggyback;
+
+/*
+ * Data for this link is fresh, or is being received on a copy of the
+ * mux that is tuned right now
+ */
+static int _epggrab_ota_covered ( epggrab_ota_mux_t *ota, time_t now )
+{
+  th_dvb_mux_instance_t *tdmi;
+  epggrab_ota_mux_t *o;
+  uint16_t onid = ota->tdmi->tdmi_network_id;
+  uint16_t tsid = ota->tdmi->tdmi_transport_stream_id;
+
+  if (ota->completed + ota->interval > now) return 1;
+  if (tsid == 0xffff) return 0;
+
+  LIST_FOREACH(tdmi, &dvb_mux_tsid_hash[tsid % DVB_MUX_TSID_HASH_WIDTH],
+               tdmi_tsid_hash_link) {
+    if (tdmi == ota->tdmi || tdmi->tdmi_transport_stream_id != tsid) continue;
+    if (onid && tdmi->tdmi_network_id && onid != tdmi->tdmi_network_id)
+      continue;
+    TAILQ_FOREACH(o, &tdmi->tdmi_epg_grab, tdmi_link) {
+      if (o->grab != ota->grab) continue;
+      if (tdmi->tdmi_adapter->tda_mux_current == tdmi) return 1;
+      if (o->completed + ota->interval > now) return 1;
+    }
+  }
+  return 0;
+}
+
 /* **************************************************************************
  * Global functions (called from DVB code)
  * *************************************************************************/
@@ -83,17 +120,91 @@ int epggrab_mux_period ( th_dvb_mux_instance_t *tdmi )
   return period;
 }
 
+int epggrab_mux_running ( th_dvb_mux_instance_t *tdmi )
+{
+  epggrab_ota_mux_t *ota;
+  TAILQ_FOREACH(ota, &tdmi->tdmi_epg_grab, tdmi_link) {
+    if (ota->is_reg && ota->state == EPGGRAB_OTA_MUX_RUNNING) return 1;
+  }
+  return 0;
+}
+
+/* Grabbers that have yet to finish (not started counts too) */
+int epggrab_mux_pending ( th_dvb_mux_instance_t *tdmi )
+{
+  epggrab_ota_mux_t *ota;
+  TAILQ_FOREACH(ota, &tdmi->tdmi_epg_grab, tdmi_link) {
+    if (ota->is_reg && (ota->state == EPGGRAB_OTA_MUX_IDLE ||
+                        ota->state == EPGGRAB_OTA_MUX_RUNNING)) return 1;
+  }
+  return 0;
+}
+
+/*
+ * Pick the mux on this adapter with the oldest EPG data that isn't
+ * covered by another tuner
+ */
 th_dvb_mux_instance_t *epggrab_mux_next ( th_dvb_adapter_t *tda )
 {
   time_t now;
-  epggrab_ota_mux_t *ota;
+  epggrab_ota_mux_t *ota, *best = NULL;
   time(&now);
   TAILQ_FOREACH(ota, &ota_mux_all, glob_link) {
-    if (ota->interval + ota->completed > now) return NULL;
-    if (!ota->is_reg) return NULL;
-    if (ota->tdmi->tdmi_adapter == tda) break;
+    if (!ota->is_reg) continue;
+    if (ota->tdmi->tdmi_adapter != tda || !ota->tdmi->tdmi_enabled) continue;
+    if (_epggrab_ota_covered(ota, now)) continue;
+    if (!best || ota->completed < best->completed) best = ota;
+  }
+  return best ? best->tdmi : NULL;
+}
+
+/*
+ * Statistics
+ */
+void epggrab_ota_stats_dump ( htsbuf_queue_t *hq )
+{
+  time_t now;
+  epggrab_module_t *m;
+  epggrab_ota_mux_t *ota;
+  th_dvb_adapter_t *tda;
+  int total, covered;
+  time_t oldest;
+  time(&now);
+
+  LIST_FOREACH(m, &epggrab_modules, link) {
+    if (m->type != EPGGRAB_OTA) continue;
+    total = covered = 0;
+    oldest = now;
+    TAILQ_FOREACH(ota, &((epggrab_module_ota_t*)m)->muxes, grab_link) {
+      if (!ota->is_reg) continue;
+      total++;
+      if (_epggrab_ota_covered(ota, now))
+        covered++;
+      else if (ota->completed < oldest)
+        oldest = ota->completed;
+    }
+    if (!total) continue;
+    htsbuf_qprintf(hq, "%s: %d of %d muxes covered", m->id, covered, total);
+    if (covered < total) {
+      if (oldest)
+        htsbuf_qprintf(hq, ", oldest data %d min old",
+                       (int)(now - oldest) / 60);
+      else
+        htsbuf_qprintf(hq, ", some never grabbed");
+    }
+    htsbuf_qprintf(hq, "\n");
+  }
+
+  htsbuf_qprintf(hq, "Grabs completed on EPG scans: %u, "
+                 "on muxes tuned for other reasons: %u\n",
+                 ota_complete_scan, ota_complete_piggyback);
+
+  TAILQ_FOREACH(tda, &dvb_adapters, tda_global_link) {
+    if (!tda->tda_epg_visits) continue;
+    htsbuf_qprintf(hq, "%s: %d EPG scans, %"PRId64" s tuned for EPG\n",
+                   tda->tda_displayname, tda->tda_epg_visits,
+                   tda->tda_epg_time / 1000);
   }
-  return ota ? ota->tdmi : NULL;
 }
 
 /* **************************************************************************
@@ -357,16 +468,16 @@ void epggrab_ota_complete  ( epggrab_ota_mux_t *ota )
     tvhlog(LOG_DEBUG, ota->grab->id, "processing complete");
     ota->state = EPGGRAB_OTA_MUX_COMPLETE;
     time(&ota->completed);
+    if (tdmi->tdmi_adapter->tda_mux_epg == tdmi)
+      ota_complete_scan++;
+    else
+      ota_complete_piggyback++;
 
-    /* Check others */
-    TAILQ_FOREACH(ota, &tdmi->tdmi_epg_grab, tdmi_link) {
-      if (ota->is_reg && ota->state == EPGGRAB_OTA_MUX_RUNNING) break;
-    }
-
-    /* All complete (bring timer forward) */
-    if (!ota) {
+    /* All complete (bring timer forward, or move on if tables are too) */
+    if (!epggrab_mux_running(tdmi)) {
       gtimer_arm(&tdmi->tdmi_adapter->tda_mux_scanner_timer,
                  dvb_adapter_mux_scanner, tdmi->tdmi_adapter, 20);
+      dvb_adapter_mux_done(tdmi);
     }
   }
 }
@@ -126,9 +126,9 @@ static uint8_t *_fb_deflate ( const uint8_t *data, size_t orig, size_t *size )
   zstr.avail_out = orig;
   zstr.next_out  = bufout;
     
-  /* Decompress */
+  /* Compress (fails if the output doesn't fit, i.e. no gain) */
   err = deflate(&zstr, Z_FINISH);
-  if ( (err != Z_STREAM_END && err != Z_OK) || zstr.total_out == 0 ) {
+  if ( err != Z_STREAM_END || zstr.total_out == 0 ) {
     free(bufout);
     bufout = NULL;
   } else {
@@ -405,18 +405,30 @@ fb_file *fb_open2
       const uint8_t *data;
       data     = ret->b.root->f.data;
       ret->buf = _fb_deflate(data, ret->size, &ret->size);
+
+      /* Incompressible, serve as is */
+      if (!ret->buf)
+        ret->gzip = 0;
     } else {
       uint8_t *data = malloc(ret->size);
       ssize_t c = fread(data, 1, ret->size, ret->d.cur);
-      if (c == ret->size)
+      if (c == ret->size) {
         ret->buf = _fb_deflate(data, ret->size, &ret->size);
+
+        /* Incompressible, serve as is */
+        if (!ret->buf) {
+          ret->gzip = 0;
+          ret->buf  = data;
+          data      = NULL;
+        }
+      }
       fclose(ret->d.cur);
       ret->d.cur = NULL;
       free(data);
     }
   
     /* Cleanup */
-    if (!ret->buf) {
+    if (!ret->buf && ret->gzip) {
       free(ret);
       ret = NULL; 
     }
@@ -567,39 +567,46 @@ htsmsg_print(htsmsg_t *msg)
 /**
  *
  */
+static void htsmsg_copy_i(htsmsg_t *src, htsmsg_t *dst);
+
 static void
-htsmsg_copy_i(htsmsg_t *src, htsmsg_t *dst)
+htsmsg_copy_field(htsmsg_field_t *f, htsmsg_t *dst)
 {
-  htsmsg_field_t *f;
   htsmsg_t *sub;
 
-  TAILQ_FOREACH(f, &src->hm_fields, hmf_link) {
-
-    switch(f->hmf_type) {
+  switch(f->hmf_type) {
 
-    case HMF_MAP:
-    case HMF_LIST:
-      sub = f->hmf_type == HMF_LIST ? 
-	htsmsg_create_list() : htsmsg_create_map();
-      htsmsg_copy_i(&f->hmf_msg, sub);
-      htsmsg_add_msg(dst, f->hmf_name, sub);
-      break;
+  case HMF_MAP:
+  case HMF_LIST:
+    sub = f->hmf_type == HMF_LIST ? 
+      htsmsg_create_list() : htsmsg_create_map();
+    htsmsg_copy_i(&f->hmf_msg, sub);
+    htsmsg_add_msg(dst, f->hmf_name, sub);
+    break;
       
-    case HMF_STR:
-      htsmsg_add_str(dst, f->hmf_name, f->hmf_str);
-      break;
+  case HMF_STR:
+    htsmsg_add_str(dst, f->hmf_name, f->hmf_str);
+    break;
 
-    case HMF_S64:
-      htsmsg_add_s64(dst, f->hmf_name, f->hmf_s64);
-      break;
+  case HMF_S64:
+    htsmsg_add_s64(dst, f->hmf_name, f->hmf_s64);
+    break;
 
-    case HMF_BIN:
-      htsmsg_add_bin(dst, f->hmf_name, f->hmf_bin, f->hmf_binsize);
-      break;
-    }
+  case HMF_BIN:
+    htsmsg_add_bin(dst, f->hmf_name, f->hmf_bin, f->hmf_binsize);
+    break;
   }
 }
 
+static void
+htsmsg_copy_i(htsmsg_t *src, htsmsg_t *dst)
+{
+  htsmsg_field_t *f;
+
+  TAILQ_FOREACH(f, &src->hm_fields, hmf_link)
+    htsmsg_copy_field(f, dst);
+}
+
 htsmsg_t *
 htsmsg_copy(htsmsg_t *src)
 {
@@ -609,6 +616,23 @@ htsmsg_copy(htsmsg_t *src)
 }
 
 
+/**
+ *
+ */
+void
+htsmsg_merge(htsmsg_t *dst, htsmsg_t *src)
+{
+  htsmsg_field_t *f;
+
+  TAILQ_FOREACH(f, &src->hm_fields, hmf_link) {
+    if(f->hmf_name != NULL)
+      while(!htsmsg_delete_field(dst, f->hmf_name))
+	;
+    htsmsg_copy_field(f, dst);
+  }
+}
+
+
 /**
  *
  */
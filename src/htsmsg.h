@@ -273,6 +273,12 @@ htsmsg_field_t *htsmsg_field_add(htsmsg_t *msg, const char *name,
  */
 htsmsg_t *htsmsg_copy(htsmsg_t *src);
 
+/**
+ * Copy all fields of \p src into \p dst, replacing any fields in
+ * \p dst with the same name.
+ */
+void htsmsg_merge(htsmsg_t *dst, htsmsg_t *src);
+
 #define HTSMSG_FOREACH(f, msg) TAILQ_FOREACH(f, &(msg)->hm_fields, hmf_link)
 
 
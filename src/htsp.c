@@ -39,6 +39,7 @@
 #include "streaming.h"
 #include "psi.h"
 #include "htsmsg_binary.h"
+#include "stats.h"
 
 #include <sys/statvfs.h>
 #include "settings.h"
@@ -46,7 +47,17 @@
 
 static void *htsp_server;
 
-#define HTSP_PROTO_VERSION 5
+/**
+ * Protocol version, additions since 5:
+ *
+ * 6: getEvents accepts 'channelId', 'start' and 'maxTime' to list the
+ *    events of a channel from a given time
+ *    dvrEntry messages carry 'conflict' when no tuner is free for them
+ *    Subscribers get a 'signalStatus' message every second, with the
+ *    quality and input statistics of the service (only clients that
+ *    said hello with version 6 or later)
+ */
+#define HTSP_PROTO_VERSION 6
 
 #define HTSP_PRIV_MASK (ACCESS_STREAMING)
 
@@ -61,6 +72,7 @@ TAILQ_HEAD(htsp_msg_q_queue, htsp_msg_q);
 static struct htsp_connection_list htsp_async_connections;
 
 static void htsp_streaming_input(void *opaque, streaming_message_t *sm);
+static void htsp_signal_status(void *aux);
 
 
 /**
@@ -77,6 +89,9 @@ typedef struct htsp_msg {
 			   hm_msg can contain messages that points
 			   to packet payload so to avoid copy we
 			   keep a reference here */
+#if ENABLE_STATS
+  uint64_t hm_time;     /* When queued, see stats.h */
+#endif
 } htsp_msg_t;
 
 
@@ -159,6 +174,8 @@ typedef struct htsp_subscription {
 
   time_t hs_last_report; /* Last queue status report sent */
 
+  gtimer_t hs_signal_timer; /* Periodic 'signalStatus' (version 6+) */
+
   int hs_dropstats[PKT_NTYPES];
 
 } htsp_subscription_t;
@@ -237,6 +254,7 @@ static void
 htsp_subscription_destroy(htsp_connection_t *htsp, htsp_subscription_t *hs)
 {
   LIST_REMOVE(hs, hs_link);
+  gtimer_disarm(&hs->hs_signal_timer);
   subscription_unsubscribe(hs->hs_s);
   htsp_flush_queue(htsp, &hs->hs_q);
   free(hs);
@@ -257,6 +275,7 @@ htsp_send(htsp_connection_t *htsp, htsmsg_t *m, pktbuf_t *pb,
   if(pb != NULL)
     pktbuf_ref_inc(pb);
   hm->hm_payloadsize = payloadsize;
+  STATS_STAMP(hm->hm_time);
   
   pthread_mutex_lock(&htsp->htsp_out_mutex);
 
@@ -410,6 +429,8 @@ htsp_build_dvrentry(dvr_entry_t *de, const char *method)
   htsmsg_add_str(out, "state", s);
   if(error)
     htsmsg_add_str(out, "error", error);
+  if(de->de_plan_conflict)
+    htsmsg_add_u32(out, "conflict", 1);
   htsmsg_add_str(out, "method", method);
   return out;
 }
@@ -784,35 +805,52 @@ htsp_build_event(epg_broadcast_t *e)
 }
 
 /**
- * Get information about the given event + 
- * n following events
+ * Get information about the given event + n following events, or
+ * about the events on a channel from a given time (default now).
+ * 'maxTime' limits the result to events starting before that time.
  */
 static htsmsg_t *
 htsp_method_getEvents(htsp_connection_t *htsp, htsmsg_t *in)
 {
-  uint32_t eventid, numFollowing;
+  uint32_t eventid, channelid, numFollowing;
+  int64_t start, maxtime;
   htsmsg_t *out, *events;
   epg_broadcast_t *e;
+  channel_t *ch;
 
-  if(htsmsg_get_u32(in, "eventId", &eventid))
-    return htsp_error("Missing argument 'eventId'");
+  if(htsmsg_get_s64(in, "maxTime", &maxtime))
+    maxtime = 0;
 
-  if(htsmsg_get_u32(in, "numFollowing", &numFollowing))
-    return htsp_error("Missing argument 'numFollowing'");
+  if(htsmsg_get_u32(in, "numFollowing", &numFollowing)) {
+    if(!maxtime)
+      return htsp_error("Missing argument 'numFollowing'");
+    numFollowing = UINT32_MAX;
+  }
 
-  if((e = epg_broadcast_find_by_id(eventid, NULL)) == NULL) {
-    return htsp_error("Event does not exist");
+  if(!htsmsg_get_u32(in, "eventId", &eventid)) {
+    if((e = epg_broadcast_find_by_id(eventid, NULL)) == NULL)
+      return htsp_error("Event does not exist");
+  } else if(!htsmsg_get_u32(in, "channelId", &channelid)) {
+    if((ch = channel_find_by_identifier(channelid)) == NULL)
+      return htsp_error("Channel does not exist");
+    if(htsmsg_get_s64(in, "start", &start))
+      start = dispatch_clock;
+    e = epg_channel_find_at(ch, start);
+  } else {
+    return htsp_error("Missing argument 'eventId'");
   }
 
   out = htsmsg_create_map();
   events = htsmsg_create_list();
   
-  htsmsg_add_msg(events, NULL, htsp_build_event(e));
-  while( numFollowing-- > 0 ) {
-    e = epg_broadcast_get_next(e);
-    if( e == NULL ) 
-      break;
+  if(e != NULL && (!maxtime || e->start < maxtime)) {
     htsmsg_add_msg(events, NULL, htsp_build_event(e));
+    while( numFollowing-- > 0 ) {
+      e = epg_broadcast_get_next(e);
+      if( e == NULL || (maxtime && e->start >= maxtime) )
+        break;
+      htsmsg_add_msg(events, NULL, htsp_build_event(e));
+    }
   }
   
   htsmsg_add_msg(out, "events", events);
@@ -923,6 +961,9 @@ htsp_method_subscribe(htsp_connection_t *htsp, htsmsg_t *in)
   hs->hs_s = subscription_create_from_channel(ch, weight,
 					      htsp->htsp_logname,
 					      &hs->hs_input, 0);
+
+  if(htsp->htsp_version >= 6)
+    gtimer_arm(&hs->hs_signal_timer, htsp_signal_status, hs, 1);
   return NULL;
 }
 
@@ -1035,6 +1076,7 @@ htsp_method_hello(htsp_connection_t *htsp, htsmsg_t *in)
     return htsp_error("Missing argument 'clientname'");
 
   tvh_str_update(&htsp->htsp_clientname, htsmsg_get_str(in, "clientname"));
+  htsp->htsp_version = v;
 
   tvhlog(LOG_INFO, "htsp", "%s: Welcomed client software: %s",
 	 htsp->htsp_logname, name);
@@ -1251,6 +1293,7 @@ htsp_write_scheduler(void *aux)
   htsp_msg_t *hm;
   void *dptr;
   size_t dlen;
+  STATS_SPAN(span);
 
   pthread_mutex_lock(&htsp->htsp_out_mutex);
 
@@ -1283,6 +1326,8 @@ htsp_write_scheduler(void *aux)
 
     pthread_mutex_unlock(&htsp->htsp_out_mutex);
 
+    STATS_SINCE(hm->hm_time, STATS_QUEUE);
+
     r = htsmsg_binary_serialize(hm->hm_msg, &dptr, &dlen, INT32_MAX);
 
 #if 0
@@ -1293,7 +1338,9 @@ htsp_write_scheduler(void *aux)
     htsp_msg_destroy(hm);
    
     /* ignore return value */ 
+    STATS_ENTER(span);
     r = write(htsp->htsp_fd, dptr, dlen);
+    STATS_LEAVE(span, STATS_WRITE);
     if(r != dlen)
       tvhlog(LOG_INFO, "htsp", "%s: Write error -- %s", 
 	     htsp->htsp_logname, strerror(errno));
@@ -1530,32 +1577,18 @@ const static char frametypearray[PKT_NTYPES] = {
 };
 
 /**
- * Build a htsmsg from a th_pkt and enqueue it on our HTSP service
+ * Build a 'muxpkt' message from a th_pkt
+ *
+ * The payload is not copied, so the packet must have its header merged
+ * and stay referenced until the message has been serialized
  */
-static void
-htsp_stream_deliver(htsp_subscription_t *hs, th_pkt_t *pkt)
+htsmsg_t *
+htsp_build_muxpkt(uint32_t sid, th_pkt_t *pkt)
 {
-  htsmsg_t *m, *n;
-  htsp_msg_t *hm;
-  htsp_connection_t *htsp = hs->hs_htsp;
-  int64_t ts;
-  int qlen = hs->hs_q.hmq_payload;
-
-  if((qlen > 500000 && pkt->pkt_frametype == PKT_B_FRAME) ||
-     (qlen > 750000 && pkt->pkt_frametype == PKT_P_FRAME) || 
-     (qlen > 1500000)) {
-
-    hs->hs_dropstats[pkt->pkt_frametype]++;
-
-    /* Queue size protection */
-    pkt_ref_dec(pkt);
-    return;
-  }
+  htsmsg_t *m = htsmsg_create_map();
 
-  m = htsmsg_create_map();
- 
   htsmsg_add_str(m, "method", "muxpkt");
-  htsmsg_add_u32(m, "subscriptionId", hs->hs_sid);
+  htsmsg_add_u32(m, "subscriptionId", sid);
   htsmsg_add_u32(m, "frametype", frametypearray[pkt->pkt_frametype]);
 
   htsmsg_add_u32(m, "stream", pkt->pkt_componentindex);
@@ -1574,8 +1607,6 @@ htsp_stream_deliver(htsp_subscription_t *hs, th_pkt_t *pkt)
 
   uint32_t dur = ts_rescale(pkt->pkt_duration, 1000000);
   htsmsg_add_u32(m, "duration", dur);
-  
-  pkt = pkt_merge_header(pkt);
 
   /**
    * Since we will serialize directly we use 'binptr' which is a binary
@@ -1583,6 +1614,68 @@ htsp_stream_deliver(htsp_subscription_t *hs, th_pkt_t *pkt)
    */
   htsmsg_add_binptr(m, "payload", pktbuf_ptr(pkt->pkt_payload),
 		    pktbuf_len(pkt->pkt_payload));
+  return m;
+}
+
+
+/**
+ * Send a 'signalStatus' message with the input statistics of the
+ * service we are delivering from, once a second
+ *
+ * Runs from a timer rather than the delivery path, the quality
+ * callbacks of the inputs want the global lock
+ */
+static void
+htsp_signal_status(void *aux)
+{
+  htsp_subscription_t *hs = aux;
+  service_t *t;
+  htsmsg_t *m;
+
+  lock_assert(&global_lock);
+
+  gtimer_arm(&hs->hs_signal_timer, htsp_signal_status, hs, 1);
+
+  if((t = hs->hs_s->ths_service) == NULL)
+    return;
+
+  m = htsmsg_create_map();
+  htsmsg_add_str(m, "method", "signalStatus");
+  htsmsg_add_u32(m, "subscriptionId", hs->hs_sid);
+  if(t->s_quality_index != NULL)
+    htsmsg_add_u32(m, "quality", MAX(t->s_quality_index(t), 0));
+  htsmsg_add_msg(m, "input", avgstat_input_msg(&t->s_rate, &t->s_cc_errors,
+					       &t->s_tei_errors,
+					       dispatch_clock));
+  htsp_send_message(hs->hs_htsp, m, &hs->hs_htsp->htsp_hmq_qstatus);
+}
+
+
+/**
+ * Build a htsmsg from a th_pkt and enqueue it on our HTSP service
+ */
+static void
+htsp_stream_deliver(htsp_subscription_t *hs, th_pkt_t *pkt)
+{
+  htsmsg_t *m, *n;
+  htsp_msg_t *hm;
+  htsp_connection_t *htsp = hs->hs_htsp;
+  int64_t ts;
+  int qlen = hs->hs_q.hmq_payload;
+
+  if((qlen > 500000 && pkt->pkt_frametype == PKT_B_FRAME) ||
+     (qlen > 750000 && pkt->pkt_frametype == PKT_P_FRAME) || 
+     (qlen > 1500000)) {
+
+    hs->hs_dropstats[pkt->pkt_frametype]++;
+
+    /* Queue size protection */
+    pkt_ref_dec(pkt);
+    return;
+  }
+
+  pkt = pkt_merge_header(pkt);
+  m = htsp_build_muxpkt(hs->hs_sid, pkt);
   htsp_send(htsp, m, pkt->pkt_payload, &hs->hs_q, pktbuf_len(pkt->pkt_payload));
 
   if(hs->hs_last_report != dispatch_clock) {
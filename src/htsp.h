@@ -38,4 +38,6 @@ void htsp_dvr_entry_add(dvr_entry_t *de);
 void htsp_dvr_entry_update(dvr_entry_t *de);
 void htsp_dvr_entry_delete(dvr_entry_t *de);
 
+htsmsg_t *htsp_build_muxpkt(uint32_t sid, struct th_pkt *pkt);
+
 #endif /* HTSP_H_ */
@@ -25,6 +25,7 @@
 #include <stdarg.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -129,6 +130,7 @@ http_rc2str(int code)
   case HTTP_STATUS_UNAUTHORIZED:    return "Unauthorized";
   case HTTP_STATUS_BAD_REQUEST:     return "Bad request";
   case HTTP_STATUS_FOUND:           return "Found";
+  case HTTP_STATUS_NOT_MODIFIED:    return "Not Modified";
   default:
     return "Unknown returncode";
     break;
@@ -145,14 +147,14 @@ static const char *cachemonths[12] = {
 };
 
 /**
- * Transmit a HTTP reply
+ * Build the header of a HTTP reply
  */
-void
-http_send_header(http_connection_t *hc, int rc, const char *content, 
-		 int64_t contentlen,
-		 const char *encoding, const char *location, 
-		 int maxage, const char *range,
-		 const char *disposition)
+static void
+http_build_header(http_connection_t *hc, htsbuf_queue_t *hq, int rc,
+		  const char *content, int64_t contentlen,
+		  const char *encoding, const char *location, 
+		  int maxage, const char *range,
+		  const char *disposition, const char *etag)
 {
   struct tm tm0, *tm;
   htsbuf_queue_t hdrs;
@@ -166,6 +168,13 @@ http_send_header(http_connection_t *hc, int rc, const char *content,
 
   htsbuf_qprintf(&hdrs, "Server: HTS/tvheadend\r\n");
 
+  /* Tagged entities are the cached static files, sent gzipped or
+     not depending on what the client accepts */
+  if(etag != NULL) {
+    htsbuf_qprintf(&hdrs, "ETag: %s\r\n", etag);
+    htsbuf_qprintf(&hdrs, "Vary: Accept-Encoding\r\n");
+  }
+
   if(maxage == 0) {
     htsbuf_qprintf(&hdrs, "Cache-Control: no-cache\r\n");
   } else {
@@ -218,10 +227,85 @@ http_send_header(http_connection_t *hc, int rc, const char *content,
   
   htsbuf_qprintf(&hdrs, "\r\n");
 
+  htsbuf_appendq(hq, &hdrs);
+}
+
+
+/**
+ * Transmit a HTTP reply
+ */
+void
+http_send_header(http_connection_t *hc, int rc, const char *content, 
+		 int64_t contentlen,
+		 const char *encoding, const char *location, 
+		 int maxage, const char *range,
+		 const char *disposition)
+{
+  htsbuf_queue_t hdrs;
+
+  htsbuf_queue_init(&hdrs, 0);
+  http_build_header(hc, &hdrs, rc, content, contentlen, encoding, location,
+		    maxage, range, disposition, NULL);
   tcp_write_queue(hc->hc_fd, &hdrs);
 }
 
 
+/**
+ * Transmit a HTTP reply with an in-memory body, header and body are
+ * handed to the kernel in a single writev()
+ */
+int
+http_send_data(http_connection_t *hc, int rc, const char *content,
+	       const char *encoding, const char *etag, int maxage,
+	       const void *data, size_t len)
+{
+  htsbuf_queue_t hdrs;
+  htsbuf_data_t *hd;
+  struct iovec *iov;
+  ssize_t r;
+  int i = 0, iovcnt = 1;
+
+  htsbuf_queue_init(&hdrs, 0);
+  http_build_header(hc, &hdrs, rc, content, len, encoding, NULL,
+		    maxage, NULL, NULL, etag);
+
+  if(hc->hc_no_output)
+    len = 0;
+
+  TAILQ_FOREACH(hd, &hdrs.hq_q, hd_link)
+    iovcnt++;
+  iov = alloca(sizeof(struct iovec) * iovcnt);
+
+  TAILQ_FOREACH(hd, &hdrs.hq_q, hd_link) {
+    iov[i  ].iov_base = hd->hd_data     + hd->hd_data_off;
+    iov[i++].iov_len  = hd->hd_data_len - hd->hd_data_off;
+  }
+  iov[i].iov_base = (void *)data;
+  iov[i].iov_len  = len;
+
+  while(iovcnt) {
+    r = writev(hc->hc_fd, iov, iovcnt);
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r <= 0)
+      break;
+
+    while(iovcnt && r >= iov->iov_len) {
+      r -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if(iovcnt) {
+      iov->iov_base += r;
+      iov->iov_len  -= r;
+    }
+  }
+
+  htsbuf_queue_flush(&hdrs);
+  return iovcnt ? -1 : 0;
+}
+
+
 
 /**
  * Transmit a HTTP reply
@@ -32,6 +32,7 @@ typedef struct http_arg {
 #define HTTP_STATUS_OK           200
 #define HTTP_STATUS_PARTIAL_CONTENT 206
 #define HTTP_STATUS_FOUND        302
+#define HTTP_STATUS_NOT_MODIFIED 304
 #define HTTP_STATUS_BAD_REQUEST  400
 #define HTTP_STATUS_UNAUTHORIZED 401
 #define HTTP_STATUS_NOT_FOUND    404
@@ -116,6 +117,10 @@ void http_send_header(http_connection_t *hc, int rc, const char *content,
 		      const char *location, int maxage, const char *range,
 		      const char *disposition);
 
+int http_send_data(http_connection_t *hc, int rc, const char *content,
+		   const char *encoding, const char *etag, int maxage,
+		   const void *data, size_t len);
+
 typedef int (http_callback_t)(http_connection_t *hc, 
 			      const char *remain, void *opaque);
 
@@ -22,6 +22,7 @@
 #include "redblack.h"
 #include "lang_codes.h"
 #include "lang_str.h"
+#include "strpool.h"
 
 /* ************************************************************************
  * Support
@@ -48,7 +49,7 @@ void lang_str_destroy ( lang_str_t *ls )
 { 
   lang_str_ele_t *e;
   while ((e = RB_FIRST(ls))) {
-    if (e->str)  free(e->str);
+    strpool_put(e->str);
     RB_REMOVE(ls, e, link);
     free(e);
   }
@@ -59,9 +60,13 @@ void lang_str_destroy ( lang_str_t *ls )
 lang_str_t *lang_str_copy ( const lang_str_t *ls )
 {
   lang_str_t *ret = lang_str_create();
-  lang_str_ele_t *e;
-  RB_FOREACH(e, ls, link)
-    lang_str_add(ret, e->str, e->lang, 0);
+  lang_str_ele_t *e, *c;
+  RB_FOREACH(e, ls, link) {
+    c = calloc(1, sizeof(lang_str_ele_t));
+    c->lang = e->lang;
+    c->str  = strpool_ref(e->str);
+    RB_INSERT_SORTED(ret, c, link, _lang_cmp);
+  }
   return ret;
 }
 
@@ -109,6 +114,7 @@ static int _lang_str_add
   int save = 0;
   static lang_str_ele_t *skel = NULL;
   lang_str_ele_t *e;
+  char *tmp;
 
   if (!str) return 0;
 
@@ -122,20 +128,24 @@ static int _lang_str_add
   /* Create */
   e = RB_INSERT_SORTED(ls, skel, link, _lang_cmp);
   if (!e) {
-    skel->str = strdup(str);
+    skel->str = strpool_get(str);
     skel = NULL;
     save = 1;
 
   /* Append */
   } else if (append) {
-    e->str = realloc(e->str, strlen(e->str) + strlen(str) + 1);
-    strcat(e->str, str);
+    tmp = malloc(strlen(e->str) + strlen(str) + 1);
+    strcpy(tmp, e->str);
+    strcat(tmp, str);
+    strpool_put(e->str);
+    e->str = strpool_get(tmp);
+    free(tmp);
     save = 1;
 
   /* Update */
   } else if (update && strcmp(str, e->str)) {
-    free(e->str);
-    e->str = strdup(str);
+    strpool_put(e->str);
+    e->str = strpool_get(str);
     save = 1;
   }
   
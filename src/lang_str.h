@@ -26,7 +26,7 @@ typedef struct lang_str_ele
 {
   RB_ENTRY(lang_str_ele) link;
   const char *lang;
-  char *str;
+  const char *str;  /* From the string pool */
 } lang_str_ele_t;
 
 typedef RB_HEAD(lang_str, lang_str_ele) lang_str_t;
@@ -60,6 +60,8 @@
 #include "ffdecsa/FFdecsa.h"
 #include "muxes.h"
 #include "config2.h"
+#include "bench.h"
+#include "stats.h"
 
 int running;
 time_t dispatch_clock;
@@ -194,7 +196,15 @@ usage(const char *argv0)
   printf(" -d              Log debug to console\n");
   printf(" -j <id>         Statically join the given transport id\n");
   printf(" -r <tsfile>     Read the given transport stream file and present\n"
-	 "                 found services as channels\n");
+	 "                 found services as channels. May be given up to\n"
+	 "                 8 times\n");
+  printf(" -R <count>      Number of virtual adapters replaying each -r file\n"
+	 "                 [default 1]\n");
+  printf(" -P <speed>      Replay speed for -r files, 1 is real time and 0\n"
+	 "                 reads as fast as possible [default 1]\n");
+  printf(" -B <options>    Benchmark the streaming path on the -r services\n"
+	 "                 and exit, options are subs=<n>,time=<secs>,\n"
+	 "                 mux=pass|matroska|htsp,sink=null|tcp,out=<file>\n");
   printf(" -A              Immediately call abort()\n");
 	 
   printf("\n");
@@ -260,7 +270,10 @@ main(int argc, char **argv)
   int createdefault = 0;
   sigset_t set;
   const char *homedir;
-  const char *rawts_input = NULL;
+  const char *rawts_input[8];
+  int rawts_inputs = 0, rawts_instances = 1, i;
+  double rawts_speed = 1.0;
+  const char *bench_opts = NULL;
   const char *join_transport = NULL;
   const char *confpath = NULL;
   char *p, *endp;
@@ -278,7 +291,7 @@ main(int argc, char **argv)
   // make sure the timezone is set
   tzset();
 
-  while((c = getopt(argc, argv, "Aa:fp:u:g:c:Chdr:j:sw:e:")) != -1) {
+  while((c = getopt(argc, argv, "Aa:fp:u:g:c:Chdr:R:P:B:j:sw:e:")) != -1) {
     switch(c) {
     case 'a':
       adapter_mask = 0x0;
@@ -334,7 +347,26 @@ main(int argc, char **argv)
       createdefault = 1;
       break;
     case 'r':
-      rawts_input = optarg;
+      if(rawts_inputs < sizeof(rawts_input) / sizeof(rawts_input[0]))
+	rawts_input[rawts_inputs++] = optarg;
+      break;
+    case 'R':
+      rawts_instances = strtol(optarg, &endp, 10);
+      if (*optarg == 0 || *endp != 0 || rawts_instances < 1) {
+        fprintf(stderr, "Invalid replay adapter count '%s'\n", optarg);
+        return 1;
+      }
+      break;
+    case 'P':
+      rawts_speed = strtod(optarg, &endp);
+      if (*optarg == 0 || *endp != 0 ||
+          !(rawts_speed >= 0 && rawts_speed <= 1000)) {
+        fprintf(stderr, "Invalid replay speed '%s'\n", optarg);
+        return 1;
+      }
+      break;
+    case 'B':
+      bench_opts = optarg;
       break;
     case 'j':
       join_transport = optarg;
@@ -395,6 +427,10 @@ main(int argc, char **argv)
 
   pthread_mutex_lock(&global_lock);
 
+#if ENABLE_STATS
+  stats_init();
+#endif
+
   time(&dispatch_clock);
 
   trap_init(argv[0]);
@@ -440,8 +476,11 @@ main(int argc, char **argv)
 
   ffdecsa_init();
   
-  if(rawts_input != NULL)
-    rawts_init(rawts_input);
+  for(i = 0; i < rawts_inputs; i++)
+    rawts_init(rawts_input[i], rawts_instances, rawts_speed);
+
+  if(bench_opts != NULL)
+    bench_init(bench_opts);
 
   if(join_transport != NULL)
     subscription_dummy_join(join_transport, 1);
@@ -48,6 +48,8 @@ typedef struct muxer {
   int         (*m_write_pkt)  (struct muxer *, struct th_pkt *);        // Append a media packet
 
   int                    m_errors;     // Number of errors
+  uint64_t               m_bytes;      // Number of bytes written
+  uint64_t               m_writes;     // Number of write calls
   muxer_container_type_t m_container;  // The type of the container
 } muxer_t;
 
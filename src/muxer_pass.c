@@ -25,6 +25,7 @@
 #include "epg.h"
 #include "psi.h"
 #include "muxer_pass.h"
+#include "stats.h"
 
 #define TS_BUFFER_COUNT   100
 #define TS_INJECTION_RATE 1000
@@ -179,14 +180,25 @@ static void
 pass_muxer_write(muxer_t *m, const void *ts, size_t len)
 {
   pass_muxer_t *pm = (pass_muxer_t*)m;
+  ssize_t r = 0;
+  STATS_SPAN(span);
+
+  if(!pm->pm_error) {
+    STATS_ENTER(span);
+    r = write(pm->pm_fd, ts, len);
+    STATS_LEAVE(span, STATS_WRITE);
+  }
 
   if(pm->pm_error) {
     pm->m_errors++;
-  } else if(write(pm->pm_fd, ts, len) != len) {
+  } else if(r != len) {
     pm->pm_error = errno;
     tvhlog(LOG_ERR, "pass", "%s: Write failed -- %s", pm->pm_filename, 
 	   strerror(errno));
     m->m_errors++;
+  } else {
+    m->m_bytes += len;
+    m->m_writes++;
   }
 }
 
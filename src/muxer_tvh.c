@@ -29,6 +29,16 @@ typedef struct tvh_muxer {
 } tvh_muxer_t;
 
 
+/**
+ * Copy the output statistics from the mkv muxer
+ */
+static void
+tvh_muxer_update_stats(tvh_muxer_t *tm)
+{
+  mk_mux_get_stats(tm->tm_ref, &tm->m_bytes, &tm->m_writes);
+}
+
+
 /**
  * Figure out the mimetype
  */
@@ -75,6 +85,8 @@ tvh_muxer_init(muxer_t* m, const struct streaming_start *ss, const char *name)
     return -1;
   }
 
+  tvh_muxer_update_stats(tm);
+
   return 0;
 }
 
@@ -126,6 +138,8 @@ tvh_muxer_write_pkt(muxer_t *m, struct th_pkt *pkt)
     return -1;
   }
 
+  tvh_muxer_update_stats(tm);
+
   return 0;
 }
 
@@ -143,6 +157,8 @@ tvh_muxer_write_meta(muxer_t *m, struct epg_broadcast *eb)
     return -1;
   }
 
+  tvh_muxer_update_stats(tm);
+
   return 0;
 }
 
@@ -160,6 +176,8 @@ tvh_muxer_close(muxer_t *m)
     return -1;
   }
 
+  tvh_muxer_update_stats(tm);
+
   return 0;
 }
 
@@ -173,7 +191,7 @@ tvh_muxer_destroy(muxer_t *m)
   tvh_muxer_t *tm = (tvh_muxer_t*)m;
 
   if(tm->tm_ref)
-    free(tm->tm_ref);
+    mk_mux_destroy(tm->tm_ref);
 
   free(tm);
 }
@@ -21,6 +21,7 @@
 #include "packet.h"
 #include "string.h"
 #include "atomic.h"
+#include "stats.h"
 
 /*
  *
@@ -47,6 +48,7 @@ pkt_alloc(const void *data, size_t datalen, int64_t pts, int64_t dts)
   th_pkt_t *pkt;
 
   pkt = calloc(1, sizeof(th_pkt_t));
+  STATS_ALLOC(STATS_ALLOC_PKT);
   if(datalen)
     pkt->pkt_payload = pktbuf_alloc(data, datalen);
   pkt->pkt_dts = dts;
@@ -108,6 +110,7 @@ void
 pktref_enqueue(struct th_pktref_queue *q, th_pkt_t *pkt)
 {
   th_pktref_t *pr = malloc(sizeof(th_pktref_t));
+  STATS_ALLOC(STATS_ALLOC_PKTREF);
   pr->pr_pkt = pkt;
   TAILQ_INSERT_TAIL(q, pr, pr_link);
 }
@@ -138,6 +141,7 @@ pkt_merge_header(th_pkt_t *pkt)
     return pkt;
 
   n = malloc(sizeof(th_pkt_t));
+  STATS_ALLOC(STATS_ALLOC_PKT);
   *n = *pkt;
 
   n->pkt_refcount = 1;
@@ -167,6 +171,7 @@ th_pkt_t *
 pkt_copy_shallow(th_pkt_t *pkt)
 {
   th_pkt_t *n = malloc(sizeof(th_pkt_t));
+  STATS_ALLOC(STATS_ALLOC_PKT);
   *n = *pkt;
 
   n->pkt_refcount = 1;
@@ -188,6 +193,7 @@ th_pktref_t *
 pktref_create(th_pkt_t *pkt)
 {
   th_pktref_t *pr = malloc(sizeof(th_pktref_t));
+  STATS_ALLOC(STATS_ALLOC_PKTREF);
   pr->pr_pkt = pkt;
   return pr;
 }
@@ -213,6 +219,7 @@ pktbuf_t *
 pktbuf_alloc(const void *data, size_t size)
 {
   pktbuf_t *pb = malloc(sizeof(pktbuf_t));
+  STATS_ALLOC(STATS_ALLOC_PKTBUF);
   pb->pb_refcount = 1;
   pb->pb_size = size;
 
@@ -228,6 +235,7 @@ pktbuf_t *
 pktbuf_make(void *data, size_t size)
 {
   pktbuf_t *pb = malloc(sizeof(pktbuf_t));
+  STATS_ALLOC(STATS_ALLOC_PKTBUF);
   pb->pb_refcount = 1;
   pb->pb_size = size;
   pb->pb_data = data;
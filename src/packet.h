@@ -56,6 +56,8 @@ typedef struct th_pkt {
   pktbuf_t *pkt_payload;
   pktbuf_t *pkt_header;
 
+  int64_t pkt_rcvtime; // Monotonic clock when the parser emitted the frame
+
 } th_pkt_t;
 
 
@@ -1392,7 +1392,6 @@ parser_deliver(service_t *t, elementary_stream_t *st, th_pkt_t *pkt)
   pkt->pkt_aspect_num = st->es_aspect_num;
   pkt->pkt_aspect_den = st->es_aspect_den;
 
-  //  avgstat_add(&st->es_rate, pkt->pkt_payloadlen, dispatch_clock);
 
   /**
    * Input is ok
@@ -1401,6 +1400,9 @@ parser_deliver(service_t *t, elementary_stream_t *st, th_pkt_t *pkt)
 
   /* Forward packet */
   pkt->pkt_componentindex = st->es_index;
+  pkt->pkt_rcvtime = getmonoclock();
+
+  service_gop_cache_add(t, st, pkt);
 
   streaming_message_t *sm = streaming_msg_create_pkt(pkt);
 
@@ -19,6 +19,7 @@
 #include "tvheadend.h"
 #include "streaming.h"
 #include "tsfix.h"
+#include "stats.h"
 
 LIST_HEAD(tfstream_list, tfstream);
 
@@ -347,10 +348,13 @@ static void
 tsfix_input(void *opaque, streaming_message_t *sm)
 {
   tsfix_t *tf = opaque;
+  STATS_SPAN(span);
 
   switch(sm->sm_type) {
   case SMT_PACKET:
+    STATS_ENTER(span);
     tsfix_input_packet(tf, sm);
+    STATS_LEAVE(span, STATS_TSFIX);
     return;
 
   case SMT_START:
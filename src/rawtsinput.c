@@ -34,19 +34,61 @@
 #include "psi.h"
 #include "tsdemux.h"
 #include "channels.h"
+#include "stats.h"
+
+#define RAWTS_READ_PACKETS 348  // Packets per read()
+#define RAWTS_PCR_MASK     0x1ffffffffLL
+#define RAWTS_MAX_LAG      1000000 // us behind schedule before we re-anchor
 
 typedef struct rawts {
+  LIST_ENTRY(rawts) rt_link;
+
   int rt_fd;
 
   char *rt_identifier;
+  char *rt_filename;
   psi_section_t rt_pat;
 
   struct service_list rt_services;
 
   int rt_pcr_pid;
 
+  /**
+   * Pacing: PCR rt_pcr_start (90kHz) is played out at monotonic time
+   * rt_clock_start (us), scaled by rt_speed. A speed of 0 disables
+   * pacing altogether.
+   */
+  double rt_speed;
+  int64_t rt_pcr_start;
+  int64_t rt_pcr_prev;
+  int64_t rt_clock_start;
+
+  uint64_t rt_packets;
+  int rt_loops;
+  int rt_late;
+
 } rawts_t;
 
+static LIST_HEAD(, rawts) rawts_instances;
+static int rawts_tally;
+
+
+/**
+ *
+ */
+static rawts_t *
+rawts_find_by_service(service_t *t)
+{
+  rawts_t *rt;
+  service_t *s;
+
+  LIST_FOREACH(rt, &rawts_instances, rt_link)
+    LIST_FOREACH(s, &rt->rt_services, s_group_link)
+      if(s == t)
+	return rt;
+  return NULL;
+}
+
 
 /**
  *
@@ -72,7 +114,7 @@ static void
 rawts_service_save(service_t *t)
 {
   htsmsg_t *m = htsmsg_create_map();
-  printf("SAVE %s\n", service_nicename(t));
+  tvhlog(LOG_DEBUG, "rawts", "Saving %s", service_nicename(t));
   
   pthread_mutex_lock(&t->s_stream_mutex); 
   psi_save_service_settings(m, t);
@@ -100,7 +142,18 @@ rawts_service_quality(service_t *t)
 static void
 rawts_service_setsourceinfo(service_t *t, struct source_info *si)
 {
+  rawts_t *rt = rawts_find_by_service(t);
+
   memset(si, 0, sizeof(struct source_info));
+
+  if(rt == NULL)
+    return;
+
+  si->si_device  = strdup(rt->rt_filename);
+  si->si_adapter = strdup(rt->rt_identifier);
+  si->si_mux     = strdup(rt->rt_filename);
+  if(t->s_svcname != NULL)
+    si->si_service = strdup(t->s_svcname);
 }
 
 
@@ -163,9 +216,8 @@ got_pmt(struct service *t, elementary_stream_t *st,
   if(table[0] != 2)
     return;
 
-  pthread_mutex_lock(&global_lock);
+  /* Called with s_stream_mutex held, like iptv we don't need global_lock */
   psi_parse_pmt(t, table + 3, table_len - 3, 1, 0);
-  pthread_mutex_unlock(&global_lock);
 }
 
 
@@ -226,15 +278,80 @@ rawts_pat(rawts_t *rt, const uint8_t *tsb)
 
 
 /**
+ * Extract the PCR base (90kHz) from a packet, if it carries one
+ */
+static int64_t
+rawts_get_pcr(const uint8_t *tsb)
+{
+  if(!(tsb[3] & 0x20) || tsb[4] == 0 || !(tsb[5] & 0x10))
+    return PTS_UNSET;
+
+  return (uint64_t)tsb[6] << 25 | (uint64_t)tsb[7] << 17 |
+    (uint64_t)tsb[8] << 9 | (uint64_t)tsb[9] << 1 | tsb[10] >> 7;
+}
+
+
+/**
+ * Sleep until the packet carrying the given PCR is due
  *
+ * The schedule is anchored at the first PCR, so sleep jitter does not
+ * accumulate. Loop restarts, discontinuities and falling too far behind
+ * all re-anchor the schedule.
  */
 static void
-process_ts_packet(rawts_t *rt, uint8_t *tsb)
+rawts_pace(rawts_t *rt, int64_t pcr)
+{
+  struct timespec slp;
+  int64_t delta, due, now;
+
+  if(rt->rt_speed <= 0)
+    return;
+
+  now = getmonoclock();
+
+  if(rt->rt_pcr_prev != PTS_UNSET) {
+    delta = (pcr - rt->rt_pcr_prev) & RAWTS_PCR_MASK;
+    if(delta > 90000)
+      rt->rt_pcr_prev = PTS_UNSET;  // Discontinuity
+  }
+
+  if(rt->rt_pcr_prev == PTS_UNSET) {
+    rt->rt_pcr_start = pcr;
+    rt->rt_clock_start = now;
+  }
+  rt->rt_pcr_prev = pcr;
+
+  delta = (pcr - rt->rt_pcr_start) & RAWTS_PCR_MASK;
+  due = rt->rt_clock_start + (int64_t)(delta * 100 / 9 / rt->rt_speed);
+
+  if(due < now - RAWTS_MAX_LAG) {
+    rt->rt_late++;
+    rt->rt_pcr_start = pcr;
+    rt->rt_clock_start = now;
+    return;
+  }
+
+  if(due <= now)
+    return;
+
+  slp.tv_sec  =  due / 1000000;
+  slp.tv_nsec = (due % 1000000) * 1000;
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &slp, NULL) == EINTR)
+    ;
+}
+
+
+/**
+ *
+ */
+static void
+process_ts_packet(rawts_t *rt, const uint8_t *tsb)
 {
   uint16_t pid;
   service_t *t;
-  int64_t pcr, d;
-  int didsleep = 0;
+  int64_t pcr;
+
+  rt->rt_packets++;
 
   pid = ((tsb[1] & 0x1f) << 8) | tsb[2];
   if(pid == 0) {
@@ -242,39 +359,16 @@ process_ts_packet(rawts_t *rt, uint8_t *tsb)
     rawts_pat(rt, tsb);
     return;
   }
-  
-  LIST_FOREACH(t, &rt->rt_services, s_group_link) {
-    pcr = PTS_UNSET;
-
-    ts_recv_packet1(t, tsb, &pcr);
-
-    if(pcr != PTS_UNSET) {
-      
-      if(rt->rt_pcr_pid == 0)
-	rt->rt_pcr_pid = pid;
-
-      if(rt->rt_pcr_pid == pid) {
-	if(t->s_pcr_last != PTS_UNSET && didsleep == 0) {
-	  struct timespec slp;
-	  int64_t delta = pcr - t->s_pcr_last;
-
-	  
-
-	  if(delta > 90000)
-	    delta = 90000;
-	  delta *= 11;
-	  d = delta + t->s_pcr_last_realtime;
-	  slp.tv_sec  =  d / 1000000;
-	  slp.tv_nsec = (d % 1000000) * 1000;
-	
-	  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &slp, NULL);
-	  didsleep = 1;
-	}
-	t->s_pcr_last = pcr;
-	t->s_pcr_last_realtime = getmonoclock();
-      }
-    }
+
+  if((pcr = rawts_get_pcr(tsb)) != PTS_UNSET) {
+    if(rt->rt_pcr_pid == 0)
+      rt->rt_pcr_pid = pid;
+    if(rt->rt_pcr_pid == pid)
+      rawts_pace(rt, pcr);
   }
+
+  LIST_FOREACH(t, &rt->rt_services, s_group_link)
+    ts_recv_packet1(t, tsb, NULL);
 }
 
 
@@ -285,45 +379,131 @@ static void *
 raw_ts_reader(void *aux)
 {
   rawts_t *rt = aux;
-  uint8_t tsblock[188];
-  int c = 0;
-  int i;
+  uint8_t *buf = malloc(188 * RAWTS_READ_PACKETS);
+  int len = 0, idx, r;
+  STATS_SPAN(span);
 
   while(1) {
 
-    for(i = 0; i < 2; i++) {
-      if(read(rt->rt_fd, tsblock, 188) != 188) {
-	lseek(rt->rt_fd, 0, SEEK_SET);
+    STATS_ENTER(span);
+    r = read(rt->rt_fd, buf + len, 188 * RAWTS_READ_PACKETS - len);
+    STATS_LEAVE(span, STATS_READ);
+    if(r < 0 && errno == EINTR)
+      continue;
+
+    if(r <= 0) {
+      if(rt->rt_packets == 0) {
+	tvhlog(LOG_ERR, "rawts", "%s: No packets in %s, giving up",
+	       rt->rt_identifier, rt->rt_filename);
+	break;
+      }
+      rt->rt_loops++;
+      tvhlog(LOG_DEBUG, "rawts",
+	     "%s: Restarting %s (loop %d, %"PRIu64" packets, %d late)",
+	     rt->rt_identifier, rt->rt_filename, rt->rt_loops,
+	     rt->rt_packets, rt->rt_late);
+      lseek(rt->rt_fd, 0, SEEK_SET);
+      rt->rt_pcr_prev = PTS_UNSET;
+      len = 0;
+      continue;
+    }
+    len += r;
+
+    idx = 0;
+    while(len >= 188) {
+      if(buf[idx] != 0x47) {
+	if(len < 188 * 3)
+	  break;
+	ts_resync(buf, &len, &idx);
 	continue;
       }
-      c++;
-      process_ts_packet(rt, tsblock);
+      process_ts_packet(rt, buf + idx);
+      idx += 188;
+      len -= 188;
     }
+
+    if(len > 0)
+      memmove(buf, buf + idx, len);
   }
 
+  free(buf);
   return NULL;
 }
 
 
 /**
+ * Replay a transport stream file on a number of virtual adapters
  *
+ * Each instance reads the file on its own and presents the services
+ * found as channels. Playback is paced by the PCR at the given speed
+ * (1 for real time), a speed of 0 reads as fast as possible.
  */
 void
-rawts_init(const char *filename)
+rawts_init(const char *filename, int instances, double speed)
 {
   pthread_t ptid;
   rawts_t *rt;
-  int fd = tvh_open(filename, O_RDONLY, 0);
+  char buf[32];
+  int fd, i;
 
-  if(fd == -1) {
-    fprintf(stderr, "Unable to open %s -- %s\n", filename, strerror(errno));
-    return;
+  for(i = 0; i < instances; i++) {
+
+    if((fd = tvh_open(filename, O_RDONLY, 0)) == -1) {
+      fprintf(stderr, "Unable to open %s -- %s\n", filename, strerror(errno));
+      return;
+    }
+
+    rt = calloc(1, sizeof(rawts_t));
+    rt->rt_fd = fd;
+
+    snprintf(buf, sizeof(buf), "rawts%d", rawts_tally++);
+    rt->rt_identifier = strdup(buf);
+    rt->rt_filename = strdup(filename);
+    rt->rt_speed = speed;
+    rt->rt_pcr_prev = PTS_UNSET;
+
+    LIST_INSERT_HEAD(&rawts_instances, rt, rt_link);
+
+    if(speed > 0)
+      tvhlog(LOG_INFO, "rawts", "%s: Replaying %s at %gx speed",
+	     rt->rt_identifier, filename, speed);
+    else
+      tvhlog(LOG_INFO, "rawts", "%s: Replaying %s unpaced",
+	     rt->rt_identifier, filename);
+
+    pthread_create(&ptid, NULL, raw_ts_reader, rt);
   }
+}
+
+
+/**
+ * Services of all replay instances, caller must hold global_lock
+ */
+int
+rawts_get_services(service_t **vec, int max)
+{
+  rawts_t *rt;
+  service_t *t;
+  int n = 0;
+
+  LIST_FOREACH(rt, &rawts_instances, rt_link)
+    LIST_FOREACH(t, &rt->rt_services, s_group_link)
+      if(n < max)
+	vec[n++] = t;
+  return n;
+}
 
-  rt = calloc(1, sizeof(rawts_t));
-  rt->rt_fd = fd;
 
-  rt->rt_identifier = strdup("rawts");
+/**
+ * Number of TS packets read by all replay instances
+ */
+uint64_t
+rawts_get_packets(void)
+{
+  rawts_t *rt;
+  uint64_t n = 0;
 
-  pthread_create(&ptid, NULL, raw_ts_reader, rt);
+  LIST_FOREACH(rt, &rawts_instances, rt_link)
+    n += rt->rt_packets;
+  return n;
 }
@@ -1,4 +1,8 @@
 
 
-void rawts_init(const char *filename);
+void rawts_init(const char *filename, int instances, double speed);
+
+int rawts_get_services(struct service **vec, int max);
+
+uint64_t rawts_get_packets(void);
 
@@ -46,11 +46,24 @@
 #include "serviceprobe.h"
 #include "atomic.h"
 #include "dvb/dvb.h"
+#include "dvr/dvr.h"
 #include "htsp.h"
 
+/**
+ * Identifier hash, grown when the chains get longer than two services
+ * on average (large satellite setups have tens of thousands)
+ */
 #define SERVICE_HASH_WIDTH 101
 
-static struct service_list servicehash[SERVICE_HASH_WIDTH];
+static struct service_list *servicehash;
+static unsigned int servicehash_width;
+static unsigned int servicehash_count;
+
+/**
+ * Bumped whenever a service starts or stops, or is (un)mapped, so
+ * subscription_reschedule() knows when retrying is worthwhile
+ */
+int service_sched_gen = 1;
 
 static void service_data_timeout(void *aux);
 
@@ -123,6 +136,8 @@ service_stream_destroy(service_t *t, elementary_stream_t *st)
   free(st);
 }
 
+static void service_gop_cache_flush(service_t *t);
+
 /**
  * Service lock must be held
  */
@@ -142,6 +157,8 @@ service_stop(service_t *t)
     td->td_stop(td);
 
   t->s_tt_commercial_advice = COMMERCIAL_UNKNOWN;
+
+  service_gop_cache_flush(t);
  
   assert(LIST_FIRST(&t->s_streaming_pad.sp_targets) == NULL);
   assert(LIST_FIRST(&t->s_subscriptions) == NULL);
@@ -155,6 +172,8 @@ service_stop(service_t *t)
   t->s_status = SERVICE_IDLE;
 
   pthread_mutex_unlock(&t->s_stream_mutex);
+
+  service_sched_gen++;
 }
 
 
@@ -222,6 +241,7 @@ service_start(service_t *t, unsigned int weight, int force_start)
     timeout = t->s_grace_period(t);
 
   gtimer_arm(&t->s_receive_timer, service_data_timeout, t, timeout);
+  service_sched_gen++;
   return 0;
 }
 
@@ -243,7 +263,8 @@ service_get_prio(service_t *t)
   switch(t->s_type) {
   case SERVICE_TYPE_DVB:
     return (t->s_scrambled ? 300 : 100) + 
-      dvb_extra_prio(t->s_dvb_mux_instance->tdmi_adapter);
+      (t->s_dvb_mux_instance == NULL ? 0 : // Raw TS input
+       dvb_extra_prio(t->s_dvb_mux_instance->tdmi_adapter));
 
   case SERVICE_TYPE_IPTV:
     return 200;
@@ -276,14 +297,84 @@ service_get_quality(service_t *t)
 
 
 
+/**
+ * What it takes to start a service, cheapest first
+ */
+typedef enum {
+  SERVICE_COST_RUNNING,  // Already running, just share it
+  SERVICE_COST_SHARE,    // Mux is tuned, no extra tuner needed
+  SERVICE_COST_IDLE,     // Needs a tuner that nobody is using
+  SERVICE_COST_BUSY,     // Needs a tuner that is in use
+} service_cost_t;
+
+typedef struct service_candidate {
+  service_t *sc_t;
+  service_cost_t sc_cost;
+  int sc_prio;
+  int sc_quality;
+  int sc_weight;  // Highest weight on the tuner, for SERVICE_COST_BUSY
+  int sc_muxes;   // Muxes the adapter can receive
+} service_candidate_t;
+
+/**
+ *
+ */
+static void
+service_candidate_init(service_candidate_t *sc, service_t *t)
+{
+  th_dvb_adapter_t *tda;
+  th_dvb_mux_instance_t *tdmi;
+
+  sc->sc_t       = t;
+  sc->sc_prio    = service_get_prio(t);
+  sc->sc_quality = service_get_quality(t);
+  sc->sc_weight  = 0;
+  sc->sc_muxes   = 0;
+
+  if(t->s_status == SERVICE_RUNNING) {
+    sc->sc_cost = SERVICE_COST_RUNNING;
+    return;
+  }
+
+  sc->sc_cost = SERVICE_COST_IDLE;
+  if(t->s_type != SERVICE_TYPE_DVB || t->s_dvb_mux_instance == NULL)
+    return;
+
+  tda = t->s_dvb_mux_instance->tdmi_adapter;
+  LIST_FOREACH(tdmi, &tda->tda_muxes, tdmi_adapter_link)
+    sc->sc_muxes++;
+
+  if(tda->tda_mux_current == NULL)
+    return;
+
+  if(tda->tda_mux_current == t->s_dvb_mux_instance &&
+     tda->tda_hostconnection != HOSTCONNECTION_USB12)
+    sc->sc_cost = SERVICE_COST_SHARE;
+  else if((sc->sc_weight = service_compute_weight(&tda->tda_transports)))
+    sc->sc_cost = SERVICE_COST_BUSY;
+}
+
+
 /**
  *  a - b  -> lowest number first
+ *
+ * Services that need no extra tuner come first. For those that need to
+ * steal one, the tuner used by the least important subscriptions comes
+ * first. After that priority and quality decide, and last we favour
+ * the adapter that can receive the fewest muxes, keeping the more
+ * versatile ones free for subscriptions that only they can serve.
  */
 static int
 servicecmp(const void *A, const void *B)
 {
-  service_t *a = *(service_t **)A;
-  service_t *b = *(service_t **)B;
+  const service_candidate_t *a = A;
+  const service_candidate_t *b = B;
+
+  if(a->sc_cost != b->sc_cost)
+    return a->sc_cost - b->sc_cost;
+
+  if(a->sc_weight != b->sc_weight)
+    return a->sc_weight - b->sc_weight;
 
   /* only check quality if both adapters have the same prio
    *
@@ -291,17 +382,138 @@ servicecmp(const void *A, const void *B)
    * additional, it may be problematic, since a higher priority value lowers the ranking
    *
    */
-  int prio_a = service_get_prio(a);
-  int prio_b = service_get_prio(b);
-  if (prio_a == prio_b) {
+  if (a->sc_prio == b->sc_prio) {
 
-    int q = service_get_quality(a) - service_get_quality(b);
+    int q = a->sc_quality - b->sc_quality;
 
     if(q != 0)
       return q; /* Quality precedes priority */
+
+    return a->sc_muxes - b->sc_muxes;
   }
 
-  return prio_a - prio_b;
+  return a->sc_prio - b->sc_prio;
+}
+
+
+/**
+ * Find a service on the given adapter for the subscription's channel,
+ * on the given mux unless that is NULL
+ */
+static service_t *
+service_find_alternative(th_subscription_t *s, th_dvb_adapter_t *tda,
+			 th_dvb_mux_instance_t *tdmi)
+{
+  service_t *t;
+
+  if(s->ths_channel == NULL)
+    return NULL; /* Direct subscription, can't be moved */
+
+  LIST_FOREACH(t, &s->ths_channel->ch_services, s_ch_link) {
+    if(t->s_type != SERVICE_TYPE_DVB || t->s_dvb_mux_instance == NULL ||
+       !t->s_enabled || !t->s_dvb_mux_instance->tdmi_enabled)
+      continue;
+    if(t->s_dvb_mux_instance->tdmi_adapter != tda)
+      continue;
+    if(tdmi == NULL || t->s_dvb_mux_instance == tdmi)
+      return t;
+  }
+  return NULL;
+}
+
+
+/**
+ * Try to free an adapter by moving everything that is received on it
+ * to another adapter that is idle or already tuned to the same mux.
+ *
+ * The subscribers see a stop and a restart, which is better than not
+ * getting another subscription going at all. That is only done to
+ * subscriptions that don't weigh more than the one asking, so a live
+ * TV request can't put a gap in a recording.
+ *
+ * Every new service is started before anyone is moved, so either all
+ * subscriptions move or none do.
+ */
+static int
+service_relocate(th_dvb_adapter_t *tda, unsigned int weight,
+		 const char *loginfo)
+{
+  th_dvb_adapter_t *dst;
+  th_dvb_mux_instance_t *tdmi;
+  th_subscription_t *s, **vec;
+  service_t *t, *alt, **alts;
+  uint8_t *started;
+  int i, cnt = 0, r;
+
+  if(tda->tda_mux_current == NULL)
+    return -1;
+
+  LIST_FOREACH(t, &tda->tda_transports, s_active_link)
+    LIST_FOREACH(s, &t->s_subscriptions, ths_service_link) {
+      if(s->ths_channel == NULL || s->ths_weight > weight)
+	return -1;
+      cnt++;
+    }
+
+  if(cnt == 0)
+    return -1;
+
+  vec = alloca(cnt * sizeof(th_subscription_t *));
+  alts = alloca(cnt * sizeof(service_t *));
+  started = alloca(cnt);
+  cnt = 0;
+  LIST_FOREACH(t, &tda->tda_transports, s_active_link)
+    LIST_FOREACH(s, &t->s_subscriptions, ths_service_link)
+      vec[cnt++] = s;
+
+  TAILQ_FOREACH(dst, &dvb_adapters, tda_global_link) {
+    if(dst == tda || dst->tda_rootpath == NULL ||
+       dst->tda_hostconnection == HOSTCONNECTION_USB12)
+      continue;
+
+    /* All of them must move to the same mux */
+    tdmi = NULL;
+    for(i = 0; i < cnt; i++) {
+      if((alt = service_find_alternative(vec[i], dst, tdmi)) == NULL)
+	break;
+      tdmi = alt->s_dvb_mux_instance;
+    }
+    if(i < cnt)
+      continue;
+
+    if(dst->tda_mux_current != NULL && dst->tda_mux_current != tdmi &&
+       service_compute_weight(&dst->tda_transports))
+      continue;
+
+    for(i = 0; i < cnt; i++) {
+      alts[i] = alt = service_find_alternative(vec[i], dst, tdmi);
+      started[i] = 0;
+      if(alt->s_status == SERVICE_RUNNING)
+	continue;
+      if((r = service_start(alt, 0, 0)) != 0) {
+	tvhlog(LOG_NOTICE, "Service", "%s: Unable to move \"%s\" -- %s",
+	       loginfo, vec[i]->ths_title, streaming_code2txt(r));
+	while(i-- > 0)
+	  if(started[i])
+	    service_stop(alts[i]);
+	return -1;
+      }
+      started[i] = 1;
+    }
+
+    tvhlog(LOG_INFO, "Service",
+	   "%s: Moving %d subscription(s) from \"%s\" to \"%s\"",
+	   loginfo, cnt, tda->tda_displayname, dst->tda_displayname);
+
+    for(i = 0; i < cnt; i++) {
+      s = vec[i];
+      service_remove_subscriber(s->ths_service, s,
+				SM_CODE_SOURCE_RECONFIGURED);
+      subscription_link_service(s, alts[i]);
+    }
+    return 0;
+  }
+  return -1;
 }
 
 
@@ -310,10 +522,11 @@ servicecmp(const void *A, const void *B)
  */
 service_t *
 service_find(channel_t *ch, unsigned int weight, const char *loginfo,
-	       int *errorp, service_t *skip)
+	       int *errorp, service_t *skip, service_t *prefer)
 {
-  service_t *t, **vec;
-  int cnt = 0, i, r, off;
+  service_candidate_t tmp, *vec;
+  service_t *t;
+  int cnt = 0, i, r;
   int err = 0;
 
   lock_assert(&global_lock);
@@ -323,7 +536,7 @@ service_find(channel_t *ch, unsigned int weight, const char *loginfo,
   LIST_FOREACH(t, &ch->ch_services, s_ch_link)
     cnt++;
 
-  vec = alloca(cnt * sizeof(service_t *));
+  vec = alloca(cnt * sizeof(service_candidate_t));
   cnt = 0;
   LIST_FOREACH(t, &ch->ch_services, s_ch_link) {
 
@@ -336,33 +549,35 @@ service_find(channel_t *ch, unsigned int weight, const char *loginfo,
       continue;
     }
 
-    vec[cnt++] = t;
+    // Skip the service that the caller didn't want
+    if(t == skip)
+      continue;
+
+    service_candidate_init(&vec[cnt++], t);
     tvhlog(LOG_DEBUG, "Service",
     		"%s: Adding adapter \"%s\" for service \"%s\"",
     		 loginfo, service_adapter_nicename(t), service_nicename(t));
   }
 
-  /* Sort services, lower priority should come come earlier in the vector
+  /* Sort services, lower cost should come come earlier in the vector
      (i.e. it will be more favoured when selecting a service */
 
-  qsort(vec, cnt, sizeof(service_t *), servicecmp);
+  qsort(vec, cnt, sizeof(service_candidate_t), servicecmp);
 
-  // Skip up to the service that the caller didn't want
-  // If the sorting above is not stable that might mess up things
-  // temporary. But it should resolve itself eventually
-  if(skip != NULL) {
-    for(i = 0; i < cnt; i++) {
-      if(skip == t)
-	break;
+  // The caller has planned for this one, so go for it unless that
+  // means stealing a tuner
+  for(i = 1; prefer != NULL && i < cnt; i++) {
+    if(vec[i].sc_t == prefer && vec[i].sc_cost < SERVICE_COST_BUSY) {
+      tmp = vec[i];
+      memmove(vec + 1, vec, i * sizeof(service_candidate_t));
+      vec[0] = tmp;
+      break;
     }
-    off = i + 1;
-  } else {
-    off = 0;
   }
 
   /* First, try all services without stealing */
-  for(i = off; i < cnt; i++) {
-    t = vec[i];
+  for(i = 0; i < cnt && vec[i].sc_cost < SERVICE_COST_BUSY; i++) {
+    t = vec[i].sc_t;
     if(t->s_quality_index(t) < 10) {
       if(loginfo != NULL) {
          tvhlog(LOG_NOTICE, "Service",
@@ -384,11 +599,27 @@ service_find(channel_t *ch, unsigned int weight, const char *loginfo,
 	     loginfo, service_nicename(t), streaming_code2txt(r));
   }
 
+  /* All tuners we can use are busy, see if what they are doing
+     could just as well be done by another one */
+
+  for(; i < cnt; i++) {
+    t = vec[i].sc_t;
+    if(t->s_type != SERVICE_TYPE_DVB || t->s_dvb_mux_instance == NULL ||
+       service_relocate(t->s_dvb_mux_instance->tdmi_adapter, weight, loginfo))
+      continue;
+    if((r = service_start(t, 0, 0)) == 0)
+      return t;
+    *errorp = r;
+  }
+
   /* Ok, nothing, try again, but supply our weight and thus, try to steal
-     transponders */
+     transponders, the one used by the least important subscriptions
+     first */
 
-  for(i = off; i < cnt; i++) {
-    t = vec[i];
+  for(i = 0; i < cnt; i++) {
+    t = vec[i].sc_t;
+    if(t->s_status == SERVICE_RUNNING)
+      continue;
     tvhlog(LOG_DEBUG, "Service", "%s: Probing adapter \"%s\" with weight %d for service \"%s\"",
 	     loginfo, service_adapter_nicename(t), weight, service_nicename(t));
 
@@ -469,6 +700,15 @@ service_destroy(service_t *t)
     subscription_unlink_service(s, SM_CODE_SOURCE_DELETED);
   }
 
+  /* ths_prefer holds no reference, don't let a new service that gets
+     the same address be mistaken for this one */
+  LIST_FOREACH(s, &subscriptions, ths_global_link)
+    if(s->ths_prefer == t)
+      s->ths_prefer = NULL;
+
+  /* Recordings may have been planned on it */
+  dvr_plan_schedule();
+
   if(t->s_ch != NULL) {
     t->s_ch = NULL;
     LIST_REMOVE(t, s_ch_link);
@@ -476,6 +716,7 @@ service_destroy(service_t *t)
 
   LIST_REMOVE(t, s_group_link);
   LIST_REMOVE(t, s_hash_link);
+  servicehash_count--;
   
   if(t->s_status != SERVICE_IDLE)
     service_stop(t);
@@ -505,17 +746,46 @@ service_destroy(service_t *t)
 }
 
 
+/**
+ *
+ */
+static void
+service_hash_grow(void)
+{
+  struct service_list *old = servicehash;
+  unsigned int i, w = servicehash_width;
+  service_t *t;
+
+  servicehash_width = w ? w * 2 + 1 : SERVICE_HASH_WIDTH;
+  servicehash = calloc(servicehash_width, sizeof(struct service_list));
+
+  for(i = 0; i < w; i++) {
+    while((t = LIST_FIRST(&old[i])) != NULL) {
+      LIST_REMOVE(t, s_hash_link);
+      LIST_INSERT_HEAD(&servicehash[tvh_strhash(t->s_identifier,
+						servicehash_width)],
+		       t, s_hash_link);
+    }
+  }
+  free(old);
+}
+
+
 /**
  * Create and initialize a new service struct
  */
 service_t *
 service_create(const char *identifier, int type, int source_type)
 {
-  unsigned int hash = tvh_strhash(identifier, SERVICE_HASH_WIDTH);
+  unsigned int hash;
   service_t *t = calloc(1, sizeof(service_t));
 
   lock_assert(&global_lock);
 
+  if(servicehash_count >= servicehash_width * 2)
+    service_hash_grow();
+  hash = tvh_strhash(identifier, servicehash_width);
+
   pthread_mutex_init(&t->s_stream_mutex, NULL);
   pthread_cond_init(&t->s_tss_cond, NULL);
   t->s_identifier = strdup(identifier);
@@ -527,10 +797,13 @@ service_create(const char *identifier, int type, int source_type)
   t->s_dvb_default_charset = NULL;
   t->s_dvb_eit_enable = 1;
   TAILQ_INIT(&t->s_components);
+  TAILQ_INIT(&t->s_gop_cache);
+  t->s_gop_cache_index = -1;
 
   streaming_pad_init(&t->s_streaming_pad);
 
   LIST_INSERT_HEAD(&servicehash[hash], t, s_hash_link);
+  servicehash_count++;
   return t;
 }
 
@@ -541,10 +814,14 @@ service_t *
 service_find_by_identifier(const char *identifier)
 {
   service_t *t;
-  unsigned int hash = tvh_strhash(identifier, SERVICE_HASH_WIDTH);
+  unsigned int hash;
 
   lock_assert(&global_lock);
 
+  if(servicehash == NULL)
+    return NULL;
+  hash = tvh_strhash(identifier, servicehash_width);
+
   LIST_FOREACH(t, &servicehash[hash], s_hash_link)
     if(!strcmp(t->s_identifier, identifier))
       break;
@@ -634,7 +911,6 @@ service_stream_create(service_t *t, int pid,
   st->es_pid = pid;
   st->es_demuxer_fd = -1;
 
-  avgstat_init(&st->es_rate, 10);
   avgstat_init(&st->es_cc_errors, 10);
 
   service_stream_make_nicename(t, st);
@@ -686,14 +962,17 @@ service_map_channel(service_t *t, channel_t *ch, int save)
 
   if(ch != NULL) {
 
-    avgstat_init(&t->s_cc_errors, 3600);
-    avgstat_init(&t->s_rate, 10);
+    avgstat_init(&t->s_cc_errors, 60);
+    avgstat_init(&t->s_tei_errors, 60);
+    avgstat_init(&t->s_rate, 60);
 
     t->s_ch = ch;
     LIST_INSERT_HEAD(&ch->ch_services, t, s_ch_link);
     htsp_channel_update(t->s_ch);
   }
 
+  service_sched_gen++;
+
   if(save)
     t->s_config_save(t);
 }
@@ -727,6 +1006,98 @@ service_set_dvb_eit_enable(service_t *t, int dvb_eit_enable)
   t->s_config_save(t);
 }
 
+/**
+ *
+ */
+void
+service_set_gop_cache(service_t *t, int enable)
+{
+  if(t->s_gop_cache_enable == enable)
+    return;
+
+  pthread_mutex_lock(&t->s_stream_mutex);
+  t->s_gop_cache_enable = enable;
+  service_gop_cache_flush(t);
+  pthread_mutex_unlock(&t->s_stream_mutex);
+
+  t->s_config_save(t);
+}
+
+
+/**
+ * Drop all cached packets, caching restarts at the next keyframe
+ */
+static void
+service_gop_cache_flush(service_t *t)
+{
+  pktref_clear_queue(&t->s_gop_cache);
+  t->s_gop_cache_size = 0;
+  t->s_gop_cache_index = -1;
+}
+
+
+/**
+ * Record a parsed packet in the GOP cache
+ *
+ * Called with s_stream_mutex held
+ */
+void
+service_gop_cache_add(service_t *t, elementary_stream_t *st, th_pkt_t *pkt)
+{
+  size_t len;
+
+  if(!t->s_gop_cache_enable)
+    return;
+
+  if(SCT_ISVIDEO(st->es_type) && pkt->pkt_frametype == PKT_I_FRAME &&
+     (t->s_gop_cache_index == -1 || t->s_gop_cache_index == st->es_index)) {
+    service_gop_cache_flush(t);
+    t->s_gop_cache_index = st->es_index;
+  }
+
+  if(t->s_gop_cache_index == -1)
+    return;
+
+  len = pkt->pkt_payload ? pktbuf_len(pkt->pkt_payload) : 0;
+  if(t->s_gop_cache_size + len > SERVICE_GOP_CACHE_MAX) {
+    /* GOP too long, give up until the next keyframe */
+    service_gop_cache_flush(t);
+    return;
+  }
+
+  pkt_ref_inc(pkt);
+  pktref_enqueue(&t->s_gop_cache, pkt);
+  t->s_gop_cache_size += len;
+}
+
+
+/**
+ * Send the cached GOP to a newly linked streaming target
+ *
+ * Called with s_stream_mutex held, returns the number of packets sent
+ */
+int
+service_gop_cache_deliver(service_t *t, streaming_target_t *st)
+{
+  th_pktref_t *pr;
+  int n = 0;
+
+  if(!t->s_gop_cache_enable)
+    return 0;
+
+  TAILQ_FOREACH(pr, &t->s_gop_cache, pr_link) {
+    streaming_target_deliver(st, streaming_msg_create_pkt(pr->pr_pkt));
+    n++;
+  }
+
+  if(n)
+    t->s_gop_cache_hits++;
+  else
+    t->s_gop_cache_misses++;
+  return n;
+}
+
+
 /**
  *
  */
@@ -845,6 +1216,9 @@ service_restart(service_t *t, int had_components)
   streaming_message_t *sm;
   lock_assert(&t->s_stream_mutex);
 
+  /* Component indices of cached packets may no longer be valid */
+  service_gop_cache_flush(t);
+
   if(had_components) {
     sm = streaming_msg_create_code(SMT_STOP, SM_CODE_SOURCE_RECONFIGURED);
     streaming_pad_deliver(&t->s_streaming_pad, sm);
@@ -94,7 +94,6 @@ typedef struct elementary_stream {
   uint8_t es_cc_valid;       /* Is CC valid at all? */
 
   avgstat_t es_cc_errors;
-  avgstat_t es_rate;
 
   int es_demuxer_fd;
   int es_peak_presentation_delay; /* Max seen diff. of DTS and PTS */
@@ -282,6 +281,7 @@ typedef struct service {
    * Per source type structs
    */
   struct th_dvb_mux_instance *s_dvb_mux_instance;
+  LIST_ENTRY(service) s_dvb_sid_link;
 
   /**
    * Unique identifer (used for storing on disk, etc)
@@ -447,6 +447,17 @@ typedef struct service {
    */
   avgstat_t s_cc_errors;
 
+  /**
+   * Continuity errors of the whole input (adapter) this service is
+   * received on, if the input keeps track of that
+   */
+  avgstat_t *s_input_cc_errors;
+
+  /**
+   * Average transport errors
+   */
+  avgstat_t s_tei_errors;
+
   /**
    * Average bitrate
    */
@@ -494,8 +505,22 @@ typedef struct service {
    */
   int s_dvb_eit_enable;
 
+  /**
+   * GOP cache, holds the packets since the most recent video keyframe
+   * so new subscribers to a running service can start at once.
+   * Protected by s_stream_mutex.
+   */
+  int s_gop_cache_enable;
+  int s_gop_cache_index;        /* Component the keyframes are taken from */
+  size_t s_gop_cache_size;      /* Payload bytes held */
+  struct th_pktref_queue s_gop_cache;
+  uint32_t s_gop_cache_hits;
+  uint32_t s_gop_cache_misses;
+
 } service_t;
 
+#define SERVICE_GOP_CACHE_MAX (8 * 1024 * 1024)
+
 
 
 
@@ -504,6 +529,8 @@ void service_init(void);
 
 unsigned int service_compute_weight(struct service_list *head);
 
+extern int service_sched_gen;
+
 int service_start(service_t *t, unsigned int weight, int force_start);
 
 service_t *service_create(const char *identifier, int type,
@@ -519,7 +546,7 @@ void service_map_channel(service_t *t, struct channel *ch, int save);
 
 service_t *service_find(struct channel *ch, unsigned int weight,
 			const char *loginfo, int *errorp,
-			service_t *skip);
+			service_t *skip, service_t *prefer);
 
 elementary_stream_t *service_stream_find(service_t *t, int pid);
 
@@ -583,6 +610,13 @@ void service_set_dvb_default_charset(service_t *t, const char *dvb_default_chars
 
 void service_set_dvb_eit_enable(service_t *t, int dvb_eit_enable);
 
+void service_set_gop_cache(service_t *t, int enable);
+
+void service_gop_cache_add(service_t *t, elementary_stream_t *st,
+			   struct th_pkt *pkt);
+
+int service_gop_cache_deliver(service_t *t, streaming_target_t *st);
+
 int service_is_primary_epg (service_t *t);
 
 htsmsg_t *servicetype_list (void);
@@ -30,11 +30,77 @@
 #include "serviceprobe.h"
 #include "streaming.h"
 #include "service.h"
+#include "config2.h"
 #include "dvb/dvb.h"
 
+/**
+ * Services are probed in groups per mux. All queued services on a mux
+ * that is already tuned (or being probed) are subscribed to at once,
+ * and a mux on each adapter that is not otherwise in use is probed in
+ * parallel, up to the configured number of concurrent probes.
+ *
+ * A queued service has s_sp_onqueue == 1 and is linked on
+ * serviceprobe_queue, a service being probed has s_sp_onqueue == 2
+ * and a serviceprobe_t on serviceprobe_active.
+ */
+typedef struct serviceprobe {
+  TAILQ_ENTRY(serviceprobe) sp_link;
+
+  service_t *sp_t;
+  th_dvb_mux_instance_t *sp_tdmi;
+  th_subscription_t *sp_s;
+  streaming_target_t sp_st;
+  time_t sp_timeout;
+
+  /* Protected by serviceprobe_mutex */
+  int sp_done;
+  const char *sp_err;
+
+} serviceprobe_t;
+
 /* List of transports to be probed, protected with global_lock */
 static struct service_queue serviceprobe_queue;  
+static TAILQ_HEAD(, serviceprobe) serviceprobe_active;
+static int serviceprobe_nactive;
+static int serviceprobe_probed;
+
+/* Wakeup of the probe thread, from the streaming callbacks */
+static pthread_mutex_t serviceprobe_mutex;
 static pthread_cond_t serviceprobe_cond;
+static int serviceprobe_kick;
+
+static void serviceprobe_finish(serviceprobe_t *sp);
+
+
+/**
+ *
+ */
+static void
+serviceprobe_wakeup(void)
+{
+  pthread_mutex_lock(&serviceprobe_mutex);
+  serviceprobe_kick = 1;
+  pthread_cond_signal(&serviceprobe_cond);
+  pthread_mutex_unlock(&serviceprobe_mutex);
+}
+
+
+/**
+ * Per adapter progress, shown in the adapter status
+ */
+static void
+serviceprobe_account(th_dvb_adapter_t *tda, int queued, int done)
+{
+  if(tda->tda_sp_queued == 0 && queued > 0) {
+    tda->tda_sp_start = dispatch_clock;
+    tda->tda_sp_done = 0;
+  }
+  tda->tda_sp_queued += queued;
+  tda->tda_sp_done += done;
+  serviceprobe_probed += done;
+  tda->tda_sp_notify = 1;
+}
+
 
 /**
  *
@@ -53,7 +119,8 @@ serviceprobe_enqueue(service_t *t)
 
   t->s_sp_onqueue = 1;
   TAILQ_INSERT_TAIL(&serviceprobe_queue, t, s_sp_link);
-  pthread_cond_signal(&serviceprobe_cond);
+  serviceprobe_account(t->s_dvb_mux_instance->tdmi_adapter, 1, 0);
+  serviceprobe_wakeup();
 }
 
 
@@ -63,176 +130,387 @@ serviceprobe_enqueue(service_t *t)
 void
 serviceprobe_delete(service_t *t)
 {
-  if(!t->s_sp_onqueue)
+  serviceprobe_t *sp;
+
+  switch(t->s_sp_onqueue) {
+  case 1:
+    TAILQ_REMOVE(&serviceprobe_queue, t, s_sp_link);
+    break;
+  case 2:
+    TAILQ_FOREACH(sp, &serviceprobe_active, sp_link)
+      if(sp->sp_t == t)
+        break;
+    assert(sp != NULL);
+    subscription_unsubscribe(sp->sp_s);
+    serviceprobe_finish(sp);
+    break;
+  default:
     return;
-  TAILQ_REMOVE(&serviceprobe_queue, t, s_sp_link);
+  }
   t->s_sp_onqueue = 0;
+  serviceprobe_account(t->s_dvb_mux_instance->tdmi_adapter, -1, 0);
 }
 
 
 /**
- *
+ * Streaming callback, we only care for the service status.
+ * Called with the service's stream mutex held, so global_lock
+ * can not be taken here.
  */
-static void *
-serviceprobe_thread(void *aux)
+static void
+serviceprobe_input(void *opaque, streaming_message_t *sm)
+{
+  serviceprobe_t *sp = opaque;
+  const char *err = NULL;
+  int done = 0;
+
+  switch(sm->sm_type) {
+  case SMT_SERVICE_STATUS:
+    if(sm->sm_code & TSS_PACKETS) {
+      done = 1;
+    } else if(sm->sm_code & (TSS_GRACEPERIOD | TSS_ERRORS)) {
+      done = 1;
+      err = service_tss2text(sm->sm_code);
+    }
+    break;
+
+  case SMT_NOSTART:
+    done = 1;
+    err = streaming_code2txt(sm->sm_code);
+    break;
+
+  default:
+    break;
+  }
+
+  streaming_msg_free(sm);
+
+  if(!done)
+    return;
+
+  pthread_mutex_lock(&serviceprobe_mutex);
+  if(!sp->sp_done) {
+    sp->sp_done = 1;
+    sp->sp_err = err;
+    serviceprobe_kick = 1;
+    pthread_cond_signal(&serviceprobe_cond);
+  }
+  pthread_mutex_unlock(&serviceprobe_mutex);
+}
+
+
+/**
+ * Map a probed service to a channel
+ */
+static void
+serviceprobe_map(service_t *t)
 {
-  service_t *t;
-  th_subscription_t *s;
-  int was_doing_work = 0;
-  streaming_queue_t sq;
-  streaming_message_t *sm;
-  //  transport_feed_status_t status;
-  int run;
-  const char *err;
   channel_t *ch;
-  uint32_t checksubscr;
+  int channum = t->s_channel_number;
+  const char *str;
+        
+  if (!channum && t->s_dvb_mux_instance->tdmi_adapter->tda_sidtochan)
+    channum = t->s_dvb_service_id;
 
-  pthread_mutex_lock(&global_lock);
+  ch = channel_find_by_name(t->s_svcname, 1, channum);
+  service_map_channel(t, ch, 1);
+      
+  tvhlog(LOG_INFO, "serviceprobe", "%20s: mapped to channel \"%s\"",
+         t->s_svcname, t->s_svcname);
 
-  streaming_queue_init(&sq, 0);
+  if(service_is_tv(t)) {
+     channel_tag_map(ch, channel_tag_find_by_name("TV channels", 1), 1);
+    tvhlog(LOG_INFO, "serviceprobe", "%20s: joined tag \"%s\"",
+           t->s_svcname, "TV channels");
+  }
 
-  err = NULL;
-  while(1) {
+  switch(t->s_servicetype) {
+    case ST_SDTV:
+    case ST_AC_SDTV:
+    case ST_EX_SDTV:
+    case ST_DN_SDTV:
+    case ST_SK_SDTV:
+      str = "SDTV";
+      break;
+    case ST_HDTV:
+    case ST_AC_HDTV:
+    case ST_EX_HDTV:
+    case ST_EP_HDTV:
+    case ST_ET_HDTV:
+    case ST_DN_HDTV:
+      str = "HDTV";
+      break;
+    case ST_RADIO:
+      str = "Radio";
+      break;
+    default:
+      str = NULL;
+  }
 
-    while((t = TAILQ_FIRST(&serviceprobe_queue)) == NULL) {
+  if(str != NULL) {
+    channel_tag_map(ch, channel_tag_find_by_name(str, 1), 1);
+    tvhlog(LOG_INFO, "serviceprobe", "%20s: joined tag \"%s\"",
+           t->s_svcname, str);
+  }
 
-      if(was_doing_work) {
-        tvhlog(LOG_INFO, "serviceprobe", "Now idle");
-        was_doing_work = 0;
-      }
-      pthread_cond_wait(&serviceprobe_cond, &global_lock);
-    }
+  if(t->s_provider != NULL) {
+    channel_tag_map(ch, channel_tag_find_by_name(t->s_provider, 1), 1);
+    tvhlog(LOG_INFO, "serviceprobe", "%20s: joined tag \"%s\"",
+           t->s_svcname, t->s_provider);
+  }
+  channel_save(ch);
+}
 
-    if(!was_doing_work) {
-      tvhlog(LOG_INFO, "serviceprobe", "Starting");
-      was_doing_work = 1;
-    }
 
-    checksubscr = !t->s_dvb_mux_instance->tdmi_adapter->tda_skip_checksubscr;
+/**
+ * Release a probe, the subscription must be gone
+ */
+static void
+serviceprobe_finish(serviceprobe_t *sp)
+{
+  TAILQ_REMOVE(&serviceprobe_active, sp, sp_link);
+  serviceprobe_nactive--;
+  service_unref(sp->sp_t);
+  free(sp);
+}
 
-    if (checksubscr) {
-      tvhlog(LOG_INFO, "serviceprobe", "%20s: checking...",
-       t->s_svcname);
 
-      s = subscription_create_from_service(t, "serviceprobe", &sq.sq_st, 0);
-      if(s == NULL) {
-        t->s_sp_onqueue = 0;
-        TAILQ_REMOVE(&serviceprobe_queue, t, s_sp_link);
-        tvhlog(LOG_INFO, "serviceprobe", "%20s: could not subscribe",
+/**
+ *
+ */
+static int
+serviceprobe_mux_active(th_dvb_mux_instance_t *tdmi)
+{
+  serviceprobe_t *sp;
+  TAILQ_FOREACH(sp, &serviceprobe_active, sp_link)
+    if(sp->sp_tdmi == tdmi)
+      return 1;
+  return 0;
+}
+
+
+/**
+ * An adapter can start probing a new mux if we are not probing on it
+ * already and nobody else is subscribed to the mux it is tuned to
+ */
+static int
+serviceprobe_adapter_idle(th_dvb_adapter_t *tda)
+{
+  serviceprobe_t *sp;
+  service_t *t;
+
+  TAILQ_FOREACH(sp, &serviceprobe_active, sp_link)
+    if(sp->sp_tdmi->tdmi_adapter == tda)
+      return 0;
+
+  if(tda->tda_mux_current != NULL)
+    LIST_FOREACH(t, &tda->tda_mux_current->tdmi_transports, s_group_link)
+      if(LIST_FIRST(&t->s_subscriptions) != NULL)
+        return 0;
+  return 1;
+}
+
+
+/**
+ * Start probing a queued service
+ */
+static void
+serviceprobe_start(service_t *t, int timeout)
+{
+  th_dvb_mux_instance_t *tdmi = t->s_dvb_mux_instance;
+  th_dvb_adapter_t *tda = tdmi->tdmi_adapter;
+  serviceprobe_t *sp;
+
+  TAILQ_REMOVE(&serviceprobe_queue, t, s_sp_link);
+
+  if(tda->tda_skip_checksubscr) {
+    t->s_sp_onqueue = 0;
+    serviceprobe_account(tda, -1, 1);
+    if(t->s_ch == NULL)
+      serviceprobe_map(t);
+    return;
+  }
+
+  tvhlog(LOG_INFO, "serviceprobe", "%20s: checking...",
          t->s_svcname);
-        continue;
-      }
-    }
 
-    service_ref(t);
-    pthread_mutex_unlock(&global_lock);
+  sp = calloc(1, sizeof(serviceprobe_t));
+  sp->sp_t = t;
+  sp->sp_tdmi = tdmi;
+  sp->sp_timeout = time(NULL) + timeout;
+  streaming_target_init(&sp->sp_st, serviceprobe_input, sp, 0);
+
+  service_ref(t);
+  t->s_sp_onqueue = 2;
+  TAILQ_INSERT_TAIL(&serviceprobe_active, sp, sp_link);
+  serviceprobe_nactive++;
+
+  sp->sp_s = subscription_create_from_service(t, "serviceprobe",
+                                              &sp->sp_st, 0);
+  if(sp->sp_s == NULL) {
+    tvhlog(LOG_INFO, "serviceprobe", "%20s: could not subscribe",
+           t->s_svcname);
+    serviceprobe_finish(sp);
+    t->s_sp_onqueue = 0;
+    serviceprobe_account(tda, -1, 1);
+  }
+}
 
-    if (checksubscr) {
-      run = 1;
-      pthread_mutex_lock(&sq.sq_mutex);
 
-      while(run) {
+/**
+ * Start as many probes as we are allowed to
+ */
+static void
+serviceprobe_schedule(void)
+{
+  int limit   = MAX(1, config_get_serviceprobe_concurrency());
+  int timeout = MAX(1, config_get_serviceprobe_timeout());
+  th_dvb_mux_instance_t *tdmi;
+  service_t *t, *next;
+
+  /* Nothing to check, map right away */
+  for(t = TAILQ_FIRST(&serviceprobe_queue); t != NULL; t = next) {
+    next = TAILQ_NEXT(t, s_sp_link);
+    if(t->s_dvb_mux_instance->tdmi_adapter->tda_skip_checksubscr)
+      serviceprobe_start(t, timeout);
+  }
+
+  /* Muxes we are already on, no retuning needed */
+  for(t = TAILQ_FIRST(&serviceprobe_queue);
+      t != NULL && serviceprobe_nactive < limit; t = next) {
+    next = TAILQ_NEXT(t, s_sp_link);
+    tdmi = t->s_dvb_mux_instance;
+    if(tdmi == tdmi->tdmi_adapter->tda_mux_current ||
+       serviceprobe_mux_active(tdmi))
+      serviceprobe_start(t, timeout);
+  }
 
-        while((sm = TAILQ_FIRST(&sq.sq_queue)) == NULL)
-          pthread_cond_wait(&sq.sq_cond, &sq.sq_mutex);
+  /* Tune idle adapters to a new mux and take all its services along */
+  for(t = TAILQ_FIRST(&serviceprobe_queue);
+      t != NULL && serviceprobe_nactive < limit; t = next) {
+    next = TAILQ_NEXT(t, s_sp_link);
+    tdmi = t->s_dvb_mux_instance;
+    if(!serviceprobe_adapter_idle(tdmi->tdmi_adapter))
+      continue;
+
+    serviceprobe_start(t, timeout);
+    for(t = next; t != NULL && serviceprobe_nactive < limit; t = next) {
+      next = TAILQ_NEXT(t, s_sp_link);
+      if(t->s_dvb_mux_instance == tdmi)
+        serviceprobe_start(t, timeout);
+    }
+    next = TAILQ_FIRST(&serviceprobe_queue);
+  }
+}
 
-        TAILQ_REMOVE(&sq.sq_queue, sm, sm_link);
 
-        pthread_mutex_unlock(&sq.sq_mutex);
+/**
+ * Reap probes that completed or timed out
+ */
+static void
+serviceprobe_reap(void)
+{
+  serviceprobe_t *sp, *next;
+  service_t *t;
+  th_dvb_adapter_t *tda;
+  time_t now = time(NULL);
+  const char *err;
+  int done;
 
-        if(sm->sm_type == SMT_SERVICE_STATUS) {
-          int status = sm->sm_code;
+  for(sp = TAILQ_FIRST(&serviceprobe_active); sp != NULL; sp = next) {
+    next = TAILQ_NEXT(sp, sp_link);
 
-          if(status & TSS_PACKETS) {
-            run = 0;
-            err = NULL;
-          } else if(status & (TSS_GRACEPERIOD | TSS_ERRORS)) {
-            run = 0;
-            err = service_tss2text(status);
-          }
-        }
+    pthread_mutex_lock(&serviceprobe_mutex);
+    done = sp->sp_done;
+    err = sp->sp_err;
+    pthread_mutex_unlock(&serviceprobe_mutex);
 
-        streaming_msg_free(sm);
-        pthread_mutex_lock(&sq.sq_mutex);
-      }
+    if(!done) {
+      if(now < sp->sp_timeout)
+        continue;
+      err = "Timeout";
+    }
 
-      streaming_queue_clear(&sq.sq_queue);
-      pthread_mutex_unlock(&sq.sq_mutex);
-    } else {
-      err = NULL;
+    t = sp->sp_t;
+    tda = sp->sp_tdmi->tdmi_adapter;
+    subscription_unsubscribe(sp->sp_s);
+    serviceprobe_finish(sp);
+    t->s_sp_onqueue = 0;
+    serviceprobe_account(tda, -1, 1);
+
+    if(err != NULL) {
+      tvhlog(LOG_INFO, "serviceprobe", "%20s: skipped: %s",
+             t->s_svcname, err);
+    } else if(t->s_ch == NULL) {
+      serviceprobe_map(t);
     }
- 
+  }
+}
+
+
+/**
+ *
+ */
+static void *
+serviceprobe_thread(void *aux)
+{
+  th_dvb_adapter_t *tda;
+  serviceprobe_t *sp;
+  struct timespec ts;
+  int was_doing_work = 0;
+  time_t deadline, started = 0;
+
+  while(1) {
+
     pthread_mutex_lock(&global_lock);
 
-    if (checksubscr) {
-      subscription_unsubscribe(s);
+    serviceprobe_reap();
+    serviceprobe_schedule();
+
+    if(serviceprobe_nactive > 0 && !was_doing_work) {
+      tvhlog(LOG_INFO, "serviceprobe", "Starting");
+      was_doing_work = 1;
+      started = dispatch_clock;
+      serviceprobe_probed = 0;
+    } else if(TAILQ_FIRST(&serviceprobe_queue) == NULL && 
+              serviceprobe_nactive == 0 && was_doing_work) {
+      tvhlog(LOG_INFO, "serviceprobe", "Now idle, %d services probed in %ds",
+             serviceprobe_probed, (int)(dispatch_clock - started));
+      was_doing_work = 0;
     }
 
-    if(t->s_status != SERVICE_ZOMBIE) {
+    /* Wait for the first timeout, or retry in a while if all adapters
+       we need are busy with other subscriptions */
+    deadline = 0;
+    TAILQ_FOREACH(sp, &serviceprobe_active, sp_link)
+      if(!deadline || sp->sp_timeout < deadline)
+        deadline = sp->sp_timeout;
+    if(!deadline && TAILQ_FIRST(&serviceprobe_queue) != NULL)
+      deadline = time(NULL) + 10;
+
+    TAILQ_FOREACH(tda, &dvb_adapters, tda_global_link) {
+      if(tda->tda_sp_notify) {
+        tda->tda_sp_notify = 0;
+        dvb_adapter_notify(tda);
+      }
+    }
 
-      if(err != NULL) {
-        tvhlog(LOG_INFO, "serviceprobe", "%20s: skipped: %s",
-        t->s_svcname, err);
-      } else if(t->s_ch == NULL) {
-        int channum = t->s_channel_number;
-        const char *str;
-        
-        if (!channum && t->s_dvb_mux_instance->tdmi_adapter->tda_sidtochan)
-          channum = t->s_dvb_service_id;
+    pthread_mutex_unlock(&global_lock);
 
-        ch = channel_find_by_name(t->s_svcname, 1, channum);
-        service_map_channel(t, ch, 1);
-      
-        tvhlog(LOG_INFO, "serviceprobe", "%20s: mapped to channel \"%s\"",
-               t->s_svcname, t->s_svcname);
-
-        if(service_is_tv(t)) {
-           channel_tag_map(ch, channel_tag_find_by_name("TV channels", 1), 1);
-          tvhlog(LOG_INFO, "serviceprobe", "%20s: joined tag \"%s\"",
-                 t->s_svcname, "TV channels");
-        }
-
-        switch(t->s_servicetype) {
-          case ST_SDTV:
-          case ST_AC_SDTV:
-          case ST_EX_SDTV:
-          case ST_DN_SDTV:
-          case ST_SK_SDTV:
-            str = "SDTV";
-            break;
-          case ST_HDTV:
-          case ST_AC_HDTV:
-          case ST_EX_HDTV:
-          case ST_EP_HDTV:
-          case ST_ET_HDTV:
-          case ST_DN_HDTV:
-            str = "HDTV";
-            break;
-          case ST_RADIO:
-            str = "Radio";
-            break;
-          default:
-            str = NULL;
-        }
-
-        if(str != NULL) {
-          channel_tag_map(ch, channel_tag_find_by_name(str, 1), 1);
-          tvhlog(LOG_INFO, "serviceprobe", "%20s: joined tag \"%s\"",
-                 t->s_svcname, str);
-        }
-
-        if(t->s_provider != NULL) {
-          channel_tag_map(ch, channel_tag_find_by_name(t->s_provider, 1), 1);
-          tvhlog(LOG_INFO, "serviceprobe", "%20s: joined tag \"%s\"",
-                 t->s_svcname, t->s_provider);
-        }
-        channel_save(ch);
+    pthread_mutex_lock(&serviceprobe_mutex);
+    while(!serviceprobe_kick) {
+      if(!deadline) {
+        pthread_cond_wait(&serviceprobe_cond, &serviceprobe_mutex);
+      } else {
+        ts.tv_sec = deadline;
+        ts.tv_nsec = 0;
+        if(pthread_cond_timedwait(&serviceprobe_cond, &serviceprobe_mutex,
+                                  &ts) == ETIMEDOUT)
+          break;
       }
-
-      t->s_sp_onqueue = 0;
-      TAILQ_REMOVE(&serviceprobe_queue, t, s_sp_link);
     }
-    service_unref(t);
+    serviceprobe_kick = 0;
+    pthread_mutex_unlock(&serviceprobe_mutex);
   }
   return NULL;
 }
@@ -245,7 +523,9 @@ void
 serviceprobe_init(void)
 {
   pthread_t ptid;
+  pthread_mutex_init(&serviceprobe_mutex, NULL);
   pthread_cond_init(&serviceprobe_cond, NULL);
   TAILQ_INIT(&serviceprobe_queue);
+  TAILQ_INIT(&serviceprobe_active);
   pthread_create(&ptid, NULL, serviceprobe_thread, NULL);
 }
@@ -0,0 +1,284 @@
+/*
+ *  tvheadend, hot path latency instrumentation
+ *  Copyright (C) 2012
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Every thread that records a timing gets a slot of its own, so the hot
+ * path never takes a lock or does an atomic operation. Slots are summed
+ * when exported. When a thread exits its slot is handed on to the next
+ * new thread, so the totals keep growing monotonically as Prometheus
+ * expects from counters.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tvheadend.h"
+#include "htsbuf.h"
+#include "stats.h"
+
+#define STATS_BUCKETS     32  // log2 of nanoseconds, the last is overflow
+#define STATS_MIN_BUCKET  6   // Smallest exported bucket (64ns)
+
+static const char *stats_stage_names[STATS_STAGES] = {
+  [STATS_READ]       = "read",
+  [STATS_DEMUX]      = "demux",
+  [STATS_DESCRAMBLE] = "descramble",
+  [STATS_PARSE]      = "parse",
+  [STATS_TSFIX]      = "tsfix",
+  [STATS_QUEUE]      = "queue",
+  [STATS_WRITE]      = "write",
+};
+
+typedef struct stats_counter {
+  uint64_t sc_count;
+  uint64_t sc_sum;  // ns
+  uint64_t sc_bucket[STATS_BUCKETS];
+} stats_counter_t;
+
+typedef struct stats_slot {
+  LIST_ENTRY(stats_slot) sl_link;
+  int sl_free;
+  stats_counter_t sl_stage[STATS_STAGES];
+  uint64_t sl_allocs[STATS_ALLOCS];
+} stats_slot_t;
+
+static LIST_HEAD(, stats_slot) stats_slots;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stats_key;
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+static __thread stats_slot_t *stats_slot;
+__thread uint64_t *stats_alloc_count;
+__thread uint64_t stats_child;
+__thread int stats_depth;
+__thread int stats_sampling;
+__thread int stats_countdown;
+
+/**
+ * Nanoseconds per tick, 32.32 fixed point
+ */
+static uint64_t stats_mult = 1ULL << 32;
+
+
+/**
+ *
+ */
+static inline uint64_t
+stats_ticks2ns(uint64_t ticks)
+{
+  if(ticks < (1ULL << 32))
+    return (ticks * stats_mult) >> 32;
+  return ((ticks >> 16) * stats_mult) >> 16;
+}
+
+
+/**
+ * Thread exit, let someone else have the slot
+ */
+static void
+stats_slot_release(void *aux)
+{
+  stats_slot_t *sl = aux;
+
+  pthread_mutex_lock(&stats_mutex);
+  sl->sl_free = 1;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+
+/**
+ * Created on first use, producer threads may start before stats_init()
+ */
+static void
+stats_key_init(void)
+{
+  pthread_key_create(&stats_key, stats_slot_release);
+}
+
+
+/**
+ *
+ */
+static stats_slot_t *
+stats_slot_get(void)
+{
+  stats_slot_t *sl;
+
+  pthread_once(&stats_key_once, stats_key_init);
+
+  pthread_mutex_lock(&stats_mutex);
+
+  LIST_FOREACH(sl, &stats_slots, sl_link)
+    if(sl->sl_free)
+      break;
+
+  if(sl == NULL) {
+    sl = calloc(1, sizeof(stats_slot_t));
+    LIST_INSERT_HEAD(&stats_slots, sl, sl_link);
+  }
+  sl->sl_free = 0;
+
+  pthread_mutex_unlock(&stats_mutex);
+
+  pthread_setspecific(stats_key, sl);
+  stats_slot = sl;
+  stats_alloc_count = sl->sl_allocs;
+  return sl;
+}
+
+
+/**
+ * First allocation counted by the current thread
+ */
+uint64_t *
+stats_alloc_slot(void)
+{
+  return (stats_slot ?: stats_slot_get())->sl_allocs;
+}
+
+
+/**
+ * Allocations counted by all threads
+ */
+void
+stats_allocs(uint64_t *v)
+{
+  stats_slot_t *sl;
+  int i;
+
+  memset(v, 0, sizeof(uint64_t) * STATS_ALLOCS);
+
+  pthread_mutex_lock(&stats_mutex);
+  LIST_FOREACH(sl, &stats_slots, sl_link)
+    for(i = 0; i < STATS_ALLOCS; i++)
+      v[i] += sl->sl_allocs[i];
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+
+/**
+ * Record a sampled time spent in a stage by the current thread
+ */
+void
+stats_record(stats_stage_t stage, uint64_t ticks)
+{
+  stats_slot_t *sl = stats_slot ?: stats_slot_get();
+  stats_counter_t *sc = &sl->sl_stage[stage];
+  uint64_t ns = stats_ticks2ns(ticks);
+  int b = ns ? 64 - __builtin_clzll(ns) : 0;
+
+  sc->sc_count += STATS_SAMPLE;
+  sc->sc_sum += ns * STATS_SAMPLE;
+  sc->sc_bucket[MIN(b, STATS_BUCKETS - 1)] += STATS_SAMPLE;
+}
+
+
+/**
+ * Write all counters in the Prometheus text format
+ */
+void
+stats_export(htsbuf_queue_t *hq)
+{
+  stats_counter_t *tot = calloc(STATS_STAGES, sizeof(stats_counter_t));
+  stats_slot_t *sl;
+  uint64_t n, allocs[STATS_ALLOCS];
+  int i, j, threads = 0;
+
+  pthread_mutex_lock(&stats_mutex);
+  LIST_FOREACH(sl, &stats_slots, sl_link) {
+    threads++;
+    for(i = 0; i < STATS_STAGES; i++) {
+      tot[i].sc_count += sl->sl_stage[i].sc_count;
+      tot[i].sc_sum += sl->sl_stage[i].sc_sum;
+      for(j = 0; j < STATS_BUCKETS; j++)
+	tot[i].sc_bucket[j] += sl->sl_stage[i].sc_bucket[j];
+    }
+  }
+  pthread_mutex_unlock(&stats_mutex);
+
+  stats_allocs(allocs);
+
+  htsbuf_qprintf(hq,
+		 "# HELP tvheadend_stage_seconds "
+		 "Time spent in each stage of the streaming path\n"
+		 "# TYPE tvheadend_stage_seconds histogram\n");
+
+  for(i = 0; i < STATS_STAGES; i++) {
+    n = 0;
+    for(j = 0; j < STATS_BUCKETS - 1; j++) {
+      n += tot[i].sc_bucket[j];
+      if(j < STATS_MIN_BUCKET)
+	continue;
+      htsbuf_qprintf(hq,
+		     "tvheadend_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} "
+		     "%"PRIu64"\n",
+		     stats_stage_names[i], (double)(1ULL << j) / 1e9, n);
+    }
+    htsbuf_qprintf(hq,
+		   "tvheadend_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} "
+		   "%"PRIu64"\n"
+		   "tvheadend_stage_seconds_sum{stage=\"%s\"} %.9f\n"
+		   "tvheadend_stage_seconds_count{stage=\"%s\"} %"PRIu64"\n",
+		   stats_stage_names[i], tot[i].sc_count,
+		   stats_stage_names[i], tot[i].sc_sum / 1e9,
+		   stats_stage_names[i], tot[i].sc_count);
+  }
+
+  htsbuf_qprintf(hq,
+		 "# HELP tvheadend_stats_threads "
+		 "Threads that have recorded timings\n"
+		 "# TYPE tvheadend_stats_threads gauge\n"
+		 "tvheadend_stats_threads %d\n", threads);
+
+  htsbuf_qprintf(hq,
+		 "# HELP tvheadend_allocs_total Allocations on the streaming path\n"
+		 "# TYPE tvheadend_allocs_total counter\n"
+		 "tvheadend_allocs_total{type=\"pkt\"} %"PRIu64"\n"
+		 "tvheadend_allocs_total{type=\"pktref\"} %"PRIu64"\n"
+		 "tvheadend_allocs_total{type=\"pktbuf\"} %"PRIu64"\n"
+		 "tvheadend_allocs_total{type=\"streaming_msg\"} %"PRIu64"\n",
+		 allocs[STATS_ALLOC_PKT], allocs[STATS_ALLOC_PKTREF],
+		 allocs[STATS_ALLOC_PKTBUF], allocs[STATS_ALLOC_MSG]);
+
+  free(tot);
+}
+
+
+/**
+ * Calibrate the tick rate against the monotonic clock
+ */
+void
+stats_init(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+  uint64_t t0, t1;
+  int64_t m0, m1;
+
+  m0 = getmonoclock();
+  t0 = stats_ticks();
+  usleep(20000);
+  m1 = getmonoclock();
+  t1 = stats_ticks();
+
+  if(t1 > t0)
+    stats_mult = ((uint64_t)(m1 - m0) * 1000 << 32) / (t1 - t0);
+  tvhlog(LOG_DEBUG, "stats", "%.1f ticks per microsecond",
+	 (double)(t1 - t0) / (m1 - m0));
+#endif
+}
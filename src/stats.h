@@ -0,0 +1,159 @@
+/*
+ *  tvheadend, hot path latency instrumentation
+ *  Copyright (C) 2012
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "config.h"
+
+/**
+ * Stages of the streaming path
+ *
+ * Spans nest (demux calls descramble and parse, parse calls tsfix, ...),
+ * the time recorded for a stage excludes the stages it calls into
+ */
+typedef enum stats_stage {
+  STATS_READ,        // Reading from the adapter
+  STATS_DEMUX,       // ts_recv_packet1()
+  STATS_DESCRAMBLE,  // CSA descrambling
+  STATS_PARSE,       // Elementary stream parsers
+  STATS_TSFIX,       // Timestamp fixup
+  STATS_QUEUE,       // Waiting in a streaming or HTSP queue
+  STATS_WRITE,       // Writing to the client socket or file
+  STATS_STAGES
+} stats_stage_t;
+
+/**
+ * Allocations on the streaming path
+ */
+typedef enum stats_alloc {
+  STATS_ALLOC_PKT,
+  STATS_ALLOC_PKTREF,
+  STATS_ALLOC_PKTBUF,
+  STATS_ALLOC_MSG,   // streaming_msg_t
+  STATS_ALLOCS
+} stats_alloc_t;
+
+#if ENABLE_STATS
+
+struct htsbuf_queue;
+
+/**
+ * Only one in STATS_SAMPLE outermost spans (and the spans nested in
+ * them) is timed, and recorded with that weight. Reading the clock for
+ * every TS packet would cost more than the 1% we can afford.
+ */
+#define STATS_SAMPLE 32
+
+extern __thread uint64_t stats_child;
+extern __thread int stats_depth;
+extern __thread int stats_sampling;
+extern __thread int stats_countdown;
+
+/**
+ * Cheap timestamp, converted to nanoseconds when recorded
+ */
+static inline uint64_t
+stats_ticks(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return (uint64_t)tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+#endif
+}
+
+void stats_record(stats_stage_t stage, uint64_t ticks);
+
+extern __thread uint64_t *stats_alloc_count;
+
+uint64_t *stats_alloc_slot(void);
+
+/**
+ * Count an allocation in the slot of the current thread
+ */
+static inline void
+stats_alloc(stats_alloc_t a)
+{
+  uint64_t *c = stats_alloc_count ?: stats_alloc_slot();
+  c[a]++;
+}
+
+void stats_allocs(uint64_t *v);
+
+typedef struct stats_span {
+  uint64_t ss_start;
+  uint64_t ss_child;
+} stats_span_t;
+
+static inline void
+stats_enter(stats_span_t *ss)
+{
+  if(stats_depth++ == 0) {
+    stats_sampling = --stats_countdown <= 0;
+    if(stats_sampling)
+      stats_countdown = STATS_SAMPLE;
+  }
+  if(!stats_sampling)
+    return;
+  ss->ss_child = stats_child;
+  stats_child = 0;
+  ss->ss_start = stats_ticks();
+}
+
+static inline void
+stats_leave(stats_span_t *ss, stats_stage_t stage)
+{
+  uint64_t d;
+
+  stats_depth--;
+  if(!stats_sampling)
+    return;
+  d = stats_ticks() - ss->ss_start;
+  stats_record(stage, d - stats_child);
+  stats_child = ss->ss_child + d;
+}
+
+void stats_init(void);
+
+void stats_export(struct htsbuf_queue *hq);
+
+#define STATS_SPAN(v)            stats_span_t v = { 0, 0 }
+#define STATS_ENTER(v)           stats_enter(&(v))
+#define STATS_LEAVE(v, stage)    stats_leave(&(v), stage)
+#define STATS_STAMP(var)         ((var) = stats_sampling ? stats_ticks() : 0)
+#define STATS_SINCE(var, stage) \
+  do { if(var) stats_record(stage, stats_ticks() - (var)); } while(0)
+#define STATS_ALLOC(a)           stats_alloc(a)
+
+#else
+
+#define STATS_SPAN(v)
+#define STATS_ENTER(v)
+#define STATS_LEAVE(v, stage)
+#define STATS_STAMP(var)
+#define STATS_SINCE(var, stage)
+#define STATS_ALLOC(a)
+
+#endif /* ENABLE_STATS */
+
+#endif /* STATS_H_ */
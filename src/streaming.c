@@ -23,6 +23,8 @@
 #include "packet.h"
 #include "atomic.h"
 #include "service.h"
+#include "stats.h"
+
 
 void
 streaming_pad_init(streaming_pad_t *sp)
@@ -51,6 +53,8 @@ streaming_queue_deliver(void *opauqe, streaming_message_t *sm)
 {
   streaming_queue_t *sq = opauqe;
 
+  STATS_STAMP(sm->sm_time);
+
   pthread_mutex_lock(&sq->sq_mutex);
   TAILQ_INSERT_TAIL(&sq->sq_queue, sm, sm_link);
   pthread_cond_signal(&sq->sq_cond);
@@ -116,7 +120,9 @@ streaming_message_t *
 streaming_msg_create(streaming_message_type_t type)
 {
   streaming_message_t *sm = malloc(sizeof(streaming_message_t));
+  STATS_ALLOC(STATS_ALLOC_MSG);
   sm->sm_type = type;
+  sm->sm_time = 0;
   return sm;
 }
 
@@ -168,7 +174,10 @@ streaming_msg_clone(streaming_message_t *src)
   streaming_message_t *dst = malloc(sizeof(streaming_message_t));
   streaming_start_t *ss;
 
+  STATS_ALLOC(STATS_ALLOC_MSG);
+
   dst->sm_type = src->sm_type;
+  dst->sm_time = 0;
 
   switch(src->sm_type) {
 
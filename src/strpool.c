@@ -0,0 +1,195 @@
+/*
+ *  tvheadend, shared string pool
+ *  Copyright (C) 2012
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * EPG data repeats itself a lot: the same titles every day, the same
+ * descriptions on every repeat and +1 channel, the same image URLs for
+ * all episodes of a series. Strings kept here are stored only once.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "tvheadend.h"
+#include "htsbuf.h"
+#include "strpool.h"
+
+typedef struct strpool_entry {
+  struct strpool_entry *se_next;
+  uint32_t se_hash;
+  uint32_t se_refcount;
+  char se_str[0];
+} strpool_entry_t;
+
+#define SE(s) ((strpool_entry_t *)((s) - offsetof(strpool_entry_t, se_str)))
+
+static pthread_mutex_t strpool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static strpool_entry_t **strpool_hash;
+static unsigned int strpool_size;   // Power of two
+static unsigned int strpool_count;  // Unique strings
+static uint64_t strpool_refs;       // References to them
+static uint64_t strpool_bytes;      // Bytes stored
+static uint64_t strpool_refbytes;   // Bytes it would take without sharing
+
+
+/**
+ * FNV-1a
+ */
+static uint32_t
+strpool_hashfn(const char *s)
+{
+  uint32_t h = 2166136261U;
+  while(*s)
+    h = (h ^ (uint8_t)*s++) * 16777619U;
+  return h;
+}
+
+
+/**
+ *
+ */
+static void
+strpool_resize(void)
+{
+  unsigned int i, size = strpool_size ? strpool_size * 2 : 1024;
+  strpool_entry_t **h = calloc(size, sizeof(strpool_entry_t *));
+  strpool_entry_t *se, *next;
+
+  for(i = 0; i < strpool_size; i++) {
+    for(se = strpool_hash[i]; se != NULL; se = next) {
+      next = se->se_next;
+      se->se_next = h[se->se_hash & (size - 1)];
+      h[se->se_hash & (size - 1)] = se;
+    }
+  }
+  free(strpool_hash);
+  strpool_hash = h;
+  strpool_size = size;
+}
+
+
+/**
+ *
+ */
+const char *
+strpool_get(const char *s)
+{
+  uint32_t hash = strpool_hashfn(s);
+  size_t len = strlen(s) + 1;
+  strpool_entry_t *se;
+
+  pthread_mutex_lock(&strpool_mutex);
+
+  if(strpool_count >= strpool_size)
+    strpool_resize();
+
+  for(se = strpool_hash[hash & (strpool_size - 1)]; se != NULL;
+      se = se->se_next)
+    if(se->se_hash == hash && !strcmp(se->se_str, s))
+      break;
+
+  if(se == NULL) {
+    se = malloc(sizeof(strpool_entry_t) + len);
+    se->se_hash = hash;
+    se->se_refcount = 0;
+    memcpy(se->se_str, s, len);
+    se->se_next = strpool_hash[hash & (strpool_size - 1)];
+    strpool_hash[hash & (strpool_size - 1)] = se;
+    strpool_count++;
+    strpool_bytes += len;
+  }
+
+  se->se_refcount++;
+  strpool_refs++;
+  strpool_refbytes += len;
+
+  pthread_mutex_unlock(&strpool_mutex);
+  return se->se_str;
+}
+
+
+/**
+ *
+ */
+const char *
+strpool_ref(const char *s)
+{
+  strpool_entry_t *se = SE(s);
+
+  pthread_mutex_lock(&strpool_mutex);
+  se->se_refcount++;
+  strpool_refs++;
+  strpool_refbytes += strlen(s) + 1;
+  pthread_mutex_unlock(&strpool_mutex);
+  return s;
+}
+
+
+/**
+ *
+ */
+void
+strpool_put(const char *s)
+{
+  strpool_entry_t *se, **p;
+  size_t len;
+
+  if(s == NULL)
+    return;
+
+  se = SE(s);
+  len = strlen(s) + 1;
+
+  pthread_mutex_lock(&strpool_mutex);
+  assert(se->se_refcount > 0);
+  strpool_refs--;
+  strpool_refbytes -= len;
+
+  if(--se->se_refcount == 0) {
+    for(p = &strpool_hash[se->se_hash & (strpool_size - 1)]; *p != se;
+	p = &(*p)->se_next)
+      ;
+    *p = se->se_next;
+    strpool_count--;
+    strpool_bytes -= len;
+    free(se);
+  }
+  pthread_mutex_unlock(&strpool_mutex);
+}
+
+
+/**
+ *
+ */
+void
+strpool_dump(htsbuf_queue_t *hq)
+{
+  pthread_mutex_lock(&strpool_mutex);
+  htsbuf_qprintf(hq,
+		 "Shared strings:  %u unique, %"PRIu64" references\n"
+		 "  stored = %"PRIu64" bytes (+ %zu overhead, "
+		 "%u hash buckets)\n"
+		 "  unshared would be = %"PRIu64" bytes\n\n",
+		 strpool_count, strpool_refs, strpool_bytes,
+		 strpool_count * sizeof(strpool_entry_t), strpool_size,
+		 strpool_refbytes);
+  pthread_mutex_unlock(&strpool_mutex);
+}
@@ -0,0 +1,42 @@
+/*
+ *  tvheadend, shared string pool
+ *  Copyright (C) 2012
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STRPOOL_H_
+#define STRPOOL_H_
+
+struct htsbuf_queue;
+
+/**
+ * Return a shared, reference counted copy of 's'. Equal strings share
+ * the same storage so the result must never be modified.
+ */
+const char *strpool_get(const char *s);
+
+/**
+ * Take another reference to a string returned by strpool_get()
+ */
+const char *strpool_ref(const char *s);
+
+/**
+ * Drop a reference, NULL is ignored
+ */
+void strpool_put(const char *s);
+
+void strpool_dump(struct htsbuf_queue *hq);
+
+#endif /* STRPOOL_H_ */
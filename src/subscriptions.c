@@ -36,6 +36,7 @@
 #include "streaming.h"
 #include "channels.h"
 #include "service.h"
+#include "packet.h"
 
 struct th_subscription_list subscriptions;
 static gtimer_t subscription_reschedule_timer;
@@ -64,7 +65,7 @@ subscription_sort(th_subscription_t *a, th_subscription_t *b)
 /**
  * The service is producing output.
  */
-static void
+void
 subscription_link_service(th_subscription_t *s, service_t *t)
 {
   streaming_message_t *sm;
@@ -75,6 +76,12 @@ subscription_link_service(th_subscription_t *s, service_t *t)
 
   pthread_mutex_lock(&t->s_stream_mutex);
 
+  // Left over from the previous service when relocated
+  if(s->ths_start_message != NULL) {
+    streaming_msg_free(s->ths_start_message);
+    s->ths_start_message = NULL;
+  }
+
   if(TAILQ_FIRST(&t->s_components) != NULL)
     s->ths_start_message =
       streaming_msg_create_data(SMT_START, service_build_stream_start(t));
@@ -95,6 +102,13 @@ subscription_link_service(th_subscription_t *s, service_t *t)
     sm = streaming_msg_create_code(SMT_SERVICE_STATUS, 
 				   t->s_streaming_status);
     streaming_target_deliver(s->ths_output, sm);
+
+    // Start from the most recent keyframe, if the service caches it
+    if(!(s->ths_flags & SUBSCRIPTION_RAW_MPEGTS) &&
+       service_gop_cache_deliver(t, s->ths_output)) {
+      s->ths_gop_cache_hit = 1;
+      s->ths_ttff = getmonoclock() - s->ths_start_mono;
+    }
   }
 
   pthread_mutex_unlock(&t->s_stream_mutex);
@@ -165,15 +179,24 @@ subscription_reschedule(void)
       error = s->ths_testing_error;
       service_remove_subscriber(s->ths_service, s, s->ths_testing_error);
     } else {
+      /* Nothing has started or stopped since we last failed, so we
+	 would fail again. Retry now and then anyway, signal quality
+	 and adapter state are not tracked */
+      if(s->ths_sched_gen == service_sched_gen &&
+	 dispatch_clock < s->ths_sched_time + 10)
+	continue;
       error = 0;
       skip = NULL;
     }
 
     snprintf(buf, sizeof(buf), "Subscription \"%s\"", s->ths_title);
-    t = service_find(s->ths_channel, s->ths_weight, buf, &error, skip);
+    t = service_find(s->ths_channel, s->ths_weight, buf, &error, skip,
+		     s->ths_prefer);
 
     if(t == NULL) {
       /* No service available */
+      s->ths_sched_gen  = service_sched_gen;
+      s->ths_sched_time = dispatch_clock;
 
       sm = streaming_msg_create_code(SMT_NOSTART, error);
       streaming_target_deliver(s->ths_output, sm);
@@ -191,6 +214,7 @@ void
 subscription_unsubscribe(th_subscription_t *s)
 {
   service_t *t = s->ths_service;
+  uint64_t bytes, writes;
 
   lock_assert(&global_lock);
 
@@ -205,6 +229,18 @@ subscription_unsubscribe(th_subscription_t *s)
 	   s->ths_title);
   }
 
+  subscription_get_output(s, &bytes, &writes);
+  if(writes)
+    tvhlog(LOG_DEBUG, "subscription",
+	   "\"%s\" sent %"PRIu64" bytes in %"PRIu64" writes",
+	   s->ths_title, bytes, writes);
+
+  if(s->ths_ttff)
+    tvhlog(LOG_DEBUG, "subscription",
+	   "\"%s\" first keyframe after %"PRId64" ms%s",
+	   s->ths_title, s->ths_ttff / 1000,
+	   s->ths_gop_cache_hit ? " (GOP cache)" : "");
+
   if(t != NULL)
     service_remove_subscriber(t, s, SM_CODE_OK);
 
@@ -218,6 +254,23 @@ subscription_unsubscribe(th_subscription_t *s)
 }
 
 
+/**
+ * Note the time the first video keyframe reaches the subscriber
+ */
+static void
+subscription_check_ttff(th_subscription_t *s, streaming_message_t *sm)
+{
+  th_pkt_t *pkt;
+
+  if(s->ths_ttff || sm->sm_type != SMT_PACKET)
+    return;
+
+  pkt = sm->sm_data;
+  if(pkt->pkt_frametype == PKT_I_FRAME)
+    s->ths_ttff = getmonoclock() - s->ths_start_mono;
+}
+
+
 /**
  * This callback is invoked when we receive data and status updates from
  * the currently bound service
@@ -261,6 +314,7 @@ subscription_input(void *opauqe, streaming_message_t *sm)
     streaming_msg_free(sm);
     return;
   }
+  subscription_check_ttff(s, sm);
   streaming_target_deliver(s->ths_output, sm);
 }
 
@@ -272,6 +326,7 @@ static void
 subscription_input_direct(void *opauqe, streaming_message_t *sm)
 {
   th_subscription_t *s = opauqe;
+  subscription_check_ttff(s, sm);
   streaming_target_deliver(s->ths_output, sm);
 }
 
@@ -303,6 +358,7 @@ subscription_create(int weight, const char *name, streaming_target_t *st,
   s->ths_flags             = flags;
 
   time(&s->ths_start);
+  s->ths_start_mono = getmonoclock();
   LIST_INSERT_SORTED(&subscriptions, s, ths_global_link, subscription_sort);
 
   return s;
@@ -316,10 +372,24 @@ th_subscription_t *
 subscription_create_from_channel(channel_t *ch, unsigned int weight, 
 				 const char *name, streaming_target_t *st,
 				 int flags)
+{
+  return subscription_create_from_channel_prefer(ch, NULL, weight,
+						 name, st, flags);
+}
+
+
+/**
+ * Subscribe to a channel, trying the given service first
+ */
+th_subscription_t *
+subscription_create_from_channel_prefer(channel_t *ch, service_t *t,
+					unsigned int weight, const char *name,
+					streaming_target_t *st, int flags)
 {
   th_subscription_t *s = subscription_create(weight, name, st, flags, 0);
 
   s->ths_channel = ch;
+  s->ths_prefer = t;
   LIST_INSERT_HEAD(&ch->ch_subscriptions, s, ths_channel_link);
   s->ths_service = NULL;
 
@@ -407,12 +477,39 @@ subscription_change_weight(th_subscription_t *s, int weight)
   LIST_REMOVE(s, ths_global_link);
 
   s->ths_weight = weight;
+  s->ths_sched_gen = 0; /* Might be able to steal now */
   LIST_INSERT_SORTED(&subscriptions, s, ths_global_link, subscription_sort);
 
   subscription_reschedule();
 }
 
 
+/**
+ * Account output sent to the client(s). Called from the streaming
+ * threads while the web UI reads the counters, 64 bit loads and stores
+ * aren't atomic on 32 bit CPUs.
+ */
+void
+subscription_add_output(th_subscription_t *s, uint64_t bytes,
+			uint64_t writes)
+{
+  __sync_fetch_and_add(&s->ths_bytes_out, bytes);
+  __sync_fetch_and_add(&s->ths_writes, writes);
+}
+
+
+/**
+ *
+ */
+void
+subscription_get_output(th_subscription_t *s, uint64_t *bytes,
+			uint64_t *writes)
+{
+  *bytes  = __sync_fetch_and_add(&s->ths_bytes_out, 0);
+  *writes = __sync_fetch_and_add(&s->ths_writes, 0);
+}
+
+
 /**
  *
  */
@@ -34,6 +34,9 @@ typedef struct th_subscription {
 
   int ths_testing_error;
 
+  int ths_sched_gen;     /* service_sched_gen at the last failed attempt */
+  time_t ths_sched_time; /* when that was */
+
   LIST_ENTRY(th_subscription) ths_channel_link;
   struct channel *ths_channel;          /* May be NULL if channel has been
 					   destroyed during the
@@ -43,10 +46,20 @@ typedef struct th_subscription {
   struct service *ths_service;   /* if NULL, ths_service_link
 					   is not linked */
 
+  struct service *ths_prefer;    /* Try this service first, if free */
+
   char *ths_title; /* display title */
   time_t ths_start;  /* time when subscription started */
   int ths_total_err; /* total errors during entire subscription */
 
+  /* See subscription_add_output() */
+  uint64_t ths_bytes_out; /* bytes sent to the client(s) */
+  uint64_t ths_writes;    /* number of write calls used to send them */
+
+  int64_t ths_start_mono; /* getmonoclock() when subscription started */
+  int64_t ths_ttff;       /* time to first video keyframe (us), 0 if none */
+  int ths_gop_cache_hit;  /* started from the service GOP cache */
+
   streaming_target_t ths_input;
 
   streaming_target_t *ths_output;
@@ -58,6 +71,8 @@ typedef struct th_subscription {
 } th_subscription_t;
 
 
+extern struct th_subscription_list subscriptions;
+
 /**
  * Prototypes
  */
@@ -74,6 +89,13 @@ th_subscription_t *subscription_create_from_channel(struct channel *ch,
 						    int flags);
 
 
+th_subscription_t *subscription_create_from_channel_prefer(struct channel *ch,
+							   struct service *t,
+							   unsigned int weight,
+							   const char *name,
+							   streaming_target_t *st,
+							   int flags);
+
 th_subscription_t *subscription_create_from_service(struct service *t,
 						    const char *name,
 						    streaming_target_t *st,
@@ -83,10 +105,18 @@ void subscription_change_weight(th_subscription_t *s, int weight);
 
 void subscription_stop(th_subscription_t *s);
 
+void subscription_link_service(th_subscription_t *s, struct service *t);
+
 void subscription_unlink_service(th_subscription_t *s, int reason);
 
 void subscription_dummy_join(const char *id, int first);
 
 int subscriptions_active(void);
 
+void subscription_add_output(th_subscription_t *s, uint64_t bytes,
+			     uint64_t writes);
+
+void subscription_get_output(th_subscription_t *s, uint64_t *bytes,
+			     uint64_t *writes);
+
 #endif /* SUBSCRIPTIONS_H */
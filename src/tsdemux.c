@@ -39,6 +39,7 @@
 #include "tsdemux.h"
 #include "parsers.h"
 #include "streaming.h"
+#include "stats.h"
 
 static void ts_remux(service_t *t, const uint8_t *tsb);
 
@@ -68,6 +69,7 @@ static void
 ts_recv_packet0(service_t *t, elementary_stream_t *st, const uint8_t *tsb)
 {
   int off, pusi, cc, error;
+  STATS_SPAN(span);
 
   service_set_streaming_status_flags(t, TSS_MUX_PACKETS);
 
@@ -87,6 +89,8 @@ ts_recv_packet0(service_t *t, elementary_stream_t *st, const uint8_t *tsb)
 		 "Continuity counter error");
       avgstat_add(&t->s_cc_errors, 1, dispatch_clock);
       avgstat_add(&st->es_cc_errors, 1, dispatch_clock);
+      if(t->s_input_cc_errors != NULL)
+	avgstat_add(t->s_input_cc_errors, 1, dispatch_clock);
 
       // Mark as error if this is not the first packet of a payload
       if(!pusi)
@@ -117,8 +121,11 @@ ts_recv_packet0(service_t *t, elementary_stream_t *st, const uint8_t *tsb)
     if(off > 188)
       break;
 
-    if(t->s_status == SERVICE_RUNNING)
+    if(t->s_status == SERVICE_RUNNING) {
+      STATS_ENTER(span);
       parse_mpeg_ts(t, st, tsb + off, 188 - off, pusi, error);
+      STATS_LEAVE(span, STATS_PARSE);
+    }
     break;
   }
 }
@@ -184,10 +191,14 @@ ts_recv_packet1(service_t *t, const uint8_t *tsb, int64_t *pcrp)
   int pid, n, m, r;
   th_descrambler_t *td;
   int error = 0;
+  STATS_SPAN(span);
+  STATS_SPAN(dspan);
 
   if(t->s_status != SERVICE_RUNNING)
     return;
 
+  STATS_ENTER(span);
+
   pthread_mutex_lock(&t->s_stream_mutex);
 
   service_set_streaming_status_flags(t, TSS_INPUT_HARDWARE);
@@ -196,6 +207,7 @@ ts_recv_packet1(service_t *t, const uint8_t *tsb, int64_t *pcrp)
     /* Transport Error Indicator */
     limitedlog(&t->s_loglimit_tei, "TS", service_nicename(t),
 	       "Transport error indicator");
+    avgstat_add(&t->s_tei_errors, 1, dispatch_clock);
     error = 1;
   }
 
@@ -209,6 +221,7 @@ ts_recv_packet1(service_t *t, const uint8_t *tsb, int64_t *pcrp)
 
   if(st == NULL) {
     pthread_mutex_unlock(&t->s_stream_mutex);
+    STATS_LEAVE(span, STATS_DEMUX);
     return;
   }
 
@@ -233,9 +246,12 @@ ts_recv_packet1(service_t *t, const uint8_t *tsb, int64_t *pcrp)
     LIST_FOREACH(td, &t->s_descramblers, td_service_link) {
       n++;
       
+      STATS_ENTER(dspan);
       r = td->td_descramble(td, t, st, tsb);
+      STATS_LEAVE(dspan, STATS_DESCRAMBLE);
       if(r == 0) {
 	pthread_mutex_unlock(&t->s_stream_mutex);
+	STATS_LEAVE(span, STATS_DEMUX);
 	return;
       }
 
@@ -255,6 +271,7 @@ ts_recv_packet1(service_t *t, const uint8_t *tsb, int64_t *pcrp)
     ts_recv_packet0(t, st, tsb);
   }
   pthread_mutex_unlock(&t->s_stream_mutex);
+  STATS_LEAVE(span, STATS_DEMUX);
 }
 
 
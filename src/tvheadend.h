@@ -43,6 +43,7 @@ extern pthread_mutex_t global_lock;
 extern pthread_mutex_t ffmpeg_lock;
 extern pthread_mutex_t fork_lock;
 
+extern int running;
 extern int webui_port;
 extern int htsp_port;
 
@@ -300,6 +301,9 @@ typedef struct streaming_message {
     void *sm_data;
     int sm_code;
   };
+#if ENABLE_STATS
+  uint64_t sm_time; // When put on a streaming queue, see stats.h
+#endif
 } streaming_message_t;
 
 /**
@@ -423,6 +427,8 @@ int tvh_open(const char *pathname, int flags, mode_t mode);
 
 int tvh_socket(int domain, int type, int protocol);
 
+int tvh_pipe(int pfd[2]);
+
 void hexdump(const char *pfx, const uint8_t *data, int len);
 
 uint32_t tvh_crc32(uint8_t *data, size_t datalen, uint32_t crc);
@@ -18,6 +18,7 @@
 
 #include <pthread.h>
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -34,16 +35,17 @@
 #include "access.h"
 
 static pthread_mutex_t comet_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t comet_cond = PTHREAD_COND_INITIALIZER;
 
 #define MAILBOX_UNUSED_TIMEOUT      20
 #define MAILBOX_EMPTY_REPLY_TIMEOUT 10
+#define MAILBOX_HASH_WIDTH          64
 
 //#define mbdebug(fmt...) printf(fmt);
 #define mbdebug(fmt...)
 
 
 static LIST_HEAD(, comet_mailbox) mailboxes;
+static LIST_HEAD(, comet_mailbox) mailbox_hash[MAILBOX_HASH_WIDTH];
 
 int mailbox_tally;
 
@@ -52,6 +54,9 @@ typedef struct comet_mailbox {
   htsmsg_t *cmb_messages; /* A vector */
   time_t cmb_last_used;
   LIST_ENTRY(comet_mailbox) cmb_link;
+  LIST_ENTRY(comet_mailbox) cmb_hash_link;
+  pthread_cond_t cmb_cond;  /* Signalled when messages are added */
+  int cmb_refcount;         /* Number of requests currently using the box */
   int cmb_debug;
 } comet_mailbox_t;
 
@@ -68,7 +73,9 @@ cmb_destroy(comet_mailbox_t *cmb)
     htsmsg_destroy(cmb->cmb_messages);
 
   LIST_REMOVE(cmb, cmb_link);
+  LIST_REMOVE(cmb, cmb_hash_link);
 
+  pthread_cond_destroy(&cmb->cmb_cond);
   free(cmb->cmb_boxid);
   free(cmb);
 }
@@ -87,7 +94,8 @@ comet_flush(void)
   for(cmb = LIST_FIRST(&mailboxes); cmb != NULL; cmb = next) {
     next = LIST_NEXT(cmb, cmb_link);
 
-    if(cmb->cmb_last_used && cmb->cmb_last_used + 60 < dispatch_clock)
+    if(cmb->cmb_refcount == 0 &&
+       cmb->cmb_last_used && cmb->cmb_last_used + 60 < dispatch_clock)
       cmb_destroy(cmb);
   }
   pthread_mutex_unlock(&comet_mutex);
@@ -124,11 +132,95 @@ comet_mailbox_create(void)
   cmb->cmb_boxid = strdup(id);
   time(&cmb->cmb_last_used);
   mailbox_tally++;
+  pthread_cond_init(&cmb->cmb_cond, NULL);
 
   LIST_INSERT_HEAD(&mailboxes, cmb, cmb_link);
+  LIST_INSERT_HEAD(&mailbox_hash[tvh_strhash(id, MAILBOX_HASH_WIDTH)],
+		   cmb, cmb_hash_link);
   return cmb;
 }
 
+
+/**
+ *
+ */
+static comet_mailbox_t *
+comet_mailbox_find(const char *boxid)
+{
+  comet_mailbox_t *cmb;
+
+  if(boxid == NULL)
+    return NULL;
+
+  LIST_FOREACH(cmb, &mailbox_hash[tvh_strhash(boxid, MAILBOX_HASH_WIDTH)],
+	       cmb_hash_link)
+    if(!strcmp(cmb->cmb_boxid, boxid))
+      break;
+  return cmb;
+}
+
+
+/**
+ * Return the identity of an entity a message describes, or NULL
+ * if the message is an event that must always be delivered
+ */
+static const char *
+comet_message_entity(htsmsg_t *m)
+{
+  const char *id;
+  uint32_t u32;
+
+  if((id = htsmsg_get_str(m, "id")) != NULL ||
+     (id = htsmsg_get_str(m, "identifier")) != NULL)
+    return id;
+
+  if(!htsmsg_get_u32(m, "reload", &u32))
+    return "";
+
+  return NULL;
+}
+
+
+/**
+ * Queue a message in a mailbox
+ *
+ * Updates about the same entity (eg. signal status for a mux) that have
+ * not been delivered yet are merged into the pending message, so a slow
+ * client only ever sees the latest state
+ */
+static void
+cmb_enqueue(comet_mailbox_t *cmb, htsmsg_t *m)
+{
+  const char *cls = htsmsg_get_str(m, "notificationClass");
+  const char *id  = cls ? comet_message_entity(m) : NULL;
+  const char *pcls, *pid;
+  htsmsg_field_t *f;
+  htsmsg_t *p;
+
+  if(cmb->cmb_messages == NULL)
+    cmb->cmb_messages = htsmsg_create_list();
+
+  if(id != NULL) {
+    HTSMSG_FOREACH(f, cmb->cmb_messages) {
+      if((p = htsmsg_get_map_by_field(f)) == NULL)
+	continue;
+      if((pcls = htsmsg_get_str(p, "notificationClass")) == NULL ||
+	 strcmp(pcls, cls))
+	continue;
+      if((pid = comet_message_entity(p)) == NULL || strcmp(pid, id))
+	continue;
+
+      htsmsg_merge(p, m);
+      pthread_cond_broadcast(&cmb->cmb_cond);
+      return;
+    }
+  }
+
+  htsmsg_add_msg(cmb->cmb_messages, NULL, htsmsg_copy(m));
+  pthread_cond_broadcast(&cmb->cmb_cond);
+}
+
+
 /**
  *
  */
@@ -170,51 +262,78 @@ comet_serverIpPort(http_connection_t *hc, comet_mailbox_t *cmb)
 }
 
 
+/**
+ * Lookup (or create) the mailbox for a request and keep it from being
+ * flushed while the request is active
+ */
+static comet_mailbox_t *
+comet_mailbox_get(http_connection_t *hc)
+{
+  comet_mailbox_t *cmb;
+
+  cmb = comet_mailbox_find(http_arg_get(&hc->hc_req_args, "boxid"));
+  if(cmb == NULL) {
+    cmb = comet_mailbox_create();
+    comet_access_update(hc, cmb);
+    comet_serverIpPort(hc, cmb);
+  }
+  cmb->cmb_refcount++;
+  cmb->cmb_last_used = 0; /* Make sure we're not flushed out */
+  return cmb;
+}
+
+
+/**
+ *
+ */
+static void
+comet_mailbox_put(comet_mailbox_t *cmb)
+{
+  cmb->cmb_refcount--;
+  cmb->cmb_last_used = dispatch_clock;
+}
+
+
+/**
+ * Take the pending messages from a mailbox as a reply message
+ */
+static htsmsg_t *
+comet_mailbox_reply(comet_mailbox_t *cmb)
+{
+  htsmsg_t *m = htsmsg_create_map();
+
+  htsmsg_add_str(m, "boxid", cmb->cmb_boxid);
+  htsmsg_add_msg(m, "messages", cmb->cmb_messages ?: htsmsg_create_list());
+  cmb->cmb_messages = NULL;
+  return m;
+}
+
+
 /**
  * Poll callback
  */
 static int
 comet_mailbox_poll(http_connection_t *hc, const char *remain, void *opaque)
 {
-  comet_mailbox_t *cmb = NULL; 
-  const char *cometid = http_arg_get(&hc->hc_req_args, "boxid");
+  comet_mailbox_t *cmb;
   const char *immediate = http_arg_get(&hc->hc_req_args, "immediate");
   int im = immediate ? atoi(immediate) : 0;
-  time_t reqtime;
   struct timespec ts;
   htsmsg_t *m;
 
-  if(!im)
-    usleep(100000); /* Always sleep 0.1 sec to avoid comet storms */
-
   pthread_mutex_lock(&comet_mutex);
 
-  if(cometid != NULL)
-    LIST_FOREACH(cmb, &mailboxes, cmb_link)
-      if(!strcmp(cmb->cmb_boxid, cometid))
-	break;
-    
-  if(cmb == NULL) {
-    cmb = comet_mailbox_create();
-    comet_access_update(hc, cmb);
-    comet_serverIpPort(hc, cmb);
-  }
-  time(&reqtime);
+  cmb = comet_mailbox_get(hc);
 
-  ts.tv_sec = reqtime + 10;
+  ts.tv_sec = time(NULL) + MAILBOX_EMPTY_REPLY_TIMEOUT;
   ts.tv_nsec = 0;
 
-  cmb->cmb_last_used = 0; /* Make sure we're not flushed out */
-
-  if(!im && cmb->cmb_messages == NULL)
-    pthread_cond_timedwait(&comet_cond, &comet_mutex, &ts);
+  while(!im && cmb->cmb_messages == NULL)
+    if(pthread_cond_timedwait(&cmb->cmb_cond, &comet_mutex, &ts) == ETIMEDOUT)
+      break;
 
-  m = htsmsg_create_map();
-  htsmsg_add_str(m, "boxid", cmb->cmb_boxid);
-  htsmsg_add_msg(m, "messages", cmb->cmb_messages ?: htsmsg_create_list());
-  cmb->cmb_messages = NULL;
-  
-  cmb->cmb_last_used = dispatch_clock;
+  m = comet_mailbox_reply(cmb);
+  comet_mailbox_put(cmb);
 
   pthread_mutex_unlock(&comet_mutex);
 
@@ -225,13 +344,96 @@ comet_mailbox_poll(http_connection_t *hc, const char *remain, void *opaque)
 }
 
 
+/**
+ *
+ */
+static int
+comet_write_queue(int fd, htsbuf_queue_t *hq)
+{
+  htsbuf_data_t *hd;
+  ssize_t r;
+  int err = 0;
+
+  while((hd = TAILQ_FIRST(&hq->hq_q)) != NULL) {
+    while(!err && hd->hd_data_off < hd->hd_data_len) {
+      r = write(fd, hd->hd_data + hd->hd_data_off,
+		hd->hd_data_len - hd->hd_data_off);
+      if(r < 0 && errno == EINTR)
+	continue;
+      if(r <= 0)
+	err = 1;
+      else
+	hd->hd_data_off += r;
+    }
+    htsbuf_data_free(hq, hd);
+  }
+  return err;
+}
+
+
+/**
+ * Push callback
+ *
+ * Delivers mailbox messages as a stream of server-sent events, each
+ * event carrying the same JSON object as a poll reply. Messages are
+ * sent as soon as they are queued, so there is no poll interval and no
+ * request per update
+ */
+static int
+comet_mailbox_stream(http_connection_t *hc, const char *remain, void *opaque)
+{
+  comet_mailbox_t *cmb;
+  struct timespec ts;
+  htsbuf_queue_t hq;
+  htsmsg_t *m;
+  int err = 0;
+
+  hc->hc_keep_alive = 0;
+  http_send_header(hc, HTTP_STATUS_OK, "text/event-stream", 0,
+		   NULL, NULL, 0, NULL, NULL);
+
+  htsbuf_queue_init(&hq, 0);
+
+  pthread_mutex_lock(&comet_mutex);
+  cmb = comet_mailbox_get(hc);
+
+  while(!err) {
+    ts.tv_sec = time(NULL) + MAILBOX_EMPTY_REPLY_TIMEOUT;
+    ts.tv_nsec = 0;
+
+    while(cmb->cmb_messages == NULL)
+      if(pthread_cond_timedwait(&cmb->cmb_cond, &comet_mutex, &ts) == ETIMEDOUT)
+	break;
+
+    if(cmb->cmb_messages != NULL) {
+      m = comet_mailbox_reply(cmb);
+      htsbuf_append(&hq, "data: ", 6);
+      htsmsg_json_serialize(m, &hq, 0);
+      htsbuf_append(&hq, "\n\n", 2);
+      htsmsg_destroy(m);
+    } else {
+      /* Keep proxies from timing out and detect dead clients */
+      htsbuf_append(&hq, ":\n\n", 3);
+    }
+
+    pthread_mutex_unlock(&comet_mutex);
+    err = comet_write_queue(hc->hc_fd, &hq);
+    pthread_mutex_lock(&comet_mutex);
+  }
+
+  comet_mailbox_put(cmb);
+  pthread_mutex_unlock(&comet_mutex);
+  return 0;
+}
+
+
 /**
  * Poll callback
  */
 static int
 comet_mailbox_dbg(http_connection_t *hc, const char *remain, void *opaque)
 {
-  comet_mailbox_t *cmb = NULL; 
+  comet_mailbox_t *cmb; 
   const char *cometid = http_arg_get(&hc->hc_req_args, "boxid");
 
   if(cometid == NULL)
@@ -239,23 +441,21 @@ comet_mailbox_dbg(http_connection_t *hc, const char *remain, void *opaque)
 
   pthread_mutex_lock(&comet_mutex);
   
-  LIST_FOREACH(cmb, &mailboxes, cmb_link) {
-    if(!strcmp(cmb->cmb_boxid, cometid)) {
-      char buf[64];
-      cmb->cmb_debug = !cmb->cmb_debug;
+  if((cmb = comet_mailbox_find(cometid)) != NULL) {
+    char buf[64];
+    cmb->cmb_debug = !cmb->cmb_debug;
  
-      if(cmb->cmb_messages == NULL)
-	cmb->cmb_messages = htsmsg_create_list();
+    if(cmb->cmb_messages == NULL)
+      cmb->cmb_messages = htsmsg_create_list();
  
-      htsmsg_t *m = htsmsg_create_map();
-      htsmsg_add_str(m, "notificationClass", "logmessage");
-      snprintf(buf, sizeof(buf), "Loglevel debug: %sabled", 
-	       cmb->cmb_debug ? "en" : "dis");
-      htsmsg_add_str(m, "logtxt", buf);
-      htsmsg_add_msg(cmb->cmb_messages, NULL, m);
-
-      pthread_cond_broadcast(&comet_cond);
-    }
+    htsmsg_t *m = htsmsg_create_map();
+    htsmsg_add_str(m, "notificationClass", "logmessage");
+    snprintf(buf, sizeof(buf), "Loglevel debug: %sabled", 
+	     cmb->cmb_debug ? "en" : "dis");
+    htsmsg_add_str(m, "logtxt", buf);
+    htsmsg_add_msg(cmb->cmb_messages, NULL, m);
+
+    pthread_cond_broadcast(&cmb->cmb_cond);
   }
   pthread_mutex_unlock(&comet_mutex);
 
@@ -270,6 +470,8 @@ void
 comet_init(void)
 {
   http_path_add("/comet/poll",  NULL, comet_mailbox_poll, ACCESS_WEB_INTERFACE);
+  http_path_add("/comet/stream", NULL, comet_mailbox_stream,
+		ACCESS_WEB_INTERFACE);
   http_path_add("/comet/debug", NULL, comet_mailbox_dbg,  ACCESS_WEB_INTERFACE);
 }
 
@@ -289,11 +491,8 @@ comet_mailbox_add_message(htsmsg_t *m, int isdebug)
     if(isdebug && !cmb->cmb_debug)
       continue;
 
-    if(cmb->cmb_messages == NULL)
-      cmb->cmb_messages = htsmsg_create_list();
-    htsmsg_add_msg(cmb->cmb_messages, NULL, htsmsg_copy(m));
+    cmb_enqueue(cmb, m);
   }
 
-  pthread_cond_broadcast(&comet_cond);
   pthread_mutex_unlock(&comet_mutex);
 }
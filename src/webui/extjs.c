@@ -1285,6 +1285,7 @@ extjs_dvrlist(http_connection_t *hc, const char *remain, void *opaque)
 
     htsmsg_add_str(m, "status", dvr_entry_status(de));
     htsmsg_add_str(m, "schedstate", dvr_entry_schedstatus(de));
+    htsmsg_add_u32(m, "conflict", de->de_plan_conflict);
 
 
     if(de->de_sched_state == DVR_COMPLETED) {
@@ -1367,6 +1368,9 @@ service_update(htsmsg_t *in)
 
     if(!htsmsg_get_u32(c, "dvb_eit_enable", &u32))
       service_set_dvb_eit_enable(t, u32);
+
+    if(!htsmsg_get_u32(c, "gop_cache", &u32))
+      service_set_gop_cache(t, u32);
   }
 }
 
@@ -1448,6 +1452,9 @@ extjs_servicedetails(http_connection_t *hc,
   htsmsg_add_str(out, "title", t->s_svcname ?: "unnamed service");
 
   htsmsg_add_msg(out, "streams", streams);
+  htsmsg_add_msg(out, "input", avgstat_input_msg(&t->s_rate, &t->s_cc_errors,
+						 &t->s_tei_errors,
+						 dispatch_clock));
 
   if(t->s_dvb_default_charset != NULL)
     htsmsg_add_str(out, "dvb_default_charset", t->s_dvb_default_charset);
@@ -1710,6 +1717,9 @@ extjs_service_update(htsmsg_t *in)
 
     if(!htsmsg_get_u32(c, "dvb_eit_enable", &u32))
       service_set_dvb_eit_enable(t, u32);
+
+    if(!htsmsg_get_u32(c, "gop_cache", &u32))
+      service_set_gop_cache(t, u32);
   }
 }
 
@@ -1785,6 +1795,10 @@ extjs_config(http_connection_t *hc, const char *remain, void *opaque)
       save |= config_set_muxconfpath(str);
     if ((str = http_arg_get(&hc->hc_req_args, "language")))
       save |= config_set_language(str);
+    if ((str = http_arg_get(&hc->hc_req_args, "serviceprobe_concurrency")))
+      save |= config_set_serviceprobe_concurrency(atoi(str));
+    if ((str = http_arg_get(&hc->hc_req_args, "serviceprobe_timeout")))
+      save |= config_set_serviceprobe_timeout(atoi(str));
     if (save) config_save();
     pthread_mutex_unlock(&global_lock);
     out = htsmsg_create_map();
@@ -237,6 +237,14 @@ extjs_dvbadapter(http_connection_t *hc, const char *remain, void *opaque)
     out = htsmsg_create_map();
     htsmsg_add_u32(out, "success", 1);
 
+  } else if(!strcmp(op, "input")) {
+
+    out = htsmsg_create_map();
+    htsmsg_add_msg(out, "input", avgstat_input_msg(&tda->tda_rate,
+						   &tda->tda_cc_errors,
+						   &tda->tda_tei_errors,
+						   dispatch_clock));
+
   } else {
     pthread_mutex_unlock(&global_lock);
     return HTTP_STATUS_BAD_REQUEST;
@@ -28,7 +28,9 @@
 #include "webui.h"
 #include "access.h"
 #include "epg.h"
+#include "epggrab.h"
 #include "psi.h"
+#include "subscriptions.h"
 #if ENABLE_LINUXDVB
 #include "dvr/dvr.h"
 #include "dvb/dvb.h"
@@ -75,6 +77,52 @@ dumpchannels(htsbuf_queue_t *hq)
   }
 }
 
+static void
+dumpmemory(htsbuf_queue_t *hq)
+{
+  outputtitle(hq, 0, "Memory");
+  epg_memory_dump(hq);
+}
+
+static void
+dumpepggrab(htsbuf_queue_t *hq)
+{
+  outputtitle(hq, 0, "EPG Grabbers");
+  epg_commit_dump(hq);
+  eit_stats_dump(hq);
+  epggrab_ota_stats_dump(hq);
+  opentv_stats_dump(hq);
+}
+
+static void
+dumpsubscriptions(htsbuf_queue_t *hq)
+{
+  th_subscription_t *s;
+  uint64_t bytes, writes;
+  outputtitle(hq, 0, "Subscriptions");
+
+  LIST_FOREACH(s, &subscriptions, ths_global_link) {
+
+    subscription_get_output(s, &bytes, &writes);
+
+    htsbuf_qprintf(hq, "%s (%s)\n", s->ths_title,
+		   s->ths_channel ? s->ths_channel->ch_name : "<no channel>");
+    htsbuf_qprintf(hq,
+		   "  weight = %d\n"
+		   "  errors = %d\n"
+		   "  bytes out = %"PRIu64"\n"
+		   "  writes = %"PRIu64"\n"
+		   "  first keyframe = %"PRId64" ms\n"
+		   "  GOP cache hit = %d\n\n",
+		   s->ths_weight,
+		   s->ths_total_err,
+		   bytes,
+		   writes,
+		   s->ths_ttff / 1000,
+		   s->ths_gop_cache_hit);
+  }
+}
+
 #if ENABLE_LINUXDVB
 static void
 dumptransports(htsbuf_queue_t *hq, struct service_list *l, int indent)
@@ -87,6 +135,11 @@ dumptransports(htsbuf_queue_t *hq, struct service_list *l, int indent)
 
     htsbuf_qprintf(hq, "%*.s%s (%s)\n", indent + 2, "",
 		   service_nicename(t), t->s_identifier);
+
+    if(t->s_gop_cache_enable)
+      htsbuf_qprintf(hq, "%*.sGOP cache: %zu bytes, %u hits, %u misses\n",
+		     indent + 4, "", t->s_gop_cache_size,
+		     t->s_gop_cache_hits, t->s_gop_cache_misses);
 	
     
     htsbuf_qprintf(hq, "%*.s%-16s %-5s %-5s %-5s %-5s %-10s\n", indent + 4, "",
@@ -132,6 +185,7 @@ dumpdvbadapters(htsbuf_queue_t *hq)
 
   TAILQ_FOREACH(tda, &dvb_adapters, tda_global_link) {
     htsbuf_qprintf(hq, "%s (%s)\n", tda->tda_displayname, tda->tda_identifier);
+    htsbuf_qprintf(hq, "  Last scan cycle: %d ms\n", tda->tda_scan_cycle_time);
      
     outputtitle(hq, 4, "Multiplexes");
     LIST_FOREACH(tdmi, &tda->tda_muxes, tdmi_adapter_link) {
@@ -139,6 +193,8 @@ dumpdvbadapters(htsbuf_queue_t *hq)
       dvb_mux_nicename(tdminame, sizeof(tdminame), tdmi);
       htsbuf_qprintf(hq, "      %s (%s)\n",
 		     tdminame, tdmi->tdmi_identifier);
+      htsbuf_qprintf(hq, "      Dwell: %d ms, tables complete after: %d ms\n",
+		     tdmi->tdmi_dwell, tdmi->tdmi_tables_time);
       
       htsbuf_qprintf(hq, "\n");
       dumptransports(hq, &tdmi->tdmi_transports, 8);
@@ -181,6 +237,12 @@ page_statedump(http_connection_t *hc, const char *remain, void *opaque)
 		 tvh_binshasum[19]);
 
   dumpchannels(hq);
+
+  dumpsubscriptions(hq);
+
+  dumpmemory(hq);
+
+  dumpepggrab(hq);
   
 #if ENABLE_LINUXDVB
   dumpdvbadapters(hq);
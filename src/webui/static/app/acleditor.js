@@ -38,6 +38,12 @@ tvheadend.acleditor = function() {
        width: 100
     });
 
+    var zerocopyColumn = new Ext.grid.CheckColumn({
+       header: "Zero-copy",
+       dataIndex: 'zerocopy',
+       width: 70
+    });
+
     var cm = new Ext.grid.ColumnModel([
 	enabledColumn,
 	{
@@ -61,6 +67,24 @@ tvheadend.acleditor = function() {
 	dvrallcfgColumn,
 	webuiColumn,
 	adminColumn,
+	{
+	    header: "Send buffer",
+	    dataIndex: 'sndbuf',
+	    width: 80,
+	    renderer: function(value, metadata, record, row, col, store) {
+		return value ? value : '<span class="tvh-grid-unset">Default</span>';
+	    },
+	    editor: new fm.NumberField({allowNegative: false})
+	},{
+	    header: "Unsent low mark",
+	    dataIndex: 'notsent_lowat',
+	    width: 90,
+	    renderer: function(value, metadata, record, row, col, store) {
+		return value ? value : '<span class="tvh-grid-unset">Default</span>';
+	    },
+	    editor: new fm.NumberField({allowNegative: false})
+	},
+	zerocopyColumn,
 	{
 	    header: "Comment",
 	    dataIndex: 'comment',
@@ -71,14 +95,14 @@ tvheadend.acleditor = function() {
     
     var UserRecord = Ext.data.Record.create([
 	'enabled','streaming','dvr','dvrallcfg','admin','webui','username',
-	'prefix','password','comment'
+	'prefix','password','comment','sndbuf','notsent_lowat','zerocopy'
     ]);
 
     return new tvheadend.tableEditor('Access control', 'accesscontrol', cm,
 				     UserRecord,
 				     [enabledColumn, streamingColumn,
 				      dvrColumn, dvrallcfgColumn, webuiColumn,
-				      adminColumn],
+				      adminColumn, zerocopyColumn],
 				     null,
 				     'config_access.html', 'group');
 }
@@ -54,17 +54,60 @@ tvheadend.cometPoller = function() {
 	});
     });
 
-    function parse_comet_response(responsetxt) {
+    function dispatch_comet_response(responsetxt) {
 	response = Ext.util.JSON.decode(responsetxt);
 	tvheadend.boxid = response.boxid
 	for(x = 0; x < response.messages.length; x++) {
             m = response.messages[x];
 	    tvheadend.comet.fireEvent(m.notificationClass, m);
 	}
+    };
+
+    function parse_comet_response(responsetxt) {
+	dispatch_comet_response(responsetxt);
 	cometRequest.delay(100);
     };
 
-    cometRequest.delay(100);
+    /*
+     * Use the push stream if the browser supports server-sent events,
+     * fall back to long polling if the stream can not be established
+     */
+    var cometStream = function() {
+	var connected = false;
+	var es = new EventSource('comet/stream' +
+				 (tvheadend.boxid ? '?boxid=' + tvheadend.boxid : ''));
+
+	es.onmessage = function(e) {
+	    if(failures > 0) {
+		tvheadend.log('Reconnected to Tvheadend',
+			      'font-weight: bold; color: #080');
+	    }
+	    connected = true;
+	    failures = 0;
+	    dispatch_comet_response(e.data);
+	};
+
+	es.onerror = function(e) {
+	    es.close();
+	    if(!connected) {
+		cometRequest.delay(100);
+		return;
+	    }
+	    if(failures == 0) {
+		tvheadend.log('There seems to be a problem with the ' + 
+			      'live update feed from Tvheadend. ' +
+			      'Trying to reconnect...',
+			      'font-weight: bold; color: #f00');
+	    }
+	    failures++;
+	    setTimeout(cometStream, 1000);
+	};
+    };
+
+    if(window.EventSource)
+	cometStream();
+    else
+	cometRequest.delay(100);
 }
 
 
@@ -7,7 +7,8 @@ tvheadend.miscconf = function() {
   var confreader = new Ext.data.JsonReader(
     { root: 'config' },
     [ 
-      'muxconfpath', 'language'
+      'muxconfpath', 'language',
+      'serviceprobe_concurrency', 'serviceprobe_timeout'
     ]
   );
 
@@ -27,6 +28,24 @@ tvheadend.miscconf = function() {
     allowBlank : true
   });
 
+  var probeConcurrency = new Ext.form.NumberField({
+    fieldLabel    : 'Concurrent service probes',
+    name          : 'serviceprobe_concurrency',
+    allowDecimals : false,
+    allowNegative : false,
+    minValue      : 1,
+    width         : 50
+  });
+
+  var probeTimeout = new Ext.form.NumberField({
+    fieldLabel    : 'Service probe timeout (s)',
+    name          : 'serviceprobe_timeout',
+    allowDecimals : false,
+    allowNegative : false,
+    minValue      : 1,
+    width         : 50
+  });
+
   /* ****************************************************************
    * Form
    * ***************************************************************/
@@ -60,7 +79,9 @@ tvheadend.miscconf = function() {
     autoHeight    : true,
     items         : [
       language,
-      dvbscanPath
+      dvbscanPath,
+      probeConcurrency,
+      probeTimeout
     ],
     tbar: [
       saveButton,
@@ -87,6 +87,20 @@ tvheadend.dvb_muxes = function(adapterData, satConfStore) {
 	    dataIndex: 'muxid',
 	    width: 50
 	},
+	{
+	    header: "Dwell time",
+	    dataIndex: 'dwell',
+	    width: 60,
+	    renderer: function(value, metadata, record, row, col, store) {
+		if(!value)
+		    return '<span class="tvh-grid-unset">Not tuned</span>';
+		var s = (value / 1000).toFixed(1) + ' s';
+		if(typeof record.data.tablesTime !== 'undefined')
+		    s += ' (tables ' + 
+			(record.data.tablesTime / 1000).toFixed(1) + ' s)';
+		return s;
+	    }
+	},
 	qualityColumn
     );
 
@@ -95,7 +109,7 @@ tvheadend.dvb_muxes = function(adapterData, satConfStore) {
 
     var rec = Ext.data.Record.create([
 	'id', 'enabled','network', 'freq', 'pol', 'satconf', 
-	'muxid', 'quality', 'fe_status', 'mod'
+	'muxid', 'quality', 'fe_status', 'mod', 'dwell', 'tablesTime'
     ]);
 
     var store = new Ext.data.JsonStore({
@@ -395,6 +409,12 @@ tvheadend.dvb_services = function(adapterId) {
 		width: 45
 	});
 
+	var gopCacheColumn = new Ext.grid.CheckColumn({
+		header: "Fast zap",
+		dataIndex: 'gop_cache',
+		width: 55
+	});
+
     var actions = new Ext.ux.grid.RowActions({
 	header:'',
 	dataIndex: 'actions',
@@ -491,6 +511,7 @@ tvheadend.dvb_services = function(adapterId) {
 		})
 	},
 	eitColumn,
+	gopCacheColumn,
 	{
 	    header: "Type",
 	    dataIndex: 'type',
@@ -537,7 +558,8 @@ tvheadend.dvb_services = function(adapterId) {
 	root: 'entries',
 	fields: Ext.data.Record.create([
 	    'id', 'enabled', 'type', 'sid', 'pmt', 'pcr', 'svcname', 'network',
-	    'provider', 'mux', 'channelname', 'dvb_default_charset', 'dvb_eit_enable'
+	    'provider', 'mux', 'channelname', 'dvb_default_charset', 'dvb_eit_enable',
+	    'gop_cache'
 	]),
 	url: "dvb/services/" + adapterId,
 	autoLoad: true,
@@ -623,7 +645,7 @@ tvheadend.dvb_services = function(adapterId) {
     var grid = new Ext.grid.EditorGridPanel({
 	stripeRows: true,
 	title: 'Services',
-	plugins: [enabledColumn, eitColumn, actions],
+	plugins: [enabledColumn, eitColumn, gopCacheColumn, actions],
 	store: store,
 	clicksToEdit: 2,
 	cm: cm,
@@ -1239,7 +1261,35 @@ tvheadend.dvb_adapter_general = function(adapterData, satConfStore) {
 	    '<h3>Currently tuned to:</h3>{currentMux}&nbsp' +
 	    '<h3>Services:</h3>{services}' +
 	    '<h3>Muxes:</h3>{muxes}' +
-	    '<h3>Muxes awaiting initial scan:</h3>{initialMuxes}'
+	    '<h3>Muxes awaiting initial scan:</h3>{initialMuxes}' +
+	    '<tpl if="scanCycle != 0">' +
+	    '<h3>Last scan cycle:</h3>{[this.eta(values.scanCycle)]}</tpl>' +
+	    '<h3>Services awaiting probe:</h3>{probeQueue}' +
+	    '<tpl if="probeEta != 0">' +
+	    ' (about {[this.eta(values.probeEta)]} left)</tpl>' +
+	    '<tpl if="input && currentMux">' +
+	    '<h2 style="font-size: 150%">Input</h2>' +
+	    '<tpl for="input">' +
+	    '<h3>Last {period} s:</h3>' +
+	    '{[this.rate(values.bitrate)]} ' +
+	    '(min {[this.rate(values.bitrateMin)]}, ' +
+	    'max {[this.rate(values.bitrateMax)]}, ' +
+	    '95% {[this.rate(values.bitrateP95)]}), ' +
+	    '{packets} packets, {ccErrors} continuity errors, ' +
+	    '{teiErrors} transport errors</tpl></tpl>',
+	{
+	    rate: function(b) {
+		return Math.round(b / 1000) + ' kb/s';
+	    },
+	    eta: function(s) {
+		if(s < 60)
+		    return s + ' s';
+		if(s < 3600)
+		    return Math.round(s / 60) + ' min';
+		return Math.floor(s / 3600) + ' h ' +
+		    Math.round((s % 3600) / 60) + ' min';
+	    }
+	}
     );
    
 
@@ -1277,6 +1327,38 @@ tvheadend.dvb_adapter_general = function(adapterData, satConfStore) {
 	    serviceScanBtn.disable();
     });
 
+    /**
+     * Input statistics change every second, fetch them only while
+     * the panel is on screen
+     */
+    var inputTask = {
+	interval: 2000,
+	run: function() {
+	    if(!panel.rendered || !panel.getEl().isVisible(true))
+		return;
+	    Ext.Ajax.request({
+		url:'dvb/adapter/' + adapterData.identifier,
+		params: {
+		    op: 'input'
+		},
+		success:function(response, options) {
+		    var m = Ext.util.JSON.decode(response.responseText);
+		    var idx = tvheadend.tvAdapterStore.find('identifier',
+							   adapterData.identifier);
+		    if(idx == -1)
+			return;
+		    tvheadend.tvAdapterStore.getAt(idx).set('input', m.input);
+		    tvheadend.tvAdapterStore.commitChanges();
+		}
+	    });
+	}
+    };
+
+    Ext.TaskMgr.start(inputTask);
+    panel.on('destroy', function() {
+	Ext.TaskMgr.stop(inputTask);
+    });
+
     return panel;
 }
 
@@ -270,7 +270,12 @@ tvheadend.dvrschedule = function() {
 	    width: 200,
 	    id:'status',
 	    header: "Status",
-	    dataIndex: 'status'
+	    dataIndex: 'status',
+	    renderer: function(value, metadata, record, row, col, store) {
+		if(record.data.conflict)
+		    return '<span class="tvh-grid-conflict">' + value + '</span>';
+		return value;
+	    }
 	}
     ]);
 
@@ -639,6 +644,7 @@ tvheadend.dvr = function() {
             {name: 'config_name'},
 	    {name: 'status'},
 	    {name: 'schedstate'},
+	    {name: 'conflict'},
 	    {name: 'creator'},
             {name: 'duration'},
             {name: 'filesize'},
@@ -664,6 +670,7 @@ tvheadend.dvr = function() {
 
 	    r.data.status = m.status;
 	    r.data.schedstate = m.schedstate;
+	    r.data.conflict = m.conflict;
 
 	    tvheadend.dvrStore.afterEdit(r);
 	    tvheadend.dvrStore.fireEvent('updated', 
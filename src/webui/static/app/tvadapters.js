@@ -14,6 +14,10 @@ tvheadend.tvAdapterStore = new Ext.data.JsonStore({
 	     'services',
 	     'muxes',
 	     'initialMuxes',
+	     'scanCycle',
+	     'probeQueue',
+	     'probeEta',
+	     'input',
 	     'satConf',
 	     'deliverySystem',
 	     'freqMin',
@@ -121,6 +125,29 @@ tvheadend.showTransportDetails = function(data)
 	html += '</div>';
     }
 
+    if(data.input) {
+	html += '<div style="display:block;font-weight:bold;margin:8px 0 4px">';
+	html += '<span style="float:left;width:60px">Period</span>';
+	html += '<span style="float:left;width:160px">Bitrate (min/max/95%)</span>';
+	html += '<span style="float:left;width:60px">CC err</span>';
+	html += '<span>TEI err</span>';
+	html += '</div>';
+
+	for(i = 0; i < data.input.length; i++) {
+	    s = data.input[i];
+	    kb = function(b) { return Math.round(b / 1000); };
+
+	    html += '<div style="display:block">';
+	    html += '<span style="float:left;width:60px">' + s.period + ' s</span>';
+	    html += '<span style="float:left;width:160px">' + kb(s.bitrate) +
+		' (' + kb(s.bitrateMin) + '/' + kb(s.bitrateMax) + '/' +
+		kb(s.bitrateP95) + ') kb/s</span>';
+	    html += '<span style="float:left;width:60px">' + s.ccErrors + '</span>';
+	    html += '<span>' + s.teiErrors + '</span>';
+	    html += '</div>';
+	}
+    }
+
     win = new Ext.Window({
 	title: 'Service details for ' + data.title,
         layout: 'fit',
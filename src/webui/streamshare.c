@@ -0,0 +1,845 @@
+/*
+ *  tvheadend, shared HTTP stream output
+ *  Copyright (C) 2012
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * HTTP clients requesting the same channel in the same container share
+ * a single subscription and muxer. The muxer writes into a pipe, a
+ * reader thread cuts the output into refcounted chunks and every client
+ * keeps its own read cursor into the chunk chain. New clients start at
+ * the most recent random access point of the video stream, preceded by
+ * the last seen PAT and PMT.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <poll.h>
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+#define SHARE_ZEROCOPY 1
+#else
+#define SHARE_ZEROCOPY 0
+#endif
+
+#include "tvheadend.h"
+#include "http.h"
+#include "webui.h"
+#include "streaming.h"
+#include "subscriptions.h"
+#include "channels.h"
+#include "service.h"
+#include "muxer.h"
+#include "stats.h"
+
+#define SHARE_CHUNK_SIZE    (188 * 348) // ~64kB
+#define SHARE_MAX_LAG       (8 * 1024 * 1024) // Also bounds the retained chain
+#define SHARE_SYNC_TIMEOUT  3 // Seconds to wait for a random access point
+#define SHARE_ZC_MAX        64 // Outstanding zero-copy sends per client
+
+/**
+ * A piece of muxer output. Each chunk holds a reference on the chunk
+ * following it, so a chain stays alive for as long as some client
+ * (or the share itself) references a chunk further back.
+ */
+typedef struct share_chunk {
+  struct share_chunk *shc_next;
+  int      shc_refcount;
+  int      shc_sync;    // Chunk starts at a random access point
+  uint64_t shc_offset;  // Stream offset of the first byte
+  size_t   shc_len;     // Only ever grows, bytes below are immutable
+  uint8_t  shc_data[SHARE_CHUNK_SIZE];
+} share_chunk_t;
+
+
+/**
+ *
+ */
+typedef struct stream_share {
+  LIST_ENTRY(stream_share) sh_link;
+  int sh_clients;
+
+  int sh_chid;
+  muxer_container_type_t sh_mc;
+  char *sh_name;
+
+  pthread_mutex_t sh_mutex;
+  pthread_cond_t  sh_cond;
+
+  streaming_queue_t  sh_sq;
+  th_subscription_t *sh_s;
+  muxer_t *sh_mux;
+  int sh_pipe[2];
+  pthread_t sh_mux_tid;
+  pthread_t sh_read_tid;
+  int sh_running;  // Cleared when the muxer thread should stop
+  int sh_eof;      // Set by the reader thread when the muxer is gone
+
+  const char *sh_mime; // NULL until the stream has started
+  int sh_pmt_pid;
+  int sh_video_pid;    // -1 if no video, every packet is then a sync point
+
+  uint8_t sh_pat[188];
+  uint8_t sh_pmt[188];
+  int sh_have_pat;
+  int sh_have_pmt;
+
+  share_chunk_t *sh_tail; // Chunk currently being filled
+  share_chunk_t *sh_sync; // Most recent chunk starting at a sync point
+  uint64_t sh_bytes;      // Total number of bytes produced
+} stream_share_t;
+
+
+/**
+ * Per client sending state
+ */
+typedef struct share_client {
+  int cl_fd;
+  int cl_zerocopy;
+
+  uint64_t cl_bytes;  // Not yet accounted on the share
+  uint64_t cl_writes;
+
+  /* Chunks referenced by zero-copy sends not yet completed */
+  struct {
+    share_chunk_t *shc;
+    int done;
+  } cl_zc[SHARE_ZC_MAX];
+  int cl_zc_head;
+  int cl_zc_count;
+  uint32_t cl_zc_seq; // Id the kernel assigns to the next send
+} share_client_t;
+
+static LIST_HEAD(, stream_share) stream_shares;
+static pthread_mutex_t stream_share_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Drop a reference, releasing every chunk that becomes unreachable
+ */
+static void
+share_chunk_unref(share_chunk_t *shc)
+{
+  share_chunk_t *next;
+
+  while(shc != NULL && --shc->shc_refcount == 0) {
+    next = shc->shc_next;
+    free(shc);
+    shc = next;
+  }
+}
+
+
+/**
+ * Append a new chunk to the chain, called with sh_mutex held
+ */
+static share_chunk_t *
+share_chunk_new(stream_share_t *sh, int sync)
+{
+  share_chunk_t *shc = malloc(sizeof(share_chunk_t));
+
+  shc->shc_next     = NULL;
+  shc->shc_refcount = 1; // sh_tail
+  shc->shc_sync     = sync;
+  shc->shc_offset   = sh->sh_bytes;
+  shc->shc_len      = 0;
+
+  if(sh->sh_tail != NULL) {
+    sh->sh_tail->shc_next = shc;
+    shc->shc_refcount++;
+    share_chunk_unref(sh->sh_tail);
+  }
+  sh->sh_tail = shc;
+
+  if(sync) {
+    shc->shc_refcount++;
+    share_chunk_unref(sh->sh_sync);
+    sh->sh_sync = shc;
+  } else if(sh->sh_sync != NULL &&
+	    sh->sh_bytes - sh->sh_sync->shc_offset > SHARE_MAX_LAG) {
+    // Don't hold on to more than a client may lag behind
+    share_chunk_unref(sh->sh_sync);
+    sh->sh_sync = NULL;
+  }
+  return shc;
+}
+
+
+/**
+ * Check if a TS packet starts a random access point of the video stream
+ */
+static int
+share_is_sync(stream_share_t *sh, const uint8_t *tsb, int pid)
+{
+  if(sh->sh_video_pid < 0)
+    return 1;
+
+  if(pid != sh->sh_video_pid || !(tsb[1] & 0x40))
+    return 0;
+
+  // Adaptation field with random_access_indicator set
+  return (tsb[3] & 0x20) && tsb[4] > 0 && (tsb[5] & 0x40);
+}
+
+
+/**
+ * Cut muxer output into chunks, called with sh_mutex held
+ */
+static void
+share_input(stream_share_t *sh, const uint8_t *tsb, size_t len)
+{
+  share_chunk_t *shc;
+  int pid, sync;
+
+  for(; len >= 188; tsb += 188, len -= 188) {
+    pid = (tsb[1] & 0x1f) << 8 | tsb[2];
+
+    if(pid == 0) {
+      memcpy(sh->sh_pat, tsb, 188);
+      sh->sh_have_pat = 1;
+    } else if(pid == sh->sh_pmt_pid) {
+      memcpy(sh->sh_pmt, tsb, 188);
+      sh->sh_have_pmt = 1;
+    }
+
+    sync = share_is_sync(sh, tsb, pid);
+    shc = sh->sh_tail;
+
+    if(shc == NULL || shc->shc_len == SHARE_CHUNK_SIZE ||
+       (sync && shc->shc_len && (sh->sh_video_pid >= 0 || !shc->shc_sync)))
+      shc = share_chunk_new(sh, sync);
+
+    memcpy(shc->shc_data + shc->shc_len, tsb, 188);
+    shc->shc_len += 188;
+    sh->sh_bytes += 188;
+  }
+}
+
+
+/**
+ * Read the muxer output from the pipe
+ */
+static void *
+share_reader_thread(void *aux)
+{
+  stream_share_t *sh = aux;
+  uint8_t buf[188 * 64];
+  size_t fill = 0, used;
+  ssize_t r;
+
+  while(1) {
+    r = read(sh->sh_pipe[0], buf + fill, sizeof(buf) - fill);
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r <= 0)
+      break;
+
+    fill += r;
+    used = fill - (fill % 188);
+
+    pthread_mutex_lock(&sh->sh_mutex);
+    share_input(sh, buf, used);
+    pthread_cond_broadcast(&sh->sh_cond);
+    pthread_mutex_unlock(&sh->sh_mutex);
+
+    memmove(buf, buf + used, fill - used);
+    fill -= used;
+  }
+
+  pthread_mutex_lock(&sh->sh_mutex);
+  sh->sh_eof = 1;
+  pthread_cond_broadcast(&sh->sh_cond);
+  pthread_mutex_unlock(&sh->sh_mutex);
+  return NULL;
+}
+
+
+/**
+ * Setup the muxer once the stream has started
+ */
+static void
+share_start(stream_share_t *sh, const streaming_start_t *ss)
+{
+  const streaming_start_component_t *ssc;
+  int i, video_pid = -1, pmt_pid = -1;
+
+  pthread_mutex_lock(&global_lock);
+  if(sh->sh_s->ths_service != NULL) {
+    if(sh->sh_mux == NULL)
+      sh->sh_mux = muxer_create(sh->sh_s->ths_service, sh->sh_mc);
+    pmt_pid = sh->sh_s->ths_service->s_pmt_pid;
+  }
+  pthread_mutex_unlock(&global_lock);
+
+  if(sh->sh_mux == NULL)
+    return;
+
+  if(sh->sh_mime == NULL && muxer_open_stream(sh->sh_mux, sh->sh_pipe[1]))
+    return;
+
+  for(i = 0; i < ss->ss_num_components; i++) {
+    ssc = &ss->ss_components[i];
+    if(!ssc->ssc_disabled && SCT_ISVIDEO(ssc->ssc_type)) {
+      video_pid = ssc->ssc_pid;
+      break;
+    }
+  }
+
+  pthread_mutex_lock(&sh->sh_mutex);
+  sh->sh_video_pid = video_pid;
+  sh->sh_pmt_pid = pmt_pid;
+  pthread_mutex_unlock(&sh->sh_mutex);
+
+  muxer_init(sh->sh_mux, ss, sh->sh_name);
+
+  pthread_mutex_lock(&sh->sh_mutex);
+  sh->sh_mime = muxer_mime(sh->sh_mux, ss);
+  pthread_cond_broadcast(&sh->sh_cond);
+  pthread_mutex_unlock(&sh->sh_mutex);
+}
+
+
+/**
+ * Feed the subscription output to the shared muxer
+ */
+static void *
+share_muxer_thread(void *aux)
+{
+  stream_share_t *sh = aux;
+  streaming_queue_t *sq = &sh->sh_sq;
+  streaming_message_t *sm;
+  struct timespec ts;
+  struct timeval tp;
+  int run = 1;
+
+  while(run) {
+    pthread_mutex_lock(&sq->sq_mutex);
+    if(!sh->sh_running) {
+      pthread_mutex_unlock(&sq->sq_mutex);
+      break;
+    }
+
+    sm = TAILQ_FIRST(&sq->sq_queue);
+    if(sm == NULL) {
+      gettimeofday(&tp, NULL);
+      ts.tv_sec  = tp.tv_sec + 1;
+      ts.tv_nsec = tp.tv_usec * 1000;
+      pthread_cond_timedwait(&sq->sq_cond, &sq->sq_mutex, &ts);
+      pthread_mutex_unlock(&sq->sq_mutex);
+      continue;
+    }
+
+    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+    pthread_mutex_unlock(&sq->sq_mutex);
+
+    STATS_SINCE(sm->sm_time, STATS_QUEUE);
+
+    switch(sm->sm_type) {
+    case SMT_MPEGTS:
+    case SMT_PACKET:
+      if(sh->sh_mux != NULL && !muxer_write_pkt(sh->sh_mux, sm->sm_data))
+	sm->sm_data = NULL;
+      break;
+
+    case SMT_START:
+      tvhlog(LOG_DEBUG, "webui", "Start shared stream %s", sh->sh_name);
+      share_start(sh, sm->sm_data);
+      break;
+
+    case SMT_STOP:
+      // A reconfigured source is followed by a new START, keep going
+      if(sm->sm_code != SM_CODE_SOURCE_RECONFIGURED)
+	run = 0;
+      break;
+
+    case SMT_NOSTART:
+    case SMT_EXIT:
+      run = 0;
+      break;
+
+    default:
+      break;
+    }
+    streaming_msg_free(sm);
+
+    if(sh->sh_mux != NULL && sh->sh_mux->m_errors)
+      run = 0;
+  }
+
+  if(sh->sh_mux != NULL) {
+    muxer_close(sh->sh_mux);
+    muxer_destroy(sh->sh_mux);
+    sh->sh_mux = NULL;
+  }
+
+  // Let the reader thread see EOF
+  close(sh->sh_pipe[1]);
+  return NULL;
+}
+
+
+/**
+ * Find or create the share for a channel, called with stream_share_mutex
+ */
+static stream_share_t *
+share_find(channel_t *ch, muxer_container_type_t mc)
+{
+  stream_share_t *sh;
+  int eof;
+
+  LIST_FOREACH(sh, &stream_shares, sh_link) {
+    if(sh->sh_chid != ch->ch_id || sh->sh_mc != mc)
+      continue;
+    pthread_mutex_lock(&sh->sh_mutex);
+    eof = sh->sh_eof;
+    pthread_mutex_unlock(&sh->sh_mutex);
+    if(!eof)
+      return sh;
+  }
+
+  sh = calloc(1, sizeof(stream_share_t));
+  if(tvh_pipe(sh->sh_pipe)) {
+    free(sh);
+    return NULL;
+  }
+
+  sh->sh_chid = ch->ch_id;
+  sh->sh_mc = mc;
+  sh->sh_video_pid = -1;
+  sh->sh_pmt_pid = -1;
+  sh->sh_running = 1;
+  pthread_mutex_init(&sh->sh_mutex, NULL);
+  pthread_cond_init(&sh->sh_cond, NULL);
+  streaming_queue_init(&sh->sh_sq, SMT_PACKET);
+
+  pthread_mutex_lock(&global_lock);
+  sh->sh_name = strdup(ch->ch_name);
+  sh->sh_s = subscription_create_from_channel(ch, 100, "HTTP",
+					      &sh->sh_sq.sq_st,
+					      SUBSCRIPTION_RAW_MPEGTS);
+  pthread_mutex_unlock(&global_lock);
+
+  if(sh->sh_s == NULL) {
+    close(sh->sh_pipe[0]);
+    close(sh->sh_pipe[1]);
+    streaming_queue_deinit(&sh->sh_sq);
+    free(sh->sh_name);
+    free(sh);
+    return NULL;
+  }
+
+  pthread_create(&sh->sh_read_tid, NULL, share_reader_thread, sh);
+  pthread_create(&sh->sh_mux_tid, NULL, share_muxer_thread, sh);
+
+  LIST_INSERT_HEAD(&stream_shares, sh, sh_link);
+  tvhlog(LOG_DEBUG, "webui", "Created shared stream for %s", sh->sh_name);
+  return sh;
+}
+
+
+/**
+ * Tear down a share once the last client has left
+ */
+static void
+share_destroy(stream_share_t *sh)
+{
+  pthread_mutex_lock(&global_lock);
+  subscription_unsubscribe(sh->sh_s);
+  pthread_mutex_unlock(&global_lock);
+
+  pthread_mutex_lock(&sh->sh_sq.sq_mutex);
+  sh->sh_running = 0;
+  pthread_cond_signal(&sh->sh_sq.sq_cond);
+  pthread_mutex_unlock(&sh->sh_sq.sq_mutex);
+
+  pthread_join(sh->sh_mux_tid, NULL);
+  pthread_join(sh->sh_read_tid, NULL);
+  close(sh->sh_pipe[0]);
+
+  streaming_queue_deinit(&sh->sh_sq);
+  share_chunk_unref(sh->sh_sync);
+  share_chunk_unref(sh->sh_tail);
+
+  tvhlog(LOG_DEBUG, "webui", "Destroyed shared stream for %s", sh->sh_name);
+
+  pthread_mutex_destroy(&sh->sh_mutex);
+  pthread_cond_destroy(&sh->sh_cond);
+  free(sh->sh_name);
+  free(sh);
+}
+
+
+/**
+ * Drop the chunk references held by completed zero-copy sends. Called
+ * with sh_mutex held.
+ */
+static void
+share_zc_reap(share_client_t *cl)
+{
+#if SHARE_ZEROCOPY
+  struct sock_extended_err *serr;
+  struct cmsghdr *cm;
+  struct msghdr msg;
+  char control[128];
+  uint32_t id, off, first;
+
+  while(cl->cl_zc_count) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if(recvmsg(cl->cl_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+      break;
+
+    first = cl->cl_zc_seq - cl->cl_zc_count;
+
+    for(cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+      serr = (struct sock_extended_err *)CMSG_DATA(cm);
+      if(serr->ee_errno || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+	continue;
+
+      // Completions are reported as a range of send ids
+      for(id = serr->ee_info; ; id++) {
+	off = id - first;
+	if(off < cl->cl_zc_count)
+	  cl->cl_zc[(cl->cl_zc_head + off) % SHARE_ZC_MAX].done = 1;
+	if(id == serr->ee_data)
+	  break;
+      }
+    }
+
+    while(cl->cl_zc_count && cl->cl_zc[cl->cl_zc_head].done) {
+      share_chunk_unref(cl->cl_zc[cl->cl_zc_head].shc);
+      cl->cl_zc_head = (cl->cl_zc_head + 1) % SHARE_ZC_MAX;
+      cl->cl_zc_count--;
+    }
+  }
+#endif
+}
+
+
+/**
+ * Wait for zero-copy completions, called with sh_mutex held
+ */
+static void
+share_zc_wait(stream_share_t *sh, share_client_t *cl)
+{
+#if SHARE_ZEROCOPY
+  struct pollfd pfd;
+
+  pfd.fd = cl->cl_fd;
+  pfd.events = 0;
+
+  pthread_mutex_unlock(&sh->sh_mutex);
+  poll(&pfd, 1, 1000);
+  pthread_mutex_lock(&sh->sh_mutex);
+
+  share_zc_reap(cl);
+#endif
+}
+
+
+/**
+ * Send data to a client with a single system call, called without
+ * sh_mutex held. With zerocopy set the kernel references the data until
+ * the send completes, so it must be pinned by the caller.
+ */
+static ssize_t
+share_send(share_client_t *cl, const uint8_t *buf, size_t len, int zerocopy)
+{
+  ssize_t r;
+  STATS_SPAN(span);
+
+  STATS_ENTER(span);
+  do {
+#if SHARE_ZEROCOPY
+    if(zerocopy)
+      r = send(cl->cl_fd, buf, len, MSG_ZEROCOPY);
+    else
+#endif
+      r = write(cl->cl_fd, buf, len);
+  } while(r < 0 && errno == EINTR);
+  STATS_LEAVE(span, STATS_WRITE);
+
+  if(r > 0) {
+    cl->cl_bytes += r;
+    cl->cl_writes++;
+  }
+  return r;
+}
+
+
+/**
+ * Send the whole buffer, called without sh_mutex held
+ */
+static int
+share_send_all(share_client_t *cl, const uint8_t *buf, size_t len)
+{
+  ssize_t r;
+
+  while(len) {
+    if((r = share_send(cl, buf, len, 0)) <= 0)
+      return -1;
+    buf += r;
+    len -= r;
+  }
+  return 0;
+}
+
+
+/**
+ * Account client output on the shared subscription, called with
+ * sh_mutex held
+ */
+static void
+share_update_stats(stream_share_t *sh, share_client_t *cl)
+{
+  subscription_add_output(sh->sh_s, cl->cl_bytes, cl->cl_writes);
+  cl->cl_bytes = cl->cl_writes = 0;
+}
+
+
+/**
+ * Pick the chunk a client should start (or resync) at and copy the
+ * cached PAT/PMT that should be sent ahead of it. Called with sh_mutex
+ * held.
+ */
+static share_chunk_t *
+share_sync_client(stream_share_t *sh, time_t joined, size_t *pos,
+		  uint8_t *psi, size_t *psilen)
+{
+  share_chunk_t *shc = sh->sh_sync;
+
+  *pos = 0;
+  *psilen = 0;
+
+  if(shc == NULL) {
+    // No random access point seen yet, start at the live edge eventually
+    if(sh->sh_tail == NULL || dispatch_clock < joined + SHARE_SYNC_TIMEOUT)
+      return NULL;
+    shc = sh->sh_tail;
+    *pos = shc->shc_len;
+  }
+
+  shc->shc_refcount++;
+
+  if(sh->sh_have_pat) {
+    memcpy(psi + *psilen, sh->sh_pat, 188);
+    *psilen += 188;
+  }
+  if(sh->sh_have_pmt) {
+    memcpy(psi + *psilen, sh->sh_pmt, 188);
+    *psilen += 188;
+  }
+  return shc;
+}
+
+
+/**
+ * Serve a shared channel stream to one HTTP client
+ */
+int
+http_stream_share(http_connection_t *hc, channel_t *ch,
+		  muxer_container_type_t mc)
+{
+  stream_share_t *sh;
+  share_chunk_t *shc = NULL, *next;
+  share_client_t cl;
+  const uint8_t *data;
+  uint8_t psi[376];
+  struct timespec ts;
+  struct timeval tp;
+  size_t pos = 0, len, psilen = 0;
+  ssize_t r;
+  time_t joined = dispatch_clock;
+  int err = 0, run = 1, timeouts = 0, zerocopy, i;
+  socklen_t errlen = sizeof(err);
+
+  pthread_mutex_lock(&stream_share_mutex);
+  sh = share_find(ch, mc);
+  if(sh != NULL)
+    sh->sh_clients++;
+  pthread_mutex_unlock(&stream_share_mutex);
+
+  if(sh == NULL)
+    return 0;
+
+  memset(&cl, 0, sizeof(cl));
+  cl.cl_fd = hc->hc_fd;
+
+  zerocopy = http_stream_sockopts(hc);
+#if SHARE_ZEROCOPY
+  i = 1;
+  if(zerocopy &&
+     !setsockopt(cl.cl_fd, SOL_SOCKET, SO_ZEROCOPY, &i, sizeof(i)))
+    cl.cl_zerocopy = 1;
+#endif
+
+  pthread_mutex_lock(&sh->sh_mutex);
+
+  while(sh->sh_mime == NULL && !sh->sh_eof) {
+    gettimeofday(&tp, NULL);
+    ts.tv_sec  = tp.tv_sec + 1;
+    ts.tv_nsec = tp.tv_usec * 1000;
+    if(pthread_cond_timedwait(&sh->sh_cond, &sh->sh_mutex, &ts) == ETIMEDOUT &&
+       ++timeouts >= 20) {
+      tvhlog(LOG_WARNING, "webui",  "Timeout waiting for packets");
+      run = 0;
+      break;
+    }
+  }
+
+  if(run && sh->sh_mime != NULL) {
+    tvhlog(LOG_DEBUG, "webui",  "Start streaming %s (shared, %d clients%s)",
+	   hc->hc_url_orig, sh->sh_clients, cl.cl_zerocopy ? ", zero-copy" : "");
+    pthread_mutex_unlock(&sh->sh_mutex);
+    http_output_content(hc, sh->sh_mime);
+    pthread_mutex_lock(&sh->sh_mutex);
+  } else {
+    run = 0;
+  }
+
+  timeouts = 0;
+  while(run) {
+    if(shc == NULL) {
+      shc = share_sync_client(sh, joined, &pos, psi, &psilen);
+    } else if(sh->sh_bytes - (shc->shc_offset + pos) > SHARE_MAX_LAG) {
+      tvhlog(LOG_WARNING, "webui", "%s: Client too slow, skipping ahead",
+	     hc->hc_url_orig);
+      share_chunk_unref(shc);
+      joined = dispatch_clock;
+      shc = share_sync_client(sh, joined, &pos, psi, &psilen);
+    }
+
+    if(shc != NULL && psilen) {
+      pthread_mutex_unlock(&sh->sh_mutex);
+      r = share_send_all(&cl, psi, psilen);
+      pthread_mutex_lock(&sh->sh_mutex);
+      psilen = 0;
+      if(r) {
+	tvhlog(LOG_DEBUG, "webui",  "Client hung up, exit streaming");
+	break;
+      }
+    }
+
+    if(shc != NULL && pos < shc->shc_len) {
+      if(cl.cl_zerocopy && cl.cl_zc_count == SHARE_ZC_MAX) {
+	share_zc_wait(sh, &cl);
+	continue;
+      }
+
+      data = shc->shc_data + pos;
+      len = shc->shc_len - pos;
+      zerocopy = cl.cl_zerocopy;
+      if(zerocopy)
+	shc->shc_refcount++; // Pinned until the kernel is done with it
+      pthread_mutex_unlock(&sh->sh_mutex);
+
+      r = share_send(&cl, data, len, zerocopy);
+
+      pthread_mutex_lock(&sh->sh_mutex);
+      share_update_stats(sh, &cl);
+
+      if(r <= 0) {
+	if(zerocopy)
+	  share_chunk_unref(shc);
+
+	if(zerocopy && r < 0 && errno == ENOBUFS) {
+	  // Too much outstanding zero-copy data, wait for completions
+	  share_zc_wait(sh, &cl);
+	  continue;
+	}
+	tvhlog(LOG_DEBUG, "webui",  "Client hung up, exit streaming");
+	break;
+      }
+
+      if(zerocopy) {
+	i = (cl.cl_zc_head + cl.cl_zc_count) % SHARE_ZC_MAX;
+	cl.cl_zc[i].shc = shc;
+	cl.cl_zc[i].done = 0;
+	cl.cl_zc_count++;
+	cl.cl_zc_seq++;
+	share_zc_reap(&cl);
+      }
+
+      pos += r;
+      timeouts = 0;
+      continue;
+    }
+
+    if(shc != NULL && shc->shc_next != NULL) {
+      next = shc->shc_next;
+      next->shc_refcount++;
+      share_chunk_unref(shc);
+      shc = next;
+      pos = 0;
+      continue;
+    }
+
+    if(sh->sh_eof)
+      break;
+
+    gettimeofday(&tp, NULL);
+    ts.tv_sec  = tp.tv_sec + 1;
+    ts.tv_nsec = tp.tv_usec * 1000;
+    if(pthread_cond_timedwait(&sh->sh_cond, &sh->sh_mutex, &ts) == ETIMEDOUT) {
+      timeouts++;
+
+      //Check socket status
+      getsockopt(hc->hc_fd, SOL_SOCKET, SO_ERROR, (char *)&err, &errlen);
+      if(err) {
+	tvhlog(LOG_DEBUG, "webui",  "Client hung up, exit streaming");
+	run = 0;
+      } else if(timeouts >= 20) {
+	tvhlog(LOG_WARNING, "webui",  "Timeout waiting for packets");
+	run = 0;
+      }
+    }
+  }
+
+  /*
+   * The kernel may still reference chunk memory of outstanding zero-copy
+   * sends. If they don't complete in time the chunks are left pinned
+   * rather than freed under the feet of the network stack.
+   */
+  for(i = 0; cl.cl_zc_count && i < 10; i++)
+    share_zc_wait(sh, &cl);
+  if(cl.cl_zc_count)
+    tvhlog(LOG_WARNING, "webui", "%s: %d zero-copy sends never completed",
+	   hc->hc_url_orig, cl.cl_zc_count);
+
+  share_update_stats(sh, &cl);
+  share_chunk_unref(shc);
+  pthread_mutex_unlock(&sh->sh_mutex);
+
+  pthread_mutex_lock(&stream_share_mutex);
+  if(--sh->sh_clients == 0)
+    LIST_REMOVE(sh, sh_link);
+  else
+    sh = NULL;
+  pthread_mutex_unlock(&stream_share_mutex);
+
+  if(sh != NULL)
+    share_destroy(sh);
+
+  return 0;
+}
@@ -29,6 +29,8 @@
 
 #include <sys/stat.h>
 #include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "tvheadend.h"
 #include "access.h"
@@ -41,6 +43,7 @@
 #include "plumbing/globalheaders.h"
 #include "epg.h"
 #include "muxer.h"
+#include "stats.h"
 
 /**
  *
@@ -78,6 +81,166 @@ page_root(http_connection_t *hc, const char *remain, void *opaque)
   return 0;
 }
 
+/**
+ * Static file cache
+ *
+ * Files below the static content paths are kept in memory, compressed
+ * (when that helps) and tagged with an ETag, so repeated UI loads are
+ * answered from memory or with a 304. Entries are never removed, so a
+ * pointer returned by webui_asset_find() remains valid. Only files that
+ * exist get an entry, so made up URLs can't grow the cache.
+ *
+ * The cache is static on purpose: the files are part of the install (or
+ * bundled into the binary), so a file edited on disk is only picked up
+ * after a restart.
+ */
+#define WEBUI_ASSET_HASH_WIDTH 256
+#define WEBUI_ASSET_MAXSIZE    (4 * 1024 * 1024)
+#define WEBUI_ASSET_MAXAGE     86400
+
+typedef struct webui_asset {
+  LIST_ENTRY(webui_asset) wa_link;
+  char    *wa_path;
+  uint8_t *wa_data;  // NULL if the file is not cacheable
+  size_t   wa_size;
+  int      wa_gzip;
+  char     wa_etag[32];
+} webui_asset_t;
+
+static LIST_HEAD(, webui_asset) webui_assets[WEBUI_ASSET_HASH_WIDTH];
+static pthread_mutex_t webui_asset_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *webui_asset_roots[8];
+static int webui_asset_nroots;
+
+
+/**
+ * Read a file into a new cache entry, NULL if it can't be opened
+ */
+static webui_asset_t *
+webui_asset_load(const char *path)
+{
+  webui_asset_t *wa;
+  fb_file *fp;
+  size_t size;
+  ssize_t c;
+
+  if((fp = fb_open(path, 0, 1)) == NULL)
+    return NULL;
+
+  wa = calloc(1, sizeof(webui_asset_t));
+  wa->wa_path = strdup(path);
+
+  size = fb_size(fp);
+  if(size <= WEBUI_ASSET_MAXSIZE) {
+    wa->wa_data = malloc(size ?: 1);
+    wa->wa_size = 0;
+    while(!fb_eof(fp) && wa->wa_size < size) {
+      if((c = fb_read(fp, wa->wa_data + wa->wa_size, size - wa->wa_size)) <= 0)
+	break;
+      wa->wa_size += c;
+    }
+
+    if(wa->wa_size != size) {
+      free(wa->wa_data);
+      wa->wa_data = NULL;
+    } else {
+      wa->wa_gzip = fb_gzipped(fp);
+      snprintf(wa->wa_etag, sizeof(wa->wa_etag), "\"%08x-%zx\"",
+	       tvh_crc32(wa->wa_data, wa->wa_size, 0xffffffff), wa->wa_size);
+    }
+  }
+
+  fb_close(fp);
+  return wa;
+}
+
+
+/**
+ * Find (and load on demand) the cache entry for a file, NULL if there
+ * is no such file
+ */
+static webui_asset_t *
+webui_asset_find(const char *path)
+{
+  unsigned int hash = tvh_strhash(path, WEBUI_ASSET_HASH_WIDTH);
+  webui_asset_t *wa, *n;
+
+  pthread_mutex_lock(&webui_asset_mutex);
+  LIST_FOREACH(wa, &webui_assets[hash], wa_link)
+    if(!strcmp(wa->wa_path, path))
+      break;
+  pthread_mutex_unlock(&webui_asset_mutex);
+
+  if(wa != NULL)
+    return wa;
+
+  if((n = webui_asset_load(path)) == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&webui_asset_mutex);
+  LIST_FOREACH(wa, &webui_assets[hash], wa_link)
+    if(!strcmp(wa->wa_path, path))
+      break;
+  if(wa == NULL) {
+    LIST_INSERT_HEAD(&webui_assets[hash], n, wa_link);
+    wa = n;
+    n = NULL;
+  }
+  pthread_mutex_unlock(&webui_asset_mutex);
+
+  if(n != NULL) {
+    free(n->wa_path);
+    free(n->wa_data);
+    free(n);
+  }
+  return wa;
+}
+
+
+/**
+ * Load all files below a directory into the cache
+ */
+static void
+webui_asset_preload(const char *dir)
+{
+  fb_dir *fd;
+  fb_dirent *de;
+  char path[500];
+
+  if((fd = fb_opendir(dir)) == NULL)
+    return;
+
+  while((de = fb_readdir(fd)) != NULL) {
+    if(de->name[0] == '.')
+      continue;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, de->name);
+    if(de->type == FB_DIR)
+      webui_asset_preload(path);
+    else if(de->type == FB_FILE)
+      webui_asset_find(path);
+  }
+  fb_closedir(fd);
+}
+
+
+/**
+ * Fill the cache in the background so startup is not delayed
+ */
+static void *
+webui_asset_preload_thread(void *aux)
+{
+  int i;
+
+  for(i = 0; i < webui_asset_nroots; i++)
+    webui_asset_preload(webui_asset_roots[i]);
+
+  tvhlog(LOG_DEBUG, "webui", "Static file cache loaded");
+  return NULL;
+}
+
+
 /**
  * Static download of a file from the filesystem
  */
@@ -90,7 +253,9 @@ page_static_file(http_connection_t *hc, const char *remain, void *opaque)
   ssize_t size;
   const char *content = NULL, *postfix;
   char buf[4096];
-  const char *gzip;
+  const char *gzip, *str;
+  webui_asset_t *wa;
+  int accept_gzip;
 
   if(remain == NULL)
     return 404;
@@ -109,8 +274,22 @@ page_static_file(http_connection_t *hc, const char *remain, void *opaque)
       content = "text/css; charset=UTF-8";
   }
 
-  // TODO: handle compression
-  fb_file *fp = fb_open(path, 0, 1);
+  str = http_arg_get(&hc->hc_args, "Accept-Encoding");
+  accept_gzip = str != NULL && strstr(str, "gzip") != NULL;
+
+  wa = webui_asset_find(path);
+  if(wa != NULL && wa->wa_data != NULL && (accept_gzip || !wa->wa_gzip)) {
+    str = http_arg_get(&hc->hc_args, "If-None-Match");
+    if(str != NULL && !strcmp(str, wa->wa_etag))
+      return http_send_data(hc, HTTP_STATUS_NOT_MODIFIED, NULL, NULL,
+			    wa->wa_etag, WEBUI_ASSET_MAXAGE, NULL, 0);
+
+    return http_send_data(hc, HTTP_STATUS_OK, content,
+			  wa->wa_gzip ? "gzip" : NULL, wa->wa_etag,
+			  WEBUI_ASSET_MAXAGE, wa->wa_data, wa->wa_size);
+  }
+
+  fb_file *fp = fb_open(path, !accept_gzip, accept_gzip);
   if (!fp) {
     tvhlog(LOG_ERR, "webui", "failed to open %s", path);
     return 500;
@@ -135,6 +314,40 @@ page_static_file(http_connection_t *hc, const char *remain, void *opaque)
   return ret;
 }
 
+/**
+ * Setup the client socket for streaming, applying the tuning from the
+ * matching access entries. Returns non-zero if zero-copy sending was
+ * requested.
+ */
+int
+http_stream_sockopts(http_connection_t *hc)
+{
+  struct timeval tp;
+  int sndbuf, lowat, zerocopy;
+
+  /* reduce timeout on write() for streaming */
+  tp.tv_sec  = 5;
+  tp.tv_usec = 0;
+  setsockopt(hc->hc_fd, SOL_SOCKET, SO_SNDTIMEO, &tp, sizeof(tp));
+
+  pthread_mutex_lock(&global_lock);
+  access_get_stream_tuning(hc->hc_username, (struct sockaddr *)hc->hc_peer,
+			   &sndbuf, &lowat, &zerocopy);
+  pthread_mutex_unlock(&global_lock);
+
+  if(sndbuf)
+    setsockopt(hc->hc_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+#ifdef TCP_NOTSENT_LOWAT
+  if(lowat)
+    setsockopt(hc->hc_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+	       &lowat, sizeof(lowat));
+#endif
+
+  return zerocopy;
+}
+
+
 /**
  * HTTP stream loop
  */
@@ -151,6 +364,7 @@ http_stream_run(http_connection_t *hc, streaming_queue_t *sq,
   int err = 0;
   socklen_t errlen = sizeof(err);
   const char *name;
+  uint64_t bytes = 0, writes = 0;
 
   mux = muxer_create(s->ths_service, mc);
   if(muxer_open_stream(mux, hc->hc_fd))
@@ -161,10 +375,7 @@ http_stream_run(http_connection_t *hc, streaming_queue_t *sq,
   else
     name = "Live Stream";
 
-  /* reduce timeout on write() for streaming */
-  tp.tv_sec  = 5;
-  tp.tv_usec = 0;
-  setsockopt(hc->hc_fd, SOL_SOCKET, SO_SNDTIMEO, &tp, sizeof(tp));
+  http_stream_sockopts(hc);
 
   while(run) {
     pthread_mutex_lock(&sq->sq_mutex);
@@ -195,6 +406,8 @@ http_stream_run(http_connection_t *hc, streaming_queue_t *sq,
     TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
     pthread_mutex_unlock(&sq->sq_mutex);
 
+    STATS_SINCE(sm->sm_time, STATS_QUEUE);
+
     switch(sm->sm_type) {
     case SMT_MPEGTS:
     case SMT_PACKET:
@@ -234,6 +447,10 @@ http_stream_run(http_connection_t *hc, streaming_queue_t *sq,
     }
     streaming_msg_free(sm);
 
+    subscription_add_output(s, mux->m_bytes - bytes, mux->m_writes - writes);
+    bytes = mux->m_bytes;
+    writes = mux->m_writes;
+
     if(mux->m_errors)
       run = 0;
   }
@@ -589,19 +806,14 @@ http_stream_channel(http_connection_t *hc, channel_t *ch)
     mc = cfg->dvr_mc;
   }
 
-  if(mc == MC_PASS) {
-    streaming_queue_init(&sq, SMT_PACKET);
-    gh = NULL;
-    tsfix = NULL;
-    st = &sq.sq_st;
-    flags = SUBSCRIPTION_RAW_MPEGTS;
-  } else {
-    streaming_queue_init(&sq, 0);
-    gh = globalheaders_create(&sq.sq_st);
-    tsfix = tsfix_create(gh);
-    st = tsfix;
-    flags = 0;
-  }
+  if(mc == MC_PASS)
+    return http_stream_share(hc, ch, mc);
+
+  streaming_queue_init(&sq, 0);
+  gh = globalheaders_create(&sq.sq_st);
+  tsfix = tsfix_create(gh);
+  st = tsfix;
+  flags = 0;
 
   pthread_mutex_lock(&global_lock);
   s = subscription_create_from_channel(ch, priority, "HTTP", st, flags);
@@ -614,10 +826,8 @@ http_stream_channel(http_connection_t *hc, channel_t *ch)
     pthread_mutex_unlock(&global_lock);
   }
 
-  if(gh)
-    globalheaders_destroy(gh);
-  if(tsfix)
-    tsfix_destroy(tsfix);
+  globalheaders_destroy(gh);
+  tsfix_destroy(tsfix);
 
   streaming_queue_deinit(&sq);
 
@@ -828,6 +1038,10 @@ static void
 webui_static_content(const char *http_path, const char *source)
 {
   http_path_add(http_path, strdup(source), page_static_file, ACCESS_WEB_INTERFACE);
+
+  if(webui_asset_nroots <
+     sizeof(webui_asset_roots) / sizeof(webui_asset_roots[0]))
+    webui_asset_roots[webui_asset_nroots++] = source;
 }
 
 
@@ -843,12 +1057,28 @@ favicon(http_connection_t *hc, const char *remain, void *opaque)
 
 int page_statedump(http_connection_t *hc, const char *remain, void *opaque);
 
+#if ENABLE_STATS
+/**
+ * Latency instrumentation in the Prometheus text format
+ */
+static int
+page_stats(http_connection_t *hc, const char *remain, void *opaque)
+{
+  stats_export(&hc->hc_reply);
+  http_output_content(hc, "text/plain; version=0.0.4");
+  return 0;
+}
+#endif
+
 /**
  * WEB user interface
  */
 void
 webui_init(void)
 {
+  pthread_t tid;
+  pthread_attr_t tattr;
+
   http_path_add("/", NULL, page_root, ACCESS_WEB_INTERFACE);
 
   http_path_add("/dvrfile", NULL, page_dvrfile, ACCESS_WEB_INTERFACE);
@@ -856,6 +1086,9 @@ webui_init(void)
   http_path_add("/playlist", NULL, page_http_playlist, ACCESS_WEB_INTERFACE);
 
   http_path_add("/state", NULL, page_statedump, ACCESS_ADMIN);
+#if ENABLE_STATS
+  http_path_add("/stats", NULL, page_stats, ACCESS_ADMIN);
+#endif
 
   http_path_add("/stream",  NULL, http_stream,  ACCESS_STREAMING);
 
@@ -867,4 +1100,9 @@ webui_init(void)
   extjs_start();
   comet_init();
 
+  pthread_attr_init(&tattr);
+  pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+  pthread_create(&tid, &tattr, webui_asset_preload_thread, NULL);
+  pthread_attr_destroy(&tattr);
+
 }
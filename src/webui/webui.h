@@ -20,6 +20,10 @@
 #define WEBUI_H_
 
 #include "htsmsg.h"
+#include "muxer.h"
+
+struct http_connection;
+struct channel;
 
 void webui_init(void);
 
@@ -55,4 +59,13 @@ void comet_mailbox_add_message(htsmsg_t *m, int isdebug);
 void comet_flush(void);
 
 
+/**
+ *
+ */
+int http_stream_sockopts(struct http_connection *hc);
+
+int http_stream_share(struct http_connection *hc, struct channel *ch,
+		      muxer_container_type_t mc);
+
+
 #endif /* WEBUI_H_ */
@@ -1,4 +1,5 @@
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>          /* See NOTES */
 #include <sys/socket.h>
 #include "tvheadend.h"
@@ -29,3 +30,19 @@ tvh_socket(int domain, int type, int protocol)
   pthread_mutex_unlock(&fork_lock);
   return fd;
 }
+
+
+int
+tvh_pipe(int pfd[2])
+{
+  int r;
+
+  pthread_mutex_lock(&fork_lock);
+  r = pipe(pfd);
+  if (r != -1) {
+    fcntl(pfd[0], F_SETFD, fcntl(pfd[0], F_GETFD) | FD_CLOEXEC);
+    fcntl(pfd[1], F_SETFD, fcntl(pfd[1], F_GETFD) | FD_CLOEXEC);
+  }
+  pthread_mutex_unlock(&fork_lock);
+  return r;
+}